@@ -0,0 +1,273 @@
+#pragma once
+
+#include "erosion.cpp"
+#include "normals.cpp"
+#include "terrain.cpp"
+#include "perf_counters.cpp"
+
+// NOTE(georgy): Benchmark harness for the terrain stages. Every case runs Repetitions times on prepared inputs and the fastest
+//				 run is reported, normalized per unit of work: per droplet step for erosion, per sample for noise and normals.
+//				 With counters on, hardware counters of that run are reported per unit as well.
+//				 "regenerate" and "regenerate-heap" rebuild a terrain (noise, normals, mesh) in buffers that come from an arena
+//				 reset between runs or from the allocator every run; their page faults show what reusing the memory saves
+#define BENCHMARK_NOISE_GRID 2048
+#define BENCHMARK_EROSION_GRID 512
+
+enum benchmark_case
+{
+	BenchmarkCase_Noise,
+	BenchmarkCase_Erosion,
+	BenchmarkCase_Normals,
+	BenchmarkCase_Regenerate,
+	BenchmarkCase_RegenerateHeap,
+
+	BenchmarkCase_Count,
+};
+
+static const char *BenchmarkCaseNames[BenchmarkCase_Count] = { "noise", "erosion", "normals", "regenerate", "regenerate-heap" };
+static const char *BenchmarkCaseUnits[BenchmarkCase_Count] = { "sample", "droplet step", "sample", "sample", "sample" };
+
+struct benchmark_context
+{
+	noise_params Noise;
+	erosion_params Erosion;
+
+	float *NoiseHeightMap;
+	uint32_t *Normals;
+	float *ErosionBase;
+	float *ErosionHeightMap;
+
+	memory_arena Arena;
+};
+
+struct benchmark_result
+{
+	uint64_t UnitCount;
+	uint64_t Nanoseconds;
+	bool HasCounters;
+	perf_counter_values Counters;
+};
+
+static bool
+InitBenchmarkContext(job_system *Jobs, benchmark_context *Context)
+{
+	uint64_t NoiseSampleCount = (uint64_t)(BENCHMARK_NOISE_GRID + 1)*(BENCHMARK_NOISE_GRID + 1);
+	uint64_t ErosionSampleCount = (uint64_t)(BENCHMARK_EROSION_GRID + 1)*(BENCHMARK_EROSION_GRID + 1);
+
+	Context->Noise = DefaultNoiseParams(10.0f);
+	Context->Erosion = DefaultErosionParams();
+	Context->Arena = {};
+	Context->NoiseHeightMap = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*NoiseSampleCount);
+	Context->Normals = (uint32_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(uint32_t)*NoiseSampleCount);
+	Context->ErosionBase = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*ErosionSampleCount);
+	Context->ErosionHeightMap = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*ErosionSampleCount);
+	bool Result = Context->NoiseHeightMap && Context->Normals && Context->ErosionBase && Context->ErosionHeightMap &&
+				  InitArena(&Context->Arena, MemoryCategory_HeightMap, (sizeof(float) + sizeof(uint32_t))*NoiseSampleCount +
+							TerrainMeshSize(BENCHMARK_NOISE_GRID, BENCHMARK_NOISE_GRID) + 256, HugePagesRequested());
+	if(Result)
+	{
+		FillHeightMapNoise(Jobs, Context->NoiseHeightMap, BENCHMARK_NOISE_GRID, BENCHMARK_NOISE_GRID, 0, 0, &Context->Noise);
+		FillHeightMapNoise(Jobs, Context->ErosionBase, BENCHMARK_EROSION_GRID, BENCHMARK_EROSION_GRID, 0, 0, &Context->Noise);
+	}
+
+	return(Result);
+}
+
+static void
+FreeBenchmarkContext(benchmark_context *Context)
+{
+	FreeMemory(Context->NoiseHeightMap);
+	FreeMemory(Context->Normals);
+	FreeMemory(Context->ErosionBase);
+	FreeMemory(Context->ErosionHeightMap);
+	FreeArena(&Context->Arena);
+}
+
+// NOTE(georgy): Untimed setup before every run
+static void
+PrepareBenchmarkCase(benchmark_context *Context, benchmark_case Case)
+{
+	if(Case == BenchmarkCase_Erosion)
+	{
+		uint64_t SampleCount = (uint64_t)(BENCHMARK_EROSION_GRID + 1)*(BENCHMARK_EROSION_GRID + 1);
+		memcpy(Context->ErosionHeightMap, Context->ErosionBase, sizeof(float)*SampleCount);
+	}
+}
+
+static uint64_t
+RegenerateBenchmarkTerrain(job_system *Jobs, benchmark_context *Context, float *HeightMap, uint32_t *Normals, terrain_mesh *Mesh)
+{
+	FillHeightMapNoise(Jobs, HeightMap, BENCHMARK_NOISE_GRID, BENCHMARK_NOISE_GRID, 0, 0, &Context->Noise);
+	CalculateNormals(Jobs, HeightMap, BENCHMARK_NOISE_GRID, BENCHMARK_NOISE_GRID, NormalFormat_Packed, Normals);
+	BuildTerrainMesh(Jobs, HeightMap, BENCHMARK_NOISE_GRID, BENCHMARK_NOISE_GRID, 32.0f, 32.0f, Mesh);
+
+	uint64_t Result = (uint64_t)(BENCHMARK_NOISE_GRID + 1)*(BENCHMARK_NOISE_GRID + 1);
+	return(Result);
+}
+
+// NOTE(georgy): Returns how many units of work the run did
+static uint64_t
+RunBenchmarkCase(job_system *Jobs, benchmark_context *Context, benchmark_case Case)
+{
+	uint64_t Result = 0;
+	switch(Case)
+	{
+		case BenchmarkCase_Noise:
+		{
+			FillHeightMapNoise(Jobs, Context->NoiseHeightMap, BENCHMARK_NOISE_GRID, BENCHMARK_NOISE_GRID, 0, 0, &Context->Noise);
+			Result = (uint64_t)(BENCHMARK_NOISE_GRID + 1)*(BENCHMARK_NOISE_GRID + 1);
+		} break;
+
+		case BenchmarkCase_Erosion:
+		{
+			Result = WaterErosion(Context->ErosionHeightMap, BENCHMARK_EROSION_GRID, BENCHMARK_EROSION_GRID, &Context->Erosion);
+		} break;
+
+		case BenchmarkCase_Normals:
+		{
+			CalculateNormals(Jobs, Context->NoiseHeightMap, BENCHMARK_NOISE_GRID, BENCHMARK_NOISE_GRID, NormalFormat_Packed, Context->Normals);
+			Result = (uint64_t)(BENCHMARK_NOISE_GRID + 1)*(BENCHMARK_NOISE_GRID + 1);
+		} break;
+
+		case BenchmarkCase_Regenerate:
+		{
+			uint64_t SampleCount = (uint64_t)(BENCHMARK_NOISE_GRID + 1)*(BENCHMARK_NOISE_GRID + 1);
+			terrain_mesh Mesh;
+			ResetArena(&Context->Arena);
+			float *HeightMap = PushArray(&Context->Arena, SampleCount, float);
+			uint32_t *Normals = PushArray(&Context->Arena, SampleCount, uint32_t);
+			if(HeightMap && Normals && PushTerrainMesh(&Context->Arena, &Mesh, BENCHMARK_NOISE_GRID, BENCHMARK_NOISE_GRID))
+			{
+				Result = RegenerateBenchmarkTerrain(Jobs, Context, HeightMap, Normals, &Mesh);
+			}
+		} break;
+
+		case BenchmarkCase_RegenerateHeap:
+		{
+			uint64_t SampleCount = (uint64_t)(BENCHMARK_NOISE_GRID + 1)*(BENCHMARK_NOISE_GRID + 1);
+			terrain_mesh Mesh;
+			SetTerrainMeshSize(&Mesh, BENCHMARK_NOISE_GRID, BENCHMARK_NOISE_GRID);
+			float *HeightMap = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+			uint32_t *Normals = (uint32_t *)AllocateMemory(MemoryCategory_Mesh, sizeof(uint32_t)*SampleCount);
+			Mesh.Vertices = (vec3 *)AllocateMemory(MemoryCategory_Mesh, sizeof(vec3)*Mesh.VertexCount);
+			Mesh.Indices = (uint32_t *)AllocateMemory(MemoryCategory_Mesh, sizeof(uint32_t)*Mesh.IndexCount);
+			if(HeightMap && Normals && Mesh.Vertices && Mesh.Indices)
+			{
+				Result = RegenerateBenchmarkTerrain(Jobs, Context, HeightMap, Normals, &Mesh);
+			}
+			FreeMemory(Mesh.Indices);
+			FreeMemory(Mesh.Vertices);
+			FreeMemory(Normals);
+			FreeMemory(HeightMap);
+		} break;
+
+		default: break;
+	}
+
+	return(Result);
+}
+
+static void
+PrintBenchmarkResult(benchmark_case Case, const benchmark_result *Result)
+{
+	const char *Unit = BenchmarkCaseUnits[Case];
+	double UnitCount = (double)Result->UnitCount;
+	printf("%-15s %12llu %-12s %10.3f ms %10.3f ns/%s\n", BenchmarkCaseNames[Case], (unsigned long long)Result->UnitCount, Unit,
+		   Result->Nanoseconds / 1000000.0, Result->Nanoseconds / UnitCount, Unit);
+
+	if(Result->HasCounters)
+	{
+		const perf_counter_values *Counters = &Result->Counters;
+		printf("                per %s:", Unit);
+		for(uint32_t Kind = 0; Kind < PerfCounter_Count; Kind++)
+		{
+			if(Counters->Valid[Kind])
+			{
+				printf(" %s %.4g", PerfCounterNames[Kind], Counters->Values[Kind] / UnitCount);
+			}
+			else
+			{
+				printf(" %s n/a", PerfCounterNames[Kind]);
+			}
+		}
+		if(Counters->Valid[PerfCounter_Cycles] && Counters->Valid[PerfCounter_Instructions] && (Counters->Values[PerfCounter_Cycles] > 0.0))
+		{
+			printf(" (IPC %.2f)", Counters->Values[PerfCounter_Instructions] / Counters->Values[PerfCounter_Cycles]);
+		}
+		printf("\n");
+	}
+}
+
+// NOTE(georgy): Runs every case, or only the one named OnlyCase when it's not null
+static bool
+RunBenchmarks(job_system *Jobs, uint32_t Repetitions, bool UseCounters, const char *OnlyCase)
+{
+	benchmark_context Context;
+	if(!InitBenchmarkContext(Jobs, &Context))
+	{
+		printf("Out of memory for the benchmarks\n");
+		FreeBenchmarkContext(&Context);
+		return(false);
+	}
+
+	perf_counter_set *Counters = 0;
+	if(UseCounters)
+	{
+		Counters = (perf_counter_set *)malloc(sizeof(perf_counter_set));
+		if(!Counters || !OpenPerfCounters(Counters))
+		{
+			printf("perf_event_open is unavailable, running without counters\n");
+			free(Counters);
+			Counters = 0;
+		}
+	}
+
+	printf("Benchmarks, best of %u, %u worker threads, %s kernels\n", Repetitions, Jobs->WorkerCount, ISALevelNames[TerrainKernels.Level]);
+	bool FoundCase = false;
+	for(uint32_t CaseIndex = 0; CaseIndex < BenchmarkCase_Count; CaseIndex++)
+	{
+		benchmark_case Case = (benchmark_case)CaseIndex;
+		if(OnlyCase && (strcmp(OnlyCase, BenchmarkCaseNames[Case]) != 0))
+		{
+			continue;
+		}
+		FoundCase = true;
+
+		benchmark_result Best = {};
+		for(uint32_t Repetition = 0; Repetition < Repetitions; Repetition++)
+		{
+			benchmark_result Run = {};
+			PrepareBenchmarkCase(&Context, Case);
+
+			if(Counters) StartPerfCounters(Counters);
+			uint64_t BeginTime = GetNanoseconds();
+			Run.UnitCount = RunBenchmarkCase(Jobs, &Context, Case);
+			Run.Nanoseconds = GetNanoseconds() - BeginTime;
+			if(Counters)
+			{
+				StopPerfCounters(Counters, &Run.Counters);
+				Run.HasCounters = true;
+			}
+
+			if((Repetition == 0) || (Run.Nanoseconds < Best.Nanoseconds))
+			{
+				Best = Run;
+			}
+		}
+
+		PrintBenchmarkResult(Case, &Best);
+	}
+
+	if(Counters)
+	{
+		ClosePerfCounters(Counters);
+		free(Counters);
+	}
+	FreeBenchmarkContext(&Context);
+
+	if(!FoundCase)
+	{
+		printf("Unknown benchmark case %s\n", OnlyCase);
+	}
+	return(FoundCase);
+}
@@ -0,0 +1,512 @@
+#pragma once
+
+#include "world.cpp"
+
+// NOTE(georgy): Multi-process world generation. The coordinator and its worker processes share nothing but the output directory:
+//				 world.params  - the world_params the workers read at start
+//				 world.r32     - the whole world heightmap, mapped by every worker, each blend writes the samples its tile owns
+//				 tile_X_Z.*    - the same halo and tile files as GenerateWorld writes, so the result is identical
+//				 jobs/pending  - one empty file per job that can run now. A worker claims a job by renaming it into
+//				 jobs/claimed    as <job>.<pid>, rename is atomic so only one worker gets it
+//				 jobs/done     - marker written once the job's outputs are in place
+//				 jobs/shutdown - workers exit once it exists
+//				 Blend jobs are published when their 3x3 neighbourhood is eroded. When a worker dies, the jobs it claimed
+//				 without a done marker go back to pending and a new worker is started
+
+#define WORLD_JOB_MAX_ATTEMPTS 3
+// NOTE(georgy): Job paths are built in 1024-byte buffers from the directory, "/jobs/claimed/", a file name of up to 255
+//				 characters and the pid, so the directory has to leave room for the rest
+#define WORLD_MAX_DIRECTORY_LENGTH 512
+
+inline uint64_t
+WorldHeightMapSize(const world_params *Params)
+{
+	uint64_t Result = sizeof(float)*((uint64_t)Params->TilesX*Params->TileSize + 1)*((uint64_t)Params->TilesZ*Params->TileSize + 1);
+
+	return(Result);
+}
+
+#if defined(_WIN32)
+
+static bool
+RunWorldCoordinator(const world_params *Params, uint32_t WorkerCount)
+{
+	printf("Multi-process world generation is only supported on Linux\n");
+	return(false);
+}
+
+static bool
+RunWorldWorker(job_system *Jobs, const char *Directory)
+{
+	printf("Multi-process world generation is only supported on Linux\n");
+	return(false);
+}
+
+#else
+
+#include <dirent.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+static void
+RemoveFilesInDirectory(const char *Directory)
+{
+	DIR *Dir = opendir(Directory);
+	if(Dir)
+	{
+		struct dirent *Entry;
+		while((Entry = readdir(Dir)) != 0)
+		{
+			if(Entry->d_name[0] != '.')
+			{
+				// NOTE(georgy): A truncated name could be some other file, those are left alone
+				char Filename[1024];
+				if(snprintf(Filename, sizeof(Filename), "%s/%s", Directory, Entry->d_name) < (int)sizeof(Filename))
+				{
+					remove(Filename);
+				}
+			}
+		}
+		closedir(Dir);
+	}
+}
+
+static void
+GetWorldJobName(char *Dest, uint32_t DestSize, const char *Kind, uint32_t TileX, uint32_t TileZ)
+{
+	snprintf(Dest, DestSize, "%s_%u_%u", Kind, TileX, TileZ);
+}
+
+static bool
+PublishWorldJob(const char *Directory, const char *JobName)
+{
+	char Filename[1024];
+	snprintf(Filename, sizeof(Filename), "%s/jobs/pending/%s", Directory, JobName);
+	bool Result = WriteEntireFile(Filename, "", 0);
+
+	return(Result);
+}
+
+static bool
+WorldJobIsDone(const char *Directory, const char *JobName)
+{
+	char Filename[1024];
+	snprintf(Filename, sizeof(Filename), "%s/jobs/done/%s", Directory, JobName);
+	bool Result = FileExists(Filename);
+
+	return(Result);
+}
+
+// NOTE(georgy): Takes any pending job. JobName gets the job without the pid suffix
+static bool
+ClaimWorldJob(const char *Directory, pid_t Pid, char *JobName, uint32_t JobNameSize)
+{
+	bool Result = false;
+
+	char PendingDirectory[1024];
+	snprintf(PendingDirectory, sizeof(PendingDirectory), "%s/jobs/pending", Directory);
+	DIR *Dir = opendir(PendingDirectory);
+	if(Dir)
+	{
+		struct dirent *Entry;
+		while(!Result && ((Entry = readdir(Dir)) != 0))
+		{
+			if(Entry->d_name[0] == '.') continue;
+
+			// NOTE(georgy): Jobs whose paths don't fit are skipped rather than renamed from or to a truncated path
+			char PendingFilename[1024];
+			char ClaimedFilename[1024];
+			if((snprintf(PendingFilename, sizeof(PendingFilename), "%s/%s", PendingDirectory, Entry->d_name) < (int)sizeof(PendingFilename)) &&
+			   (snprintf(ClaimedFilename, sizeof(ClaimedFilename), "%s/jobs/claimed/%s.%d", Directory, Entry->d_name, (int)Pid) < (int)sizeof(ClaimedFilename)) &&
+			   (rename(PendingFilename, ClaimedFilename) == 0))
+			{
+				snprintf(JobName, JobNameSize, "%s", Entry->d_name);
+				Result = true;
+			}
+		}
+		closedir(Dir);
+	}
+
+	return(Result);
+}
+
+static bool
+RunWorldJob(job_system *Jobs, const world_params *Params, const char *JobName, float *GridHeightMap, float *WorldHeightMap)
+{
+	bool Result = false;
+
+	char Kind[16];
+	uint32_t TileX, TileZ;
+	if((sscanf(JobName, "%15[a-z]_%u_%u", Kind, &TileX, &TileZ) == 3) && (TileX < Params->TilesX) && (TileZ < Params->TilesZ))
+	{
+		if(strcmp(Kind, "erode") == 0)
+		{
+			int32_t OriginX = (int32_t)(TileX*Params->TileSize) - (int32_t)Params->Halo;
+			int32_t OriginZ = (int32_t)(TileZ*Params->TileSize) - (int32_t)Params->Halo;
+			uint32_t GridSize = WorldTileGridSize(Params);
+			FillHeightMapNoise(Jobs, GridHeightMap, GridSize, GridSize, OriginX, OriginZ, &Params->Noise);
+			Result = ErodeWorldTile(Params, TileX, TileZ, GridHeightMap);
+		}
+		else if(strcmp(Kind, "blend") == 0)
+		{
+			Result = BlendWorldTile(Jobs, Params, TileX, TileZ, WorldHeightMap);
+		}
+	}
+
+	if(!Result)
+	{
+		printf("Worker %d: job %s failed\n", (int)getpid(), JobName);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Runs jobs until the coordinator asks to shut down. A failed job stays claimed and the worker exits,
+//				 the coordinator then hands it to a new worker
+static bool
+RunWorldWorker(job_system *Jobs, const char *Directory)
+{
+	char Filename[1024];
+	world_params Params;
+	snprintf(Filename, sizeof(Filename), "%s/world.params", Directory);
+	if(!ReadFileInto(Filename, &Params, sizeof(Params)))
+	{
+		printf("Failed to read %s\n", Filename);
+		return(false);
+	}
+	Params.OutputDirectory = Directory;
+
+	mapped_file WorldFile;
+	snprintf(Filename, sizeof(Filename), "%s/world.r32", Directory);
+	if(!MapFile(&WorldFile, Filename, WorldHeightMapSize(&Params), false))
+	{
+		printf("Failed to map %s\n", Filename);
+		return(false);
+	}
+
+	uint32_t GridSamples = WorldTileGridSize(&Params) + 1;
+	float *GridHeightMap = (float *)AllocateNodeMemory(MemoryCategory_HeightMap, sizeof(float)*GridSamples*GridSamples, Jobs->NUMANodes[0]);
+
+	bool Result = (GridHeightMap != 0);
+	pid_t Pid = getpid();
+	char ShutdownFilename[1024];
+	snprintf(ShutdownFilename, sizeof(ShutdownFilename), "%s/jobs/shutdown", Directory);
+	while(Result)
+	{
+		char JobName[256];
+		if(ClaimWorldJob(Directory, Pid, JobName, sizeof(JobName)))
+		{
+			Result = RunWorldJob(Jobs, &Params, JobName, GridHeightMap, (float *)WorldFile.Memory);
+			if(Result)
+			{
+				snprintf(Filename, sizeof(Filename), "%s/jobs/done/%s", Directory, JobName);
+				Result = WriteEntireFile(Filename, "", 0);
+				snprintf(Filename, sizeof(Filename), "%s/jobs/claimed/%s.%d", Directory, JobName, (int)Pid);
+				remove(Filename);
+			}
+		}
+		else if(FileExists(ShutdownFilename))
+		{
+			break;
+		}
+		else
+		{
+			usleep(2000);
+		}
+	}
+
+	FreeMemory(GridHeightMap);
+	UnmapFile(&WorldFile);
+
+	return(Result);
+}
+
+// NOTE(georgy): On a machine with several NUMA nodes the worker keeps its threads and memory on NUMANode
+static pid_t
+StartWorldWorker(const char *Directory, uint32_t NUMANode)
+{
+	pid_t Pid = fork();
+	if(Pid == 0)
+	{
+		if(GlobalNUMA.NodeCount > 1)
+		{
+			char NodeString[16];
+			snprintf(NodeString, sizeof(NodeString), "%u", NUMANode % GlobalNUMA.NodeCount);
+			SetEnv("EROSION_NUMA_NODE", NodeString);
+		}
+		execl("/proc/self/exe", "erosion", "--worker", Directory, (char *)0);
+		_exit(127);
+	}
+
+	return(Pid);
+}
+
+// NOTE(georgy): Index of a job in the attempt counts: erode jobs first, then blend jobs
+static int32_t
+WorldJobIndex(const world_params *Params, const char *JobName)
+{
+	int32_t Result = -1;
+
+	char Kind[16];
+	uint32_t TileX, TileZ;
+	if((sscanf(JobName, "%15[a-z]_%u_%u", Kind, &TileX, &TileZ) == 3) && (TileX < Params->TilesX) && (TileZ < Params->TilesZ))
+	{
+		uint32_t TileIndex = TileX + TileZ*Params->TilesX;
+		Result = (strcmp(Kind, "blend") == 0) ? (int32_t)(Params->TilesX*Params->TilesZ + TileIndex) : (int32_t)TileIndex;
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Puts the unfinished jobs of a dead worker back. Returns false if one of them ran out of attempts
+static bool
+RequeueWorkerJobs(const world_params *Params, pid_t Pid, std::vector<uint32_t> &Attempts, uint32_t *RetryCount)
+{
+	bool Result = true;
+
+	char ClaimedDirectory[1024];
+	snprintf(ClaimedDirectory, sizeof(ClaimedDirectory), "%s/jobs/claimed", Params->OutputDirectory);
+	DIR *Dir = opendir(ClaimedDirectory);
+	if(Dir)
+	{
+		char Suffix[32];
+		snprintf(Suffix, sizeof(Suffix), ".%d", (int)Pid);
+		size_t SuffixLength = strlen(Suffix);
+
+		struct dirent *Entry;
+		while((Entry = readdir(Dir)) != 0)
+		{
+			size_t Length = strlen(Entry->d_name);
+			if((Entry->d_name[0] == '.') || (Length <= SuffixLength) || (strcmp(Entry->d_name + Length - SuffixLength, Suffix) != 0))
+			{
+				continue;
+			}
+
+			char JobName[256];
+			char ClaimedFilename[1024];
+			if((snprintf(JobName, sizeof(JobName), "%.*s", (int)(Length - SuffixLength), Entry->d_name) >= (int)sizeof(JobName)) ||
+			   (snprintf(ClaimedFilename, sizeof(ClaimedFilename), "%s/%s", ClaimedDirectory, Entry->d_name) >= (int)sizeof(ClaimedFilename)))
+			{
+				continue;
+			}
+
+			if(WorldJobIsDone(Params->OutputDirectory, JobName))
+			{
+				remove(ClaimedFilename);
+				continue;
+			}
+
+			int32_t JobIndex = WorldJobIndex(Params, JobName);
+			if((JobIndex >= 0) && (++Attempts[JobIndex] < WORLD_JOB_MAX_ATTEMPTS))
+			{
+				char PendingFilename[1024];
+				snprintf(PendingFilename, sizeof(PendingFilename), "%s/jobs/pending/%s", Params->OutputDirectory, JobName);
+				rename(ClaimedFilename, PendingFilename);
+				(*RetryCount)++;
+				printf("Worker %d died, retrying %s\n", (int)Pid, JobName);
+			}
+			else
+			{
+				printf("Job %s failed %u times, giving up\n", JobName, WORLD_JOB_MAX_ATTEMPTS);
+				Result = false;
+			}
+		}
+		closedir(Dir);
+	}
+
+	return(Result);
+}
+
+static bool
+RunWorldCoordinator(const world_params *Params, uint32_t WorkerCount)
+{
+	if(!CheckWorldParams(Params))
+	{
+		return(false);
+	}
+	if(strlen(Params->OutputDirectory) > WORLD_MAX_DIRECTORY_LENGTH)
+	{
+		printf("The output directory path is longer than %u characters\n", WORLD_MAX_DIRECTORY_LENGTH);
+		return(false);
+	}
+
+	const char *Directory = Params->OutputDirectory;
+	char Filename[1024];
+	const char *JobDirectories[] = { "jobs", "jobs/pending", "jobs/claimed", "jobs/done" };
+	for(uint32_t DirectoryIndex = 0; DirectoryIndex < ArrayCount(JobDirectories); DirectoryIndex++)
+	{
+		snprintf(Filename, sizeof(Filename), "%s/%s", Directory, JobDirectories[DirectoryIndex]);
+		if(!MakeDirectory(Filename))
+		{
+			printf("Can't create %s\n", Filename);
+			return(false);
+		}
+		if(DirectoryIndex > 0)
+		{
+			RemoveFilesInDirectory(Filename);
+		}
+	}
+	snprintf(Filename, sizeof(Filename), "%s/jobs/shutdown", Directory);
+	remove(Filename);
+
+	world_params SharedParams = *Params;
+	SharedParams.OutputDirectory = 0;
+	snprintf(Filename, sizeof(Filename), "%s/world.params", Directory);
+	if(!WriteEntireFileAtomic(Filename, &SharedParams, sizeof(SharedParams)))
+	{
+		printf("Failed to write %s\n", Filename);
+		return(false);
+	}
+
+	mapped_file WorldFile;
+	snprintf(Filename, sizeof(Filename), "%s/world.r32", Directory);
+	if(!MapFile(&WorldFile, Filename, WorldHeightMapSize(Params), true))
+	{
+		printf("Failed to create %s\n", Filename);
+		return(false);
+	}
+	UnmapFile(&WorldFile);
+	RemoveWorldHalos(Params);
+
+	uint64_t BeginTime = GetNanoseconds();
+
+	uint32_t TileCount = Params->TilesX*Params->TilesZ;
+	char JobName[256];
+	for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
+	{
+		GetWorldJobName(JobName, sizeof(JobName), "erode", TileIndex % Params->TilesX, TileIndex / Params->TilesX);
+		PublishWorldJob(Directory, JobName);
+	}
+
+	// NOTE(georgy): Each worker process gets one thread unless asked otherwise, the processes are the parallelism
+	setenv("EROSION_WORKERS", "1", 0);
+	std::vector<pid_t> Workers;
+	std::vector<uint32_t> WorkerNodes;
+	uint32_t WorkerStartCount = 0;
+	uint32_t MaxWorkerStartCount = 2*WorkerCount + TileCount;
+	for(uint32_t WorkerIndex = 0; WorkerIndex < WorkerCount; WorkerIndex++)
+	{
+		pid_t Pid = StartWorldWorker(Directory, WorkerIndex);
+		if(Pid > 0)
+		{
+			Workers.push_back(Pid);
+			WorkerNodes.push_back(WorkerIndex);
+			WorkerStartCount++;
+		}
+	}
+
+	std::vector<uint8_t> Eroded(TileCount, 0);
+	std::vector<uint8_t> BlendPublished(TileCount, 0);
+	std::vector<uint8_t> Blended(TileCount, 0);
+	std::vector<uint32_t> Attempts(2*TileCount, 0);
+	uint32_t BlendedCount = 0;
+	uint32_t RetryCount = 0;
+	bool Failed = Workers.empty();
+	while(!Failed && (BlendedCount < TileCount))
+	{
+		for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
+		{
+			uint32_t TileX = TileIndex % Params->TilesX;
+			uint32_t TileZ = TileIndex / Params->TilesX;
+			if(!Eroded[TileIndex])
+			{
+				GetWorldJobName(JobName, sizeof(JobName), "erode", TileX, TileZ);
+				Eroded[TileIndex] = WorldJobIsDone(Directory, JobName);
+			}
+			else if(BlendPublished[TileIndex] && !Blended[TileIndex])
+			{
+				GetWorldJobName(JobName, sizeof(JobName), "blend", TileX, TileZ);
+				Blended[TileIndex] = WorldJobIsDone(Directory, JobName);
+				BlendedCount += Blended[TileIndex];
+			}
+		}
+
+		for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
+		{
+			if(BlendPublished[TileIndex]) continue;
+
+			uint32_t TileX = TileIndex % Params->TilesX;
+			uint32_t TileZ = TileIndex / Params->TilesX;
+			bool NeighboursEroded = true;
+			for(uint32_t NeighbourZ = (TileZ > 0) ? (TileZ - 1) : 0; (NeighbourZ <= TileZ + 1) && (NeighbourZ < Params->TilesZ); NeighbourZ++)
+			{
+				for(uint32_t NeighbourX = (TileX > 0) ? (TileX - 1) : 0; (NeighbourX <= TileX + 1) && (NeighbourX < Params->TilesX); NeighbourX++)
+				{
+					NeighboursEroded = NeighboursEroded && Eroded[NeighbourX + NeighbourZ*Params->TilesX];
+				}
+			}
+
+			if(NeighboursEroded)
+			{
+				GetWorldJobName(JobName, sizeof(JobName), "blend", TileX, TileZ);
+				PublishWorldJob(Directory, JobName);
+				BlendPublished[TileIndex] = true;
+			}
+		}
+
+		int Status;
+		pid_t DeadPid;
+		while((DeadPid = waitpid(-1, &Status, WNOHANG)) > 0)
+		{
+			// NOTE(georgy): The replacement takes over the node of the worker that died
+			uint32_t DeadNode = 0;
+			for(uint32_t WorkerIndex = 0; WorkerIndex < Workers.size(); WorkerIndex++)
+			{
+				if(Workers[WorkerIndex] == DeadPid)
+				{
+					DeadNode = WorkerNodes[WorkerIndex];
+					Workers[WorkerIndex] = Workers.back();
+					WorkerNodes[WorkerIndex] = WorkerNodes.back();
+					Workers.pop_back();
+					WorkerNodes.pop_back();
+					break;
+				}
+			}
+
+			Failed = !RequeueWorkerJobs(Params, DeadPid, Attempts, &RetryCount) || Failed;
+			if(!Failed)
+			{
+				if(WorkerStartCount < MaxWorkerStartCount)
+				{
+					pid_t Pid = StartWorldWorker(Directory, DeadNode);
+					if(Pid > 0)
+					{
+						Workers.push_back(Pid);
+						WorkerNodes.push_back(DeadNode);
+						WorkerStartCount++;
+					}
+				}
+				Failed = Workers.empty();
+			}
+		}
+
+		if(!Failed && (BlendedCount < TileCount))
+		{
+			usleep(5000);
+		}
+	}
+
+	snprintf(Filename, sizeof(Filename), "%s/jobs/shutdown", Directory);
+	WriteEntireFile(Filename, "", 0);
+	for(uint32_t WorkerIndex = 0; WorkerIndex < Workers.size(); WorkerIndex++)
+	{
+		if(Failed)
+		{
+			kill(Workers[WorkerIndex], SIGTERM);
+		}
+		waitpid(Workers[WorkerIndex], 0, 0);
+	}
+
+	uint64_t EndTime = GetNanoseconds();
+	printf("World %ux%u tiles of %u on %u worker processes: %.3f ms, %u retries%s\n", Params->TilesX, Params->TilesZ, Params->TileSize,
+		   WorkerCount, (EndTime - BeginTime) / 1000000.0, RetryCount, Failed ? ", FAILED" : "");
+
+	if(!Failed)
+	{
+		RemoveWorldHalos(Params);
+	}
+
+	return(!Failed);
+}
+
+#endif
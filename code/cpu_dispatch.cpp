@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define SIMD_X86 0
+#endif
+
+// NOTE(georgy): MSVC lets us use any intrinsics in any function, GCC and Clang need per-function target attributes
+//				 so that one binary can contain all the variants
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TARGET_SSE42
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+enum cpu_isa_level
+{
+	ISALevel_Scalar,
+	ISALevel_SSE42,
+	ISALevel_AVX2,
+	ISALevel_AVX512,
+
+	ISALevel_Count
+};
+
+static const char *ISALevelNames[ISALevel_Count] =
+{
+	"scalar",
+	"sse4.2",
+	"avx2",
+	"avx512"
+};
+
+#if SIMD_X86
+static void
+CPUID(uint32_t Leaf, uint32_t SubLeaf, uint32_t *Registers)
+{
+#if defined(_MSC_VER)
+	__cpuidex((int *)Registers, Leaf, SubLeaf);
+#else
+	__cpuid_count(Leaf, SubLeaf, Registers[0], Registers[1], Registers[2], Registers[3]);
+#endif
+}
+
+static uint64_t
+XGetBV(void)
+{
+#if defined(_MSC_VER)
+	uint64_t Result = _xgetbv(0);
+#else
+	uint32_t Low, High;
+	__asm__ volatile("xgetbv" : "=a"(Low), "=d"(High) : "c"(0));
+	uint64_t Result = ((uint64_t)High << 32) | Low;
+#endif
+	return(Result);
+}
+#endif
+
+// NOTE(georgy): Returns the best level that both the CPU and the OS (saved register state) support
+static cpu_isa_level
+DetectCPUISALevel(void)
+{
+	cpu_isa_level Result = ISALevel_Scalar;
+
+#if SIMD_X86
+	uint32_t Registers[4] = {};
+	CPUID(0, 0, Registers);
+	uint32_t MaxLeaf = Registers[0];
+
+	CPUID(1, 0, Registers);
+	bool SSE42 = (Registers[2] & (1 << 20)) != 0;
+	bool OSXSave = (Registers[2] & (1 << 27)) != 0;
+	bool AVX = (Registers[2] & (1 << 28)) != 0;
+
+	bool AVX2 = false;
+	bool AVX512F = false;
+	if(MaxLeaf >= 7)
+	{
+		CPUID(7, 0, Registers);
+		AVX2 = (Registers[1] & (1 << 5)) != 0;
+		AVX512F = (Registers[1] & (1 << 16)) != 0;
+	}
+
+	uint64_t XCR0 = OSXSave ? XGetBV() : 0;
+	bool OSSavesYMM = (XCR0 & 0x6) == 0x6;
+	bool OSSavesZMM = (XCR0 & 0xE6) == 0xE6;
+
+	if(SSE42)
+	{
+		Result = ISALevel_SSE42;
+		if(AVX && AVX2 && OSSavesYMM)
+		{
+			Result = ISALevel_AVX2;
+			if(AVX512F && OSSavesZMM)
+			{
+				Result = ISALevel_AVX512;
+			}
+		}
+	}
+#endif
+
+	return(Result);
+}
+
+// NOTE(georgy): EROSION_ISA=scalar|sse4.2|avx2|avx512 forces a level for benchmarking and testing.
+//				 We never go above what the machine supports, that would just crash with an illegal instruction
+static cpu_isa_level
+ChooseCPUISALevel(void)
+{
+	cpu_isa_level Detected = DetectCPUISALevel();
+	cpu_isa_level Result = Detected;
+
+	const char *Override = getenv("EROSION_ISA");
+	if(Override && Override[0])
+	{
+		bool Found = false;
+		for(uint32_t Level = 0; Level < ISALevel_Count; Level++)
+		{
+			if(strcmp(Override, ISALevelNames[Level]) == 0)
+			{
+				Found = true;
+				if(Level <= (uint32_t)Detected)
+				{
+					Result = (cpu_isa_level)Level;
+				}
+				else
+				{
+					printf("EROSION_ISA=%s is not supported by this CPU, using %s\n", Override, ISALevelNames[Detected]);
+				}
+			}
+		}
+
+		if(!Found)
+		{
+			printf("Unknown EROSION_ISA=%s, using %s\n", Override, ISALevelNames[Detected]);
+		}
+	}
+
+	return(Result);
+}
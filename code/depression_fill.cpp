@@ -0,0 +1,703 @@
+#pragma once
+
+#include "job_system.cpp"
+#include "memory.cpp"
+#include "trace.cpp"
+
+// NOTE(georgy): Fills small depressions before erosion, so droplets don't waste their lifetime going back and forth in pits.
+//				 Priority-flood finds the level every sample would be flooded to if water could only leave over the map's border
+//				 (the lowest possible "highest point" on a path to the border). Samples below that level form depressions;
+//				 the ones no deeper than MaxDepth and no larger than MaxArea samples are raised to it, deeper lakes stay as they are.
+//				 A raised depression isn't left flat: it rises RisePerSample, and at least one float step, per sample away from where
+//				 it spills over, so droplets still have a slope to follow out of it (their direction is normalized, so any slope does).
+//				 The rise is kept as small as it can be because samples on the rim that drained into the depression before can be
+//				 lower than its raised far end and become pits themselves; 1e-4 per sample turned 20 expected pits into 397.
+//				 The flood runs on tiles of TileSize x TileSize samples in parallel, each one flooded from its own border with
+//				 watershed labels. The labels' spill heights into each other, inside tiles and across their seams, make a small
+//				 graph that one more flood solves, and every sample is then raised to the level of its watershed. The result is
+//				 the same as flooding the whole map at once, which is what a TileSize that covers the whole map does.
+//				 Every tile needs 12 bytes per sample while it runs, the whole map 9 bytes per sample.
+//				 Depressions are found and raised on the calling thread, that's a single pass over the map
+#define FILL_OCEAN_LABEL 1
+
+struct depression_fill_params
+{
+	float MaxDepth;
+	uint32_t MaxArea;
+	float RisePerSample;
+	uint32_t TileSize;
+};
+
+inline depression_fill_params
+DefaultDepressionFillParams(void)
+{
+	depression_fill_params Result;
+	Result.MaxDepth = 0.5f;
+	Result.MaxArea = 4096;
+	Result.RisePerSample = 0.0f;
+	Result.TileSize = 1024;
+
+	return(Result);
+}
+
+struct depression_fill_stats
+{
+	uint32_t DepressionCount;
+	uint32_t FilledCount;
+	uint64_t DepressionSamples;
+	uint64_t FilledSamples;
+	double DepressionVolume;
+	double FilledVolume;
+	uint32_t TileCount;
+	uint32_t LabelCount;
+};
+
+//
+// NOTE(georgy): Priority queue
+//
+
+struct fill_heap_entry
+{
+	float Height;
+	uint32_t Index;
+};
+
+// NOTE(georgy): Min-heap on height, ties go to the lower index so the order doesn't depend on the push order
+struct fill_heap
+{
+	fill_heap_entry *Entries;
+	uint32_t Count;
+	uint32_t Capacity;
+};
+
+inline bool
+FillHeapLess(fill_heap_entry A, fill_heap_entry B)
+{
+	bool Result = (A.Height < B.Height) || ((A.Height == B.Height) && (A.Index < B.Index));
+	return(Result);
+}
+
+inline void
+PushFillHeap(fill_heap *Heap, float Height, uint32_t Index)
+{
+	Assert(Heap->Count < Heap->Capacity);
+	fill_heap_entry Entry = { Height, Index };
+	uint32_t At = Heap->Count++;
+	while(At > 0)
+	{
+		uint32_t Parent = (At - 1) / 2;
+		if(!FillHeapLess(Entry, Heap->Entries[Parent]))
+		{
+			break;
+		}
+		Heap->Entries[At] = Heap->Entries[Parent];
+		At = Parent;
+	}
+	Heap->Entries[At] = Entry;
+}
+
+inline fill_heap_entry
+PopFillHeap(fill_heap *Heap)
+{
+	fill_heap_entry Result = Heap->Entries[0];
+	fill_heap_entry Last = Heap->Entries[--Heap->Count];
+	uint32_t At = 0;
+	for(;;)
+	{
+		uint32_t Child = 2*At + 1;
+		if(Child >= Heap->Count)
+		{
+			break;
+		}
+		if((Child + 1 < Heap->Count) && FillHeapLess(Heap->Entries[Child + 1], Heap->Entries[Child]))
+		{
+			Child++;
+		}
+		if(!FillHeapLess(Heap->Entries[Child], Last))
+		{
+			break;
+		}
+		Heap->Entries[At] = Heap->Entries[Child];
+		At = Child;
+	}
+	if(Heap->Count)
+	{
+		Heap->Entries[At] = Last;
+	}
+
+	return(Result);
+}
+
+//
+// NOTE(georgy): Spill graph
+//
+
+// NOTE(georgy): Water of label A can flow into label B (and back) once it's Height high
+struct fill_edge
+{
+	uint32_t A;
+	uint32_t B;
+	float Height;
+};
+
+struct fill_edge_list
+{
+	fill_edge *Edges;
+	uint32_t Count;
+	uint32_t Capacity;
+};
+
+static bool
+AddFillEdge(fill_edge_list *List, uint32_t A, uint32_t B, float Height)
+{
+	if(A > B)
+	{
+		uint32_t Temp = A;
+		A = B;
+		B = Temp;
+	}
+
+	// NOTE(georgy): Neighbouring samples of two watersheds usually come one after another, the last edge catches most repeats
+	if(List->Count)
+	{
+		fill_edge *Last = List->Edges + List->Count - 1;
+		if((Last->A == A) && (Last->B == B))
+		{
+			Last->Height = Min(Last->Height, Height);
+			return(true);
+		}
+	}
+
+	if(List->Count == List->Capacity)
+	{
+		uint32_t Capacity = List->Capacity ? 2*List->Capacity : 1024;
+		fill_edge *Edges = (fill_edge *)AllocateMemory(MemoryCategory_Scratch, sizeof(fill_edge)*Capacity);
+		if(!Edges)
+		{
+			return(false);
+		}
+		if(List->Count)
+		{
+			memcpy(Edges, List->Edges, sizeof(fill_edge)*List->Count);
+		}
+		FreeMemory(List->Edges);
+		List->Edges = Edges;
+		List->Capacity = Capacity;
+	}
+
+	fill_edge Edge = { A, B, Height };
+	List->Edges[List->Count++] = Edge;
+	return(true);
+}
+
+static int
+CompareFillEdges(const void *AData, const void *BData)
+{
+	const fill_edge *A = (const fill_edge *)AData;
+	const fill_edge *B = (const fill_edge *)BData;
+	int Result = (A->A != B->A) ? ((A->A < B->A) ? -1 : 1) : ((A->B != B->B) ? ((A->B < B->B) ? -1 : 1) : 0);
+	return(Result);
+}
+
+// NOTE(georgy): Leaves one edge per pair of labels, the lowest
+static void
+MergeFillEdges(fill_edge_list *List)
+{
+	if(List->Count == 0)
+	{
+		return;
+	}
+
+	qsort(List->Edges, List->Count, sizeof(fill_edge), CompareFillEdges);
+	uint32_t Count = 1;
+	for(uint32_t EdgeIndex = 1; EdgeIndex < List->Count; EdgeIndex++)
+	{
+		fill_edge *Last = List->Edges + Count - 1;
+		fill_edge Edge = List->Edges[EdgeIndex];
+		if((Edge.A == Last->A) && (Edge.B == Last->B))
+		{
+			Last->Height = Min(Last->Height, Edge.Height);
+		}
+		else
+		{
+			List->Edges[Count++] = Edge;
+		}
+	}
+	List->Count = Count;
+}
+
+//
+// NOTE(georgy): Flooding
+//
+
+static const int32_t FillNeighbourX[8] = { -1, 0, 1, -1, 1, -1, 0, 1 };
+static const int32_t FillNeighbourZ[8] = { -1, -1, -1, 0, 0, 1, 1, 1 };
+
+struct fill_tile
+{
+	uint32_t XMin, XMax;
+	uint32_t ZMin, ZMax;
+
+	uint32_t LabelCount;
+	uint32_t LabelBase;
+	fill_edge_list Edges;
+	bool Failed;
+};
+
+// NOTE(georgy): Labels of a tile are 2, 3, ... within the tile, the map's labels put the tiles one after another
+inline uint32_t
+GlobalFillLabel(const fill_tile *Tile, uint32_t Label)
+{
+	uint32_t Result = (Label == FILL_OCEAN_LABEL) ? FILL_OCEAN_LABEL : (Tile->LabelBase + Label - 2);
+	return(Result);
+}
+
+// NOTE(georgy): Floods the samples [XMin, XMax]x[ZMin, ZMax] from the tile's border. Filled gets the level of every sample within
+//				 the tile, Labels the watershed it drains to: the samples on the map's border drain to the ocean, every other
+//				 sample of the tile's border that isn't reached first starts a watershed of its own. The spill heights between
+//				 the watersheds go to Tile->Edges. State is 0 for every sample of the tile on entry
+static void
+FloodFillTile(const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, fill_tile *Tile,
+			  float *Filled, uint32_t *Labels, uint8_t *State)
+{
+	uint32_t Pitch = GridWidth + 1;
+	uint32_t TileWidth = Tile->XMax - Tile->XMin + 1;
+	uint32_t TileHeight = Tile->ZMax - Tile->ZMin + 1;
+	uint32_t SampleCount = TileWidth*TileHeight;
+
+	// NOTE(georgy): Every sample goes into the heap or onto the pit stack once
+	fill_heap Heap = {};
+	Heap.Capacity = SampleCount;
+	Heap.Entries = (fill_heap_entry *)AllocateMemory(MemoryCategory_Scratch, sizeof(fill_heap_entry)*SampleCount);
+	uint32_t *Pits = (uint32_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(uint32_t)*SampleCount);
+	if(!Heap.Entries || !Pits)
+	{
+		Tile->Failed = true;
+		FreeMemory(Heap.Entries);
+		FreeMemory(Pits);
+		return;
+	}
+
+	for(uint32_t Z = Tile->ZMin; Z <= Tile->ZMax; Z++)
+	{
+		bool BorderRow = (Z == Tile->ZMin) || (Z == Tile->ZMax);
+		for(uint32_t X = Tile->XMin; X <= Tile->XMax; X += (BorderRow || (X == Tile->XMax)) ? 1 : (Tile->XMax - Tile->XMin))
+		{
+			uint32_t Index = X + Z*Pitch;
+			bool MapBorder = (X == 0) || (Z == 0) || (X == GridWidth) || (Z == GridHeight);
+			Filled[Index] = HeightMap[Index];
+			Labels[Index] = MapBorder ? FILL_OCEAN_LABEL : 0;
+			State[Index] = 1;
+			PushFillHeap(&Heap, HeightMap[Index], Index);
+		}
+	}
+
+	// NOTE(georgy): Samples below the level of the one they were reached from are flooded to that level and go onto the pit stack,
+	//				 which is emptied before the heap is touched again. Everything on it is at the current level, so its order
+	//				 doesn't matter
+	uint32_t NextLabel = 2;
+	uint32_t PitCount = 0;
+	while(PitCount || Heap.Count)
+	{
+		uint32_t Index = PitCount ? Pits[--PitCount] : PopFillHeap(&Heap).Index;
+		if(Labels[Index] == 0)
+		{
+			Labels[Index] = NextLabel++;
+		}
+		uint32_t Label = Labels[Index];
+		float Level = Filled[Index];
+
+		int32_t X = (int32_t)(Index % Pitch);
+		int32_t Z = (int32_t)(Index / Pitch);
+		for(uint32_t Neighbour = 0; Neighbour < 8; Neighbour++)
+		{
+			int32_t NeighbourX = X + FillNeighbourX[Neighbour];
+			int32_t NeighbourZ = Z + FillNeighbourZ[Neighbour];
+			if((NeighbourX < (int32_t)Tile->XMin) || (NeighbourX > (int32_t)Tile->XMax) ||
+			   (NeighbourZ < (int32_t)Tile->ZMin) || (NeighbourZ > (int32_t)Tile->ZMax))
+			{
+				continue;
+			}
+
+			uint32_t NeighbourIndex = (uint32_t)NeighbourX + (uint32_t)NeighbourZ*Pitch;
+			if(State[NeighbourIndex] == 0)
+			{
+				float Height = HeightMap[NeighbourIndex];
+				State[NeighbourIndex] = 1;
+				Labels[NeighbourIndex] = Label;
+				if(Height <= Level)
+				{
+					Filled[NeighbourIndex] = Level;
+					Pits[PitCount++] = NeighbourIndex;
+				}
+				else
+				{
+					Filled[NeighbourIndex] = Height;
+					PushFillHeap(&Heap, Height, NeighbourIndex);
+				}
+			}
+			else if(Labels[NeighbourIndex] == 0)
+			{
+				// NOTE(georgy): A border sample still in the heap. It isn't lower than Level, or it'd have come out first,
+				//				 so it just joins this watershed instead of starting one
+				Labels[NeighbourIndex] = Label;
+			}
+			else if(Labels[NeighbourIndex] != Label)
+			{
+				if(!AddFillEdge(&Tile->Edges, Label, Labels[NeighbourIndex], Max(Level, Filled[NeighbourIndex])))
+				{
+					Tile->Failed = true;
+				}
+			}
+		}
+	}
+	Tile->LabelCount = NextLabel - 2;
+
+	FreeMemory(Pits);
+	FreeMemory(Heap.Entries);
+	MergeFillEdges(&Tile->Edges);
+}
+
+// NOTE(georgy): The lowest level every label's water has to rise to before it reaches the ocean. Edges are
+//				 the merged edges of all tiles, sorted by A and then B
+static bool
+SolveFillLabels(const fill_edge_list *Edges, uint32_t LabelCount, float *LabelLevels)
+{
+	uint32_t *EdgeStart = (uint32_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(uint32_t)*(LabelCount + 1));
+	uint32_t *Neighbours = (uint32_t *)AllocateMemory(MemoryCategory_Scratch, 2*sizeof(uint32_t)*((uint64_t)Edges->Count + 1));
+	float *NeighbourHeights = (float *)AllocateMemory(MemoryCategory_Scratch, 2*sizeof(float)*((uint64_t)Edges->Count + 1));
+	fill_heap Heap = {};
+	Heap.Capacity = 2*Edges->Count + 1;
+	Heap.Entries = (fill_heap_entry *)AllocateMemory(MemoryCategory_Scratch, sizeof(fill_heap_entry)*Heap.Capacity);
+	bool Result = EdgeStart && Neighbours && NeighbourHeights && Heap.Entries;
+	if(Result)
+	{
+		memset(EdgeStart, 0, sizeof(uint32_t)*(LabelCount + 1));
+		for(uint32_t EdgeIndex = 0; EdgeIndex < Edges->Count; EdgeIndex++)
+		{
+			EdgeStart[Edges->Edges[EdgeIndex].A + 1]++;
+			EdgeStart[Edges->Edges[EdgeIndex].B + 1]++;
+		}
+		for(uint32_t Label = 0; Label < LabelCount; Label++)
+		{
+			EdgeStart[Label + 1] += EdgeStart[Label];
+		}
+		for(uint32_t EdgeIndex = 0; EdgeIndex < Edges->Count; EdgeIndex++)
+		{
+			fill_edge Edge = Edges->Edges[EdgeIndex];
+			uint32_t AAt = EdgeStart[Edge.A]++;
+			uint32_t BAt = EdgeStart[Edge.B]++;
+			Neighbours[AAt] = Edge.B;
+			NeighbourHeights[AAt] = Edge.Height;
+			Neighbours[BAt] = Edge.A;
+			NeighbourHeights[BAt] = Edge.Height;
+		}
+		for(uint32_t Label = LabelCount; Label > 0; Label--)
+		{
+			EdgeStart[Label] = EdgeStart[Label - 1];
+		}
+		EdgeStart[0] = 0;
+
+		for(uint32_t Label = 0; Label < LabelCount; Label++)
+		{
+			LabelLevels[Label] = FLT_MAX;
+		}
+		LabelLevels[FILL_OCEAN_LABEL] = -FLT_MAX;
+		PushFillHeap(&Heap, -FLT_MAX, FILL_OCEAN_LABEL);
+		while(Heap.Count)
+		{
+			fill_heap_entry Entry = PopFillHeap(&Heap);
+			if(Entry.Height > LabelLevels[Entry.Index])
+			{
+				continue;
+			}
+
+			for(uint32_t At = EdgeStart[Entry.Index]; At < EdgeStart[Entry.Index + 1]; At++)
+			{
+				float Level = Max(Entry.Height, NeighbourHeights[At]);
+				if(Level < LabelLevels[Neighbours[At]])
+				{
+					LabelLevels[Neighbours[At]] = Level;
+					PushFillHeap(&Heap, Level, Neighbours[At]);
+				}
+			}
+		}
+	}
+
+	FreeMemory(Heap.Entries);
+	FreeMemory(NeighbourHeights);
+	FreeMemory(Neighbours);
+	FreeMemory(EdgeStart);
+	return(Result);
+}
+
+// NOTE(georgy): Filled gets the level of every sample. Labels and State are scratch, State has to be zeroed
+static bool
+FloodFillLevels(job_system *Jobs, const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, uint32_t TileSize,
+				float *Filled, uint32_t *Labels, uint8_t *State, depression_fill_stats *Stats)
+{
+	TIMED_FUNCTION();
+	uint32_t Pitch = GridWidth + 1;
+	uint32_t TilesX = (GridWidth + TileSize) / TileSize;
+	uint32_t TilesZ = (GridHeight + TileSize) / TileSize;
+	uint32_t TileCount = TilesX*TilesZ;
+	fill_tile *Tiles = (fill_tile *)AllocateMemory(MemoryCategory_Scratch, sizeof(fill_tile)*TileCount);
+	if(!Tiles)
+	{
+		return(false);
+	}
+	for(uint32_t TileZ = 0; TileZ < TilesZ; TileZ++)
+	{
+		for(uint32_t TileX = 0; TileX < TilesX; TileX++)
+		{
+			fill_tile *Tile = Tiles + TileX + TileZ*TilesX;
+			memset(Tile, 0, sizeof(*Tile));
+			Tile->XMin = TileX*TileSize;
+			Tile->ZMin = TileZ*TileSize;
+			Tile->XMax = Min((int32_t)(Tile->XMin + TileSize - 1), (int32_t)GridWidth);
+			Tile->ZMax = Min((int32_t)(Tile->ZMin + TileSize - 1), (int32_t)GridHeight);
+		}
+	}
+
+	ParallelFor(Jobs, "FloodTiles", TileCount, 1, [=](uint32_t Begin, uint32_t End)
+	{
+		for(uint32_t TileIndex = Begin; TileIndex < End; TileIndex++)
+		{
+			FloodFillTile(HeightMap, GridWidth, GridHeight, Tiles + TileIndex, Filled, Labels, State);
+		}
+	});
+
+	// NOTE(georgy): Edges of all tiles in the map's labels, plus the ones between neighbouring samples across the seams.
+	//				 Samples on a tile's border are never raised within it, their level is their height
+	bool Result = true;
+	uint32_t LabelCount = 2;
+	fill_edge_list Edges = {};
+	for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
+	{
+		fill_tile *Tile = Tiles + TileIndex;
+		Result = Result && !Tile->Failed;
+		Tile->LabelBase = LabelCount;
+		LabelCount += Tile->LabelCount;
+		for(uint32_t EdgeIndex = 0; Result && (EdgeIndex < Tile->Edges.Count); EdgeIndex++)
+		{
+			fill_edge Edge = Tile->Edges.Edges[EdgeIndex];
+			Result = AddFillEdge(&Edges, GlobalFillLabel(Tile, Edge.A), GlobalFillLabel(Tile, Edge.B), Edge.Height);
+		}
+	}
+	for(uint32_t TileIndex = 0; Result && (TileIndex < TileCount); TileIndex++)
+	{
+		const fill_tile *Tile = Tiles + TileIndex;
+		for(uint32_t Z = Tile->ZMin; Z <= Tile->ZMax; Z++)
+		{
+			for(uint32_t X = Tile->XMin; X <= Tile->XMax; X++)
+			{
+				// NOTE(georgy): Only the right and lower seams, looking right and down (and up-right over the right seam),
+				//				 the other tiles see the rest
+				if((X != Tile->XMax) && (Z != Tile->ZMax))
+				{
+					continue;
+				}
+				uint32_t Index = X + Z*Pitch;
+				uint32_t Label = GlobalFillLabel(Tile, Labels[Index]);
+				for(uint32_t Neighbour = 2; Neighbour < 8; Neighbour++)
+				{
+					int32_t NeighbourX = (int32_t)X + FillNeighbourX[Neighbour];
+					int32_t NeighbourZ = (int32_t)Z + FillNeighbourZ[Neighbour];
+					if((Neighbour == 3) ||
+					   (NeighbourX < 0) || (NeighbourX > (int32_t)GridWidth) || (NeighbourZ < 0) || (NeighbourZ > (int32_t)GridHeight) ||
+					   ((NeighbourX >= (int32_t)Tile->XMin) && (NeighbourX <= (int32_t)Tile->XMax) &&
+						(NeighbourZ >= (int32_t)Tile->ZMin) && (NeighbourZ <= (int32_t)Tile->ZMax)))
+					{
+						continue;
+					}
+
+					uint32_t NeighbourTileIndex = ((uint32_t)NeighbourX / TileSize) + ((uint32_t)NeighbourZ / TileSize)*TilesX;
+					uint32_t NeighbourIndex = (uint32_t)NeighbourX + (uint32_t)NeighbourZ*Pitch;
+					uint32_t NeighbourLabel = GlobalFillLabel(Tiles + NeighbourTileIndex, Labels[NeighbourIndex]);
+					if(NeighbourLabel != Label)
+					{
+						Result = Result && AddFillEdge(&Edges, Label, NeighbourLabel, Max(Filled[Index], Filled[NeighbourIndex]));
+					}
+				}
+			}
+		}
+	}
+
+	float *LabelLevels = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*LabelCount);
+	if(Result && LabelLevels)
+	{
+		MergeFillEdges(&Edges);
+		Result = SolveFillLabels(&Edges, LabelCount, LabelLevels);
+	}
+	else
+	{
+		Result = false;
+	}
+
+	if(Result)
+	{
+		ParallelFor(Jobs, "RaiseTiles", TileCount, 1, [=](uint32_t Begin, uint32_t End)
+		{
+			for(uint32_t TileIndex = Begin; TileIndex < End; TileIndex++)
+			{
+				const fill_tile *Tile = Tiles + TileIndex;
+				for(uint32_t Z = Tile->ZMin; Z <= Tile->ZMax; Z++)
+				{
+					for(uint32_t X = Tile->XMin; X <= Tile->XMax; X++)
+					{
+						uint32_t Index = X + Z*Pitch;
+						Filled[Index] = Max(Filled[Index], LabelLevels[GlobalFillLabel(Tile, Labels[Index])]);
+					}
+				}
+			}
+		});
+		Stats->TileCount = TileCount;
+		Stats->LabelCount = LabelCount - 2;
+	}
+
+	FreeMemory(LabelLevels);
+	FreeMemory(Edges.Edges);
+	for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
+	{
+		FreeMemory(Tiles[TileIndex].Edges.Edges);
+	}
+	FreeMemory(Tiles);
+	return(Result);
+}
+
+//
+// NOTE(georgy): Filling
+//
+
+// NOTE(georgy): Finds the connected groups of samples below their level and raises the small ones. Queue has room for every sample,
+//				 State is 1 for every sample on entry and 0 for the ones already looked at when this returns
+static void
+RaiseDepressions(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const depression_fill_params *Params,
+				 float *Filled, uint32_t *Queue, uint8_t *State, depression_fill_stats *Stats)
+{
+	TIMED_FUNCTION();
+	uint32_t Pitch = GridWidth + 1;
+	uint32_t SampleCount = Pitch*(GridHeight + 1);
+	for(uint32_t First = 0; First < SampleCount; First++)
+	{
+		if(!State[First] || (Filled[First] <= HeightMap[First]))
+		{
+			continue;
+		}
+
+		// NOTE(georgy): Neighbouring samples below their levels share the level, so a depression is all of one level
+		float Level = Filled[First];
+		float MaxDepth = 0.0f;
+		double Volume = 0.0;
+		uint32_t Count = 0;
+		Queue[Count++] = First;
+		State[First] = 0;
+		for(uint32_t At = 0; At < Count; At++)
+		{
+			uint32_t Index = Queue[At];
+			MaxDepth = Max(MaxDepth, Level - HeightMap[Index]);
+			Volume += Level - HeightMap[Index];
+
+			int32_t X = (int32_t)(Index % Pitch);
+			int32_t Z = (int32_t)(Index / Pitch);
+			for(uint32_t Neighbour = 0; Neighbour < 8; Neighbour++)
+			{
+				int32_t NeighbourX = X + FillNeighbourX[Neighbour];
+				int32_t NeighbourZ = Z + FillNeighbourZ[Neighbour];
+				uint32_t NeighbourIndex = (uint32_t)NeighbourX + (uint32_t)NeighbourZ*Pitch;
+				if((NeighbourX >= 0) && (NeighbourX <= (int32_t)GridWidth) && (NeighbourZ >= 0) && (NeighbourZ <= (int32_t)GridHeight) &&
+				   State[NeighbourIndex] && (Filled[NeighbourIndex] > HeightMap[NeighbourIndex]))
+				{
+					State[NeighbourIndex] = 0;
+					Queue[Count++] = NeighbourIndex;
+				}
+			}
+		}
+
+		Stats->DepressionCount++;
+		Stats->DepressionSamples += Count;
+		Stats->DepressionVolume += Volume;
+		if((MaxDepth > Params->MaxDepth) || (Count > Params->MaxArea) || (2*(uint64_t)Count > SampleCount))
+		{
+			continue;
+		}
+
+		// NOTE(georgy): Breadth-first from the samples next to where it spills over (a sample outside at the level),
+		//				 a bit higher with every step. The second half of Queue is free
+		uint32_t *Ring = Queue + Count;
+		uint32_t RingCount = 0;
+		for(uint32_t At = 0; At < Count; At++)
+		{
+			uint32_t Index = Queue[At];
+			int32_t X = (int32_t)(Index % Pitch);
+			int32_t Z = (int32_t)(Index / Pitch);
+			for(uint32_t Neighbour = 0; Neighbour < 8; Neighbour++)
+			{
+				int32_t NeighbourX = X + FillNeighbourX[Neighbour];
+				int32_t NeighbourZ = Z + FillNeighbourZ[Neighbour];
+				uint32_t NeighbourIndex = (uint32_t)NeighbourX + (uint32_t)NeighbourZ*Pitch;
+				if((NeighbourX >= 0) && (NeighbourX <= (int32_t)GridWidth) && (NeighbourZ >= 0) && (NeighbourZ <= (int32_t)GridHeight) &&
+				   (Filled[NeighbourIndex] <= HeightMap[NeighbourIndex]) && (HeightMap[NeighbourIndex] <= Level))
+				{
+					Ring[RingCount++] = Index;
+					HeightMap[Index] = Max(Level + Params->RisePerSample, nextafterf(Level, FLT_MAX));
+					break;
+				}
+			}
+		}
+		for(uint32_t At = 0; At < RingCount; At++)
+		{
+			uint32_t Index = Ring[At];
+			int32_t X = (int32_t)(Index % Pitch);
+			int32_t Z = (int32_t)(Index / Pitch);
+			for(uint32_t Neighbour = 0; Neighbour < 8; Neighbour++)
+			{
+				int32_t NeighbourX = X + FillNeighbourX[Neighbour];
+				int32_t NeighbourZ = Z + FillNeighbourZ[Neighbour];
+				uint32_t NeighbourIndex = (uint32_t)NeighbourX + (uint32_t)NeighbourZ*Pitch;
+				if((NeighbourX >= 0) && (NeighbourX <= (int32_t)GridWidth) && (NeighbourZ >= 0) && (NeighbourZ <= (int32_t)GridHeight) &&
+				   (HeightMap[NeighbourIndex] < Level))
+				{
+					Ring[RingCount++] = NeighbourIndex;
+					HeightMap[NeighbourIndex] = Max(HeightMap[Index] + Params->RisePerSample, nextafterf(HeightMap[Index], FLT_MAX));
+				}
+			}
+		}
+
+		Stats->FilledCount++;
+		Stats->FilledSamples += Count;
+		Stats->FilledVolume += Volume + Params->RisePerSample*(double)Count;
+	}
+}
+
+// NOTE(georgy): Raises the small depressions of HeightMap, see the top of the file. Fails only when out of memory,
+//				 HeightMap is left as it was then
+static bool
+FillDepressions(job_system *Jobs, float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const depression_fill_params *Params,
+				depression_fill_stats *Stats)
+{
+	TIMED_FUNCTION();
+	memset(Stats, 0, sizeof(*Stats));
+	uint64_t SampleCount = (uint64_t)(GridWidth + 1)*(GridHeight + 1);
+	uint32_t TileSize = Max((int32_t)Params->TileSize, 2);
+
+	float *Filled = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*SampleCount);
+	uint32_t *Labels = (uint32_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(uint32_t)*SampleCount);
+	uint8_t *State = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, SampleCount);
+	bool Result = Filled && Labels && State;
+	if(Result)
+	{
+		memset(State, 0, SampleCount);
+		Result = FloodFillLevels(Jobs, HeightMap, GridWidth, GridHeight, TileSize, Filled, Labels, State, Stats);
+	}
+	if(Result)
+	{
+		// NOTE(georgy): The flood left State at 1 everywhere, Labels is done with and becomes the queue
+		RaiseDepressions(HeightMap, GridWidth, GridHeight, Params, Filled, Labels, State, Stats);
+	}
+
+	FreeMemory(State);
+	FreeMemory(Labels);
+	FreeMemory(Filled);
+	return(Result);
+}
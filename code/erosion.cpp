@@ -0,0 +1,418 @@
+#pragma once
+
+#include "height_storage.cpp"
+#include "memory.cpp"
+#include "trace.cpp"
+
+struct erosion_params
+{
+	uint32_t DropletCount;
+	uint32_t MaxLifeTime;
+	uint32_t Seed;
+
+	float Inertia;
+	float CapacityFactor;
+	float MinCarryCapacity;
+	float Deposition;
+	float Erosion;
+	float Evaporation;
+	float Gravity;
+	int32_t Radius;
+};
+
+inline erosion_params
+DefaultErosionParams(void)
+{
+	erosion_params Result;
+	Result.DropletCount = 75000;
+	Result.MaxLifeTime = 30;
+	Result.Seed = 1337;
+	Result.Inertia = 0.4f;
+	Result.CapacityFactor = 2.0f;
+	Result.MinCarryCapacity = 0.001f;
+	Result.Deposition = 0.1f;
+	Result.Erosion = 0.3f;
+	Result.Evaporation = 0.1f;
+	Result.Gravity = 4.0f;
+	Result.Radius = 6;
+
+	return(Result);
+}
+
+// NOTE(georgy): Moves one droplet from (X, Z) until it stops, evaporates or leaves the grid and returns how many steps it moved.
+//				 HeightMap is float * or one of the storages from height_storage.cpp
+template<typename height_storage> static uint32_t
+SimulateDroplet(height_storage *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const erosion_params *Params, float X, float Z)
+{
+	vec2 DropletP = vec2(X, Z);
+	vec2 DropletDir = vec2(0.0f, 0.0f);
+	float DropletSediment = 0.0f;
+	float DropletSpeed = 1.0f;
+	float DropletWater = 1.0f;
+
+	uint32_t LifeTime = 0;
+	for(; LifeTime < Params->MaxLifeTime; LifeTime++)
+	{
+		// NOTE(georgy): Current droplet's grid cell indices
+		uint32_t XIndex = (uint32_t)DropletP.x;
+		uint32_t ZIndex = (uint32_t)DropletP.y;
+		uint32_t Grid00Index = XIndex + ZIndex*(GridWidth + 1);
+		uint32_t Grid01Index = Grid00Index + 1;
+		uint32_t Grid10Index = Grid00Index + (GridWidth + 1);
+		uint32_t Grid11Index = Grid00Index + (GridWidth + 1) + 1;
+
+		// NOTE(georgy): Droplet's offset inside the cell
+		float U = (DropletP.x - XIndex);
+		float V = (DropletP.y - ZIndex);
+		AddFlow(HeightMap, GridWidth, Grid00Index, U, V, DropletWater);
+
+		// NOTE(georgy): Find current height, gradient and direction
+		float Height00 = LoadHeight(HeightMap, Grid00Index);
+		float Height01 = LoadHeight(HeightMap, Grid01Index);
+		float Height10 = LoadHeight(HeightMap, Grid10Index);
+		float Height11 = LoadHeight(HeightMap, Grid11Index);
+		vec2 Grad00 = vec2(Height01 - Height00, Height10 - Height00);
+		vec2 Grad01 = vec2(Height01 - Height00, Height11 - Height01);
+		vec2 Grad10 = vec2(Height11 - Height10, Height10 - Height00);
+		vec2 Grad11 = vec2(Height11 - Height10, Height11 - Height01);
+		vec2 GradInterpolation0 = Lerp(Grad00, Grad01, U);
+		vec2 GradInterpolation1 = Lerp(Grad10, Grad11, U);
+		vec2 Grad = Lerp(GradInterpolation0, GradInterpolation1, V);
+
+		vec2 OldP = DropletP;
+		DropletDir = NOZ(Lerp(Grad, DropletDir, Params->Inertia));
+		DropletP -= DropletDir;
+
+		float OldHeightInterpolation0 = Lerp(Height00, Height01, U);
+		float OldHeightInterpolation1 = Lerp(Height10, Height11, U);
+		float OldHeight = Lerp(OldHeightInterpolation0, OldHeightInterpolation1, V);
+
+		if(((DropletDir.x == 0.0f) && (DropletDir.y == 0.0f)) ||
+		    (DropletP.x < 0.0f) || (DropletP.x >= GridWidth) ||
+			(DropletP.y < 0.0f) || (DropletP.y >= GridHeight))
+		{
+			break;	
+		}
+
+		// NOTE(georgy): New droplet's position grid cell indices
+		uint32_t NewXIndex = (uint32_t)DropletP.x;
+		uint32_t NewZIndex = (uint32_t)DropletP.y;
+		uint32_t NewGrid00Index = NewXIndex + NewZIndex*(GridWidth + 1);
+		uint32_t NewGrid01Index = NewGrid00Index + 1;
+		uint32_t NewGrid10Index = NewGrid00Index + (GridWidth + 1);
+		uint32_t NewGrid11Index = NewGrid00Index + (GridWidth + 1) + 1;
+
+		// NOTE(georgy): New droplet's offset inside the cell
+		float NewU = (DropletP.x - NewXIndex);
+		float NewV = (DropletP.y - NewZIndex);
+
+		// NOTE(georgy): Find new height
+		float NewHeight00 = LoadHeight(HeightMap, NewGrid00Index);
+		float NewHeight01 = LoadHeight(HeightMap, NewGrid01Index);
+		float NewHeight10 = LoadHeight(HeightMap, NewGrid10Index);
+		float NewHeight11 = LoadHeight(HeightMap, NewGrid11Index);
+		float NewHeightInterpolation0 = Lerp(NewHeight00, NewHeight01, NewU);
+		float NewHeightInterpolation1 = Lerp(NewHeight10, NewHeight11, NewU);
+		float NewHeight = Lerp(NewHeightInterpolation0, NewHeightInterpolation1, NewV);
+
+		// NOTE(georgy): Find the difference between old and new heightm, and calculate new carry capacity
+		float HeightDiff = NewHeight - OldHeight;
+		float DropletCarryCapacity = Max(-HeightDiff*DropletSpeed*DropletWater*Params->CapacityFactor, Params->MinCarryCapacity);
+
+		// NOTE(georgy): If droplet's carrying more than it has capacity, or if NewHeight > OldHeight
+		if((DropletCarryCapacity < DropletSediment) || (HeightDiff > 0))
+		{
+			float DropAmount = (HeightDiff > 0) ? Min(DropletSediment, HeightDiff) : (DropletSediment - DropletCarryCapacity)*Params->Deposition;
+			DropletSediment -= DropAmount;
+
+			AddHeight(HeightMap, Grid00Index, DropAmount*(1.0f - U)*(1.0f - V));
+			AddHeight(HeightMap, Grid01Index, DropAmount*U*(1.0f - V));
+			AddHeight(HeightMap, Grid10Index, DropAmount*(1.0f - U)*V);
+			AddHeight(HeightMap, Grid11Index, DropAmount*U*V);
+		}
+		else
+		{
+			// NOTE(georgy): Erosion
+			float TakeAmount = Min((DropletCarryCapacity - DropletSediment)*Params->Erosion, -HeightDiff);
+			DropletSediment += ErodeBrush(HeightMap, GridWidth, GridHeight, XIndex, ZIndex, OldP, Params->Radius, TakeAmount);
+		}
+
+		// NOTE(georgy): New speed and water
+		// TODO(georgy): I think, not plus but minus HeightDiff*Params->Gravity is more correct. If we flow down, we want our speed to increase??
+		DropletSpeed = SquareRoot(Square(DropletSpeed) + HeightDiff*Params->Gravity); 
+		DropletWater *= (1.0f - Params->Evaporation);
+	}
+
+	return(LifeTime);
+}
+
+// NOTE(georgy): All the state between droplets is the droplet index and Series, so a run can be stopped after any droplet
+//				 and continued later with the same result (see erosion_checkpoint.cpp)
+// NOTE(georgy): Droplets per ErosionBatch trace event
+#define EROSION_TRACE_BATCH 4096
+
+// NOTE(georgy): Returns the number of droplet steps, for per-step benchmark numbers
+template<typename height_storage> static uint64_t
+WaterErosion(height_storage *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const erosion_params *Params, random_series *Series)
+{
+	uint64_t StepCount = 0;
+	for(uint32_t BatchBegin = 0; BatchBegin < Params->DropletCount; BatchBegin += EROSION_TRACE_BATCH)
+	{
+		TIMED_SCOPE("ErosionBatch");
+
+		uint32_t BatchEnd = BatchBegin + EROSION_TRACE_BATCH;
+		if(BatchEnd > Params->DropletCount) BatchEnd = Params->DropletCount;
+		for(uint32_t Droplet = BatchBegin; Droplet < BatchEnd; Droplet++)
+		{
+			float X = (float)RandomChoice(Series, GridWidth);
+			float Z = (float)RandomChoice(Series, GridHeight);
+			StepCount += SimulateDroplet(HeightMap, GridWidth, GridHeight, Params, X, Z);
+		}
+	}
+
+	return(StepCount);
+}
+
+static uint64_t
+WaterErosion(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const erosion_params *Params)
+{
+	random_series Series = RandomSeed(Params->Seed);
+	uint64_t Result = WaterErosion(HeightMap, GridWidth, GridHeight, Params, &Series);
+
+	return(Result);
+}
+
+// NOTE(georgy): Layers for texturing, written in the same droplet loop (see layered_heights)
+struct erosion_layers
+{
+	float *Flow;
+	float *Deposit;
+	float *Eroded;
+};
+
+// NOTE(georgy): Same droplets and heights as the WaterErosion above. Every layer has (GridWidth + 1)*(GridHeight + 1) samples
+//				 and is overwritten. Heights only change by deposition and erosion, so Eroded is Deposit minus the change of
+//				 the height; it holds the heights from before until then, and is exact up to float rounding of the heights
+static uint64_t
+WaterErosion(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const erosion_params *Params, erosion_layers *Layers)
+{
+	uint64_t SampleCount = (uint64_t)(GridWidth + 1)*(GridHeight + 1);
+	memset(Layers->Flow, 0, sizeof(float)*SampleCount);
+	memset(Layers->Deposit, 0, sizeof(float)*SampleCount);
+	memcpy(Layers->Eroded, HeightMap, sizeof(float)*SampleCount);
+
+	layered_heights Heights;
+	Heights.HeightMap = HeightMap;
+	Heights.Flow = Layers->Flow;
+	Heights.Deposit = Layers->Deposit;
+	random_series Series = RandomSeed(Params->Seed);
+	uint64_t Result = WaterErosion(&Heights, GridWidth, GridHeight, Params, &Series);
+
+	for(uint64_t SampleIndex = 0; SampleIndex < SampleCount; SampleIndex++)
+	{
+		float Eroded = Layers->Deposit[SampleIndex] - (HeightMap[SampleIndex] - Layers->Eroded[SampleIndex]);
+		Layers->Eroded[SampleIndex] = Max(Eroded, 0.0f);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Local erosion for editor brushes. Droplets spawn only in the cells [XMin, XMax]x[ZMin, ZMax],
+//				 each one with the probability Mask[X + Z*RegionWidth]/255 when Mask is set. They can change the heightmap
+//				 up to Margin samples outside of the region, with the effect fading out linearly over the margin
+struct erosion_brush
+{
+	uint32_t XMin, XMax;
+	uint32_t ZMin, ZMax;
+	const uint8_t *Mask;
+	uint32_t Margin;
+	uint32_t DropletCount;
+};
+
+inline float
+BrushFalloff(int32_t Sample, int32_t RegionMin, int32_t RegionMax, uint32_t Margin)
+{
+	int32_t Distance = Max(Max(RegionMin - Sample, Sample - RegionMax), 0);
+	float Result = (Margin > 0) ? Max(1.0f - (float)Distance/(float)Margin, 0.0f) : 1.0f;
+
+	return(Result);
+}
+
+// NOTE(georgy): Only the region plus its margin is copied out and simulated, so the cost depends on the brush and not on
+//				 the size of the heightmap. Returns the samples that were changed (XMin > XMax if none), so the caller
+//				 can update normals and vertex buffers for just that rectangle. The window is temporary memory of Scratch
+static brush_rect
+WaterErosionBrush(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const erosion_params *Params,
+				  const erosion_brush *Brush, random_series *Series, memory_arena *Scratch)
+{
+	TIMED_FUNCTION();
+
+	brush_rect Result = { 1, 0, 1, 0 };
+	Assert((Brush->XMin <= Brush->XMax) && (Brush->XMax < GridWidth));
+	Assert((Brush->ZMin <= Brush->ZMax) && (Brush->ZMax < GridHeight));
+
+	// NOTE(georgy): Window of samples that can change, region cells' samples plus the margin, clamped to the grid
+	int32_t WindowXMin = Max((int32_t)Brush->XMin - (int32_t)Brush->Margin, 0);
+	int32_t WindowZMin = Max((int32_t)Brush->ZMin - (int32_t)Brush->Margin, 0);
+	int32_t WindowXMax = Min((int32_t)(Brush->XMax + 1 + Brush->Margin), (int32_t)GridWidth);
+	int32_t WindowZMax = Min((int32_t)(Brush->ZMax + 1 + Brush->Margin), (int32_t)GridHeight);
+	uint32_t WindowWidth = (uint32_t)(WindowXMax - WindowXMin);
+	uint32_t WindowHeight = (uint32_t)(WindowZMax - WindowZMin);
+	if((WindowWidth < 2) || (WindowHeight < 2))
+	{
+		return(Result);
+	}
+
+	uint32_t SampleCount = (WindowWidth + 1)*(WindowHeight + 1);
+	temporary_memory Temporary = BeginTemporaryMemory(Scratch);
+	float *Memory = PushArray(Scratch, SampleCount + (WindowWidth + 1) + (WindowHeight + 1), float);
+	if(!Memory)
+	{
+		printf("Out of memory for the erosion brush\n");
+		EndTemporaryMemory(Temporary);
+		return(Result);
+	}
+	float *FalloffX = Memory + SampleCount;
+	float *FalloffZ = FalloffX + (WindowWidth + 1);
+
+	for(uint32_t Z = 0; Z <= WindowHeight; Z++)
+	{
+		memcpy(Memory + Z*(WindowWidth + 1), HeightMap + WindowXMin + (WindowZMin + Z)*(GridWidth + 1), sizeof(float)*(WindowWidth + 1));
+		FalloffZ[Z] = BrushFalloff(WindowZMin + (int32_t)Z, (int32_t)Brush->ZMin, (int32_t)Brush->ZMax + 1, Brush->Margin);
+	}
+	for(uint32_t X = 0; X <= WindowWidth; X++)
+	{
+		FalloffX[X] = BrushFalloff(WindowXMin + (int32_t)X, (int32_t)Brush->XMin, (int32_t)Brush->XMax + 1, Brush->Margin);
+	}
+
+	falloff_heights Heights;
+	Heights.HeightMap = Memory;
+	Heights.GridWidth = WindowWidth;
+	Heights.FalloffX = FalloffX;
+	Heights.FalloffZ = FalloffZ;
+	Heights.Touched = Result;
+	Heights.Touched.XMin = Heights.Touched.ZMin = (int32_t)SampleCount;
+	Heights.Touched.XMax = Heights.Touched.ZMax = -1;
+
+	uint32_t RegionWidth = Brush->XMax - Brush->XMin + 1;
+	uint32_t RegionHeight = Brush->ZMax - Brush->ZMin + 1;
+	for(uint32_t Droplet = 0; Droplet < Brush->DropletCount; Droplet++)
+	{
+		uint32_t X = RandomChoice(Series, RegionWidth);
+		uint32_t Z = RandomChoice(Series, RegionHeight);
+		if(Brush->Mask && (RandomChoice(Series, 255) >= Brush->Mask[X + Z*RegionWidth]))
+		{
+			continue;
+		}
+
+		float WindowX = (float)(Brush->XMin + X - (uint32_t)WindowXMin);
+		float WindowZ = (float)(Brush->ZMin + Z - (uint32_t)WindowZMin);
+		SimulateDroplet(&Heights, WindowWidth, WindowHeight, Params, WindowX, WindowZ);
+	}
+
+	if(Heights.Touched.XMin <= Heights.Touched.XMax)
+	{
+		Result.XMin = WindowXMin + Heights.Touched.XMin;
+		Result.XMax = WindowXMin + Heights.Touched.XMax;
+		Result.ZMin = WindowZMin + Heights.Touched.ZMin;
+		Result.ZMax = WindowZMin + Heights.Touched.ZMax;
+
+		uint32_t TouchedWidth = (uint32_t)(Heights.Touched.XMax - Heights.Touched.XMin + 1);
+		for(int32_t Z = Heights.Touched.ZMin; Z <= Heights.Touched.ZMax; Z++)
+		{
+			memcpy(HeightMap + Result.XMin + (WindowZMin + Z)*(GridWidth + 1),
+				   Memory + Heights.Touched.XMin + Z*(WindowWidth + 1), sizeof(float)*TouchedWidth);
+		}
+	}
+
+	EndTemporaryMemory(Temporary);
+	return(Result);
+}
+
+// NOTE(georgy): How far from its spawn point a droplet can change the heightmap.
+//				 It moves one cell per step and its erosion brush reaches Radius cells further
+inline uint32_t
+ErosionReach(const erosion_params *Params)
+{
+	uint32_t Result = Params->MaxLifeTime + (uint32_t)Params->Radius + 1;
+
+	return(Result);
+}
+
+// NOTE(georgy): For tiled erosion droplets are tied to world positions instead of the grid. The world is split into
+//				 spawn blocks with their own random series, and droplets run in rounds: droplet 0 of every block in row order,
+//				 then droplet 1 and so on. Two grids that overlap run the droplets of the overlap in the same order,
+//				 and droplets are still spread over the whole area over time like in WaterErosion
+#define EROSION_SPAWN_BLOCK_SIZE 64
+
+inline uint32_t
+DropletsPerSpawnBlock(uint32_t DropletCount, uint32_t Area)
+{
+	uint64_t BlockArea = EROSION_SPAWN_BLOCK_SIZE*EROSION_SPAWN_BLOCK_SIZE;
+	uint32_t Result = (uint32_t)(((uint64_t)DropletCount*BlockArea + Area/2) / Area);
+
+	return(Result);
+}
+
+// NOTE(georgy): Seeds of spawn blocks in the int32 range are the same as they've always been, further out the high halves go in too
+inline uint32_t
+SpawnBlockSeed(uint32_t Seed, int64_t BlockX, int64_t BlockZ)
+{
+	uint32_t Result = HashCombine(HashCombine(Seed, (uint32_t)BlockX), (uint32_t)BlockZ);
+	if((BlockX != (int32_t)BlockX) || (BlockZ != (int32_t)BlockZ))
+	{
+		Result = HashCombine(HashCombine(Result, (uint32_t)((uint64_t)BlockX >> 32)), (uint32_t)((uint64_t)BlockZ >> 32));
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Erodes the part of the world that starts at (OriginX, OriginZ). Only droplets spawned inside the grid are simulated.
+//				 Fails without touching HeightMap if there's no memory for the spawn blocks
+static bool
+WaterErosionRegion(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, int64_t OriginX, int64_t OriginZ,
+				   const erosion_params *Params, uint32_t DropletsPerBlock, uint32_t Seed)
+{
+	int64_t BlockSize = EROSION_SPAWN_BLOCK_SIZE;
+	int64_t FirstBlockX = FloorDivide(OriginX, BlockSize);
+	int64_t FirstBlockZ = FloorDivide(OriginZ, BlockSize);
+	uint32_t BlockCountX = (uint32_t)(FloorDivide(OriginX + (int64_t)GridWidth - 1, BlockSize) - FirstBlockX + 1);
+	uint32_t BlockCountZ = (uint32_t)(FloorDivide(OriginZ + (int64_t)GridHeight - 1, BlockSize) - FirstBlockZ + 1);
+
+	random_series *BlockSeries = (random_series *)AllocateMemory(MemoryCategory_Scratch, sizeof(random_series)*BlockCountX*BlockCountZ);
+	if(!BlockSeries)
+	{
+		printf("Out of memory for spawn blocks\n");
+		return(false);
+	}
+	for(uint32_t BlockZ = 0; BlockZ < BlockCountZ; BlockZ++)
+	{
+		for(uint32_t BlockX = 0; BlockX < BlockCountX; BlockX++)
+		{
+			BlockSeries[BlockX + BlockZ*BlockCountX] = RandomSeed(SpawnBlockSeed(Seed, FirstBlockX + BlockX, FirstBlockZ + BlockZ));
+		}
+	}
+
+	// NOTE(georgy): Block corners relative to the grid fit in 32 bits, the grid is never that large
+	int32_t FirstCornerX = (int32_t)(FirstBlockX*BlockSize - OriginX);
+	int32_t FirstCornerZ = (int32_t)(FirstBlockZ*BlockSize - OriginZ);
+	for(uint32_t Round = 0; Round < DropletsPerBlock; Round++)
+	{
+		for(uint32_t BlockZ = 0; BlockZ < BlockCountZ; BlockZ++)
+		{
+			for(uint32_t BlockX = 0; BlockX < BlockCountX; BlockX++)
+			{
+				random_series *Series = BlockSeries + BlockX + BlockZ*BlockCountX;
+				int32_t X = FirstCornerX + (int32_t)(BlockX*EROSION_SPAWN_BLOCK_SIZE) + (int32_t)RandomChoice(Series, EROSION_SPAWN_BLOCK_SIZE);
+				int32_t Z = FirstCornerZ + (int32_t)(BlockZ*EROSION_SPAWN_BLOCK_SIZE) + (int32_t)RandomChoice(Series, EROSION_SPAWN_BLOCK_SIZE);
+				if((X >= 0) && (X < (int32_t)GridWidth) && (Z >= 0) && (Z < (int32_t)GridHeight))
+				{
+					SimulateDroplet(HeightMap, GridWidth, GridHeight, Params, (float)X, (float)Z);
+				}
+			}
+		}
+	}
+
+	FreeMemory(BlockSeries);
+	return(true);
+}
@@ -0,0 +1,377 @@
+#pragma once
+
+#include "erosion.cpp"
+#include "terrain_file.cpp"
+#include "platform.cpp"
+
+// NOTE(georgy): Checkpoints for long WaterErosion runs. Everything a run needs to continue is the heightmap, the droplet
+//				 cursor and the random series, so a resumed run ends with exactly the heightmap of an uninterrupted one.
+//				 Directory holds:
+//				 checkpoint.base      - the whole heightmap at some sequence number
+//				 checkpoint.NNNNNNNN  - journals, the tiles droplets changed since the previous checkpoint
+//				 Every file is written to .tmp and renamed, so a file either is complete or doesn't exist. Resume applies
+//				 the journals after the base in order and stops at the first one that's missing, corrupt or doesn't continue
+//				 from the state before it. Once the journals outgrow the heightmap they're folded into a new base
+#define EROSION_CHECKPOINT_MAGIC 0x504B4345 // NOTE(georgy): "ECKP"
+#define EROSION_CHECKPOINT_VERSION 1
+// NOTE(georgy): How often the clock is looked at, checkpoints land on multiples of this many droplets
+#define EROSION_CHECKPOINT_DROPLET_GRANULARITY 256
+
+struct erosion_checkpoint_header
+{
+	uint32_t Magic;
+	uint32_t Version;
+	// NOTE(georgy): Hash of the parameters, the grid and the heights before erosion, checkpoints of other runs are ignored
+	uint64_t RunKey;
+	uint32_t Sequence;
+	// NOTE(georgy): Journals only, the base has the whole heightmap instead of tile indices and tiles
+	uint32_t TileCount;
+	// NOTE(georgy): State the journal continues from
+	uint32_t PreviousCursor;
+	uint32_t PreviousRandomState;
+	// NOTE(georgy): State after the file is applied, Cursor is the number of droplets done
+	uint32_t Cursor;
+	uint32_t RandomState;
+	// NOTE(georgy): HashBytes of everything after the header
+	uint64_t Hash;
+};
+
+struct erosion_checkpoint_stats
+{
+	uint32_t ResumedCursor;
+	uint32_t CheckpointCount;
+	uint64_t BytesWritten;
+	uint64_t Nanoseconds;
+};
+
+struct erosion_checkpoint_run
+{
+	const char *Directory;
+	uint64_t RunKey;
+	float *HeightMap;
+	uint32_t GridWidth;
+	uint32_t GridHeight;
+	uint32_t TilesX;
+	uint32_t TilesZ;
+
+	uint32_t Sequence;
+	uint32_t BaseSequence;
+	uint32_t Cursor;
+	random_series Series;
+	// NOTE(georgy): Journal bytes written since the base
+	uint64_t JournalBytes;
+};
+
+static uint64_t
+ErosionCheckpointRunKey(const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const erosion_params *Params)
+{
+	uint32_t Header[] = { EROSION_CHECKPOINT_VERSION, GridWidth, GridHeight, DIRTY_TILE_SIZE };
+
+	uint64_t Result = HashBytes(Header, sizeof(Header));
+	Result = HashBytes(Params, sizeof(*Params), Result);
+	Result = HashBytes(HeightMap, sizeof(float)*(GridWidth + 1)*(GridHeight + 1), Result);
+	return(Result);
+}
+
+static void
+GetCheckpointFilename(char *Dest, uint32_t DestSize, const char *Directory, uint32_t Sequence, bool Base)
+{
+	if(Base)
+	{
+		snprintf(Dest, DestSize, "%s/checkpoint.base", Directory);
+	}
+	else
+	{
+		snprintf(Dest, DestSize, "%s/checkpoint.%08u", Directory, Sequence);
+	}
+}
+
+// NOTE(georgy): Maps a checkpoint file and checks its header and hash
+static bool
+OpenCheckpointFile(mapped_file *File, const char *Filename, uint64_t RunKey, const erosion_checkpoint_header **Header)
+{
+	if(!MapFileReadOnly(File, Filename))
+	{
+		return(false);
+	}
+
+	*Header = (const erosion_checkpoint_header *)File->Memory;
+	bool Result = (File->Size >= sizeof(erosion_checkpoint_header)) && ((*Header)->Magic == EROSION_CHECKPOINT_MAGIC) &&
+				  ((*Header)->Version == EROSION_CHECKPOINT_VERSION) && ((*Header)->RunKey == RunKey) &&
+				  ((*Header)->Hash == HashBytes(*Header + 1, File->Size - sizeof(erosion_checkpoint_header)));
+	if(!Result)
+	{
+		UnmapFile(File);
+	}
+
+	return(Result);
+}
+
+static bool
+WriteCheckpointBase(erosion_checkpoint_run *Run, erosion_checkpoint_stats *Stats)
+{
+	uint64_t SamplesSize = sizeof(float)*(Run->GridWidth + 1)*(Run->GridHeight + 1);
+	uint8_t *Memory = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(erosion_checkpoint_header) + SamplesSize);
+	if(!Memory)
+	{
+		return(false);
+	}
+
+	erosion_checkpoint_header *Header = (erosion_checkpoint_header *)Memory;
+	memset(Header, 0, sizeof(*Header));
+	Header->Magic = EROSION_CHECKPOINT_MAGIC;
+	Header->Version = EROSION_CHECKPOINT_VERSION;
+	Header->RunKey = Run->RunKey;
+	Header->Sequence = Run->Sequence;
+	Header->Cursor = Run->Cursor;
+	Header->RandomState = Run->Series.State;
+	memcpy(Header + 1, Run->HeightMap, SamplesSize);
+	Header->Hash = HashBytes(Header + 1, SamplesSize);
+
+	char Filename[1024];
+	GetCheckpointFilename(Filename, sizeof(Filename), Run->Directory, 0, true);
+	bool Result = WriteEntireFileAtomic(Filename, Memory, sizeof(erosion_checkpoint_header) + SamplesSize);
+	FreeMemory(Memory);
+
+	if(Result)
+	{
+		// NOTE(georgy): The journals the new base replaces. A crash before they're gone leaves them behind, but resume skips
+		//				 every journal up to the base's sequence
+		for(uint32_t Sequence = Run->BaseSequence + 1; Sequence <= Run->Sequence; Sequence++)
+		{
+			GetCheckpointFilename(Filename, sizeof(Filename), Run->Directory, Sequence, false);
+			remove(Filename);
+		}
+		Run->BaseSequence = Run->Sequence;
+		Run->JournalBytes = 0;
+		Stats->BytesWritten += sizeof(erosion_checkpoint_header) + SamplesSize;
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Writes the dirty tiles and clears them
+static bool
+WriteCheckpointJournal(erosion_checkpoint_run *Run, uint8_t *DirtyTiles, uint32_t PreviousCursor, uint32_t PreviousRandomState,
+					   erosion_checkpoint_stats *Stats)
+{
+	uint32_t TileCount = Run->TilesX*Run->TilesZ;
+	uint32_t DirtyCount = 0;
+	uint64_t SamplesSize = 0;
+	for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
+	{
+		if(DirtyTiles[TileIndex])
+		{
+			terrain_tile_rect Rect = GetTerrainTileRect(Run->GridWidth, Run->GridHeight, DIRTY_TILE_SIZE, TileIndex % Run->TilesX, TileIndex / Run->TilesX);
+			SamplesSize += sizeof(float)*Rect.Width*Rect.Height;
+			DirtyCount++;
+		}
+	}
+
+	uint64_t Size = sizeof(erosion_checkpoint_header) + sizeof(uint32_t)*DirtyCount + SamplesSize;
+	uint8_t *Memory = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, Size);
+	if(!Memory)
+	{
+		return(false);
+	}
+
+	erosion_checkpoint_header *Header = (erosion_checkpoint_header *)Memory;
+	memset(Header, 0, sizeof(*Header));
+	Header->Magic = EROSION_CHECKPOINT_MAGIC;
+	Header->Version = EROSION_CHECKPOINT_VERSION;
+	Header->RunKey = Run->RunKey;
+	Header->Sequence = Run->Sequence + 1;
+	Header->TileCount = DirtyCount;
+	Header->PreviousCursor = PreviousCursor;
+	Header->PreviousRandomState = PreviousRandomState;
+	Header->Cursor = Run->Cursor;
+	Header->RandomState = Run->Series.State;
+
+	uint32_t *TileIndices = (uint32_t *)(Header + 1);
+	float *Samples = (float *)(TileIndices + DirtyCount);
+	for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
+	{
+		if(DirtyTiles[TileIndex])
+		{
+			*TileIndices++ = TileIndex;
+			terrain_tile_rect Rect = GetTerrainTileRect(Run->GridWidth, Run->GridHeight, DIRTY_TILE_SIZE, TileIndex % Run->TilesX, TileIndex / Run->TilesX);
+			for(uint32_t Z = 0; Z < Rect.Height; Z++)
+			{
+				memcpy(Samples, Run->HeightMap + Rect.X + (Rect.Z + Z)*(Run->GridWidth + 1), sizeof(float)*Rect.Width);
+				Samples += Rect.Width;
+			}
+		}
+	}
+	Header->Hash = HashBytes(Header + 1, Size - sizeof(erosion_checkpoint_header));
+
+	char Filename[1024];
+	GetCheckpointFilename(Filename, sizeof(Filename), Run->Directory, Run->Sequence + 1, false);
+	bool Result = WriteEntireFileAtomic(Filename, Memory, Size);
+	FreeMemory(Memory);
+
+	if(Result)
+	{
+		Run->Sequence++;
+		Run->JournalBytes += Size;
+		Stats->BytesWritten += Size;
+		Stats->CheckpointCount++;
+		memset(DirtyTiles, 0, TileCount);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Loads the newest state of the run into Run->HeightMap. Fails if there's no base for this run
+static bool
+ResumeErosionCheckpoint(erosion_checkpoint_run *Run)
+{
+	char Filename[1024];
+	GetCheckpointFilename(Filename, sizeof(Filename), Run->Directory, 0, true);
+
+	mapped_file File;
+	const erosion_checkpoint_header *Header;
+	uint64_t SamplesSize = sizeof(float)*(Run->GridWidth + 1)*(Run->GridHeight + 1);
+	if(!OpenCheckpointFile(&File, Filename, Run->RunKey, &Header))
+	{
+		return(false);
+	}
+	bool Result = (File.Size == sizeof(erosion_checkpoint_header) + SamplesSize);
+	if(Result)
+	{
+		memcpy(Run->HeightMap, Header + 1, SamplesSize);
+		Run->Sequence = Run->BaseSequence = Header->Sequence;
+		Run->Cursor = Header->Cursor;
+		Run->Series.State = Header->RandomState;
+	}
+	UnmapFile(&File);
+
+	uint32_t TileCount = Run->TilesX*Run->TilesZ;
+	for(;;)
+	{
+		GetCheckpointFilename(Filename, sizeof(Filename), Run->Directory, Run->Sequence + 1, false);
+		if(!Result || !OpenCheckpointFile(&File, Filename, Run->RunKey, &Header))
+		{
+			break;
+		}
+
+		// NOTE(georgy): Checks the whole journal before touching the heightmap
+		bool Valid = (Header->Sequence == Run->Sequence + 1) && (Header->PreviousCursor == Run->Cursor) &&
+					 (Header->PreviousRandomState == Run->Series.State) && (Header->TileCount <= TileCount) &&
+					 (File.Size >= sizeof(erosion_checkpoint_header) + sizeof(uint32_t)*(uint64_t)Header->TileCount);
+		const uint32_t *TileIndices = (const uint32_t *)(Header + 1);
+		uint64_t ExpectedSize = sizeof(erosion_checkpoint_header) + sizeof(uint32_t)*(uint64_t)Header->TileCount;
+		for(uint32_t Index = 0; Valid && (Index < Header->TileCount); Index++)
+		{
+			Valid = (TileIndices[Index] < TileCount);
+			if(Valid)
+			{
+				terrain_tile_rect Rect = GetTerrainTileRect(Run->GridWidth, Run->GridHeight, DIRTY_TILE_SIZE, TileIndices[Index] % Run->TilesX, TileIndices[Index] / Run->TilesX);
+				ExpectedSize += sizeof(float)*Rect.Width*Rect.Height;
+			}
+		}
+		Valid = Valid && (File.Size == ExpectedSize);
+
+		if(Valid)
+		{
+			const float *Samples = (const float *)(TileIndices + Header->TileCount);
+			for(uint32_t Index = 0; Index < Header->TileCount; Index++)
+			{
+				terrain_tile_rect Rect = GetTerrainTileRect(Run->GridWidth, Run->GridHeight, DIRTY_TILE_SIZE, TileIndices[Index] % Run->TilesX, TileIndices[Index] / Run->TilesX);
+				for(uint32_t Z = 0; Z < Rect.Height; Z++)
+				{
+					memcpy(Run->HeightMap + Rect.X + (Rect.Z + Z)*(Run->GridWidth + 1), Samples, sizeof(float)*Rect.Width);
+					Samples += Rect.Width;
+				}
+			}
+			Run->Sequence++;
+			Run->Cursor = Header->Cursor;
+			Run->Series.State = Header->RandomState;
+			Run->JournalBytes += File.Size;
+		}
+		UnmapFile(&File);
+
+		if(!Valid)
+		{
+			break;
+		}
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): WaterErosion that checkpoints into Directory at least IntervalSeconds apart, and first continues from the
+//				 checkpoints of the same run if Directory has them. HeightMap must hold the heights before erosion either way.
+//				 The run gives up like an interrupted one at the first checkpoint with at least StopCursor droplets done
+static bool
+WaterErosionCheckpointed(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const erosion_params *Params,
+						 const char *Directory, float IntervalSeconds, erosion_checkpoint_stats *Stats, uint32_t StopCursor = UINT32_MAX)
+{
+	memset(Stats, 0, sizeof(*Stats));
+	if(!MakeDirectory(Directory))
+	{
+		printf("Can't checkpoint into %s\n", Directory);
+		return(false);
+	}
+
+	erosion_checkpoint_run Run = {};
+	Run.Directory = Directory;
+	Run.RunKey = ErosionCheckpointRunKey(HeightMap, GridWidth, GridHeight, Params);
+	Run.HeightMap = HeightMap;
+	Run.GridWidth = GridWidth;
+	Run.GridHeight = GridHeight;
+	Run.TilesX = TerrainTileCount(GridWidth + 1, DIRTY_TILE_SIZE);
+	Run.TilesZ = TerrainTileCount(GridHeight + 1, DIRTY_TILE_SIZE);
+	Run.Series = RandomSeed(Params->Seed);
+
+	uint64_t CheckpointBegin = GetNanoseconds();
+	bool Result = ResumeErosionCheckpoint(&Run);
+	if(Result)
+	{
+		Stats->ResumedCursor = Run.Cursor;
+	}
+	else
+	{
+		Result = WriteCheckpointBase(&Run, Stats);
+	}
+	Stats->Nanoseconds += GetNanoseconds() - CheckpointBegin;
+
+	uint8_t *DirtyTiles = (uint8_t *)AllocateZeroedMemory(MemoryCategory_Scratch, Run.TilesX*Run.TilesZ);
+	Result = Result && DirtyTiles;
+
+	dirty_tracked_heights Heights = { HeightMap, GridWidth, Run.TilesX, DirtyTiles };
+	uint64_t HeightMapSize = sizeof(float)*(GridWidth + 1)*(GridHeight + 1);
+	uint64_t IntervalNanoseconds = (uint64_t)(IntervalSeconds*1000000000.0);
+	while(Result && (Run.Cursor < Params->DropletCount) && (Run.Cursor < StopCursor))
+	{
+		uint32_t PreviousCursor = Run.Cursor;
+		uint32_t PreviousRandomState = Run.Series.State;
+		uint64_t IntervalBegin = GetNanoseconds();
+		do
+		{
+			uint32_t BatchEnd = ((Params->DropletCount - Run.Cursor) > EROSION_CHECKPOINT_DROPLET_GRANULARITY) ?
+								(Run.Cursor + EROSION_CHECKPOINT_DROPLET_GRANULARITY) : Params->DropletCount;
+			for(; Run.Cursor < BatchEnd; Run.Cursor++)
+			{
+				float X = (float)RandomChoice(&Run.Series, GridWidth);
+				float Z = (float)RandomChoice(&Run.Series, GridHeight);
+				SimulateDroplet(&Heights, GridWidth, GridHeight, Params, X, Z);
+			}
+		} while((Run.Cursor < Params->DropletCount) && ((GetNanoseconds() - IntervalBegin) < IntervalNanoseconds));
+
+		CheckpointBegin = GetNanoseconds();
+		Result = WriteCheckpointJournal(&Run, DirtyTiles, PreviousCursor, PreviousRandomState, Stats);
+		if(Result && (Run.JournalBytes > HeightMapSize))
+		{
+			Result = WriteCheckpointBase(&Run, Stats);
+		}
+		Stats->Nanoseconds += GetNanoseconds() - CheckpointBegin;
+	}
+
+	if(!Result)
+	{
+		printf("Failed to checkpoint erosion into %s\n", Directory);
+	}
+
+	FreeMemory(DirtyTiles);
+	return(Result);
+}
@@ -0,0 +1,620 @@
+#pragma once
+
+#include "erosion.cpp"
+#include "terrain.cpp"
+#include "terrain_file.cpp"
+
+// NOTE(georgy): Eroded terrain stored as the difference from its noise base. The base is regenerated from the noise
+//				 parameters in the header, so only what erosion changed is stored: every sample's delta is quantized to
+//				 a multiple of Step, predicted from its neighbours (erosion moves material with a brush, so deltas
+//				 are smooth), and the zigzagged residual is entropy coded with rANS, tile by tile. Loaded heights are within
+//				 Step/2 of the originals (plus float rounding if the noise kernels of the loading CPU round differently).
+//				 Layout, all little-endian:
+//				 erosion_delta_header
+//				 erosion_delta_tile[TilesX*TilesZ], tiles in row order
+//				 tile data: symbol frequencies (varints), rANS stream size (u32), rANS stream, extra bits
+#define EROSION_DELTA_MAGIC 0x4C444554 // NOTE(georgy): "TEDL"
+#define EROSION_DELTA_VERSION 2
+#define EROSION_DELTA_TILE_SIZE 128
+
+// NOTE(georgy): Values below 16 are symbols of their own, bigger ones are coded by their bit length and second highest bit,
+//				 with the rest of the bits stored raw. 16 + 2*(31 - 4 + 1) symbols cover every uint32_t
+#define DELTA_DIRECT_SYMBOLS 16
+#define DELTA_SYMBOL_COUNT 72
+
+#define RANS_PROB_BITS 12
+#define RANS_PROB_SCALE (1 << RANS_PROB_BITS)
+#define RANS_L (1u << 23)
+
+struct erosion_delta_header
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t GridWidth;
+	uint32_t GridHeight;
+	int64_t OriginX;
+	int64_t OriginZ;
+	uint32_t TileSize;
+	float Step;
+	noise_params Noise;
+	// NOTE(georgy): What produced the delta, loading doesn't need it
+	erosion_params Erosion;
+};
+
+struct erosion_delta_tile
+{
+	uint64_t Offset;
+	// NOTE(georgy): HashBytes of the quantized deltas of the tile, rows in order
+	uint64_t Hash;
+	uint32_t Size;
+	uint32_t Reserved;
+};
+
+//
+// NOTE(georgy): Symbols
+//
+
+inline uint32_t
+ZigZag(int32_t Value)
+{
+	uint32_t Result = ((uint32_t)Value << 1) ^ (uint32_t)(Value >> 31);
+
+	return(Result);
+}
+
+inline int32_t
+UnZigZag(uint32_t Value)
+{
+	int32_t Result = (int32_t)(Value >> 1) ^ -(int32_t)(Value & 1);
+
+	return(Result);
+}
+
+inline uint32_t
+HighestBitIndex(uint32_t Value)
+{
+	uint32_t Result = 0;
+	while(Value >>= 1)
+	{
+		Result++;
+	}
+
+	return(Result);
+}
+
+inline uint32_t
+DeltaSymbol(uint32_t Value, uint32_t *ExtraBitCount)
+{
+	uint32_t Result = Value;
+	*ExtraBitCount = 0;
+	if(Value >= DELTA_DIRECT_SYMBOLS)
+	{
+		uint32_t BitIndex = HighestBitIndex(Value);
+		Result = DELTA_DIRECT_SYMBOLS + 2*(BitIndex - 4) + ((Value >> (BitIndex - 1)) & 1);
+		*ExtraBitCount = BitIndex - 1;
+	}
+
+	return(Result);
+}
+
+struct delta_bit_writer
+{
+	uint8_t *At;
+	uint64_t Bits;
+	uint32_t BitCount;
+};
+
+inline void
+WriteDeltaBits(delta_bit_writer *Writer, uint32_t Value, uint32_t BitCount)
+{
+	Writer->Bits |= (uint64_t)Value << Writer->BitCount;
+	Writer->BitCount += BitCount;
+	while(Writer->BitCount >= 8)
+	{
+		*Writer->At++ = (uint8_t)Writer->Bits;
+		Writer->Bits >>= 8;
+		Writer->BitCount -= 8;
+	}
+}
+
+struct delta_bit_reader
+{
+	const uint8_t *At;
+	const uint8_t *End;
+	uint64_t Bits;
+	uint32_t BitCount;
+	bool Overrun;
+};
+
+inline uint32_t
+ReadDeltaBits(delta_bit_reader *Reader, uint32_t BitCount)
+{
+	while(Reader->BitCount < BitCount)
+	{
+		uint64_t Byte = 0;
+		if(Reader->At < Reader->End)
+		{
+			Byte = *Reader->At++;
+		}
+		else
+		{
+			Reader->Overrun = true;
+		}
+		Reader->Bits |= Byte << Reader->BitCount;
+		Reader->BitCount += 8;
+	}
+
+	uint32_t Result = (uint32_t)(Reader->Bits & ((1ull << BitCount) - 1));
+	Reader->Bits >>= BitCount;
+	Reader->BitCount -= BitCount;
+	return(Result);
+}
+
+inline uint8_t *
+WriteVarint(uint8_t *Out, uint32_t Value)
+{
+	while(Value >= 128)
+	{
+		*Out++ = (uint8_t)(Value | 128);
+		Value >>= 7;
+	}
+	*Out++ = (uint8_t)Value;
+
+	return(Out);
+}
+
+static bool
+ReadVarint(const uint8_t **In, const uint8_t *End, uint32_t *Value)
+{
+	uint32_t Result = 0;
+	for(uint32_t Shift = 0; (Shift < 32) && (*In < End); Shift += 7)
+	{
+		uint8_t Byte = *(*In)++;
+		Result |= (uint32_t)(Byte & 127) << Shift;
+		if(!(Byte & 128))
+		{
+			*Value = Result;
+			return(true);
+		}
+	}
+
+	return(false);
+}
+
+// NOTE(georgy): Scales the counts to RANS_PROB_SCALE keeping every used symbol at least 1. The rounding error goes to the
+//				 most frequent symbol, which is the one that can take it with the least cost
+static void
+NormalizeSymbolFrequencies(const uint32_t *Counts, uint32_t Total, uint32_t *Frequencies)
+{
+	uint32_t Sum = 0;
+	uint32_t MostFrequent = 0;
+	for(uint32_t Symbol = 0; Symbol < DELTA_SYMBOL_COUNT; Symbol++)
+	{
+		Frequencies[Symbol] = 0;
+		if(Counts[Symbol])
+		{
+			uint32_t Frequency = (uint32_t)(((uint64_t)Counts[Symbol]*RANS_PROB_SCALE) / Total);
+			Frequencies[Symbol] = (Frequency > 0) ? Frequency : 1;
+			Sum += Frequencies[Symbol];
+		}
+		if(Counts[Symbol] > Counts[MostFrequent])
+		{
+			MostFrequent = Symbol;
+		}
+	}
+
+	Assert((int32_t)Frequencies[MostFrequent] + (RANS_PROB_SCALE - (int32_t)Sum) > 0);
+	Frequencies[MostFrequent] += RANS_PROB_SCALE - Sum;
+}
+
+//
+// NOTE(georgy): Tiles
+//
+
+// NOTE(georgy): A plane through the left, upper and upper left deltas, the left or upper one on the edges of the tile
+inline int32_t
+PredictDelta(const int32_t *Steps, uint32_t X, uint32_t Z, uint32_t Width)
+{
+	int32_t Result = 0;
+	if((X > 0) && (Z > 0)) Result = Steps[-1] + Steps[-(int32_t)Width] - Steps[-(int32_t)Width - 1];
+	else if(X > 0) Result = Steps[-1];
+	else if(Z > 0) Result = Steps[-(int32_t)Width];
+
+	return(Result);
+}
+
+inline uint64_t
+ErosionDeltaTileBound(uint32_t SampleCount)
+{
+	// NOTE(georgy): Frequencies, rANS size, at most two rANS bytes and 30 extra bits per sample, rANS state
+	uint64_t Result = 5*DELTA_SYMBOL_COUNT + 4 + (uint64_t)SampleCount*6 + 8;
+
+	return(Result);
+}
+
+// NOTE(georgy): Values are zigzagged prediction residuals. Returns the size written to Dest
+static uint64_t
+EncodeDeltaTile(const uint32_t *Values, uint32_t SampleCount, uint8_t *Dest, uint8_t *Scratch)
+{
+	uint32_t Counts[DELTA_SYMBOL_COUNT] = {};
+	for(uint32_t SampleIndex = 0; SampleIndex < SampleCount; SampleIndex++)
+	{
+		uint32_t ExtraBitCount;
+		Counts[DeltaSymbol(Values[SampleIndex], &ExtraBitCount)]++;
+	}
+
+	uint32_t Frequencies[DELTA_SYMBOL_COUNT];
+	uint32_t Starts[DELTA_SYMBOL_COUNT];
+	NormalizeSymbolFrequencies(Counts, SampleCount, Frequencies);
+	uint8_t *Out = Dest;
+	uint32_t Start = 0;
+	for(uint32_t Symbol = 0; Symbol < DELTA_SYMBOL_COUNT; Symbol++)
+	{
+		Out = WriteVarint(Out, Frequencies[Symbol]);
+		Starts[Symbol] = Start;
+		Start += Frequencies[Symbol];
+	}
+
+	// NOTE(georgy): rANS decodes in the opposite order it encodes, so the stream is built backwards from the end of Scratch
+	uint64_t ScratchSize = (uint64_t)SampleCount*2 + 8;
+	uint8_t *StreamEnd = Scratch + ScratchSize;
+	uint8_t *Stream = StreamEnd;
+	uint32_t State = RANS_L;
+	for(uint32_t SampleIndex = SampleCount; SampleIndex > 0; SampleIndex--)
+	{
+		uint32_t ExtraBitCount;
+		uint32_t Symbol = DeltaSymbol(Values[SampleIndex - 1], &ExtraBitCount);
+		uint32_t Frequency = Frequencies[Symbol];
+		uint32_t StateMax = ((RANS_L >> RANS_PROB_BITS) << 8)*Frequency;
+		while(State >= StateMax)
+		{
+			*--Stream = (uint8_t)State;
+			State >>= 8;
+		}
+		State = ((State / Frequency) << RANS_PROB_BITS) + (State % Frequency) + Starts[Symbol];
+	}
+	Stream -= 4;
+	memcpy(Stream, &State, 4);
+
+	uint32_t StreamSize = (uint32_t)(StreamEnd - Stream);
+	memcpy(Out, &StreamSize, 4);
+	memcpy(Out + 4, Stream, StreamSize);
+	Out += 4 + StreamSize;
+
+	delta_bit_writer Writer = { Out, 0, 0 };
+	for(uint32_t SampleIndex = 0; SampleIndex < SampleCount; SampleIndex++)
+	{
+		uint32_t ExtraBitCount;
+		DeltaSymbol(Values[SampleIndex], &ExtraBitCount);
+		if(ExtraBitCount)
+		{
+			WriteDeltaBits(&Writer, Values[SampleIndex] & ((1u << ExtraBitCount) - 1), ExtraBitCount);
+		}
+	}
+	WriteDeltaBits(&Writer, 0, 7);
+
+	uint64_t Result = (uint64_t)(Writer.At - Dest);
+	return(Result);
+}
+
+static bool
+DecodeDeltaTile(const uint8_t *Data, uint64_t Size, uint32_t *Values, uint32_t SampleCount)
+{
+	const uint8_t *In = Data;
+	const uint8_t *End = Data + Size;
+
+	uint32_t Frequencies[DELTA_SYMBOL_COUNT];
+	uint32_t Starts[DELTA_SYMBOL_COUNT];
+	uint8_t SlotSymbols[RANS_PROB_SCALE];
+	uint32_t Start = 0;
+	for(uint32_t Symbol = 0; Symbol < DELTA_SYMBOL_COUNT; Symbol++)
+	{
+		if(!ReadVarint(&In, End, &Frequencies[Symbol]) || (Frequencies[Symbol] > RANS_PROB_SCALE - Start))
+		{
+			return(false);
+		}
+		Starts[Symbol] = Start;
+		memset(SlotSymbols + Start, (int)Symbol, Frequencies[Symbol]);
+		Start += Frequencies[Symbol];
+	}
+
+	uint32_t StreamSize;
+	if((Start != RANS_PROB_SCALE) || ((End - In) < 4))
+	{
+		return(false);
+	}
+	memcpy(&StreamSize, In, 4);
+	In += 4;
+	if((StreamSize < 4) || ((uint64_t)(End - In) < StreamSize))
+	{
+		return(false);
+	}
+
+	const uint8_t *Stream = In + 4;
+	const uint8_t *StreamEnd = In + StreamSize;
+	uint32_t State;
+	memcpy(&State, In, 4);
+	delta_bit_reader Reader = { StreamEnd, End, 0, 0, false };
+	for(uint32_t SampleIndex = 0; SampleIndex < SampleCount; SampleIndex++)
+	{
+		uint32_t Slot = State & (RANS_PROB_SCALE - 1);
+		uint32_t Symbol = SlotSymbols[Slot];
+		State = Frequencies[Symbol]*(State >> RANS_PROB_BITS) + Slot - Starts[Symbol];
+		while((State < RANS_L) && (Stream < StreamEnd))
+		{
+			State = (State << 8) | *Stream++;
+		}
+
+		uint32_t Value = Symbol;
+		if(Symbol >= DELTA_DIRECT_SYMBOLS)
+		{
+			uint32_t BitIndex = (Symbol - DELTA_DIRECT_SYMBOLS)/2 + 4;
+			uint32_t Top = 2 | ((Symbol - DELTA_DIRECT_SYMBOLS) & 1);
+			Value = (Top << (BitIndex - 1)) | ReadDeltaBits(&Reader, BitIndex - 1);
+		}
+		Values[SampleIndex] = Value;
+	}
+
+	// NOTE(georgy): The encoder started from RANS_L, so a stream that was read exactly ends there
+	bool Result = (State == RANS_L) && (Stream == StreamEnd) && !Reader.Overrun;
+	return(Result);
+}
+
+//
+// NOTE(georgy): Files
+//
+
+// NOTE(georgy): HeightMap is the eroded version of the grid FillHeightMapNoise makes from Noise at (OriginX, OriginZ)
+static bool
+WriteErosionDeltaFile(job_system *Jobs, const char *Filename, const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight,
+					  int64_t OriginX, int64_t OriginZ, const noise_params *Noise, const erosion_params *Erosion, float Step)
+{
+	uint32_t SampleCount = (GridWidth + 1)*(GridHeight + 1);
+	uint32_t TileSize = EROSION_DELTA_TILE_SIZE;
+	uint32_t TilesX = TerrainTileCount(GridWidth + 1, TileSize);
+	uint32_t TilesZ = TerrainTileCount(GridHeight + 1, TileSize);
+	uint32_t TileCount = TilesX*TilesZ;
+
+	float *Base = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	terrain_compressed_tile *CompressedTiles = (terrain_compressed_tile *)AllocateZeroedMemory(MemoryCategory_Scratch, TileCount*sizeof(terrain_compressed_tile));
+	if(!Base || !CompressedTiles)
+	{
+		FreeMemory(CompressedTiles);
+		FreeMemory(Base);
+		return(false);
+	}
+	FillHeightMapNoise(Jobs, Base, GridWidth, GridHeight, OriginX, OriginZ, Noise);
+
+	// NOTE(georgy): The predictor adds and subtracts three neighbouring steps, so the steps must stay within
+	//				 a quarter of the int32 range for the residuals not to overflow
+	float MaxDelta = 0.0f;
+	for(uint32_t Index = 0; Index < SampleCount; Index++)
+	{
+		MaxDelta = Max(MaxDelta, Absolute(HeightMap[Index] - Base[Index]));
+	}
+	float InvStep = 1.0f / Step;
+	if(!(MaxDelta*InvStep < (float)(INT32_MAX / 4)))
+	{
+		printf("Step %g is too small for the erosion deltas of up to %g in %s\n", Step, MaxDelta, Filename);
+		FreeMemory(CompressedTiles);
+		FreeMemory(Base);
+		return(false);
+	}
+	std::atomic<uint32_t> FailedTileCount(0);
+	ParallelFor(Jobs, "EncodeDeltaTiles", TileCount, 1, [&](uint32_t Begin, uint32_t End)
+	{
+		for(uint32_t TileIndex = Begin; TileIndex < End; TileIndex++)
+		{
+			terrain_tile_rect Rect = GetTerrainTileRect(GridWidth, GridHeight, TileSize, TileIndex % TilesX, TileIndex / TilesX);
+			uint32_t TileSampleCount = Rect.Width*Rect.Height;
+			int32_t *Quantized = (int32_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(int32_t)*TileSampleCount);
+			uint32_t *Values = (uint32_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(uint32_t)*TileSampleCount);
+			uint8_t *Scratch = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, (uint64_t)TileSampleCount*2 + 8);
+			uint8_t *Encoded = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, ErosionDeltaTileBound(TileSampleCount));
+			if(Quantized && Values && Scratch && Encoded)
+			{
+				for(uint32_t Z = 0; Z < Rect.Height; Z++)
+				{
+					for(uint32_t X = 0; X < Rect.Width; X++)
+					{
+						uint32_t Index = (Rect.X + X) + (Rect.Z + Z)*(GridWidth + 1);
+						Quantized[X + Z*Rect.Width] = FloorReal32ToInt32((HeightMap[Index] - Base[Index])*InvStep + 0.5f);
+					}
+				}
+				for(uint32_t Z = 0; Z < Rect.Height; Z++)
+				{
+					for(uint32_t X = 0; X < Rect.Width; X++)
+					{
+						const int32_t *Steps = Quantized + X + Z*Rect.Width;
+						Values[X + Z*Rect.Width] = ZigZag(*Steps - PredictDelta(Steps, X, Z, Rect.Width));
+					}
+				}
+
+				terrain_compressed_tile *Tile = CompressedTiles + TileIndex;
+				Tile->Hash = HashBytes(Quantized, sizeof(int32_t)*TileSampleCount);
+				Tile->Size = EncodeDeltaTile(Values, TileSampleCount, Encoded, Scratch);
+				Tile->Data = Encoded;
+			}
+			else
+			{
+				FreeMemory(Encoded);
+				FailedTileCount.fetch_add(1);
+			}
+			FreeMemory(Scratch);
+			FreeMemory(Values);
+			FreeMemory(Quantized);
+		}
+	});
+
+	bool Result = (FailedTileCount == 0);
+	if(Result)
+	{
+		erosion_delta_header Header = {};
+		Header.Magic = EROSION_DELTA_MAGIC;
+		Header.Version = EROSION_DELTA_VERSION;
+		Header.GridWidth = GridWidth;
+		Header.GridHeight = GridHeight;
+		Header.OriginX = OriginX;
+		Header.OriginZ = OriginZ;
+		Header.TileSize = TileSize;
+		Header.Step = Step;
+		Header.Noise = *Noise;
+		Header.Erosion = *Erosion;
+
+		erosion_delta_tile *FileTiles = (erosion_delta_tile *)AllocateZeroedMemory(MemoryCategory_Scratch, TileCount*sizeof(erosion_delta_tile));
+		uint64_t Offset = sizeof(Header) + sizeof(erosion_delta_tile)*TileCount;
+		for(uint32_t TileIndex = 0; FileTiles && (TileIndex < TileCount); TileIndex++)
+		{
+			FileTiles[TileIndex].Offset = Offset;
+			FileTiles[TileIndex].Hash = CompressedTiles[TileIndex].Hash;
+			FileTiles[TileIndex].Size = (uint32_t)CompressedTiles[TileIndex].Size;
+			Offset += CompressedTiles[TileIndex].Size;
+		}
+
+		char TempFilename[1024];
+		snprintf(TempFilename, sizeof(TempFilename), "%s.tmp", Filename);
+		FILE *File = FileTiles ? fopen(TempFilename, "wb") : 0;
+		Result = (File != 0);
+		if(File)
+		{
+			Result = (fwrite(&Header, sizeof(Header), 1, File) == 1);
+			Result = Result && (fwrite(FileTiles, sizeof(erosion_delta_tile), TileCount, File) == TileCount);
+			for(uint32_t TileIndex = 0; Result && (TileIndex < TileCount); TileIndex++)
+			{
+				Result = (fwrite(CompressedTiles[TileIndex].Data, 1, CompressedTiles[TileIndex].Size, File) == CompressedTiles[TileIndex].Size);
+			}
+			Result = (fclose(File) == 0) && Result;
+		}
+		Result = Result && ReplaceFile(TempFilename, Filename);
+
+		FreeMemory(FileTiles);
+	}
+
+	for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
+	{
+		FreeMemory(CompressedTiles[TileIndex].Data);
+	}
+	FreeMemory(CompressedTiles);
+	FreeMemory(Base);
+
+	return(Result);
+}
+
+struct erosion_delta_file
+{
+	mapped_file File;
+
+	const erosion_delta_header *Header;
+	const erosion_delta_tile *Tiles;
+	uint32_t TilesX, TilesZ;
+};
+
+static void
+CloseErosionDeltaFile(erosion_delta_file *File)
+{
+	UnmapFile(&File->File);
+}
+
+static bool
+OpenErosionDeltaFile(erosion_delta_file *Result, const char *Filename)
+{
+	if(!MapFileReadOnly(&Result->File, Filename))
+	{
+		printf("Can't open %s\n", Filename);
+		return(false);
+	}
+
+	const uint8_t *Memory = (const uint8_t *)Result->File.Memory;
+	uint64_t Size = Result->File.Size;
+	bool Valid = (Size >= sizeof(erosion_delta_header));
+	if(Valid)
+	{
+		Result->Header = (const erosion_delta_header *)Memory;
+		Valid = (Result->Header->Magic == EROSION_DELTA_MAGIC) && (Result->Header->Version == EROSION_DELTA_VERSION) &&
+				(Result->Header->TileSize > 0) && (Result->Header->Step > 0.0f) && (Result->Header->Noise.OctaveCount <= MAX_NOISE_OCTAVES);
+	}
+	if(Valid)
+	{
+		Result->TilesX = TerrainTileCount(Result->Header->GridWidth + 1, Result->Header->TileSize);
+		Result->TilesZ = TerrainTileCount(Result->Header->GridHeight + 1, Result->Header->TileSize);
+		uint64_t TileCount = (uint64_t)Result->TilesX*Result->TilesZ;
+		Valid = (sizeof(erosion_delta_header) + sizeof(erosion_delta_tile)*TileCount <= Size);
+		if(Valid)
+		{
+			Result->Tiles = (const erosion_delta_tile *)(Memory + sizeof(erosion_delta_header));
+			for(uint64_t TileIndex = 0; Valid && (TileIndex < TileCount); TileIndex++)
+			{
+				Valid = (Result->Tiles[TileIndex].Offset <= Size) && (Result->Tiles[TileIndex].Size <= Size - Result->Tiles[TileIndex].Offset);
+			}
+		}
+	}
+
+	if(!Valid)
+	{
+		printf("%s is not a valid erosion delta file\n", Filename);
+		CloseErosionDeltaFile(Result);
+	}
+
+	return(Valid);
+}
+
+// NOTE(georgy): Regenerates the noise base into HeightMap, (GridWidth + 1)*(GridHeight + 1) samples, and adds the deltas tile by tile
+static bool
+ReadErosionDeltaFile(job_system *Jobs, erosion_delta_file *File, float *HeightMap)
+{
+	const erosion_delta_header *Header = File->Header;
+	uint32_t GridWidth = Header->GridWidth;
+	noise_params Noise = Header->Noise;
+	FillHeightMapNoise(Jobs, HeightMap, GridWidth, Header->GridHeight, Header->OriginX, Header->OriginZ, &Noise);
+
+	uint32_t TileCount = File->TilesX*File->TilesZ;
+	std::atomic<uint32_t> FailedTileCount(0);
+	ParallelFor(Jobs, "DecodeDeltaTiles", TileCount, 1, [&](uint32_t Begin, uint32_t End)
+	{
+		for(uint32_t TileIndex = Begin; TileIndex < End; TileIndex++)
+		{
+			terrain_tile_rect Rect = GetTerrainTileRect(GridWidth, Header->GridHeight, Header->TileSize, TileIndex % File->TilesX, TileIndex / File->TilesX);
+			uint32_t TileSampleCount = Rect.Width*Rect.Height;
+			const erosion_delta_tile *Tile = File->Tiles + TileIndex;
+			const uint8_t *Data = (const uint8_t *)File->File.Memory + Tile->Offset;
+
+			uint32_t *Values = (uint32_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(uint32_t)*TileSampleCount);
+			bool TileValid = Values && DecodeDeltaTile(Data, Tile->Size, Values, TileSampleCount);
+			if(TileValid)
+			{
+				// NOTE(georgy): Residuals become deltas in place, in the order the predictor needs
+				int32_t *Steps = (int32_t *)Values;
+				for(uint32_t Z = 0; Z < Rect.Height; Z++)
+				{
+					for(uint32_t X = 0; X < Rect.Width; X++)
+					{
+						int32_t *Delta = Steps + X + Z*Rect.Width;
+						*Delta = UnZigZag((uint32_t)*Delta) + PredictDelta(Delta, X, Z, Rect.Width);
+					}
+				}
+				TileValid = (HashBytes(Values, sizeof(uint32_t)*TileSampleCount) == Tile->Hash);
+			}
+			if(TileValid)
+			{
+				for(uint32_t Z = 0; Z < Rect.Height; Z++)
+				{
+					float *Row = HeightMap + (Rect.X + (uint64_t)(Rect.Z + Z)*(GridWidth + 1));
+					const int32_t *Steps = (const int32_t *)Values + Z*Rect.Width;
+					for(uint32_t X = 0; X < Rect.Width; X++)
+					{
+						Row[X] += Header->Step*(float)Steps[X];
+					}
+				}
+			}
+			else
+			{
+				printf("Erosion delta tile %u is corrupt\n", TileIndex);
+				FailedTileCount.fetch_add(1);
+			}
+			FreeMemory(Values);
+		}
+	});
+
+	bool Result = (FailedTileCount == 0);
+	return(Result);
+}
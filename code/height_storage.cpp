@@ -0,0 +1,377 @@
+#pragma once
+
+// NOTE(georgy): Height storage for erosion. Plain float arrays, float arrays that track dirty tiles or keep output layers,
+//				 or 16-bit unorm samples (Height = Offset + Scale*Sample) that take half the memory and bandwidth. Quantized
+//				 heights are widened to float on load, and all the droplet state (sediment, speed, water) stays float. Stores round
+//				 stochastically, so changes smaller than one step (most erosion and deposition amounts) still land on average
+//				 instead of being dropped
+
+// NOTE(georgy): Largest brush the scalar ErodeBrush overloads cache the weights of on the stack, larger ones compute every weight twice
+#define MAX_CACHED_BRUSH_RADIUS 16
+
+struct quantized_heights
+{
+	uint16_t *Samples;
+	float Offset;
+	float Scale;
+	float InvScale;
+
+	// NOTE(georgy): Stores that went past the top of the range and were clamped to 65535
+	uint32_t SaturatedCount;
+
+	random_series Dither;
+};
+
+inline float
+LoadHeight(float *HeightMap, uint32_t Index)
+{
+	float Result = HeightMap[Index];
+
+	return(Result);
+}
+
+inline void
+AddHeight(float *HeightMap, uint32_t Index, float Delta)
+{
+	HeightMap[Index] += Delta;
+}
+
+inline float
+LoadHeight(quantized_heights *Heights, uint32_t Index)
+{
+	float Result = Heights->Offset + Heights->Scale*(float)Heights->Samples[Index];
+
+	return(Result);
+}
+
+// NOTE(georgy): floor(x + u) with uniform u in [0, 1) rounds up with probability frac(x), so the expected result is x
+inline int32_t
+DitheredSteps(quantized_heights *Heights, float Steps)
+{
+	int32_t Result = FloorReal32ToInt32(Steps + RandomUnilateral(&Heights->Dither));
+
+	return(Result);
+}
+
+inline uint16_t
+ClampSample(int32_t Value)
+{
+	uint16_t Result = (uint16_t)((Value < 0) ? 0 : ((Value > 65535) ? 65535 : Value));
+
+	return(Result);
+}
+
+// NOTE(georgy): The delta is rounded on its own and added as an integer, so a sample that doesn't change is stored exactly
+inline void
+AddHeight(quantized_heights *Heights, uint32_t Index, float Delta)
+{
+	int32_t Value = (int32_t)Heights->Samples[Index] + DitheredSteps(Heights, Delta*Heights->InvScale);
+	Heights->Samples[Index] = ClampSample(Value);
+	Heights->SaturatedCount += (Value > 65535) ? 1 : 0;
+}
+
+inline float
+ErodeBrush(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, uint32_t XIndex, uint32_t ZIndex, vec2 P, int32_t Radius, float TakeAmount)
+{
+	float Result = TerrainKernels.ErodeBrush(HeightMap, GridWidth, GridHeight, XIndex, ZIndex, P, Radius, TakeAmount);
+
+	return(Result);
+}
+
+// NOTE(georgy): Fills Weights with the brush weight of every sample of Rect in row order and returns their sum.
+//				 Weights is null for brushes larger than MAX_CACHED_BRUSH_RADIUS, then only the sum is computed
+static float
+CacheBrushWeights(brush_rect Rect, vec2 P, int32_t Radius, float *Weights)
+{
+	uint32_t RectWidth = (uint32_t)(Rect.XMax - Rect.XMin + 1);
+	uint32_t RectHeight = (uint32_t)(Rect.ZMax - Rect.ZMin + 1);
+
+	float Result = 0.0f;
+	for(uint32_t Z = 0; Z < RectHeight; Z++)
+	{
+		float DZ = (float)(Rect.ZMin + (int32_t)Z) - P.y;
+		for(uint32_t X = 0; X < RectWidth; X++)
+		{
+			float Weight = BrushWeight(Rect.XMin + (int32_t)X, DZ*DZ, P, Radius);
+			if(Weights)
+			{
+				Weights[X + Z*RectWidth] = Weight;
+			}
+			Result += Weight;
+		}
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Weight of sample (X, Z) of Rect, from Weights if CacheBrushWeights filled them
+inline float
+CachedBrushWeight(const float *Weights, brush_rect Rect, uint32_t X, uint32_t Z, vec2 P, int32_t Radius)
+{
+	float Result;
+	if(Weights)
+	{
+		Result = Weights[X + Z*(uint32_t)(Rect.XMax - Rect.XMin + 1)];
+	}
+	else
+	{
+		float DZ = (float)(Rect.ZMin + (int32_t)Z) - P.y;
+		Result = BrushWeight(Rect.XMin + (int32_t)X, DZ*DZ, P, Radius);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Same as ErodeBrushScalar, the brush weights are float and only the stores are quantized
+static float
+ErodeBrush(quantized_heights *Heights, uint32_t GridWidth, uint32_t GridHeight, uint32_t XIndex, uint32_t ZIndex, vec2 P, int32_t Radius, float TakeAmount)
+{
+	float Taken = 0.0f;
+
+	brush_rect Rect = ClampBrush(GridWidth, GridHeight, XIndex, ZIndex, Radius);
+	uint32_t RectWidth = (uint32_t)(Rect.XMax - Rect.XMin + 1);
+	uint32_t RectHeight = (uint32_t)(Rect.ZMax - Rect.ZMin + 1);
+
+	float WeightCache[(2*MAX_CACHED_BRUSH_RADIUS + 1)*(2*MAX_CACHED_BRUSH_RADIUS + 1)];
+	float *Weights = (Radius <= MAX_CACHED_BRUSH_RADIUS) ? WeightCache : 0;
+	float WeightSum = CacheBrushWeights(Rect, P, Radius, Weights);
+
+	float TakePerWeight = TakeAmount / WeightSum;
+	for(uint32_t Z = 0; Z < RectHeight; Z++)
+	{
+		uint32_t RowIndex = Rect.XMin + (Rect.ZMin + Z)*(GridWidth + 1);
+		for(uint32_t X = 0; X < RectWidth; X++)
+		{
+			float Weight = CachedBrushWeight(Weights, Rect, X, Z, P, Radius);
+			if(Weight > 0.0f)
+			{
+				float Height = LoadHeight(Heights, RowIndex + X);
+				float AmountToErode = Weight*TakePerWeight;
+				float DeltaSediment = (Height < AmountToErode) ? Height : AmountToErode;
+				AddHeight(Heights, RowIndex + X, -DeltaSediment);
+				Taken += DeltaSediment;
+			}
+		}
+	}
+
+	return(Taken);
+}
+
+// NOTE(georgy): Float heights that remember which DIRTY_TILE_SIZE x DIRTY_TILE_SIZE sample tiles were written,
+//				 so a checkpoint only has to save those
+#define DIRTY_TILE_SHIFT 6
+#define DIRTY_TILE_SIZE (1 << DIRTY_TILE_SHIFT)
+
+struct dirty_tracked_heights
+{
+	float *HeightMap;
+	uint32_t GridWidth;
+	uint32_t TilesX;
+	uint8_t *DirtyTiles;
+};
+
+inline float
+LoadHeight(dirty_tracked_heights *Heights, uint32_t Index)
+{
+	float Result = Heights->HeightMap[Index];
+
+	return(Result);
+}
+
+inline void
+AddHeight(dirty_tracked_heights *Heights, uint32_t Index, float Delta)
+{
+	Heights->HeightMap[Index] += Delta;
+
+	uint32_t X = Index % (Heights->GridWidth + 1);
+	uint32_t Z = Index / (Heights->GridWidth + 1);
+	Heights->DirtyTiles[(X >> DIRTY_TILE_SHIFT) + (Z >> DIRTY_TILE_SHIFT)*Heights->TilesX] = 1;
+}
+
+inline float
+ErodeBrush(dirty_tracked_heights *Heights, uint32_t GridWidth, uint32_t GridHeight, uint32_t XIndex, uint32_t ZIndex, vec2 P, int32_t Radius, float TakeAmount)
+{
+	float Result = TerrainKernels.ErodeBrush(Heights->HeightMap, GridWidth, GridHeight, XIndex, ZIndex, P, Radius, TakeAmount);
+
+	brush_rect Rect = ClampBrush(GridWidth, GridHeight, XIndex, ZIndex, Radius);
+	for(int32_t TileZ = (Rect.ZMin >> DIRTY_TILE_SHIFT); TileZ <= (Rect.ZMax >> DIRTY_TILE_SHIFT); TileZ++)
+	{
+		for(int32_t TileX = (Rect.XMin >> DIRTY_TILE_SHIFT); TileX <= (Rect.XMax >> DIRTY_TILE_SHIFT); TileX++)
+		{
+			Heights->DirtyTiles[TileX + TileZ*Heights->TilesX] = 1;
+		}
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Float heights where every change is scaled by a per-sample weight, FalloffX[X]*FalloffZ[Z].
+//				 Used for local erosion to fade its effect out towards the edge of the edited area.
+//				 Touched grows to cover every sample that was changed
+struct falloff_heights
+{
+	float *HeightMap;
+	uint32_t GridWidth;
+	const float *FalloffX;
+	const float *FalloffZ;
+
+	brush_rect Touched;
+};
+
+inline float
+LoadHeight(falloff_heights *Heights, uint32_t Index)
+{
+	float Result = Heights->HeightMap[Index];
+
+	return(Result);
+}
+
+inline void
+TouchSample(falloff_heights *Heights, int32_t X, int32_t Z)
+{
+	if(X < Heights->Touched.XMin) Heights->Touched.XMin = X;
+	if(X > Heights->Touched.XMax) Heights->Touched.XMax = X;
+	if(Z < Heights->Touched.ZMin) Heights->Touched.ZMin = Z;
+	if(Z > Heights->Touched.ZMax) Heights->Touched.ZMax = Z;
+}
+
+inline void
+AddHeight(falloff_heights *Heights, uint32_t Index, float Delta)
+{
+	uint32_t X = Index % (Heights->GridWidth + 1);
+	uint32_t Z = Index / (Heights->GridWidth + 1);
+	float Weight = Heights->FalloffX[X]*Heights->FalloffZ[Z];
+	if(Weight > 0.0f)
+	{
+		Heights->HeightMap[Index] += Weight*Delta;
+		TouchSample(Heights, (int32_t)X, (int32_t)Z);
+	}
+}
+
+// NOTE(georgy): Same as ErodeBrushScalar with every sample's share scaled by its falloff, returns what was actually taken
+static float
+ErodeBrush(falloff_heights *Heights, uint32_t GridWidth, uint32_t GridHeight, uint32_t XIndex, uint32_t ZIndex, vec2 P, int32_t Radius, float TakeAmount)
+{
+	float Taken = 0.0f;
+
+	brush_rect Rect = ClampBrush(GridWidth, GridHeight, XIndex, ZIndex, Radius);
+	uint32_t RectWidth = (uint32_t)(Rect.XMax - Rect.XMin + 1);
+	uint32_t RectHeight = (uint32_t)(Rect.ZMax - Rect.ZMin + 1);
+
+	float WeightCache[(2*MAX_CACHED_BRUSH_RADIUS + 1)*(2*MAX_CACHED_BRUSH_RADIUS + 1)];
+	float *Weights = (Radius <= MAX_CACHED_BRUSH_RADIUS) ? WeightCache : 0;
+	float WeightSum = CacheBrushWeights(Rect, P, Radius, Weights);
+
+	float TakePerWeight = TakeAmount / WeightSum;
+	for(uint32_t Z = 0; Z < RectHeight; Z++)
+	{
+		float FalloffZ = Heights->FalloffZ[Rect.ZMin + Z];
+		float *Row = Heights->HeightMap + Rect.XMin + (Rect.ZMin + Z)*(GridWidth + 1);
+		for(uint32_t X = 0; X < RectWidth; X++)
+		{
+			float Weight = CachedBrushWeight(Weights, Rect, X, Z, P, Radius)*Heights->FalloffX[Rect.XMin + X]*FalloffZ;
+			if(Weight > 0.0f)
+			{
+				float AmountToErode = Weight*TakePerWeight;
+				float DeltaSediment = (Row[X] < AmountToErode) ? Row[X] : AmountToErode;
+				Row[X] -= DeltaSediment;
+				Taken += DeltaSediment;
+				TouchSample(Heights, Rect.XMin + (int32_t)X, Rect.ZMin + (int32_t)Z);
+			}
+		}
+	}
+
+	return(Taken);
+}
+
+// NOTE(georgy): Float heights that also keep what the droplets did to every sample: the water that passed over it (every step
+//				 adds the droplet's water, split bilinearly over the cell's corners) and the sediment deposited on it.
+//				 The layers belong to the droplet loop that writes them, nothing else touches them while it runs, so they're
+//				 plain adds. Erosion goes straight to the ErodeBrush kernels, what it took is worked out at the end from the
+//				 heights before and after (see WaterErosion with erosion_layers)
+struct layered_heights
+{
+	float *HeightMap;
+	float *Flow;
+	float *Deposit;
+};
+
+inline float
+LoadHeight(layered_heights *Heights, uint32_t Index)
+{
+	float Result = Heights->HeightMap[Index];
+
+	return(Result);
+}
+
+// NOTE(georgy): Everything the droplets add is deposition
+inline void
+AddHeight(layered_heights *Heights, uint32_t Index, float Delta)
+{
+	Heights->HeightMap[Index] += Delta;
+	Heights->Deposit[Index] += Delta;
+}
+
+inline float
+ErodeBrush(layered_heights *Heights, uint32_t GridWidth, uint32_t GridHeight, uint32_t XIndex, uint32_t ZIndex, vec2 P, int32_t Radius, float TakeAmount)
+{
+	float Result = TerrainKernels.ErodeBrush(Heights->HeightMap, GridWidth, GridHeight, XIndex, ZIndex, P, Radius, TakeAmount);
+
+	return(Result);
+}
+
+// NOTE(georgy): Called by the droplet loop every step, only layered_heights keeps the flow
+template<typename height_storage> inline void
+AddFlow(height_storage *, uint32_t, uint32_t, float, float, float)
+{
+}
+
+inline void
+AddFlow(layered_heights *Heights, uint32_t GridWidth, uint32_t Grid00Index, float U, float V, float Water)
+{
+	float *Flow = Heights->Flow + Grid00Index;
+	Flow[0] += Water*(1.0f - U)*(1.0f - V);
+	Flow[1] += Water*U*(1.0f - V);
+	Flow[GridWidth + 1] += Water*(1.0f - U)*V;
+	Flow[GridWidth + 2] += Water*U*V;
+}
+
+// NOTE(georgy): Picks Offset and Scale from the range of HeightMap, with some headroom for deposition.
+//				 Samples must have room for (GridWidth + 1)*(GridHeight + 1) elements
+static void
+QuantizeHeightMap(quantized_heights *Heights, uint16_t *Samples, const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, uint32_t Seed)
+{
+	uint32_t SampleCount = (GridWidth + 1)*(GridHeight + 1);
+	float MinHeight = HeightMap[0];
+	float MaxHeight = HeightMap[0];
+	for(uint32_t SampleIndex = 1; SampleIndex < SampleCount; SampleIndex++)
+	{
+		MinHeight = Min(MinHeight, HeightMap[SampleIndex]);
+		MaxHeight = Max(MaxHeight, HeightMap[SampleIndex]);
+	}
+	float Headroom = 0.0625f*(MaxHeight - MinHeight) + 0.001f;
+	MinHeight = Max(0.0f, MinHeight - Headroom);
+	MaxHeight += Headroom;
+
+	Heights->Samples = Samples;
+	Heights->Offset = MinHeight;
+	Heights->Scale = (MaxHeight - MinHeight) / 65535.0f;
+	Heights->InvScale = 1.0f / Heights->Scale;
+	Heights->SaturatedCount = 0;
+	Heights->Dither = RandomSeed(Seed);
+
+	for(uint32_t SampleIndex = 0; SampleIndex < SampleCount; SampleIndex++)
+	{
+		Samples[SampleIndex] = ClampSample(FloorReal32ToInt32((HeightMap[SampleIndex] - MinHeight)*Heights->InvScale + 0.5f));
+	}
+}
+
+static void
+DequantizeHeightMap(float *HeightMap, quantized_heights *Heights, uint32_t GridWidth, uint32_t GridHeight)
+{
+	uint32_t SampleCount = (GridWidth + 1)*(GridHeight + 1);
+	for(uint32_t SampleIndex = 0; SampleIndex < SampleCount; SampleIndex++)
+	{
+		HeightMap[SampleIndex] = LoadHeight(Heights, SampleIndex);
+	}
+}
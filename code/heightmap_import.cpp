@@ -0,0 +1,918 @@
+#pragma once
+
+#include "job_system.cpp"
+#include "memory.cpp"
+#include "platform.cpp"
+
+// NOTE(georgy): Heightmap import. Files are mapped, never read into a buffer:
+//				 RAW float (.r32, .f32)  - used in place through a copy-on-write mapping, so erosion copies only the pages it writes
+//				 RAW uint16 (.r16, .raw) - converted in parallel from the mapping straight into the heightmap
+//				 PGM (P5, 8 or 16 bit)   - same
+//				 PNG (8 or 16 bit)       - inflated as a stream, every scanline is unfiltered and converted as soon as it's complete
+//				 RAW files carry no size, so they must be square. Integer samples are scaled to [0, MaxHeight].
+//				 An image of W x H samples becomes a grid of (W - 1) x (H - 1) cells
+
+enum heightmap_format
+{
+	HeightmapFormat_Unknown,
+	HeightmapFormat_RawFloat,
+	HeightmapFormat_RawU16,
+	HeightmapFormat_PGM,
+	HeightmapFormat_PNG,
+};
+
+struct imported_heightmap
+{
+	float *HeightMap;
+	uint32_t GridWidth;
+	uint32_t GridHeight;
+
+	// NOTE(georgy): HeightMap points into the copy-on-write mapping of the file when this is set
+	bool UsesMapping;
+	mapped_file Mapping;
+};
+
+static void
+FreeImportedHeightMap(imported_heightmap *Imported)
+{
+	if(Imported->UsesMapping)
+	{
+		UnmapFile(&Imported->Mapping);
+	}
+	else
+	{
+		FreeMemory(Imported->HeightMap);
+	}
+	Imported->HeightMap = 0;
+}
+
+static bool
+HasExtension(const char *Filename, const char *Extension)
+{
+	size_t FilenameLength = strlen(Filename);
+	size_t ExtensionLength = strlen(Extension);
+	bool Result = (FilenameLength >= ExtensionLength) && (strcmp(Filename + FilenameLength - ExtensionLength, Extension) == 0);
+
+	return(Result);
+}
+
+static heightmap_format
+DetectHeightmapFormat(const char *Filename, const uint8_t *Data, uint64_t Size)
+{
+	const uint8_t PNGSignature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+	heightmap_format Result = HeightmapFormat_Unknown;
+	if((Size >= sizeof(PNGSignature)) && (memcmp(Data, PNGSignature, sizeof(PNGSignature)) == 0))
+	{
+		Result = HeightmapFormat_PNG;
+	}
+	else if((Size >= 2) && (Data[0] == 'P') && (Data[1] == '5'))
+	{
+		Result = HeightmapFormat_PGM;
+	}
+	else if(HasExtension(Filename, ".r32") || HasExtension(Filename, ".f32"))
+	{
+		Result = HeightmapFormat_RawFloat;
+	}
+	else if(HasExtension(Filename, ".r16") || HasExtension(Filename, ".raw"))
+	{
+		Result = HeightmapFormat_RawU16;
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Square side for a RAW file of SampleCount samples, 0 if it isn't square
+static uint32_t
+SquareSide(uint64_t SampleCount)
+{
+	uint32_t Side = (uint32_t)(sqrt((double)SampleCount) + 0.5);
+	uint32_t Result = ((uint64_t)Side*Side == SampleCount) ? Side : 0;
+
+	return(Result);
+}
+
+// NOTE(georgy): Integer samples, 1 or 2 bytes, Stride bytes from one to the next
+static void
+ConvertSamplesToHeights(job_system *Jobs, const uint8_t *Samples, uint32_t Width, uint32_t Height, uint32_t BytesPerSample,
+						uint32_t Stride, bool BigEndian, float Scale, float *HeightMap)
+{
+	ParallelFor(Jobs, "ImportRows", Height, GrainForCount(Jobs, Height), [=](uint32_t Begin, uint32_t End)
+	{
+		for(uint32_t Z = Begin; Z < End; Z++)
+		{
+			const uint8_t *Row = Samples + (uint64_t)Z*Width*Stride;
+			float *Dest = HeightMap + (uint64_t)Z*Width;
+			if(BytesPerSample == 1)
+			{
+				for(uint32_t X = 0; X < Width; X++)
+				{
+					Dest[X] = Scale*(float)Row[X*Stride];
+				}
+			}
+			else if(BigEndian)
+			{
+				for(uint32_t X = 0; X < Width; X++)
+				{
+					Dest[X] = Scale*(float)((Row[X*Stride] << 8) | Row[X*Stride + 1]);
+				}
+			}
+			else
+			{
+				for(uint32_t X = 0; X < Width; X++)
+				{
+					Dest[X] = Scale*(float)(Row[X*Stride] | (Row[X*Stride + 1] << 8));
+				}
+			}
+		}
+	});
+}
+
+//
+// NOTE(georgy): PGM
+//
+
+// NOTE(georgy): Next whitespace separated number of the header, skipping # comments
+static bool
+ParsePGMNumber(const uint8_t **At, const uint8_t *End, uint32_t *Value)
+{
+	const uint8_t *P = *At;
+	for(;;)
+	{
+		while((P < End) && ((*P == ' ') || (*P == '\t') || (*P == '\r') || (*P == '\n'))) P++;
+		if((P < End) && (*P == '#'))
+		{
+			while((P < End) && (*P != '\n')) P++;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	bool Result = (P < End) && (*P >= '0') && (*P <= '9');
+	uint64_t Number = 0;
+	while((P < End) && (*P >= '0') && (*P <= '9') && (Number <= 0xFFFFFFFF))
+	{
+		Number = 10*Number + (*P++ - '0');
+	}
+	Result = Result && (Number <= 0xFFFFFFFF);
+
+	*Value = (uint32_t)Number;
+	*At = P;
+	return(Result);
+}
+
+static bool
+ImportPGM(job_system *Jobs, const uint8_t *Data, uint64_t Size, float MaxHeight, imported_heightmap *Result)
+{
+	const uint8_t *At = Data + 2;
+	const uint8_t *End = Data + Size;
+	uint32_t Width, Height, MaxValue;
+	if(!ParsePGMNumber(&At, End, &Width) || !ParsePGMNumber(&At, End, &Height) || !ParsePGMNumber(&At, End, &MaxValue) ||
+	   (At >= End) || (Width < 2) || (Height < 2) || (MaxValue == 0) || (MaxValue > 65535))
+	{
+		printf("Bad PGM header\n");
+		return(false);
+	}
+	// NOTE(georgy): Exactly one whitespace byte before the samples
+	At++;
+
+	uint32_t BytesPerSample = (MaxValue < 256) ? 1 : 2;
+	if((uint64_t)(End - At) < (uint64_t)Width*Height*BytesPerSample)
+	{
+		printf("PGM is shorter than %ux%u samples\n", Width, Height);
+		return(false);
+	}
+
+	Result->HeightMap = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*Width*Height);
+	if(!Result->HeightMap)
+	{
+		return(false);
+	}
+	Result->GridWidth = Width - 1;
+	Result->GridHeight = Height - 1;
+	ConvertSamplesToHeights(Jobs, At, Width, Height, BytesPerSample, BytesPerSample, true, MaxHeight / (float)MaxValue, Result->HeightMap);
+
+	return(true);
+}
+
+//
+// NOTE(georgy): Inflate
+//
+
+#define INFLATE_WINDOW_SIZE 32768
+#define INFLATE_FAST_BITS 9
+
+struct inflate_huffman
+{
+	// NOTE(georgy): (Symbol << 4) | Length for codes up to INFLATE_FAST_BITS long, zero sends the decoder to the slow path
+	uint16_t Fast[1 << INFLATE_FAST_BITS];
+	uint16_t Counts[16];
+	uint16_t Symbols[288];
+};
+
+struct inflate_segment
+{
+	const uint8_t *Data;
+	uint32_t Size;
+};
+
+typedef void inflate_flush(void *User, uint8_t *Output);
+
+struct inflate_state
+{
+	const inflate_segment *Segments;
+	uint32_t SegmentCount;
+	uint32_t SegmentIndex;
+	const uint8_t *In;
+	const uint8_t *InEnd;
+	// NOTE(georgy): Zero bytes handed out after the input ran out, the refill reads ahead of what the stream needs
+	uint32_t PhantomBytes;
+
+	uint64_t BitBuffer;
+	uint32_t BitCount;
+
+	uint8_t Window[INFLATE_WINDOW_SIZE];
+	uint64_t TotalOut;
+
+	// NOTE(georgy): Output is handed to Flush every OutputSize bytes
+	uint8_t *Output;
+	uint32_t OutputSize;
+	uint32_t OutputUsed;
+	inflate_flush *Flush;
+	void *User;
+	uint32_t Adler;
+
+	inflate_huffman LiteralCodes;
+	inflate_huffman DistanceCodes;
+};
+
+inline uint8_t
+NextInputByte(inflate_state *State)
+{
+	while(State->In == State->InEnd)
+	{
+		if(State->SegmentIndex >= State->SegmentCount)
+		{
+			State->PhantomBytes++;
+			return(0);
+		}
+		State->In = State->Segments[State->SegmentIndex].Data;
+		State->InEnd = State->In + State->Segments[State->SegmentIndex].Size;
+		State->SegmentIndex++;
+	}
+
+	return(*State->In++);
+}
+
+inline void
+RefillBits(inflate_state *State)
+{
+	while(State->BitCount <= 56)
+	{
+		State->BitBuffer |= (uint64_t)NextInputByte(State) << State->BitCount;
+		State->BitCount += 8;
+	}
+}
+
+inline uint32_t
+GetBits(inflate_state *State, uint32_t Count)
+{
+	if(State->BitCount < Count)
+	{
+		RefillBits(State);
+	}
+	uint32_t Result = (uint32_t)(State->BitBuffer & ((1ull << Count) - 1));
+	State->BitBuffer >>= Count;
+	State->BitCount -= Count;
+
+	return(Result);
+}
+
+inline bool
+InflateOverrun(inflate_state *State)
+{
+	bool Result = ((uint64_t)State->PhantomBytes*8 > State->BitCount);
+
+	return(Result);
+}
+
+static uint32_t
+UpdateAdler32(uint32_t Adler, const uint8_t *Data, uint32_t Size)
+{
+	uint32_t A = Adler & 0xFFFF;
+	uint32_t B = Adler >> 16;
+	while(Size)
+	{
+		// NOTE(georgy): 5552 bytes is the most that can be summed before B overflows
+		uint32_t BlockSize = (Size < 5552) ? Size : 5552;
+		for(uint32_t ByteIndex = 0; ByteIndex < BlockSize; ByteIndex++)
+		{
+			A += Data[ByteIndex];
+			B += A;
+		}
+		A %= 65521;
+		B %= 65521;
+		Data += BlockSize;
+		Size -= BlockSize;
+	}
+
+	uint32_t Result = (B << 16) | A;
+	return(Result);
+}
+
+inline void
+InflateEmit(inflate_state *State, uint8_t Byte)
+{
+	State->Window[State->TotalOut++ & (INFLATE_WINDOW_SIZE - 1)] = Byte;
+	State->Output[State->OutputUsed++] = Byte;
+	if(State->OutputUsed == State->OutputSize)
+	{
+		// NOTE(georgy): Checksummed before Flush, which may change the output in place
+		State->Adler = UpdateAdler32(State->Adler, State->Output, State->OutputUsed);
+		State->Flush(State->User, State->Output);
+		State->OutputUsed = 0;
+	}
+}
+
+static bool
+BuildHuffman(inflate_huffman *Huffman, const uint8_t *Lengths, uint32_t Count)
+{
+	memset(Huffman->Counts, 0, sizeof(Huffman->Counts));
+	for(uint32_t Symbol = 0; Symbol < Count; Symbol++)
+	{
+		Huffman->Counts[Lengths[Symbol]]++;
+	}
+	Huffman->Counts[0] = 0;
+
+	int32_t Left = 1;
+	for(uint32_t Length = 1; Length < 16; Length++)
+	{
+		Left = 2*Left - Huffman->Counts[Length];
+		if(Left < 0)
+		{
+			return(false);
+		}
+	}
+
+	uint16_t Offsets[16];
+	Offsets[1] = 0;
+	for(uint32_t Length = 1; Length < 15; Length++)
+	{
+		Offsets[Length + 1] = Offsets[Length] + Huffman->Counts[Length];
+	}
+	for(uint32_t Symbol = 0; Symbol < Count; Symbol++)
+	{
+		if(Lengths[Symbol])
+		{
+			Huffman->Symbols[Offsets[Lengths[Symbol]]++] = (uint16_t)Symbol;
+		}
+	}
+
+	// NOTE(georgy): Canonical codes are sent most significant bit first, so the table is indexed by reversed codes
+	memset(Huffman->Fast, 0, sizeof(Huffman->Fast));
+	uint32_t Code = 0;
+	uint32_t SymbolIndex = 0;
+	for(uint32_t Length = 1; Length <= INFLATE_FAST_BITS; Length++)
+	{
+		for(uint32_t CodeIndex = 0; CodeIndex < Huffman->Counts[Length]; CodeIndex++)
+		{
+			uint32_t Reversed = 0;
+			for(uint32_t Bit = 0; Bit < Length; Bit++)
+			{
+				Reversed |= ((Code >> Bit) & 1) << (Length - 1 - Bit);
+			}
+			uint16_t Entry = (uint16_t)((Huffman->Symbols[SymbolIndex++] << 4) | Length);
+			for(uint32_t Fill = Reversed; Fill < (1 << INFLATE_FAST_BITS); Fill += (1 << Length))
+			{
+				Huffman->Fast[Fill] = Entry;
+			}
+			Code++;
+		}
+		Code <<= 1;
+	}
+
+	return(true);
+}
+
+static int32_t
+DecodeSymbol(inflate_state *State, inflate_huffman *Huffman)
+{
+	if(State->BitCount < 16)
+	{
+		RefillBits(State);
+	}
+
+	uint16_t Entry = Huffman->Fast[State->BitBuffer & ((1 << INFLATE_FAST_BITS) - 1)];
+	if(Entry)
+	{
+		State->BitBuffer >>= (Entry & 15);
+		State->BitCount -= (Entry & 15);
+		return(Entry >> 4);
+	}
+
+	// NOTE(georgy): Long codes, one bit at a time
+	int32_t Code = 0;
+	int32_t First = 0;
+	int32_t Index = 0;
+	for(uint32_t Length = 1; Length < 16; Length++)
+	{
+		Code |= GetBits(State, 1);
+		int32_t Count = Huffman->Counts[Length];
+		if((Code - Count) < First)
+		{
+			return(Huffman->Symbols[Index + (Code - First)]);
+		}
+		Index += Count;
+		First = (First + Count) << 1;
+		Code <<= 1;
+	}
+
+	return(-1);
+}
+
+static bool
+InflateCodes(inflate_state *State)
+{
+	static const uint16_t LengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const uint8_t LengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const uint16_t DistanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+											 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const uint8_t DistanceExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	for(;;)
+	{
+		int32_t Symbol = DecodeSymbol(State, &State->LiteralCodes);
+		if((Symbol < 0) || InflateOverrun(State))
+		{
+			return(false);
+		}
+
+		if(Symbol < 256)
+		{
+			InflateEmit(State, (uint8_t)Symbol);
+		}
+		else if(Symbol == 256)
+		{
+			return(true);
+		}
+		else
+		{
+			Symbol -= 257;
+			if(Symbol >= 29)
+			{
+				return(false);
+			}
+			uint32_t Length = LengthBase[Symbol] + GetBits(State, LengthExtra[Symbol]);
+
+			int32_t DistanceSymbol = DecodeSymbol(State, &State->DistanceCodes);
+			if((DistanceSymbol < 0) || (DistanceSymbol >= 30))
+			{
+				return(false);
+			}
+			uint32_t Distance = DistanceBase[DistanceSymbol] + GetBits(State, DistanceExtra[DistanceSymbol]);
+			if(Distance > State->TotalOut)
+			{
+				return(false);
+			}
+
+			for(uint32_t ByteIndex = 0; ByteIndex < Length; ByteIndex++)
+			{
+				InflateEmit(State, State->Window[(State->TotalOut - Distance) & (INFLATE_WINDOW_SIZE - 1)]);
+			}
+		}
+	}
+}
+
+static bool
+InflateDynamicTables(inflate_state *State)
+{
+	static const uint8_t CodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	uint32_t LiteralCount = GetBits(State, 5) + 257;
+	uint32_t DistanceCount = GetBits(State, 5) + 1;
+	uint32_t CodeLengthCount = GetBits(State, 4) + 4;
+	if((LiteralCount > 286) || (DistanceCount > 30))
+	{
+		return(false);
+	}
+
+	uint8_t Lengths[286 + 30] = {};
+	for(uint32_t Index = 0; Index < CodeLengthCount; Index++)
+	{
+		Lengths[CodeLengthOrder[Index]] = (uint8_t)GetBits(State, 3);
+	}
+	inflate_huffman CodeLengthCodes;
+	if(!BuildHuffman(&CodeLengthCodes, Lengths, 19))
+	{
+		return(false);
+	}
+
+	memset(Lengths, 0, sizeof(Lengths));
+	uint32_t Index = 0;
+	while(Index < LiteralCount + DistanceCount)
+	{
+		int32_t Symbol = DecodeSymbol(State, &CodeLengthCodes);
+		if((Symbol < 0) || InflateOverrun(State))
+		{
+			return(false);
+		}
+
+		if(Symbol < 16)
+		{
+			Lengths[Index++] = (uint8_t)Symbol;
+		}
+		else
+		{
+			uint8_t Repeated = 0;
+			uint32_t RepeatCount;
+			if(Symbol == 16)
+			{
+				if(Index == 0)
+				{
+					return(false);
+				}
+				Repeated = Lengths[Index - 1];
+				RepeatCount = 3 + GetBits(State, 2);
+			}
+			else if(Symbol == 17)
+			{
+				RepeatCount = 3 + GetBits(State, 3);
+			}
+			else
+			{
+				RepeatCount = 11 + GetBits(State, 7);
+			}
+
+			if(Index + RepeatCount > LiteralCount + DistanceCount)
+			{
+				return(false);
+			}
+			while(RepeatCount--)
+			{
+				Lengths[Index++] = Repeated;
+			}
+		}
+	}
+
+	bool Result = (Lengths[256] != 0) && BuildHuffman(&State->LiteralCodes, Lengths, LiteralCount) &&
+				  BuildHuffman(&State->DistanceCodes, Lengths + LiteralCount, DistanceCount);
+	return(Result);
+}
+
+static void
+InflateFixedTables(inflate_state *State)
+{
+	uint8_t Lengths[288];
+	for(uint32_t Symbol = 0; Symbol < 288; Symbol++)
+	{
+		Lengths[Symbol] = (Symbol < 144) ? 8 : ((Symbol < 256) ? 9 : ((Symbol < 280) ? 7 : 8));
+	}
+	BuildHuffman(&State->LiteralCodes, Lengths, 288);
+
+	for(uint32_t Symbol = 0; Symbol < 30; Symbol++)
+	{
+		Lengths[Symbol] = 5;
+	}
+	BuildHuffman(&State->DistanceCodes, Lengths, 30);
+}
+
+// NOTE(georgy): Inflates a zlib stream split over Segments, handing the output to Flush in OutputSize pieces.
+//				 A trailing piece shorter than OutputSize stays in Output
+static bool
+InflateZlib(inflate_state *State)
+{
+	State->Adler = 1;
+
+	uint32_t CMF = GetBits(State, 8);
+	uint32_t FLG = GetBits(State, 8);
+	if(((CMF & 15) != 8) || (((CMF << 8) | FLG) % 31) || (FLG & 32))
+	{
+		return(false);
+	}
+
+	uint32_t Final;
+	do
+	{
+		Final = GetBits(State, 1);
+		uint32_t Type = GetBits(State, 2);
+		bool BlockOk = false;
+		if(Type == 0)
+		{
+			GetBits(State, State->BitCount & 7);
+			uint32_t Length = GetBits(State, 16);
+			uint32_t InvLength = GetBits(State, 16);
+			BlockOk = (Length == (~InvLength & 0xFFFF));
+			for(uint32_t ByteIndex = 0; BlockOk && (ByteIndex < Length); ByteIndex++)
+			{
+				InflateEmit(State, (uint8_t)GetBits(State, 8));
+			}
+		}
+		else if(Type == 1)
+		{
+			InflateFixedTables(State);
+			BlockOk = InflateCodes(State);
+		}
+		else if(Type == 2)
+		{
+			BlockOk = InflateDynamicTables(State) && InflateCodes(State);
+		}
+
+		if(!BlockOk || InflateOverrun(State))
+		{
+			return(false);
+		}
+	} while(!Final);
+
+	GetBits(State, State->BitCount & 7);
+	uint32_t StoredAdler = 0;
+	for(uint32_t ByteIndex = 0; ByteIndex < 4; ByteIndex++)
+	{
+		StoredAdler = (StoredAdler << 8) | GetBits(State, 8);
+	}
+	uint32_t Adler = UpdateAdler32(State->Adler, State->Output, State->OutputUsed);
+
+	bool Result = !InflateOverrun(State) && (Adler == StoredAdler);
+	return(Result);
+}
+
+//
+// NOTE(georgy): PNG
+//
+
+inline uint32_t
+ReadBigEndian32(const uint8_t *Data)
+{
+	uint32_t Result = ((uint32_t)Data[0] << 24) | ((uint32_t)Data[1] << 16) | ((uint32_t)Data[2] << 8) | Data[3];
+
+	return(Result);
+}
+
+struct png_row_decoder
+{
+	uint32_t Width, Height;
+	uint32_t BytesPerSample;
+	uint32_t BytesPerPixel;
+	uint32_t RowBytes;
+	uint8_t *PreviousRow;
+
+	uint32_t Row;
+	bool Failed;
+	float Scale;
+	float *HeightMap;
+};
+
+inline uint8_t
+PaethPredictor(int32_t A, int32_t B, int32_t C)
+{
+	int32_t P = A + B - C;
+	int32_t PA = (P > A) ? (P - A) : (A - P);
+	int32_t PB = (P > B) ? (P - B) : (B - P);
+	int32_t PC = (P > C) ? (P - C) : (C - P);
+	uint8_t Result = (uint8_t)(((PA <= PB) && (PA <= PC)) ? A : ((PB <= PC) ? B : C));
+
+	return(Result);
+}
+
+// NOTE(georgy): Called with every complete scanline: a filter type byte and RowBytes of filtered data
+static void
+PNGScanlineDone(void *User, uint8_t *Scanline)
+{
+	png_row_decoder *Decoder = (png_row_decoder *)User;
+	if(Decoder->Failed || (Decoder->Row >= Decoder->Height) || (Scanline[0] > 4))
+	{
+		Decoder->Failed = true;
+		return;
+	}
+
+	uint8_t Filter = Scanline[0];
+	uint8_t *Row = Scanline + 1;
+	const uint8_t *Up = Decoder->PreviousRow;
+	uint32_t BPP = Decoder->BytesPerPixel;
+	for(uint32_t ByteIndex = 0; ByteIndex < Decoder->RowBytes; ByteIndex++)
+	{
+		uint8_t Left = (ByteIndex >= BPP) ? Row[ByteIndex - BPP] : 0;
+		uint8_t UpLeft = (ByteIndex >= BPP) ? Up[ByteIndex - BPP] : 0;
+		switch(Filter)
+		{
+			case 1: Row[ByteIndex] += Left; break;
+			case 2: Row[ByteIndex] += Up[ByteIndex]; break;
+			case 3: Row[ByteIndex] += (uint8_t)(((uint32_t)Left + Up[ByteIndex]) >> 1); break;
+			case 4: Row[ByteIndex] += PaethPredictor(Left, Up[ByteIndex], UpLeft); break;
+		}
+	}
+
+	// NOTE(georgy): First channel only, 16-bit samples are big-endian
+	float *Dest = Decoder->HeightMap + (uint64_t)Decoder->Row*Decoder->Width;
+	for(uint32_t X = 0; X < Decoder->Width; X++)
+	{
+		const uint8_t *Pixel = Row + X*BPP;
+		uint32_t Value = (Decoder->BytesPerSample == 2) ? ((Pixel[0] << 8) | Pixel[1]) : Pixel[0];
+		Dest[X] = Decoder->Scale*(float)Value;
+	}
+
+	memcpy(Decoder->PreviousRow, Row, Decoder->RowBytes);
+	Decoder->Row++;
+}
+
+static bool
+ImportPNG(const uint8_t *Data, uint64_t Size, float MaxHeight, imported_heightmap *Result)
+{
+	const uint8_t *At = Data + 8;
+	const uint8_t *End = Data + Size;
+
+	png_row_decoder Decoder = {};
+	uint32_t ChannelCount = 0;
+	uint32_t SegmentCount = 0;
+	inflate_segment *Segments = 0;
+	bool HeaderOk = false;
+	bool Ended = false;
+
+	// NOTE(georgy): Two passes over the chunks: count the IDAT chunks, then point at them
+	for(uint32_t Pass = 0; Pass < 2; Pass++)
+	{
+		At = Data + 8;
+		uint32_t SegmentIndex = 0;
+		while(!Ended && ((End - At) >= 12))
+		{
+			uint32_t Length = ReadBigEndian32(At);
+			const uint8_t *Type = At + 4;
+			const uint8_t *ChunkData = At + 8;
+			if((uint64_t)(End - ChunkData) < (uint64_t)Length + 4)
+			{
+				break;
+			}
+
+			if((Pass == 0) && (memcmp(Type, "IHDR", 4) == 0) && (Length >= 13))
+			{
+				Decoder.Width = ReadBigEndian32(ChunkData);
+				Decoder.Height = ReadBigEndian32(ChunkData + 4);
+				uint32_t BitDepth = ChunkData[8];
+				uint32_t ColorType = ChunkData[9];
+				uint32_t Interlace = ChunkData[12];
+				ChannelCount = (ColorType == 0) ? 1 : ((ColorType == 2) ? 3 : ((ColorType == 4) ? 2 : ((ColorType == 6) ? 4 : 0)));
+				HeaderOk = ((BitDepth == 8) || (BitDepth == 16)) && ChannelCount && (Interlace == 0) &&
+						   (Decoder.Width >= 2) && (Decoder.Height >= 2) && (Decoder.Width <= (1 << 24)) && (Decoder.Height <= (1 << 24));
+				Decoder.BytesPerSample = BitDepth / 8;
+			}
+			else if(memcmp(Type, "IDAT", 4) == 0)
+			{
+				if(Pass == 1)
+				{
+					Segments[SegmentIndex].Data = ChunkData;
+					Segments[SegmentIndex].Size = Length;
+				}
+				SegmentIndex++;
+			}
+			else if(memcmp(Type, "IEND", 4) == 0)
+			{
+				Ended = (Pass == 1);
+				break;
+			}
+
+			At = ChunkData + Length + 4;
+		}
+
+		if(Pass == 0)
+		{
+			SegmentCount = SegmentIndex;
+			if(!HeaderOk || (SegmentCount == 0))
+			{
+				printf("Unsupported PNG, only non-interlaced 8 or 16 bit grey, grey-alpha, RGB or RGBA\n");
+				return(false);
+			}
+			Segments = (inflate_segment *)AllocateMemory(MemoryCategory_Scratch, sizeof(inflate_segment)*SegmentCount);
+			if(!Segments)
+			{
+				return(false);
+			}
+		}
+	}
+
+	Decoder.BytesPerPixel = ChannelCount*Decoder.BytesPerSample;
+	Decoder.RowBytes = Decoder.Width*Decoder.BytesPerPixel;
+	Decoder.Scale = MaxHeight / ((Decoder.BytesPerSample == 2) ? 65535.0f : 255.0f);
+	Decoder.PreviousRow = (uint8_t *)AllocateZeroedMemory(MemoryCategory_Scratch, Decoder.RowBytes);
+	Decoder.HeightMap = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*(uint64_t)Decoder.Width*Decoder.Height);
+	uint8_t *Scanline = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, Decoder.RowBytes + 1);
+	inflate_state *State = (inflate_state *)AllocateZeroedMemory(MemoryCategory_Scratch, sizeof(inflate_state));
+
+	bool Success = false;
+	if(Decoder.PreviousRow && Decoder.HeightMap && Scanline && State)
+	{
+		State->Segments = Segments;
+		State->SegmentCount = SegmentCount;
+		State->Output = Scanline;
+		State->OutputSize = Decoder.RowBytes + 1;
+		State->Flush = PNGScanlineDone;
+		State->User = &Decoder;
+
+		Success = InflateZlib(State) && !Decoder.Failed && (Decoder.Row == Decoder.Height);
+		if(!Success)
+		{
+			printf("Corrupt PNG image data\n");
+		}
+	}
+
+	FreeMemory(State);
+	FreeMemory(Scanline);
+	FreeMemory(Decoder.PreviousRow);
+	FreeMemory(Segments);
+
+	if(Success)
+	{
+		Result->HeightMap = Decoder.HeightMap;
+		Result->GridWidth = Decoder.Width - 1;
+		Result->GridHeight = Decoder.Height - 1;
+	}
+	else
+	{
+		FreeMemory(Decoder.HeightMap);
+	}
+
+	return(Success);
+}
+
+//
+// NOTE(georgy): Import
+//
+
+static bool
+ImportHeightMap(job_system *Jobs, const char *Filename, float MaxHeight, imported_heightmap *Result)
+{
+	memset(Result, 0, sizeof(*Result));
+
+	mapped_file Mapping;
+	if(!MapExistingFile(&Mapping, Filename, true))
+	{
+		printf("Can't open %s\n", Filename);
+		return(false);
+	}
+
+	const uint8_t *Data = (const uint8_t *)Mapping.Memory;
+	bool Success = false;
+	heightmap_format Format = DetectHeightmapFormat(Filename, Data, Mapping.Size);
+	switch(Format)
+	{
+		case HeightmapFormat_RawFloat:
+		{
+			uint32_t Side = ((Mapping.Size % sizeof(float)) == 0) ? SquareSide(Mapping.Size / sizeof(float)) : 0;
+			if(Side >= 2)
+			{
+				Result->HeightMap = (float *)Mapping.Memory;
+				Result->GridWidth = Side - 1;
+				Result->GridHeight = Side - 1;
+				Result->UsesMapping = true;
+				Result->Mapping = Mapping;
+				Success = true;
+			}
+		} break;
+
+		case HeightmapFormat_RawU16:
+		{
+			uint32_t Side = ((Mapping.Size % sizeof(uint16_t)) == 0) ? SquareSide(Mapping.Size / sizeof(uint16_t)) : 0;
+			if(Side >= 2)
+			{
+				Result->HeightMap = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*(uint64_t)Side*Side);
+				if(Result->HeightMap)
+				{
+					Result->GridWidth = Side - 1;
+					Result->GridHeight = Side - 1;
+					ConvertSamplesToHeights(Jobs, Data, Side, Side, 2, 2, false, MaxHeight / 65535.0f, Result->HeightMap);
+					Success = true;
+				}
+			}
+		} break;
+
+		case HeightmapFormat_PGM:
+		{
+			Success = ImportPGM(Jobs, Data, Mapping.Size, MaxHeight, Result);
+		} break;
+
+		case HeightmapFormat_PNG:
+		{
+			Success = ImportPNG(Data, Mapping.Size, MaxHeight, Result);
+		} break;
+
+		default:
+		{
+			printf("Unknown heightmap format: %s\n", Filename);
+		} break;
+	}
+
+	if((Format == HeightmapFormat_RawFloat) || (Format == HeightmapFormat_RawU16))
+	{
+		if(!Success)
+		{
+			printf("RAW heightmap %s must be square\n", Filename);
+		}
+	}
+
+	if(!Result->UsesMapping)
+	{
+		UnmapFile(&Mapping);
+	}
+
+	return(Success);
+}
@@ -0,0 +1,591 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "numa.cpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// NOTE(georgy): One pool for every terrain stage. Each worker owns a deque: it pushes and pops its own jobs
+//				 at the back (LIFO, cache-warm) while idle workers steal from the front of the others (FIFO, big chunks first).
+//
+//				 NUMA: on a machine with several nodes the workers are spread over them round robin (worker W is on node
+//				 W % NodeCount) and each one is pinned to the CPUs of its node. A job can be given a node (AddNodeJob), it's
+//				 queued on a worker of that node, and idle workers steal from their own node before they go to another one.
+//				 Node jobs that ran somewhere else are counted as remote, see GetNodeJobStats
+
+struct job_system;
+struct job_counter;
+
+typedef void job_proc(void *Data, uint32_t Begin, uint32_t End);
+
+// NOTE(georgy): Called after every job with the time it took, WorkerIndex 0 is any non-worker thread that helped out
+typedef void job_timing_hook(void *User, const char *Name, uint32_t WorkerIndex, uint64_t BeginNanoseconds, uint64_t EndNanoseconds);
+
+struct job
+{
+	const char *Name;
+	job_proc *Proc;
+	void *Data;
+	uint32_t Begin, End;
+	// NOTE(georgy): Node of the pool (not the OS's), NUMA_ANY_NODE if any worker can take it
+	uint32_t Node;
+
+	job_counter *Counter;
+};
+
+// NOTE(georgy): Counts unfinished jobs. A job can depend on a counter, it's queued only once the counter drops to zero
+struct job_counter
+{
+	std::atomic<int32_t> Value;
+
+	std::mutex Lock;
+	std::vector<job> Waiting;
+
+	job_counter() : Value(0) {}
+};
+
+struct job_worker_queue
+{
+	std::mutex Lock;
+	std::deque<job> Jobs;
+};
+
+struct job_system_config
+{
+	// NOTE(georgy): Including the thread that creates the system, 0 means one per hardware thread
+	uint32_t WorkerCount;
+	bool PinWorkers;
+};
+
+// NOTE(georgy): Jobs with a node, index 0 ran on a worker of their node, index 1 on another one
+struct node_job_stats
+{
+	uint64_t JobCount[2];
+	uint64_t Nanoseconds[2];
+};
+
+struct job_system
+{
+	uint32_t WorkerCount;
+	job_worker_queue *Queues;
+
+	// NOTE(georgy): Nodes the workers are spread over, NUMANodes maps them to the nodes of GlobalNUMA
+	uint32_t NodeCount;
+	uint32_t NUMANodes[MAX_NUMA_NODES];
+	std::atomic<uint64_t> NodeJobCount[2];
+	std::atomic<uint64_t> NodeJobNanoseconds[2];
+	std::vector<std::thread> Threads;
+
+	std::atomic<int32_t> QueuedJobCount;
+	std::atomic<uint32_t> NextQueue;
+	std::mutex SleepLock;
+	std::condition_variable WakeUp;
+	std::atomic<bool> Running;
+
+	job_timing_hook *TimingHook;
+	void *TimingHookUser;
+};
+
+static thread_local uint32_t JobWorkerIndex = 0;
+
+inline uint64_t
+GetNanoseconds(void)
+{
+	uint64_t Result = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	return(Result);
+}
+
+static void
+PinCurrentThread(uint32_t CPUIndex)
+{
+	uint32_t CPUCount = std::thread::hardware_concurrency();
+	if(CPUCount)
+	{
+		CPUIndex %= CPUCount;
+#if defined(_WIN32)
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << CPUIndex);
+#elif defined(__linux__)
+		cpu_set_t Set;
+		CPU_ZERO(&Set);
+		CPU_SET(CPUIndex, &Set);
+		pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set);
+#endif
+	}
+}
+
+inline uint32_t
+WorkerNode(job_system *Jobs, uint32_t WorkerIndex)
+{
+	uint32_t Result = WorkerIndex % Jobs->NodeCount;
+	return(Result);
+}
+
+static void
+PushJob(job_system *Jobs, job Job)
+{
+	uint32_t QueueIndex = JobWorkerIndex;
+	if((Job.Node != NUMA_ANY_NODE) && (Jobs->NodeCount > 1))
+	{
+		// NOTE(georgy): A worker of the job's node keeps it, anyone else hands it to the workers of that node in turn
+		uint32_t Node = Job.Node % Jobs->NodeCount;
+		if((QueueIndex == 0) || (WorkerNode(Jobs, QueueIndex) != Node))
+		{
+			uint32_t NodeWorkerCount = (Jobs->WorkerCount - Node + Jobs->NodeCount - 1) / Jobs->NodeCount;
+			QueueIndex = Node + Jobs->NodeCount*(Jobs->NextQueue.fetch_add(1) % NodeWorkerCount);
+		}
+	}
+	else if(QueueIndex == 0)
+	{
+		// NOTE(georgy): Jobs from outside the pool get spread around, so the workers don't all steal from one deque
+		QueueIndex = Jobs->NextQueue.fetch_add(1) % Jobs->WorkerCount;
+	}
+
+	job_worker_queue *Queue = Jobs->Queues + QueueIndex;
+	{
+		std::lock_guard<std::mutex> Guard(Queue->Lock);
+		Queue->Jobs.push_back(Job);
+	}
+	Jobs->QueuedJobCount.fetch_add(1);
+
+	std::lock_guard<std::mutex> Guard(Jobs->SleepLock);
+	Jobs->WakeUp.notify_one();
+}
+
+static bool
+TakeJob(job_system *Jobs, job *Job)
+{
+	bool Result = false;
+
+	// NOTE(georgy): Queues of workers on the same node first, the others only once those are empty
+	uint32_t OwnIndex = JobWorkerIndex;
+	uint32_t OwnNode = WorkerNode(Jobs, OwnIndex);
+	for(uint32_t Offset = 0; !Result && (Offset < 2*Jobs->WorkerCount); Offset++)
+	{
+		uint32_t QueueIndex = (OwnIndex + Offset) % Jobs->WorkerCount;
+		bool SameNode = (WorkerNode(Jobs, QueueIndex) == OwnNode);
+		if(SameNode != (Offset < Jobs->WorkerCount))
+		{
+			continue;
+		}
+		job_worker_queue *Queue = Jobs->Queues + QueueIndex;
+
+		std::lock_guard<std::mutex> Guard(Queue->Lock);
+		if(!Queue->Jobs.empty())
+		{
+			if(Offset == 0)
+			{
+				*Job = Queue->Jobs.back();
+				Queue->Jobs.pop_back();
+			}
+			else
+			{
+				*Job = Queue->Jobs.front();
+				Queue->Jobs.pop_front();
+			}
+			Result = true;
+		}
+	}
+
+	if(Result)
+	{
+		Jobs->QueuedJobCount.fetch_sub(1);
+	}
+
+	return(Result);
+}
+
+static void
+FinishJob(job_system *Jobs, job_counter *Counter)
+{
+	if(Counter)
+	{
+		// NOTE(georgy): Decrement under the lock, WaitForCounter takes the same lock before it lets the counter go out of scope
+		std::vector<job> Released;
+		{
+			std::lock_guard<std::mutex> Guard(Counter->Lock);
+			if(Counter->Value.fetch_sub(1) == 1)
+			{
+				Released.swap(Counter->Waiting);
+			}
+		}
+
+		for(uint32_t JobIndex = 0; JobIndex < Released.size(); JobIndex++)
+		{
+			PushJob(Jobs, Released[JobIndex]);
+		}
+	}
+}
+
+static void
+RunJob(job_system *Jobs, job *Job)
+{
+	bool NodeJob = (Job->Node != NUMA_ANY_NODE) && (Jobs->NodeCount > 1);
+	if(Jobs->TimingHook || NodeJob)
+	{
+		uint64_t Begin = GetNanoseconds();
+		Job->Proc(Job->Data, Job->Begin, Job->End);
+		uint64_t End = GetNanoseconds();
+		if(Jobs->TimingHook)
+		{
+			Jobs->TimingHook(Jobs->TimingHookUser, Job->Name, JobWorkerIndex, Begin, End);
+		}
+		if(NodeJob)
+		{
+			uint32_t Remote = (WorkerNode(Jobs, JobWorkerIndex) != (Job->Node % Jobs->NodeCount)) ? 1 : 0;
+			Jobs->NodeJobCount[Remote].fetch_add(1);
+			Jobs->NodeJobNanoseconds[Remote].fetch_add(End - Begin);
+		}
+	}
+	else
+	{
+		Job->Proc(Job->Data, Job->Begin, Job->End);
+	}
+
+	FinishJob(Jobs, Job->Counter);
+}
+
+// NOTE(georgy): Pinned to one CPU with Pin, otherwise to its node when the pool knows about nodes
+static void
+PinWorker(job_system *Jobs, uint32_t WorkerIndex, bool Pin, bool PinToNode)
+{
+	if(PinToNode)
+	{
+		uint32_t NUMANode = Jobs->NUMANodes[WorkerNode(Jobs, WorkerIndex)];
+		PinCurrentThreadToNode(&GlobalNUMA, NUMANode, Pin ? (WorkerIndex / Jobs->NodeCount) : NUMA_ANY_CPU);
+	}
+	else if(Pin)
+	{
+		PinCurrentThread(WorkerIndex);
+	}
+}
+
+static void
+JobWorkerThread(job_system *Jobs, uint32_t WorkerIndex, bool Pin, bool PinToNode)
+{
+	JobWorkerIndex = WorkerIndex;
+	PinWorker(Jobs, WorkerIndex, Pin, PinToNode);
+
+	while(Jobs->Running)
+	{
+		job Job;
+		if(TakeJob(Jobs, &Job))
+		{
+			RunJob(Jobs, &Job);
+		}
+		else
+		{
+			std::unique_lock<std::mutex> Lock(Jobs->SleepLock);
+			Jobs->WakeUp.wait(Lock, [Jobs]() { return((Jobs->QueuedJobCount > 0) || !Jobs->Running); });
+		}
+	}
+}
+
+// NOTE(georgy): EROSION_WORKERS=N and EROSION_PIN_WORKERS=1 override the config. EROSION_NUMA=0 ignores the nodes,
+//				 EROSION_NUMA_NODE=N keeps the whole pool on node N (the coordinator gives one to each worker process)
+static void
+InitJobSystem(job_system *Jobs, job_system_config Config)
+{
+	const char *WorkersOverride = getenv("EROSION_WORKERS");
+	if(WorkersOverride && WorkersOverride[0])
+	{
+		Config.WorkerCount = (uint32_t)atoi(WorkersOverride);
+	}
+	const char *PinOverride = getenv("EROSION_PIN_WORKERS");
+	if(PinOverride && PinOverride[0])
+	{
+		Config.PinWorkers = (atoi(PinOverride) != 0);
+	}
+
+	if(Config.WorkerCount == 0)
+	{
+		Config.WorkerCount = std::thread::hardware_concurrency();
+		if(Config.WorkerCount == 0) Config.WorkerCount = 1;
+	}
+
+	Jobs->WorkerCount = Config.WorkerCount;
+	Jobs->Queues = new job_worker_queue[Jobs->WorkerCount];
+	Jobs->QueuedJobCount = 0;
+	Jobs->NextQueue = 0;
+	Jobs->Running = true;
+	Jobs->TimingHook = 0;
+	Jobs->TimingHookUser = 0;
+
+	DetectNUMATopology(&GlobalNUMA);
+	const char *NUMAEnv = getenv("EROSION_NUMA");
+	const char *NUMANodeEnv = getenv("EROSION_NUMA_NODE");
+	bool UseNUMA = (!NUMAEnv || (atoi(NUMAEnv) != 0)) && (GlobalNUMA.NodeCount > 1);
+	bool PinToNode = false;
+	Jobs->NodeCount = 1;
+	Jobs->NUMANodes[0] = 0;
+	if(UseNUMA && NUMANodeEnv && NUMANodeEnv[0])
+	{
+		Jobs->NUMANodes[0] = (uint32_t)atoi(NUMANodeEnv) % GlobalNUMA.NodeCount;
+		PinToNode = true;
+	}
+	else if(UseNUMA && (Jobs->WorkerCount > 1))
+	{
+		Jobs->NodeCount = (Jobs->WorkerCount < GlobalNUMA.NodeCount) ? Jobs->WorkerCount : GlobalNUMA.NodeCount;
+		for(uint32_t Node = 0; Node < Jobs->NodeCount; Node++)
+		{
+			Jobs->NUMANodes[Node] = Node;
+		}
+		PinToNode = true;
+	}
+	for(uint32_t Remote = 0; Remote < 2; Remote++)
+	{
+		Jobs->NodeJobCount[Remote] = 0;
+		Jobs->NodeJobNanoseconds[Remote] = 0;
+	}
+
+	PinWorker(Jobs, 0, Config.PinWorkers, PinToNode);
+
+	// NOTE(georgy): The creating thread is worker 0, it runs jobs while it waits for them
+	for(uint32_t WorkerIndex = 1; WorkerIndex < Jobs->WorkerCount; WorkerIndex++)
+	{
+		Jobs->Threads.emplace_back(JobWorkerThread, Jobs, WorkerIndex, Config.PinWorkers, PinToNode);
+	}
+}
+
+static void
+ShutdownJobSystem(job_system *Jobs)
+{
+	{
+		std::lock_guard<std::mutex> Guard(Jobs->SleepLock);
+		Jobs->Running = false;
+		Jobs->WakeUp.notify_all();
+	}
+	for(uint32_t ThreadIndex = 0; ThreadIndex < Jobs->Threads.size(); ThreadIndex++)
+	{
+		Jobs->Threads[ThreadIndex].join();
+	}
+	Jobs->Threads.clear();
+
+	delete[] Jobs->Queues;
+	Jobs->Queues = 0;
+}
+
+static void
+SetJobTimingHook(job_system *Jobs, job_timing_hook *Hook, void *User)
+{
+	Jobs->TimingHookUser = User;
+	Jobs->TimingHook = Hook;
+}
+
+static void
+GetNodeJobStats(job_system *Jobs, node_job_stats *Stats)
+{
+	for(uint32_t Remote = 0; Remote < 2; Remote++)
+	{
+		Stats->JobCount[Remote] = Jobs->NodeJobCount[Remote];
+		Stats->Nanoseconds[Remote] = Jobs->NodeJobNanoseconds[Remote];
+	}
+}
+
+// NOTE(georgy): Node of the pool that owns Index-th piece of work (a tile...), pieces are dealt out round robin
+inline uint32_t
+NodeForIndex(job_system *Jobs, uint32_t Index)
+{
+	uint32_t Result = Index % Jobs->NodeCount;
+	return(Result);
+}
+
+// NOTE(georgy): Counter is incremented now and decremented when the job is done.
+//				 If Dependency is not null, the job doesn't start until Dependency reaches zero.
+//				 Node is a node of the pool or NUMA_ANY_NODE
+static void
+AddNodeJob(job_system *Jobs, uint32_t Node, const char *Name, job_proc *Proc, void *Data, uint32_t Begin, uint32_t End,
+		   job_counter *Counter, job_counter *Dependency = 0)
+{
+	job Job;
+	Job.Name = Name;
+	Job.Proc = Proc;
+	Job.Data = Data;
+	Job.Begin = Begin;
+	Job.End = End;
+	Job.Node = Node;
+	Job.Counter = Counter;
+
+	if(Counter)
+	{
+		Counter->Value.fetch_add(1);
+	}
+
+	bool Deferred = false;
+	if(Dependency && (Dependency->Value > 0))
+	{
+		std::lock_guard<std::mutex> Guard(Dependency->Lock);
+		if(Dependency->Value > 0)
+		{
+			Dependency->Waiting.push_back(Job);
+			Deferred = true;
+		}
+	}
+
+	if(!Deferred)
+	{
+		PushJob(Jobs, Job);
+	}
+}
+
+static void
+AddJob(job_system *Jobs, const char *Name, job_proc *Proc, void *Data, uint32_t Begin, uint32_t End,
+	   job_counter *Counter, job_counter *Dependency = 0)
+{
+	AddNodeJob(Jobs, NUMA_ANY_NODE, Name, Proc, Data, Begin, End, Counter, Dependency);
+}
+
+static void
+JoinJobProc(void *, uint32_t, uint32_t)
+{
+}
+
+// NOTE(georgy): AddJob takes a single dependency, so waiting on several counters goes through Counter:
+//				 one empty job per dependency, all counted on Counter. Use Counter as the dependency afterwards
+static void
+AddJoin(job_system *Jobs, job_counter *Counter, job_counter **Dependencies, uint32_t DependencyCount)
+{
+	for(uint32_t DependencyIndex = 0; DependencyIndex < DependencyCount; DependencyIndex++)
+	{
+		AddJob(Jobs, "Join", JoinJobProc, 0, 0, 0, Counter, Dependencies[DependencyIndex]);
+	}
+}
+
+// NOTE(georgy): Helps with whatever is queued instead of blocking, so waiting from inside a job can't deadlock the pool
+static void
+WaitForCounter(job_system *Jobs, job_counter *Counter)
+{
+	while(Counter->Value > 0)
+	{
+		job Job;
+		if(TakeJob(Jobs, &Job))
+		{
+			RunJob(Jobs, &Job);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	std::lock_guard<std::mutex> Guard(Counter->Lock);
+}
+
+template<typename body>
+struct parallel_for_data
+{
+	body *Body;
+};
+
+template<typename body> static void
+ParallelForProc(void *Data, uint32_t Begin, uint32_t End)
+{
+	parallel_for_data<body> *ForData = (parallel_for_data<body> *)Data;
+	(*ForData->Body)(Begin, End);
+}
+
+// NOTE(georgy): Calls Body(Begin, End) for [0, Count) split into chunks of Grain items (rows, tiles...).
+//				 Without a job system everything runs on the calling thread
+template<typename body> static void
+ParallelFor(job_system *Jobs, const char *Name, uint32_t Count, uint32_t Grain, body Body)
+{
+	if(Grain == 0) Grain = 1;
+
+	if(!Jobs || (Jobs->WorkerCount == 1) || (Count <= Grain))
+	{
+		if(Count)
+		{
+			Body(0, Count);
+		}
+	}
+	else
+	{
+		parallel_for_data<body> Data;
+		Data.Body = &Body;
+
+		job_counter Counter;
+		for(uint32_t Begin = 0; Begin < Count; Begin += Grain)
+		{
+			uint32_t End = ((Count - Begin) > Grain) ? (Begin + Grain) : Count;
+			AddJob(Jobs, Name, ParallelForProc<body>, &Data, Begin, End, &Counter);
+		}
+		WaitForCounter(Jobs, &Counter);
+	}
+}
+
+// NOTE(georgy): Picks a grain that gives every worker a few chunks to steal
+inline uint32_t
+GrainForCount(job_system *Jobs, uint32_t Count)
+{
+	uint32_t WorkerCount = Jobs ? Jobs->WorkerCount : 1;
+	uint32_t Result = Count / (4*WorkerCount);
+	if(Result == 0) Result = 1;
+	return(Result);
+}
+
+//
+// NOTE(georgy): Per-job-name timing, enabled with EROSION_JOB_TIMINGS=1
+//
+
+struct job_timing_entry
+{
+	const char *Name;
+	uint64_t JobCount;
+	uint64_t TotalNanoseconds;
+};
+
+struct job_timing_stats
+{
+	std::mutex Lock;
+	std::vector<job_timing_entry> Entries;
+};
+
+static void
+AccumulateJobTiming(void *User, const char *Name, uint32_t, uint64_t BeginNanoseconds, uint64_t EndNanoseconds)
+{
+	job_timing_stats *Stats = (job_timing_stats *)User;
+	std::lock_guard<std::mutex> Guard(Stats->Lock);
+
+	job_timing_entry *Entry = 0;
+	for(uint32_t EntryIndex = 0; EntryIndex < Stats->Entries.size(); EntryIndex++)
+	{
+		if(strcmp(Stats->Entries[EntryIndex].Name, Name) == 0)
+		{
+			Entry = &Stats->Entries[EntryIndex];
+			break;
+		}
+	}
+	if(!Entry)
+	{
+		job_timing_entry NewEntry = { Name, 0, 0 };
+		Stats->Entries.push_back(NewEntry);
+		Entry = &Stats->Entries.back();
+	}
+
+	Entry->JobCount++;
+	Entry->TotalNanoseconds += EndNanoseconds - BeginNanoseconds;
+}
+
+static void
+PrintJobTimings(job_timing_stats *Stats)
+{
+	std::lock_guard<std::mutex> Guard(Stats->Lock);
+	for(uint32_t EntryIndex = 0; EntryIndex < Stats->Entries.size(); EntryIndex++)
+	{
+		job_timing_entry *Entry = &Stats->Entries[EntryIndex];
+		printf("%-24s %8llu jobs %10.3f ms total\n", Entry->Name, (unsigned long long)Entry->JobCount, Entry->TotalNanoseconds / 1000000.0);
+	}
+}
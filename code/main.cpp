@@ -6,243 +6,1246 @@
 
 #include "math_utils.cpp"
 #include "shader.h"
+#include "terrain_kernels.cpp"
+#include "erosion.cpp"
+#include "normals.cpp"
+#include "terrain.cpp"
+#include "platform.cpp"
+#include "world.cpp"
+#include "coordinator.cpp"
+#include "terrain_file.cpp"
+#include "heightmap_import.cpp"
+#include "result_cache.cpp"
+#include "erosion_delta.cpp"
+#include "erosion_checkpoint.cpp"
+#include "parameter_sweep.cpp"
+#include "benchmark.cpp"
+#include "scenarios.cpp"
+#include "verify.cpp"
+#include "query.cpp"
+#include "depression_fill.cpp"
+#include "streaming.cpp"
 #include <vector>
 
+#define TERRAIN_GRID_SIZE 512
+#define TERRAIN_MAX_HEIGHT 10.0f
+
+// NOTE(georgy): The viewer's terrain lives in arenas that GenerateTerrain resets instead of freeing, so a regenerated terrain
+//				 is written into the pages of the previous one. EROSION_HUGE_PAGES=1 asks for huge pages for them
+struct terrain_memory
+{
+	memory_arena HeightMaps;
+	memory_arena Scratch;
+	memory_arena Mesh;
+};
+
+static bool
+InitTerrainMemory(terrain_memory *Memory)
+{
+	uint64_t SampleCount = (uint64_t)(TERRAIN_GRID_SIZE + 1)*(TERRAIN_GRID_SIZE + 1);
+	bool HugePages = HugePagesRequested();
+	bool Result = InitArena(&Memory->HeightMaps, MemoryCategory_HeightMap, TerrainCacheEntrySize(TERRAIN_GRID_SIZE, TERRAIN_GRID_SIZE), HugePages) &&
+				  InitArena(&Memory->Scratch, MemoryCategory_Scratch, 2*sizeof(float)*SampleCount, HugePages) &&
+				  InitArena(&Memory->Mesh, MemoryCategory_Mesh, TerrainMeshSize(TERRAIN_GRID_SIZE, TERRAIN_GRID_SIZE) + 128, HugePages);
+
+	return(Result);
+}
+
 static void
-WaterErosion(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight)
+FreeTerrainMemory(terrain_memory *Memory)
 {
-	const uint32_t DropletsCount = 75000;
-	const uint32_t MaxLifeTime = 30;
-
-	srand(1337);
-	for(uint32_t Droplet = 0; Droplet < DropletsCount; Droplet++)
-	{
-		// NOTE(georgy): Get random position for droplet
-		float X = rand() % GridWidth;
-		float Z = rand() % GridHeight;
-		vec2 DropletP = vec2(X, Z);
-		vec2 DropletDir = vec2(0.0f, 0.0f);
-		float DropletSediment = 0.0f;
-		float DropletSpeed = 1.0f;
-		float DropletWater = 1.0f;
-
-		float DropletInertia = 0.4f;
-		float DropletCapacityFactor = 2.0f;
-		float MinCarryCapacity = 0.001f;
-		float DropletDeposition = 0.1f;
-		float DropletErosion = 0.3f;
-		float DropletEvaporation = 0.1f;
-		float Gravity = 4.0f;
-		int32_t Radius = 6;
-
-		for(uint32_t LifeTime = 0; LifeTime < MaxLifeTime; LifeTime++)
-		{
-			// NOTE(georgy): Current droplet's grid cell indices
-			uint32_t XIndex = (uint32_t)DropletP.x;
-			uint32_t ZIndex = (uint32_t)DropletP.y;
-			uint32_t Grid00Index = XIndex + ZIndex*(GridWidth + 1);
-			uint32_t Grid01Index = Grid00Index + 1;
-			uint32_t Grid10Index = Grid00Index + (GridWidth + 1);
-			uint32_t Grid11Index = Grid00Index + (GridWidth + 1) + 1;
-
-			// NOTE(georgy): Droplet's offset inside the cell
-			float U = (DropletP.x - XIndex);
-			float V = (DropletP.y - ZIndex);
-
-			// NOTE(georgy): Find current height, gradient and direction
-			float Height00 = HeightMap[Grid00Index];
-			float Height01 = HeightMap[Grid01Index];
-			float Height10 = HeightMap[Grid10Index];
-			float Height11 = HeightMap[Grid11Index];
-			vec2 Grad00 = vec2(Height01 - Height00, Height10 - Height00);
-			vec2 Grad01 = vec2(Height01 - Height00, Height11 - Height01);
-			vec2 Grad10 = vec2(Height11 - Height10, Height10 - Height00);
-			vec2 Grad11 = vec2(Height11 - Height10, Height11 - Height01);
-			vec2 GradInterpolation0 = Lerp(Grad00, Grad01, U);
-			vec2 GradInterpolation1 = Lerp(Grad10, Grad11, U);
-			vec2 Grad = Lerp(GradInterpolation0, GradInterpolation1, V);
-
-			vec2 OldP = DropletP;
-			DropletDir = NOZ(Lerp(Grad, DropletDir, DropletInertia));
-			DropletP -= DropletDir;
-
-			float OldHeightInterpolation0 = Lerp(Height00, Height01, U);
-			float OldHeightInterpolation1 = Lerp(Height10, Height11, U);
-			float OldHeight = Lerp(OldHeightInterpolation0, OldHeightInterpolation1, V);
-
-			if(((DropletDir.x == 0.0f) && (DropletDir.y == 0.0f)) ||
-			    (DropletP.x < 0.0f) || (DropletP.x >= GridWidth) ||
-				(DropletP.y < 0.0f) || (DropletP.y >= GridHeight))
+	FreeArena(&Memory->HeightMaps);
+	FreeArena(&Memory->Scratch);
+	FreeArena(&Memory->Mesh);
+}
+
+// NOTE(georgy): Generates the viewer's terrain, or maps it from the cache in "cache" (EROSION_CACHE_DIR) when it was
+//				 generated with the same settings before. EROSION_CACHE=0 always generates and leaves the cache alone.
+//				 Whatever the previous terrain had in Memory is reused, so it has to be freed (FreeCachedTerrain) before
+static bool
+GenerateTerrain(job_system *Jobs, terrain_memory *Memory, uint32_t ErosionSeed, terrain_cache_entry *Terrain, terrain_mesh *Mesh)
+{
+	TIMED_FUNCTION();
+
+	const uint32_t GridWidth = TERRAIN_GRID_SIZE;
+	const uint32_t GridHeight = TERRAIN_GRID_SIZE;
+
+	const float TerrainWidth = 32.0f;
+	const float TerrainHeight = 32.0f;
+	const float MaxHeight = TERRAIN_MAX_HEIGHT;
+
+	ResetArena(&Memory->HeightMaps);
+	ResetArena(&Memory->Scratch);
+	ResetArena(&Memory->Mesh);
+
+	noise_params Noise = DefaultNoiseParams(MaxHeight);
+	erosion_params ErosionParams = DefaultErosionParams();
+	ErosionParams.Seed = ErosionSeed;
+	const char *StorageEnv = getenv("EROSION_HEIGHT_STORAGE");
+	bool QuantizedStorage = StorageEnv && (strcmp(StorageEnv, "u16") == 0);
+	const char *FillEnv = getenv("EROSION_FILL_DEPRESSIONS");
+	bool FillPits = FillEnv && (atoi(FillEnv) != 0);
+
+	// NOTE(georgy): EROSION_LAYERS=1 saves the flow, deposit and erosion layers next to the heights with EROSION_SAVE_TERRAIN.
+	//				 They only come out of the droplet loop, so the cache is skipped then. There are none with u16 storage
+	const char *SaveFilename = getenv("EROSION_SAVE_TERRAIN");
+	const char *LayersEnv = getenv("EROSION_LAYERS");
+	bool SaveLayers = SaveFilename && LayersEnv && (atoi(LayersEnv) != 0) && !QuantizedStorage;
+	erosion_layers Layers = {};
+
+	const char *CacheEnv = getenv("EROSION_CACHE");
+	bool UseCache = (!CacheEnv || (atoi(CacheEnv) != 0)) && !SaveLayers;
+	const char *CacheDirectory = getenv("EROSION_CACHE_DIR") ? getenv("EROSION_CACHE_DIR") : "cache";
+	uint64_t CacheKey = TerrainCacheKey(&Noise, &ErosionParams, GridWidth, GridHeight, (QuantizedStorage ? 1 : 0) | (FillPits ? 2 : 0));
+	char CacheFilename[512];
+	GetTerrainCacheFilename(CacheFilename, sizeof(CacheFilename), CacheDirectory, CacheKey);
+
+	uint64_t BeginTime = GetNanoseconds();
+	bool CacheHit = UseCache && LoadCachedTerrain(Terrain, CacheFilename, CacheKey, GridWidth, GridHeight);
+	if(!CacheHit)
+	{
+		float *HeightMap;
+		{
+			MEMORY_PHASE("Noise");
+			if(!AllocateCachedTerrain(Terrain, &Memory->HeightMaps, CacheKey, GridWidth, GridHeight))
 			{
-				break;	
+				return(false);
 			}
 
-			// NOTE(georgy): New droplet's position grid cell indices
-			uint32_t NewXIndex = (uint32_t)DropletP.x;
-			uint32_t NewZIndex = (uint32_t)DropletP.y;
-			uint32_t NewGrid00Index = NewXIndex + NewZIndex*(GridWidth + 1);
-			uint32_t NewGrid01Index = NewGrid00Index + 1;
-			uint32_t NewGrid10Index = NewGrid00Index + (GridWidth + 1);
-			uint32_t NewGrid11Index = NewGrid00Index + (GridWidth + 1) + 1;
-
-			// NOTE(georgy): New droplet's offset inside the cell
-			float NewU = (DropletP.x - NewXIndex);
-			float NewV = (DropletP.y - NewZIndex);
-
-			// NOTE(georgy): Find new height
-			float NewHeight00 = HeightMap[NewGrid00Index];
-			float NewHeight01 = HeightMap[NewGrid01Index];
-			float NewHeight10 = HeightMap[NewGrid10Index];
-			float NewHeight11 = HeightMap[NewGrid11Index];
-			float NewHeightInterpolation0 = Lerp(NewHeight00, NewHeight01, NewU);
-			float NewHeightInterpolation1 = Lerp(NewHeight10, NewHeight11, NewU);
-			float NewHeight = Lerp(NewHeightInterpolation0, NewHeightInterpolation1, NewV);
-
-			// NOTE(georgy): Find the difference between old and new heightm, and calculate new carry capacity
-			float HeightDiff = NewHeight - OldHeight;
-			float DropletCarryCapacity = Max(-HeightDiff*DropletSpeed*DropletWater*DropletCapacityFactor, MinCarryCapacity);
-
-			// NOTE(georgy): If droplet's carrying more than it has capacity, or if NewHeight > OldHeight
-			if((DropletCarryCapacity < DropletSediment) || (HeightDiff > 0))
+			HeightMap = Terrain->HeightMap;
+			FillHeightMapNoise(Jobs, HeightMap, GridWidth, GridHeight, 0, 0, &Noise);
+		}
+
+		// NOTE(georgy): EROSION_FILL_DEPRESSIONS=1 raises the small pits of the noise before the droplets run (depression_fill.cpp)
+		if(FillPits)
+		{
+			MEMORY_PHASE("Fill");
+			depression_fill_params FillParams = DefaultDepressionFillParams();
+			depression_fill_stats FillStats;
+			if(FillDepressions(Jobs, HeightMap, GridWidth, GridHeight, &FillParams, &FillStats))
 			{
-				float DropAmount = (HeightDiff > 0) ? Min(DropletSediment, HeightDiff) : (DropletSediment - DropletCarryCapacity)*DropletDeposition;
-				DropletSediment -= DropAmount;
+				printf("Filled %u of %u depressions\n", FillStats.FilledCount, FillStats.DepressionCount);
+			}
+		}
 
-				HeightMap[Grid00Index] += DropAmount*(1.0f - U)*(1.0f - V);
-				HeightMap[Grid01Index] += DropAmount*U*(1.0f - V);
-				HeightMap[Grid10Index] += DropAmount*(1.0f - U)*V;
-				HeightMap[Grid11Index] += DropAmount*U*V;
+		// NOTE(georgy): Droplets of one heightmap depend on each other, so this stays on the calling thread
+		{
+			MEMORY_PHASE("Erosion");
+			temporary_memory Temporary = BeginTemporaryMemory(&Memory->Scratch);
+			uint16_t *Samples = QuantizedStorage ? PushArray(&Memory->Scratch, (GridWidth + 1)*(GridHeight + 1), uint16_t) : 0;
+			if(Samples)
+			{
+				quantized_heights Heights;
+				random_series Series = RandomSeed(ErosionParams.Seed);
+				QuantizeHeightMap(&Heights, Samples, HeightMap, GridWidth, GridHeight, ErosionParams.Seed);
+				WaterErosion(&Heights, GridWidth, GridHeight, &ErosionParams, &Series);
+				DequantizeHeightMap(HeightMap, &Heights, GridWidth, GridHeight);
+				if(Heights.SaturatedCount)
+				{
+					printf("%u deposits went past the top of the 16-bit height range and were clamped\n", Heights.SaturatedCount);
+				}
 			}
-			else
+			else if(SaveLayers)
 			{
-				// NOTE(georgy): Erosion
-				float TakeAmount = Min((DropletCarryCapacity - DropletSediment)*DropletErosion, -HeightDiff);
-
-				float WeightSum = 0.0f;
-				for(int32_t ZOffset = -Radius; ZOffset <= Radius; ZOffset++)
+				uint64_t SampleCount = (uint64_t)(GridWidth + 1)*(GridHeight + 1);
+				Layers.Flow = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*SampleCount);
+				Layers.Deposit = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*SampleCount);
+				Layers.Eroded = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*SampleCount);
+				if(Layers.Flow && Layers.Deposit && Layers.Eroded)
 				{
-					for(int32_t XOffset = -Radius; XOffset <= Radius; XOffset++)
-					{
-						int32_t XInd = XIndex + XOffset;
-						int32_t ZInd = ZIndex + ZOffset;
-						if((XInd >= 0) && (XInd <= GridWidth) && (ZInd >= 0) && (ZInd <= GridHeight))
-						{
-							WeightSum += Max(0.0f, Radius - Length(vec2i(XInd, ZInd) - OldP));
-						}
-					}
+					WaterErosion(HeightMap, GridWidth, GridHeight, &ErosionParams, &Layers);
 				}
-
-				for(int32_t ZOffset = -Radius; ZOffset <= Radius; ZOffset++)
+				else
 				{
-					for(int32_t XOffset = -Radius; XOffset <= Radius; XOffset++)
-					{
-						int32_t XInd = XIndex + XOffset;
-						int32_t ZInd = ZIndex + ZOffset;
-						if((XInd >= 0) && (XInd <= GridWidth) && (ZInd >= 0) && (ZInd <= GridHeight))
-						{
-							float Weight = Max(0.0f, Radius - Length(vec2i(XInd, ZInd) - OldP)) / WeightSum;
-							float AmountToErode = Weight*TakeAmount;
-							float DeltaSediment = (HeightMap[XInd + ZInd*(GridWidth+1)] < AmountToErode) ? HeightMap[XInd + ZInd*(GridWidth+1)] : AmountToErode;
-							HeightMap[XInd + ZInd*(GridWidth+1)] -= DeltaSediment;
-							DropletSediment += DeltaSediment;
-						}
-					}
+					printf("Out of memory for the erosion layers\n");
+					SaveLayers = false;
+					WaterErosion(HeightMap, GridWidth, GridHeight, &ErosionParams);
 				}
 			}
+			else
+			{
+				WaterErosion(HeightMap, GridWidth, GridHeight, &ErosionParams);
+			}
+			EndTemporaryMemory(Temporary);
+		}
+
+		{
+			MEMORY_PHASE("Normals");
+			CalculateNormals(Jobs, HeightMap, GridWidth, GridHeight, NormalFormat_Packed, Terrain->Normals);
+		}
+
+		if(UseCache)
+		{
+			StoreCachedTerrain(Terrain, CacheDirectory, CacheFilename);
+		}
+	}
+	uint64_t EndTime = GetNanoseconds();
+	printf("Terrain %s in %.3f ms\n", CacheHit ? "mapped from cache" : "generated", (EndTime - BeginTime) / 1000000.0);
+
+	{
+		MEMORY_PHASE("Mesh");
+		if(!PushTerrainMesh(&Memory->Mesh, Mesh, GridWidth, GridHeight))
+		{
+			FreeMemory(Layers.Eroded);
+			FreeMemory(Layers.Deposit);
+			FreeMemory(Layers.Flow);
+			FreeCachedTerrain(Terrain);
+			return(false);
+		}
+		BuildTerrainMesh(Jobs, Terrain->HeightMap, GridWidth, GridHeight, TerrainWidth, TerrainHeight, Mesh);
+	}
 
-			// NOTE(georgy): New speed and water
-			// TODO(georgy): I think, not plus but minus HeightDiff*Gravity is more correct. If we flow down, we want our speed to increase??
-			DropletSpeed = SquareRoot(Square(DropletSpeed) + HeightDiff*Gravity); 
-			DropletWater *= (1.0f - DropletEvaporation);
+	if(SaveFilename)
+	{
+		terrain_layer_source FileLayers[] =
+		{
+			{ TerrainLayer_Height, sizeof(float), Terrain->HeightMap },
+			{ TerrainLayer_Normals, sizeof(uint32_t), Terrain->Normals },
+			{ TerrainLayer_Flow, sizeof(float), Layers.Flow },
+			{ TerrainLayer_Deposit, sizeof(float), Layers.Deposit },
+			{ TerrainLayer_Erosion, sizeof(float), Layers.Eroded },
+		};
+		uint32_t LayerCount = SaveLayers ? ArrayCount(FileLayers) : 2;
+		if(!WriteTerrainFile(Jobs, SaveFilename, GridWidth, GridHeight, TERRAIN_FILE_DEFAULT_TILE_SIZE, FileLayers, LayerCount))
+		{
+			printf("Failed to save %s\n", SaveFilename);
 		}
 	}
+	FreeMemory(Layers.Eroded);
+	FreeMemory(Layers.Deposit);
+	FreeMemory(Layers.Flow);
+
+	return(true);
 }
 
-static vec3
-CalculateNormal(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, uint32_t X, uint32_t Z)
+// NOTE(georgy): Erodes the viewer's heightmap with float and with 16-bit storage from the same droplets and prints how far apart they are.
+//				 "storage" is the error of just storing the float result in 16 bits, "erosion" also includes the droplets
+//				 taking different paths over the quantized heights
+static void
+ReportQuantizedStorage(job_system *Jobs)
 {
-	if(X == 0) X = 1;
-	if(Z == 0) Z = 1;
-	if(X == GridWidth) X = GridWidth - 1;
-	if(Z == GridHeight) Z = GridHeight - 1;
-
-	float HeightLeft = HeightMap[(X - 1) + Z*(GridWidth + 1)];
-	float HeightRight = HeightMap[(X + 1) + Z*(GridWidth + 1)];
-	float HeightDown = HeightMap[X + (Z - 1)*(GridWidth + 1)];
-	float HeightUp = HeightMap[X + (Z + 1)*(GridWidth + 1)];
-
-	vec3 Normal = Normalize(vec3(HeightLeft - HeightRight, 0.125f, HeightUp - HeightDown));
-	return(Normal);
+	const uint32_t GridWidth = TERRAIN_GRID_SIZE;
+	const uint32_t GridHeight = TERRAIN_GRID_SIZE;
+	const float MaxHeight = TERRAIN_MAX_HEIGHT;
+	const uint32_t SampleCount = (GridWidth + 1)*(GridHeight + 1);
+
+	float *Source = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	float *Reference = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	float *Result = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	uint16_t *Samples = (uint16_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(uint16_t)*SampleCount);
+	if(Source && Reference && Result && Samples)
+	{
+		noise_params Noise = DefaultNoiseParams(MaxHeight);
+		FillHeightMapNoise(Jobs, Source, GridWidth, GridHeight, 0, 0, &Noise);
+		erosion_params ErosionParams = DefaultErosionParams();
+
+		memcpy(Reference, Source, sizeof(float)*SampleCount);
+		random_series Series = RandomSeed(1337);
+		uint64_t FloatBegin = GetNanoseconds();
+		WaterErosion(Reference, GridWidth, GridHeight, &ErosionParams, &Series);
+		uint64_t FloatEnd = GetNanoseconds();
+
+		quantized_heights Heights;
+		QuantizeHeightMap(&Heights, Samples, Reference, GridWidth, GridHeight, 1337);
+		DequantizeHeightMap(Result, &Heights, GridWidth, GridHeight);
+		height_error StorageError = CompareHeightMaps(Result, Reference, SampleCount);
+
+		QuantizeHeightMap(&Heights, Samples, Source, GridWidth, GridHeight, 1337);
+		Series = RandomSeed(1337);
+		uint64_t QuantizedBegin = GetNanoseconds();
+		WaterErosion(&Heights, GridWidth, GridHeight, &ErosionParams, &Series);
+		uint64_t QuantizedEnd = GetNanoseconds();
+		DequantizeHeightMap(Result, &Heights, GridWidth, GridHeight);
+		height_error ErosionError = CompareHeightMaps(Result, Reference, SampleCount);
+
+		double SourceVolume = HeightMapVolume(Source, SampleCount);
+		double ReferenceEroded = SourceVolume - HeightMapVolume(Reference, SampleCount);
+		double QuantizedEroded = SourceVolume - HeightMapVolume(Result, SampleCount);
+
+		printf("Height storage %ux%u, step %g (%g of the range)\n", GridWidth, GridHeight, Heights.Scale, 1.0 / 65535.0);
+		printf("  float: %8u bytes %10.3f ms\n", SampleCount*(uint32_t)sizeof(float), (FloatEnd - FloatBegin) / 1000000.0);
+		printf("  u16:   %8u bytes %10.3f ms\n", SampleCount*(uint32_t)sizeof(uint16_t), (QuantizedEnd - QuantizedBegin) / 1000000.0);
+		printf("  storage error: max %g rms %g mean %g\n", StorageError.MaxError, StorageError.RMSError, StorageError.MeanError);
+		printf("  erosion error: max %g rms %g mean %g\n", ErosionError.MaxError, ErosionError.RMSError, ErosionError.MeanError);
+		printf("  eroded volume: float %g u16 %g (%+.3f%%)\n", ReferenceEroded, QuantizedEroded, 100.0*(QuantizedEroded - ReferenceEroded) / ReferenceEroded);
+		printf("  saturated stores: %u\n", Heights.SaturatedCount);
+	}
+
+	FreeMemory(Samples);
+	FreeMemory(Result);
+	FreeMemory(Reference);
+	FreeMemory(Source);
 }
 
-static void
-GenerateTerrain(std::vector<vec3> &Vertices, std::vector<vec3> &Normals, std::vector<uint32_t> &Indices)
+// NOTE(georgy): Fills the depressions of a GridSize x GridSize noise heightmap with one tile and with TileSize tiles (they have to
+//				 agree), then erodes it with and without the fill from the same droplets. Droplets per area are the viewer's.
+//				 "depressions" after erosion counts every pit left, whatever its size
+static bool
+ReportDepressionFill(job_system *Jobs, uint32_t GridSize, uint32_t TileSize)
 {
-	const uint32_t GridWidth = 512;
-	const uint32_t GridHeight = 512;
+	const float MaxHeight = TERRAIN_MAX_HEIGHT;
+	const uint64_t SampleCount = (uint64_t)(GridSize + 1)*(GridSize + 1);
 
-	const float TerrainWidth = 32.0f;
-	const float TerrainHeight = 32.0f;
-	const float MaxHeight = 10.0f;
+	float *Source = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	float *Filled = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	float *TiledFilled = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	bool Result = Source && Filled && TiledFilled;
+	if(Result)
+	{
+		noise_params Noise = DefaultNoiseParams(MaxHeight);
+		FillHeightMapNoise(Jobs, Source, GridSize, GridSize, 0, 0, &Noise);
 
-	float* HeightMap = (float*)malloc(sizeof(float) * (GridWidth + 1) * (GridHeight + 1));
-	if (HeightMap)
+		depression_fill_params Params = DefaultDepressionFillParams();
+		depression_fill_params SingleTile = Params;
+		SingleTile.TileSize = GridSize + 1;
+		Params.TileSize = TileSize;
+		depression_fill_stats Stats;
+		depression_fill_stats TiledStats;
+		memcpy(Filled, Source, sizeof(float)*SampleCount);
+		memcpy(TiledFilled, Source, sizeof(float)*SampleCount);
+		uint64_t SingleBegin = GetNanoseconds();
+		Result = FillDepressions(0, Filled, GridSize, GridSize, &SingleTile, &Stats);
+		uint64_t SingleEnd = GetNanoseconds();
+		Result = Result && FillDepressions(Jobs, TiledFilled, GridSize, GridSize, &Params, &TiledStats);
+		uint64_t TiledEnd = GetNanoseconds();
+		if(!Result)
+		{
+			printf("Out of memory for the depression fill\n");
+		}
+		else
+		{
+			bool Match = (memcmp(Filled, TiledFilled, sizeof(float)*SampleCount) == 0);
+			printf("Depression fill %ux%u, max depth %g, max area %u, rise %g per sample (at least a float step)\n", GridSize, GridSize, Params.MaxDepth, Params.MaxArea, Params.RisePerSample);
+			printf("  one tile:   %10.3f ms\n", (SingleEnd - SingleBegin) / 1000000.0);
+			printf("  %u tiles: %10.3f ms on %u workers, %s the single tile\n", TiledStats.TileCount, (TiledEnd - SingleEnd) / 1000000.0,
+				   Jobs->WorkerCount, Match ? "same as" : "DIFFERENT from");
+			printf("  depressions: %u (%llu samples, volume %g), filled %u (%llu samples, volume %g)\n",
+				   Stats.DepressionCount, (unsigned long long)Stats.DepressionSamples, Stats.DepressionVolume,
+				   Stats.FilledCount, (unsigned long long)Stats.FilledSamples, Stats.FilledVolume);
+			Result = Match;
+		}
+	}
+
+	if(Result && (GridSize <= 4096))
+	{
+		// NOTE(georgy): Source and TiledFilled get eroded in place, Filled keeps the filled heightmap
+		erosion_params ErosionParams = DefaultErosionParams();
+		ErosionParams.DropletCount = (uint32_t)((uint64_t)ErosionParams.DropletCount*GridSize*GridSize / (TERRAIN_GRID_SIZE*TERRAIN_GRID_SIZE));
+		double SourceVolume = HeightMapVolume(Source, SampleCount);
+		double FilledVolume = HeightMapVolume(Filled, SampleCount);
+		memcpy(TiledFilled, Filled, sizeof(float)*SampleCount);
+
+		uint64_t SourceBegin = GetNanoseconds();
+		uint64_t SourceSteps = WaterErosion(Source, GridSize, GridSize, &ErosionParams);
+		uint64_t SourceEnd = GetNanoseconds();
+		uint64_t FilledSteps = WaterErosion(TiledFilled, GridSize, GridSize, &ErosionParams);
+		uint64_t FilledEnd = GetNanoseconds();
+
+		depression_fill_params CountOnly = DefaultDepressionFillParams();
+		CountOnly.MaxArea = 0;
+		depression_fill_stats SourcePits;
+		depression_fill_stats FilledPits;
+		FillDepressions(Jobs, Source, GridSize, GridSize, &CountOnly, &SourcePits);
+		FillDepressions(Jobs, TiledFilled, GridSize, GridSize, &CountOnly, &FilledPits);
+		height_error Difference = CompareHeightMaps(TiledFilled, Source, (uint32_t)SampleCount);
+
+		printf("Erosion, %u droplets\n", ErosionParams.DropletCount);
+		printf("  unfilled: %12llu steps (%.2f per droplet) %10.3f ms\n", (unsigned long long)SourceSteps,
+			   (double)SourceSteps / ErosionParams.DropletCount, (SourceEnd - SourceBegin) / 1000000.0);
+		printf("  filled:   %12llu steps (%.2f per droplet) %10.3f ms, %+.2f%% steps\n", (unsigned long long)FilledSteps,
+			   (double)FilledSteps / ErosionParams.DropletCount, (FilledEnd - SourceEnd) / 1000000.0,
+			   100.0*((double)FilledSteps - (double)SourceSteps) / (double)SourceSteps);
+		printf("  eroded volume: unfilled %g filled %g\n", SourceVolume - HeightMapVolume(Source, SampleCount),
+			   FilledVolume - HeightMapVolume(TiledFilled, SampleCount));
+		printf("  depressions after: unfilled %u (%llu samples, volume %g) filled %u (%llu samples, volume %g)\n",
+			   SourcePits.DepressionCount, (unsigned long long)SourcePits.DepressionSamples, SourcePits.DepressionVolume,
+			   FilledPits.DepressionCount, (unsigned long long)FilledPits.DepressionSamples, FilledPits.DepressionVolume);
+		printf("  filled vs unfilled: max %g rms %g mean %g\n", Difference.MaxError, Difference.RMSError, Difference.MeanError);
+	}
+
+	FreeMemory(TiledFilled);
+	FreeMemory(Filled);
+	FreeMemory(Source);
+	return(Result);
+}
+
+// NOTE(georgy): Prints what's in a terrain file and decompresses every layer to check it
+static bool
+PrintTerrainFileInfo(job_system *Jobs, const char *Filename)
+{
+	terrain_file File;
+	if(!OpenTerrainFile(&File, Filename))
 	{
-		memset(HeightMap, 0, sizeof(float) * (GridWidth + 1) * (GridHeight + 1));
-		for(uint32_t Z = 0; Z <= GridHeight; Z++)
+		return(false);
+	}
+
+	const terrain_file_header *Header = File.Header;
+	printf("%s: %ux%u cells, %ux%u tiles of %u, %llu bytes\n", Filename, Header->GridWidth, Header->GridHeight,
+		   File.TilesX, File.TilesZ, Header->TileSize, (unsigned long long)File.File.Size);
+
+	bool Result = true;
+	uint32_t TileCount = File.TilesX*File.TilesZ;
+	for(uint32_t LayerIndex = 0; LayerIndex < Header->LayerCount; LayerIndex++)
+	{
+		uint32_t BytesPerSample = File.Layers[LayerIndex].BytesPerSample;
+		uint64_t RawSize = (uint64_t)(Header->GridWidth + 1)*(Header->GridHeight + 1)*BytesPerSample;
+		uint64_t CompressedSize = 0;
+		for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
 		{
-			for(uint32_t X = 0; X <= GridWidth; X++)
+			CompressedSize += File.Tiles[LayerIndex*TileCount + TileIndex].Size;
+		}
+
+		void *Samples = AllocateMemory(MemoryCategory_Scratch, RawSize);
+		uint64_t BeginTime = GetNanoseconds();
+		bool LayerValid = Samples && ReadTerrainLayer(Jobs, &File, LayerIndex, Samples);
+		uint64_t EndTime = GetNanoseconds();
+		printf("  layer %u kind %u: %llu -> %llu bytes (%.2fx), decompressed in %.3f ms%s\n", LayerIndex, File.Layers[LayerIndex].Kind,
+			   (unsigned long long)RawSize, (unsigned long long)CompressedSize, (double)RawSize / CompressedSize,
+			   (EndTime - BeginTime) / 1000000.0, LayerValid ? "" : ", CORRUPT");
+		Result = Result && LayerValid;
+		FreeMemory(Samples);
+	}
+
+	CloseTerrainFile(&File);
+	return(Result);
+}
+
+// NOTE(georgy): Imports a heightmap, erodes it with the droplet density the viewer uses on 512x512 and saves it as a terrain file
+static bool
+ErodeHeightMapFile(job_system *Jobs, const char *InputFilename, const char *OutputFilename)
+{
+	const float MaxHeight = TERRAIN_MAX_HEIGHT;
+
+	uint64_t ImportBegin = GetNanoseconds();
+	imported_heightmap Imported;
+	{
+		MEMORY_PHASE("Import");
+		if(!ImportHeightMap(Jobs, InputFilename, MaxHeight, &Imported))
+		{
+			return(false);
+		}
+	}
+	uint64_t ImportEnd = GetNanoseconds();
+
+	uint32_t GridWidth = Imported.GridWidth;
+	uint32_t GridHeight = Imported.GridHeight;
+	uint64_t SampleCount = (uint64_t)(GridWidth + 1)*(GridHeight + 1);
+	erosion_params ErosionParams = DefaultErosionParams();
+	ErosionParams.DropletCount = (uint32_t)(((uint64_t)ErosionParams.DropletCount*GridWidth*GridHeight) / (TERRAIN_GRID_SIZE*TERRAIN_GRID_SIZE));
+
+	// NOTE(georgy): EROSION_LAYERS=1 adds the flow, deposit and erosion layers to the file
+	const char *LayersEnv = getenv("EROSION_LAYERS");
+	erosion_layers Layers = {};
+	if(LayersEnv && (atoi(LayersEnv) != 0))
+	{
+		Layers.Flow = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*SampleCount);
+		Layers.Deposit = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*SampleCount);
+		Layers.Eroded = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*SampleCount);
+	}
+	bool SaveLayers = Layers.Flow && Layers.Deposit && Layers.Eroded;
+	{
+		MEMORY_PHASE("Erosion");
+		if(SaveLayers)
+		{
+			WaterErosion(Imported.HeightMap, GridWidth, GridHeight, &ErosionParams, &Layers);
+		}
+		else
+		{
+			WaterErosion(Imported.HeightMap, GridWidth, GridHeight, &ErosionParams);
+		}
+	}
+	uint64_t ErosionEnd = GetNanoseconds();
+
+	MEMORY_PHASE("Export");
+	bool Result = false;
+	uint32_t *Normals = (uint32_t *)AllocateMemory(MemoryCategory_Mesh, sizeof(uint32_t)*SampleCount);
+	if(Normals)
+	{
+		CalculateNormals(Jobs, Imported.HeightMap, GridWidth, GridHeight, NormalFormat_Packed, Normals);
+		terrain_layer_source FileLayers[] =
+		{
+			{ TerrainLayer_Height, sizeof(float), Imported.HeightMap },
+			{ TerrainLayer_Normals, sizeof(uint32_t), Normals },
+			{ TerrainLayer_Flow, sizeof(float), Layers.Flow },
+			{ TerrainLayer_Deposit, sizeof(float), Layers.Deposit },
+			{ TerrainLayer_Erosion, sizeof(float), Layers.Eroded },
+		};
+		uint32_t LayerCount = SaveLayers ? ArrayCount(FileLayers) : 2;
+		Result = WriteTerrainFile(Jobs, OutputFilename, GridWidth, GridHeight, TERRAIN_FILE_DEFAULT_TILE_SIZE, FileLayers, LayerCount);
+		FreeMemory(Normals);
+	}
+	FreeMemory(Layers.Eroded);
+	FreeMemory(Layers.Deposit);
+	FreeMemory(Layers.Flow);
+	uint64_t ExportEnd = GetNanoseconds();
+
+	printf("%s: %ux%u cells, %u droplets\n", InputFilename, GridWidth, GridHeight, ErosionParams.DropletCount);
+	printf("  import %.3f ms, erosion %.3f ms, normals and export %.3f ms\n", (ImportEnd - ImportBegin) / 1000000.0,
+		   (ErosionEnd - ImportEnd) / 1000000.0, (ExportEnd - ErosionEnd) / 1000000.0);
+
+	FreeImportedHeightMap(&Imported);
+	return(Result);
+}
+
+// NOTE(georgy): Stores the viewer's terrain as an erosion delta, loads it back and compares it with the heights and with
+//				 the other ways of storing them. Step is a fraction of MaxHeight
+static bool
+ReportErosionDelta(job_system *Jobs, const char *Filename, float StepFraction)
+{
+	const uint32_t GridWidth = TERRAIN_GRID_SIZE;
+	const uint32_t GridHeight = TERRAIN_GRID_SIZE;
+	const float MaxHeight = TERRAIN_MAX_HEIGHT;
+	const uint32_t SampleCount = (GridWidth + 1)*(GridHeight + 1);
+
+	float *HeightMap = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	float *Loaded = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	if(!HeightMap || !Loaded)
+	{
+		FreeMemory(Loaded);
+		FreeMemory(HeightMap);
+		return(false);
+	}
+
+	noise_params Noise = DefaultNoiseParams(MaxHeight);
+	erosion_params ErosionParams = DefaultErosionParams();
+	FillHeightMapNoise(Jobs, HeightMap, GridWidth, GridHeight, 0, 0, &Noise);
+	WaterErosion(HeightMap, GridWidth, GridHeight, &ErosionParams);
+
+	float Step = StepFraction*MaxHeight;
+	char RawFilename[1024];
+	char TerrainFilename[1024];
+	snprintf(RawFilename, sizeof(RawFilename), "%s.r32", Filename);
+	snprintf(TerrainFilename, sizeof(TerrainFilename), "%s.ter", Filename);
+	terrain_layer_source Layer = { TerrainLayer_Height, sizeof(float), HeightMap };
+	bool Result = WriteErosionDeltaFile(Jobs, Filename, HeightMap, GridWidth, GridHeight, 0, 0, &Noise, &ErosionParams, Step) &&
+				  WriteEntireFile(RawFilename, HeightMap, sizeof(float)*SampleCount) &&
+				  WriteTerrainFile(Jobs, TerrainFilename, GridWidth, GridHeight, TERRAIN_FILE_DEFAULT_TILE_SIZE, &Layer, 1);
+
+	erosion_delta_file DeltaFile;
+	if(Result && OpenErosionDeltaFile(&DeltaFile, Filename))
+	{
+		uint64_t DeltaBegin = GetNanoseconds();
+		Result = ReadErosionDeltaFile(Jobs, &DeltaFile, Loaded);
+		uint64_t DeltaEnd = GetNanoseconds();
+		uint64_t DeltaSize = DeltaFile.File.Size;
+		CloseErosionDeltaFile(&DeltaFile);
+
+		height_error Error = CompareHeightMaps(Loaded, HeightMap, SampleCount);
+
+		uint64_t RawBegin = GetNanoseconds();
+		Result = ReadFileInto(RawFilename, Loaded, sizeof(float)*SampleCount) && Result;
+		uint64_t RawEnd = GetNanoseconds();
+
+		terrain_file TerrainFile;
+		uint64_t TerrainSize = 0;
+		uint64_t TerrainBegin = GetNanoseconds();
+		if(OpenTerrainFile(&TerrainFile, TerrainFilename))
+		{
+			Result = ReadTerrainLayer(Jobs, &TerrainFile, 0, Loaded) && Result;
+			TerrainSize = TerrainFile.File.Size;
+			CloseTerrainFile(&TerrainFile);
+		}
+		uint64_t TerrainEnd = GetNanoseconds();
+
+		uint64_t RawSize = sizeof(float)*SampleCount;
+		printf("Erosion delta %ux%u, step %g\n", GridWidth, GridHeight, Step);
+		printf("  raw float:    %8llu bytes          %8.3f ms\n", (unsigned long long)RawSize, (RawEnd - RawBegin) / 1000000.0);
+		printf("  terrain file: %8llu bytes (%5.2fx) %8.3f ms\n", (unsigned long long)TerrainSize, (double)RawSize / TerrainSize,
+			   (TerrainEnd - TerrainBegin) / 1000000.0);
+		printf("  delta:        %8llu bytes (%5.2fx) %8.3f ms\n", (unsigned long long)DeltaSize, (double)RawSize / DeltaSize,
+			   (DeltaEnd - DeltaBegin) / 1000000.0);
+		printf("  delta error: max %g rms %g mean %g\n", Error.MaxError, Error.RMSError, Error.MeanError);
+	}
+
+	FreeMemory(Loaded);
+	FreeMemory(HeightMap);
+	return(Result);
+}
+
+// NOTE(georgy): Erodes the viewer's heightmap with checkpoints in Directory, continuing from them if a previous run was stopped.
+//				 The hash of the result is the same however many times the run was interrupted
+static bool
+ErodeWithCheckpoints(job_system *Jobs, const char *Directory, uint32_t DropletCount, float IntervalSeconds)
+{
+	const uint32_t GridWidth = TERRAIN_GRID_SIZE;
+	const uint32_t GridHeight = TERRAIN_GRID_SIZE;
+	const float MaxHeight = TERRAIN_MAX_HEIGHT;
+	const uint32_t SampleCount = (GridWidth + 1)*(GridHeight + 1);
+
+	float *HeightMap = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	if(!HeightMap)
+	{
+		return(false);
+	}
+
+	noise_params Noise = DefaultNoiseParams(MaxHeight);
+	erosion_params ErosionParams = DefaultErosionParams();
+	ErosionParams.DropletCount = DropletCount;
+	FillHeightMapNoise(Jobs, HeightMap, GridWidth, GridHeight, 0, 0, &Noise);
+
+	erosion_checkpoint_stats Stats;
+	uint64_t BeginTime = GetNanoseconds();
+	bool Result = WaterErosionCheckpointed(HeightMap, GridWidth, GridHeight, &ErosionParams, Directory, IntervalSeconds, &Stats);
+	uint64_t EndTime = GetNanoseconds();
+	if(Result)
+	{
+		printf("Eroded %u droplets, resumed at %u\n", DropletCount, Stats.ResumedCursor);
+		printf("  %u checkpoints, %llu bytes, %.3f ms of %.3f ms\n", Stats.CheckpointCount, (unsigned long long)Stats.BytesWritten,
+			   Stats.Nanoseconds / 1000000.0, (EndTime - BeginTime) / 1000000.0);
+		printf("  heightmap hash %016llx\n", (unsigned long long)HashBytes(HeightMap, sizeof(float)*SampleCount));
+	}
+
+	FreeMemory(HeightMap);
+	return(Result);
+}
+
+// NOTE(georgy): Erodes the viewer's heightmap with every combination of the parameter values in AxisArgs ("Name=Value,Value,...")
+static bool
+SweepErosionParams(job_system *Jobs, const char *OutputDirectory, char **AxisArgs, uint32_t AxisCount)
+{
+	const uint32_t GridWidth = TERRAIN_GRID_SIZE;
+	const uint32_t GridHeight = TERRAIN_GRID_SIZE;
+	const float MaxHeight = TERRAIN_MAX_HEIGHT;
+
+	sweep_axis Axes[MAX_SWEEP_AXES];
+	if(AxisCount > MAX_SWEEP_AXES)
+	{
+		printf("At most %u parameters can be swept at once\n", MAX_SWEEP_AXES);
+		return(false);
+	}
+	for(uint32_t AxisIndex = 0; AxisIndex < AxisCount; AxisIndex++)
+	{
+		if(!ParseSweepAxis(Axes + AxisIndex, AxisArgs[AxisIndex]))
+		{
+			return(false);
+		}
+	}
+
+	float *Base = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*(GridWidth + 1)*(GridHeight + 1));
+	if(!Base)
+	{
+		return(false);
+	}
+	noise_params Noise = DefaultNoiseParams(MaxHeight);
+	FillHeightMapNoise(Jobs, Base, GridWidth, GridHeight, 0, 0, &Noise);
+
+	erosion_params BaseParams = DefaultErosionParams();
+	std::vector<erosion_params> Configurations;
+	BuildSweepConfigurations(&BaseParams, Axes, AxisCount, Configurations);
+
+	uint32_t ProcessCount = std::thread::hardware_concurrency();
+	bool Result = RunParameterSweep(Base, GridWidth, GridHeight, Configurations, Axes, AxisCount, OutputDirectory,
+									(ProcessCount > 0) ? ProcessCount : 1);
+
+	FreeMemory(Base);
+	return(Result);
+}
+
+// NOTE(georgy): Body of a scenario from scenarios.cpp, runs in its own process (--scenario-run) and writes the checksum of its output.
+//				 viewer512 - the viewer's startup without the cache: noise, erosion, normals and mesh of 512x512
+//				 erode4k   - 4096x4096 noise eroded with the viewer's droplet density and exported as a terrain file
+//				 world16k  - GenerateWorld with 32x32 tiles of 512
+static bool
+RunScenario(job_system *Jobs, const char *Name, const char *Directory)
+{
+	bool Result = false;
+	uint64_t Checksum = HASH_BYTES_SEED;
+
+	if(strcmp(Name, "viewer512") == 0)
+	{
+		SetEnv("EROSION_CACHE", "0");
+		SetEnv("EROSION_HEIGHT_STORAGE", 0);
+		SetEnv("EROSION_SAVE_TERRAIN", 0);
+
+		terrain_memory Memory = {};
+		terrain_mesh Mesh;
+		terrain_cache_entry Terrain;
+		Result = InitTerrainMemory(&Memory) && GenerateTerrain(Jobs, &Memory, DefaultErosionParams().Seed, &Terrain, &Mesh);
+		if(Result)
+		{
+			uint64_t SampleCount = (uint64_t)(Terrain.GridWidth + 1)*(Terrain.GridHeight + 1);
+			Checksum = HashBytes(Terrain.HeightMap, sizeof(float)*SampleCount, Checksum);
+			Checksum = HashBytes(Terrain.Normals, sizeof(uint32_t)*SampleCount, Checksum);
+			Checksum = HashBytes(Mesh.Vertices, sizeof(vec3)*Mesh.VertexCount, Checksum);
+			Checksum = HashBytes(Mesh.Indices, sizeof(uint32_t)*Mesh.IndexCount, Checksum);
+			FreeCachedTerrain(&Terrain);
+		}
+		FreeTerrainMemory(&Memory);
+	}
+	else if(strcmp(Name, "erode4k") == 0)
+	{
+		const uint32_t GridSize = 4096;
+		uint64_t SampleCount = (uint64_t)(GridSize + 1)*(GridSize + 1);
+		float *HeightMap = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+		uint32_t *Normals = (uint32_t *)AllocateMemory(MemoryCategory_Mesh, sizeof(uint32_t)*SampleCount);
+		if(HeightMap && Normals)
+		{
+			noise_params Noise = DefaultNoiseParams(TERRAIN_MAX_HEIGHT);
+			erosion_params ErosionParams = DefaultErosionParams();
+			ErosionParams.DropletCount = (uint32_t)(((uint64_t)ErosionParams.DropletCount*GridSize*GridSize) / (TERRAIN_GRID_SIZE*TERRAIN_GRID_SIZE));
+			FillHeightMapNoise(Jobs, HeightMap, GridSize, GridSize, 0, 0, &Noise);
+			WaterErosion(HeightMap, GridSize, GridSize, &ErosionParams);
+			CalculateNormals(Jobs, HeightMap, GridSize, GridSize, NormalFormat_Packed, Normals);
+
+			char Filename[512];
+			snprintf(Filename, sizeof(Filename), "%s/erode4k.ter", Directory);
+			terrain_layer_source Layers[] =
 			{
-				float Noise = 1.5f*(0.5f*PerlinNoise2D(vec2(0.5f*0.01345f*X, -0.5f*0.01345f*Z)) + 0.5f);
-				Noise += 0.5f*(0.5f*PerlinNoise2D(vec2(1.0f*0.01345f*X, -1.0f*0.01345f*Z)) + 0.5f);
-				Noise += 0.25f*(0.5f*PerlinNoise2D(vec2(2.0f*0.01345f*X, -2.0f*0.01345f*Z)) + 0.5f);
-				Noise += 0.125f*(0.5f*PerlinNoise2D(vec2(4.0f*0.01345f*X, -4.0f*0.01345f*Z)) + 0.5f);
-				float Height = MaxHeight*Noise;
-				HeightMap[X + Z*(GridWidth + 1)] = Height;
-			}	
+				{ TerrainLayer_Height, sizeof(float), HeightMap },
+				{ TerrainLayer_Normals, sizeof(uint32_t), Normals },
+			};
+			Result = WriteTerrainFile(Jobs, Filename, GridSize, GridSize, TERRAIN_FILE_DEFAULT_TILE_SIZE, Layers, ArrayCount(Layers)) &&
+					 HashFile(Filename, &Checksum);
+			remove(Filename);
 		}
+		FreeMemory(Normals);
+		FreeMemory(HeightMap);
+	}
+	else if(strcmp(Name, "world16k") == 0)
+	{
+		char OutputDirectory[512];
+		snprintf(OutputDirectory, sizeof(OutputDirectory), "%s/world16k", Directory);
 
-		WaterErosion(HeightMap, GridWidth, GridHeight);
+		world_params WorldParams = DefaultWorldParams();
+		WorldParams.TilesX = 32;
+		WorldParams.TilesZ = 32;
+		WorldParams.OutputDirectory = OutputDirectory;
+		Result = GenerateWorld(Jobs, &WorldParams);
 
-		float StepX = TerrainWidth / GridWidth;
-		float StepZ = TerrainHeight / GridHeight;
-		for(uint32_t Z = 0; Z <= GridHeight; Z++)
+		// NOTE(georgy): Tiles are hashed in row order and removed, a 16k world is a couple of gigabytes
+		for(uint32_t TileZ = 0; TileZ < WorldParams.TilesZ; TileZ++)
 		{
-			for(uint32_t X = 0; X <= GridWidth; X++)
+			for(uint32_t TileX = 0; TileX < WorldParams.TilesX; TileX++)
 			{
-				float Height = HeightMap[X + Z*(GridWidth + 1)];
-				vec3 P = vec3(StepX*X, Height, -StepZ*Z);
-				vec3 Normal = CalculateNormal(HeightMap, GridWidth, GridHeight, X, Z);
+				char Filename[512];
+				GetWorldTileFilename(Filename, sizeof(Filename), &WorldParams, TileX, TileZ, "r32");
+				Result = Result && HashFile(Filename, &Checksum);
+				remove(Filename);
+				GetWorldTileFilename(Filename, sizeof(Filename), &WorldParams, TileX, TileZ, "n32");
+				Result = Result && HashFile(Filename, &Checksum);
+				remove(Filename);
+			}
+		}
+	}
+	else
+	{
+		printf("Unknown scenario %s\n", Name);
+	}
+
+	Result = Result && WriteScenarioChecksum(Directory, Name, Checksum);
+	return(Result);
+}
+
+// NOTE(georgy): One dab of the erosion brush on the cell (CenterX, CenterZ). Droplets spawn in a circle of Radius cells that
+//				 gets weaker towards its edge, and their effect fades out over Radius/2 cells around it.
+//				 Returns the vertices whose heights or normals changed (XMin > XMax if none did). Its buffers are temporary memory of Scratch
+static brush_rect
+ApplyErosionBrush(job_system *Jobs, float *HeightMap, uint32_t *Normals, uint32_t GridWidth, uint32_t GridHeight,
+				  uint32_t CenterX, uint32_t CenterZ, uint32_t Radius, random_series *Series, memory_arena *Scratch)
+{
+	brush_rect Result = { 1, 0, 1, 0 };
+
+	erosion_params Params = DefaultErosionParams();
+	erosion_brush Brush;
+	Brush.XMin = (uint32_t)Max((int32_t)CenterX - (int32_t)Radius, 0);
+	Brush.ZMin = (uint32_t)Max((int32_t)CenterZ - (int32_t)Radius, 0);
+	Brush.XMax = (uint32_t)Min((int32_t)(CenterX + Radius), (int32_t)GridWidth - 1);
+	Brush.ZMax = (uint32_t)Min((int32_t)(CenterZ + Radius), (int32_t)GridHeight - 1);
+	Brush.Margin = Radius/2;
+
+	// NOTE(georgy): Same droplet density as the whole map gets from DefaultErosionParams
+	uint32_t RegionWidth = Brush.XMax - Brush.XMin + 1;
+	uint32_t RegionHeight = Brush.ZMax - Brush.ZMin + 1;
+	Brush.DropletCount = (uint32_t)((uint64_t)Params.DropletCount*RegionWidth*RegionHeight / (TERRAIN_GRID_SIZE*TERRAIN_GRID_SIZE));
+
+	temporary_memory Temporary = BeginTemporaryMemory(Scratch);
+	uint8_t *Mask = PushArray(Scratch, RegionWidth*RegionHeight, uint8_t);
+	if(!Mask)
+	{
+		EndTemporaryMemory(Temporary);
+		return(Result);
+	}
+	for(uint32_t Z = 0; Z < RegionHeight; Z++)
+	{
+		for(uint32_t X = 0; X < RegionWidth; X++)
+		{
+			vec2 Offset = vec2((float)(Brush.XMin + X) - (float)CenterX, (float)(Brush.ZMin + Z) - (float)CenterZ);
+			float Strength = Clamp(2.0f*(1.0f - Length(Offset)/(float)Radius), 0.0f, 1.0f);
+			Mask[X + Z*RegionWidth] = (uint8_t)(255.0f*Strength);
+		}
+	}
+	Brush.Mask = Mask;
 
-				Vertices.push_back(P);
-				Normals.push_back(Normal);
-			}	
+	brush_rect Touched = WaterErosionBrush(HeightMap, GridWidth, GridHeight, &Params, &Brush, Series, Scratch);
+	if(Touched.XMin <= Touched.XMax)
+	{
+		Result = GrowRect(Touched, 1, GridWidth, GridHeight);
+		CalculateNormalsRect(Jobs, HeightMap, GridWidth, GridHeight, Result, NormalFormat_Packed, Normals);
+	}
+
+	EndTemporaryMemory(Temporary);
+	return(Result);
+}
+
+// NOTE(georgy): Times brush dabs (erosion and normals) at random places of a GridSize x GridSize heightmap
+static bool
+BenchmarkErosionBrush(job_system *Jobs, uint32_t GridSize, uint32_t Radius, uint32_t DabCount)
+{
+	const float MaxHeight = TERRAIN_MAX_HEIGHT;
+	uint64_t SampleCount = (uint64_t)(GridSize + 1)*(GridSize + 1);
+	if((GridSize < 2*Radius + 2) || (Radius == 0))
+	{
+		printf("The grid has to be larger than the brush\n");
+		return(false);
+	}
+
+	float *HeightMap = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount);
+	uint32_t *Normals = (uint32_t *)AllocateMemory(MemoryCategory_Mesh, sizeof(uint32_t)*SampleCount);
+	memory_arena Scratch;
+	if(!HeightMap || !Normals || !InitArena(&Scratch, MemoryCategory_Scratch, 2*sizeof(float)*SampleCount, false))
+	{
+		printf("Out of memory for a %ux%u heightmap\n", GridSize, GridSize);
+		FreeMemory(HeightMap);
+		FreeMemory(Normals);
+		return(false);
+	}
+
+	noise_params Noise = DefaultNoiseParams(MaxHeight);
+	uint64_t SetupBegin = GetNanoseconds();
+	FillHeightMapNoise(Jobs, HeightMap, GridSize, GridSize, 0, 0, &Noise);
+	CalculateNormals(Jobs, HeightMap, GridSize, GridSize, NormalFormat_Packed, Normals);
+	uint64_t SetupEnd = GetNanoseconds();
+	printf("Brush benchmark %ux%u, radius %u, setup %.1f ms\n", GridSize, GridSize, Radius, (SetupEnd - SetupBegin) / 1000000.0);
+
+	random_series Placement = RandomSeed(7);
+	random_series Series = RandomSeed(DefaultErosionParams().Seed);
+	uint64_t TotalNanoseconds = 0;
+	uint64_t MaxNanoseconds = 0;
+	uint64_t TouchedSamples = 0;
+	for(uint32_t Dab = 0; Dab < DabCount; Dab++)
+	{
+		uint32_t CenterX = Radius + RandomChoice(&Placement, GridSize - 2*Radius);
+		uint32_t CenterZ = Radius + RandomChoice(&Placement, GridSize - 2*Radius);
+
+		uint64_t DabBegin = GetNanoseconds();
+		brush_rect Rect = ApplyErosionBrush(Jobs, HeightMap, Normals, GridSize, GridSize, CenterX, CenterZ, Radius, &Series, &Scratch);
+		uint64_t DabNanoseconds = GetNanoseconds() - DabBegin;
+
+		TotalNanoseconds += DabNanoseconds;
+		MaxNanoseconds = (DabNanoseconds > MaxNanoseconds) ? DabNanoseconds : MaxNanoseconds;
+		if(Rect.XMin <= Rect.XMax)
+		{
+			TouchedSamples += (uint64_t)(Rect.XMax - Rect.XMin + 1)*(Rect.ZMax - Rect.ZMin + 1);
 		}
+	}
+
+	printf("  %u dabs: mean %.3f ms, max %.3f ms, %llu samples updated per dab\n", DabCount,
+		   TotalNanoseconds / (1000000.0*DabCount), MaxNanoseconds / 1000000.0, (unsigned long long)(TouchedSamples / DabCount));
+
+	FreeArena(&Scratch);
+	FreeMemory(Normals);
+	FreeMemory(HeightMap);
+	return(true);
+}
+
+// NOTE(georgy): Flies the camera in a straight line from (StartX, StartZ) at Speed samples per frame for FrameCount frames of 1/60 s and
+//				 times the stream's per-frame update. Tiles are generated in the background meanwhile, like in the viewer
+static bool
+BenchmarkTerrainStream(job_system *Jobs, uint32_t FrameCount, double Speed, double StartX, double StartZ)
+{
+	MEMORY_PHASE("Stream");
+	stream_params Params = DefaultStreamParams();
+	terrain_stream Stream;
+	if(!InitTerrainStream(Jobs, &Stream, &Params))
+	{
+		FreeTerrainStream(&Stream);
+		return(false);
+	}
 
-		for(uint32_t Z = 0; Z < GridHeight; Z++)
+	printf("Stream benchmark from (%.0f, %.0f), %u frames at %.1f samples per frame, %u workers\n", StartX, StartZ, FrameCount, Speed, Jobs->WorkerCount);
+	printf("  tiles %u cells + %u halo, view radius %u, %u slots in %.1f MB, %u tiles in flight\n", Params.TileSize, Params.Halo,
+		   Params.ViewRadius, Stream.SlotCount, Params.MemoryCap / (1024.0*1024.0), Params.MaxTilesInFlight);
+
+	const uint64_t FrameNanoseconds = 1000000000 / 60;
+	uint64_t MissingTotal = 0;
+	uint64_t BeginTime = GetNanoseconds();
+	for(uint32_t Frame = 0; Frame < FrameCount; Frame++)
+	{
+		uint64_t FrameBegin = GetNanoseconds();
+		UpdateTerrainStream(&Stream, StartX + Speed*Frame, StartZ + 0.25*Speed*Frame);
+		MissingTotal += Stream.Stats.TilesMissing;
+
+		uint64_t Elapsed = GetNanoseconds() - FrameBegin;
+		if(Elapsed < FrameNanoseconds)
+		{
+			std::this_thread::sleep_for(std::chrono::nanoseconds(FrameNanoseconds - Elapsed));
+		}
+	}
+	uint64_t EndTime = GetNanoseconds();
+
+	uint32_t SeamCount;
+	float SeamError = MeasureStreamSeams(&Stream, &SeamCount);
+	const stream_stats *Stats = &Stream.Stats;
+	printf("  update: mean %.3f ms, max %.3f ms over %.1f s\n", Stats->TotalUpdateNanoseconds / (1000000.0*Stats->FrameCount),
+		   Stats->MaxUpdateNanoseconds / 1000000.0, (EndTime - BeginTime) / 1000000000.0);
+	printf("  tiles: %llu requested, %llu generated, %llu evicted, %.1f missing from view per frame (%u at the end)\n",
+		   (unsigned long long)Stats->TilesRequested, (unsigned long long)Stream.TilesGenerated.load(), (unsigned long long)Stats->TilesEvicted,
+		   (double)MissingTotal / FrameCount, Stats->TilesMissing);
+	printf("  seams: max height difference %g on %u shared edges\n", SeamError, SeamCount);
+
+	FreeTerrainStream(&Stream);
+	return(true);
+}
+
+// NOTE(georgy): Viewer for --stream. WASD moves the camera (shift is faster), it stays above the terrain once the tile under it
+//				 is ready. Every slot of the stream has its own GL buffers that a new tile overwrites, at most
+//				 STREAM_UPLOADS_PER_FRAME tiles are uploaded per frame. Tiles are drawn relative to the camera, the offsets are
+//				 computed in double, so the floats the GPU gets stay small however far the camera goes
+#define STREAM_UPLOADS_PER_FRAME 4
+
+static bool
+RunStreamViewer(job_system *Jobs, GLFWwindow *Window, double StartX, double StartZ, const char *TraceFilename)
+{
+	stream_params Params = DefaultStreamParams();
+	terrain_stream Stream;
+	if(!InitTerrainStream(Jobs, &Stream, &Params))
+	{
+		FreeTerrainStream(&Stream);
+		return(false);
+	}
+
+	GLuint *VAOs = (GLuint *)malloc(sizeof(GLuint)*Stream.SlotCount);
+	GLuint *PosVBOs = (GLuint *)malloc(sizeof(GLuint)*Stream.SlotCount);
+	GLuint *NormalsVBOs = (GLuint *)malloc(sizeof(GLuint)*Stream.SlotCount);
+	GLuint EBO;
+	{
+		TIMED_SCOPE("UploadBuffers");
+		MEMORY_PHASE("Upload");
+		glGenVertexArrays(Stream.SlotCount, VAOs);
+		glGenBuffers(Stream.SlotCount, PosVBOs);
+		glGenBuffers(Stream.SlotCount, NormalsVBOs);
+		glGenBuffers(1, &EBO);
+		for(uint32_t SlotIndex = 0; SlotIndex < Stream.SlotCount; SlotIndex++)
 		{
-			for(uint32_t X = 0; X <= GridWidth; X++)
+			glBindVertexArray(VAOs[SlotIndex]);
+			glBindBuffer(GL_ARRAY_BUFFER, PosVBOs[SlotIndex]);
+			glBufferData(GL_ARRAY_BUFFER, Stream.VertexCount*sizeof(vec3), 0, GL_DYNAMIC_DRAW);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+			glBindBuffer(GL_ARRAY_BUFFER, NormalsVBOs[SlotIndex]);
+			glBufferData(GL_ARRAY_BUFFER, Stream.VertexCount*sizeof(uint32_t), 0, GL_DYNAMIC_DRAW);
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, 0, (void *)0);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			if(SlotIndex == 0)
 			{
-				uint32_t Index0 = X + Z*(GridWidth + 1);
-				uint32_t Index1 = X + (Z + 1)*(GridWidth + 1);
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, Stream.IndexCount*sizeof(uint32_t), Stream.Indices, GL_STATIC_DRAW);
+			}
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		TrackExternalMemory(MemoryCategory_GPUStaging, (uint64_t)Stream.SlotCount*Stream.VertexCount*(sizeof(vec3) + sizeof(uint32_t)) +
+							Stream.IndexCount*sizeof(uint32_t));
+	}
+
+	glClearColor(0.2f, 0.4f, 0.8f, 1.0f);
+	shader Shader("shaders\\VS.glsl", "shaders\\FS.glsl");
+
+	double CameraX = StartX;
+	double CameraZ = StartZ;
+	float EyeHeight = 2.0f*Params.Noise.MaxHeight*Params.Noise.OctaveAmplitudes[0];
+	double LastTime = glfwGetTime();
+	bool TraceKeyWasDown = false;
+	while(!glfwWindowShouldClose(Window))
+	{
+		TIMED_SCOPE("Frame");
+		glfwPollEvents();
+
+		double Time = glfwGetTime();
+		float SecondsElapsed = (float)(Time - LastTime);
+		LastTime = Time;
+
+		// NOTE(georgy): Camera speed in samples per second, forward is +Z in samples and -z in the mesh
+		double Speed = ((glfwGetKey(Window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) ? 2000.0 : 200.0)*SecondsElapsed;
+		if(glfwGetKey(Window, GLFW_KEY_W) == GLFW_PRESS) CameraZ += Speed;
+		if(glfwGetKey(Window, GLFW_KEY_S) == GLFW_PRESS) CameraZ -= Speed;
+		if(glfwGetKey(Window, GLFW_KEY_D) == GLFW_PRESS) CameraX += Speed;
+		if(glfwGetKey(Window, GLFW_KEY_A) == GLFW_PRESS) CameraX -= Speed;
 
-				Indices.push_back(Index0);
-				Indices.push_back(Index1);
+		UpdateTerrainStream(&Stream, CameraX, CameraZ);
+
+		float GroundHeight;
+		if(SampleTerrainStream(&Stream, CameraX, CameraZ, &GroundHeight))
+		{
+			float TargetHeight = GroundHeight + 4.0f;
+			EyeHeight += (TargetHeight - EyeHeight)*Min(1.0f, 4.0f*SecondsElapsed);
+		}
 
-				if(X == GridWidth)
+		bool TraceKeyDown = (glfwGetKey(Window, GLFW_KEY_T) == GLFW_PRESS);
+		if(TraceKeyDown && !TraceKeyWasDown)
+		{
+			if(GlobalTrace.Enabled)
+			{
+				StopTrace();
+				WriteTrace(TraceFilename);
+			}
+			else
+			{
+				StartTrace(Jobs);
+			}
+		}
+		TraceKeyWasDown = TraceKeyDown;
+
+		{
+			TIMED_SCOPE("StreamUpload");
+			uint32_t UploadCount = 0;
+			for(uint32_t SlotIndex = 0; (SlotIndex < Stream.SlotCount) && (UploadCount < STREAM_UPLOADS_PER_FRAME); SlotIndex++)
+			{
+				stream_slot *Slot = Stream.Slots + SlotIndex;
+				if(Slot->Changed && StreamSlotVisible(&Stream, Slot))
 				{
-					Indices.push_back(Index1);
-					Indices.push_back((Z + 1)*(GridWidth + 1));
+					glBindBuffer(GL_ARRAY_BUFFER, PosVBOs[SlotIndex]);
+					glBufferSubData(GL_ARRAY_BUFFER, 0, Stream.VertexCount*sizeof(vec3), Slot->Vertices);
+					glBindBuffer(GL_ARRAY_BUFFER, NormalsVBOs[SlotIndex]);
+					glBufferSubData(GL_ARRAY_BUFFER, 0, Stream.VertexCount*sizeof(uint32_t), Slot->Normals);
+					Slot->Changed = false;
+					UploadCount++;
 				}
-			}	
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
 
-		free(HeightMap);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		mat4 Projection = Perspective(45.0f, 900.0f / 540.0f, 0.1f, 200.0f);
+		mat4 View = LookAt(vec3(0.0f, EyeHeight, 0.0f), vec3(0.0f, EyeHeight - 4.0f, -12.0f));
+
+		Shader.Use();
+		Shader.SetMat4("Projection", Projection);
+		Shader.SetMat4("View", View);
+		for(uint32_t SlotIndex = 0; SlotIndex < Stream.SlotCount; SlotIndex++)
+		{
+			stream_slot *Slot = Stream.Slots + SlotIndex;
+			if(!Slot->Changed && StreamSlotVisible(&Stream, Slot))
+			{
+				double OffsetX = ((double)Slot->TileX*Params.TileSize - CameraX)*Params.CellSize;
+				double OffsetZ = ((double)Slot->TileZ*Params.TileSize - CameraZ)*Params.CellSize;
+				Shader.SetMat4("Model", Translation(vec3((float)OffsetX, 0.0f, -(float)OffsetZ)));
+				glBindVertexArray(VAOs[SlotIndex]);
+				glDrawElements(GL_TRIANGLE_STRIP, Stream.IndexCount, GL_UNSIGNED_INT, 0);
+			}
+		}
+		glBindVertexArray(0);
+
+		glfwSwapBuffers(Window);
 	}
+
+	glDeleteVertexArrays(Stream.SlotCount, VAOs);
+	glDeleteBuffers(Stream.SlotCount, PosVBOs);
+	glDeleteBuffers(Stream.SlotCount, NormalsVBOs);
+	glDeleteBuffers(1, &EBO);
+	free(NormalsVBOs);
+	free(PosVBOs);
+	free(VAOs);
+	FreeTerrainStream(&Stream);
+
+	return(true);
 }
 
-int main(void)
+int main(int ArgCount, char **Args)
 {
+	InitTerrainKernels();
+
+	// NOTE(georgy): --stream opens the viewer on an endless streamed terrain instead (see streaming.cpp), at (StartX, StartZ) if given.
+	//				 The stream generates tiles on the background workers, so it gets at least one even on a single CPU
+	bool StreamMode = (ArgCount >= 2) && (strcmp(Args[1], "--stream") == 0);
+	bool StreamBenchMode = (ArgCount >= 2) && (strcmp(Args[1], "--stream-bench") == 0);
+
+	job_system Jobs;
+	job_system_config JobsConfig = {};
+	if((StreamMode || StreamBenchMode) && (std::thread::hardware_concurrency() < 2))
+	{
+		JobsConfig.WorkerCount = 2;
+	}
+	InitJobSystem(&Jobs, JobsConfig);
+
+	job_timing_stats JobTimings;
+	const char *PrintJobTimingsEnv = getenv("EROSION_JOB_TIMINGS");
+	bool ShowJobTimings = PrintJobTimingsEnv && (atoi(PrintJobTimingsEnv) != 0);
+	if(ShowJobTimings)
+	{
+		SetJobTimingHook(&Jobs, AccumulateJobTiming, &JobTimings);
+	}
+
+	// NOTE(georgy): EROSION_TRACE=File records a trace of the whole run (see trace.cpp), in the viewer T starts and stops one
+	const char *TraceFilename = getenv("EROSION_TRACE");
+	if(TraceFilename && TraceFilename[0])
+	{
+		StartTrace(&Jobs);
+	}
+	else
+	{
+		TraceFilename = "trace.json";
+	}
+
+	// NOTE(georgy): Headless modes:
+	//				 --world TilesX TilesZ [OutputDirectory]
+	//				 --coordinator TilesX TilesZ [OutputDirectory] [WorkerProcessCount]
+	//				 --worker OutputDirectory (started by the coordinator)
+	//				 --storage-report
+	//				 --terrain-info TerrainFile
+	//				 --erode-file Heightmap(.r32, .f32, .r16, .raw, .pgm, .png) TerrainFile
+	//				 --delta-report DeltaFile [StepFraction]
+	//				 --erode-checkpointed Directory [DropletCount] [CheckpointSeconds]
+	//				 --brush-bench [GridSize] [Radius]
+	//				 --sweep OutputDirectory Name=Value,Value,... [Name=Value,Value,...]
+	//				 --bench [Case|all] [Repetitions] (EROSION_PERF_COUNTERS=1 adds hardware counters)
+	//				 --scenario [Name|all] [BaselineFile] [record]
+	//				 --scenario-run Name Directory (started by --scenario)
+	//				 --verify [Case|all] [Directory] [record]
+	//				 --query-bench [GridSize] [QueryCount]
+	//				 --fill-report [GridSize] [TileSize]
+	//				 --stream-bench [FrameCount] [Speed] [StartX] [StartZ] (Speed in samples per frame)
+	bool WorldMode = (ArgCount >= 4) && (strcmp(Args[1], "--world") == 0);
+	bool CoordinatorMode = (ArgCount >= 4) && (strcmp(Args[1], "--coordinator") == 0);
+	bool WorkerMode = (ArgCount >= 3) && (strcmp(Args[1], "--worker") == 0);
+	bool StorageReportMode = (ArgCount >= 2) && (strcmp(Args[1], "--storage-report") == 0);
+	bool TerrainInfoMode = (ArgCount >= 3) && (strcmp(Args[1], "--terrain-info") == 0);
+	bool ErodeFileMode = (ArgCount >= 4) && (strcmp(Args[1], "--erode-file") == 0);
+	bool DeltaReportMode = (ArgCount >= 3) && (strcmp(Args[1], "--delta-report") == 0);
+	bool CheckpointedMode = (ArgCount >= 3) && (strcmp(Args[1], "--erode-checkpointed") == 0);
+	bool BrushBenchMode = (ArgCount >= 2) && (strcmp(Args[1], "--brush-bench") == 0);
+	bool SweepMode = (ArgCount >= 4) && (strcmp(Args[1], "--sweep") == 0);
+	bool BenchMode = (ArgCount >= 2) && (strcmp(Args[1], "--bench") == 0);
+	bool ScenarioMode = (ArgCount >= 2) && (strcmp(Args[1], "--scenario") == 0);
+	bool ScenarioRunMode = (ArgCount >= 4) && (strcmp(Args[1], "--scenario-run") == 0);
+	bool VerifyMode = (ArgCount >= 2) && (strcmp(Args[1], "--verify") == 0);
+	bool QueryBenchMode = (ArgCount >= 2) && (strcmp(Args[1], "--query-bench") == 0);
+	bool FillReportMode = (ArgCount >= 2) && (strcmp(Args[1], "--fill-report") == 0);
+	if(WorldMode || CoordinatorMode || WorkerMode || StorageReportMode || TerrainInfoMode || ErodeFileMode || DeltaReportMode ||
+	   CheckpointedMode || BrushBenchMode || SweepMode || BenchMode || ScenarioMode || ScenarioRunMode || VerifyMode ||
+	   QueryBenchMode || FillReportMode || StreamBenchMode)
+	{
+		bool Success = true;
+		if(StorageReportMode)
+		{
+			ReportQuantizedStorage(&Jobs);
+		}
+		else if(TerrainInfoMode)
+		{
+			Success = PrintTerrainFileInfo(&Jobs, Args[2]);
+		}
+		else if(ErodeFileMode)
+		{
+			Success = ErodeHeightMapFile(&Jobs, Args[2], Args[3]);
+		}
+		else if(DeltaReportMode)
+		{
+			float StepFraction = (ArgCount >= 4) ? (float)atof(Args[3]) : (1.0f / 65536.0f);
+			Success = (StepFraction > 0.0f) && ReportErosionDelta(&Jobs, Args[2], StepFraction);
+		}
+		else if(CheckpointedMode)
+		{
+			uint32_t DropletCount = (ArgCount >= 4) ? (uint32_t)atoi(Args[3]) : DefaultErosionParams().DropletCount;
+			float IntervalSeconds = (ArgCount >= 5) ? (float)atof(Args[4]) : 30.0f;
+			Success = ErodeWithCheckpoints(&Jobs, Args[2], DropletCount, IntervalSeconds);
+		}
+		else if(BrushBenchMode)
+		{
+			uint32_t GridSize = (ArgCount >= 3) ? (uint32_t)atoi(Args[2]) : 16384;
+			uint32_t Radius = (ArgCount >= 4) ? (uint32_t)atoi(Args[3]) : 32;
+			Success = BenchmarkErosionBrush(&Jobs, GridSize, Radius, 64);
+		}
+		else if(SweepMode)
+		{
+			Success = SweepErosionParams(&Jobs, Args[2], Args + 3, (uint32_t)(ArgCount - 3));
+		}
+		else if(BenchMode)
+		{
+			const char *OnlyCase = ((ArgCount >= 3) && (strcmp(Args[2], "all") != 0)) ? Args[2] : 0;
+			uint32_t Repetitions = (ArgCount >= 4) ? (uint32_t)atoi(Args[3]) : 5;
+			const char *CountersEnv = getenv("EROSION_PERF_COUNTERS");
+			bool UseCounters = CountersEnv && (atoi(CountersEnv) != 0);
+			Success = RunBenchmarks(&Jobs, (Repetitions > 0) ? Repetitions : 1, UseCounters, OnlyCase);
+		}
+		else if(ScenarioMode)
+		{
+			const char *Which = (ArgCount >= 3) ? Args[2] : "all";
+			const char *BaselineFilename = (ArgCount >= 4) ? Args[3] : "scenarios.json";
+			bool Record = (ArgCount >= 5) && (strcmp(Args[4], "record") == 0);
+			Success = RunScenarios(Which, BaselineFilename, Record, "scenario_output");
+		}
+		else if(ScenarioRunMode)
+		{
+			Success = RunScenario(&Jobs, Args[2], Args[3]);
+		}
+		else if(VerifyMode)
+		{
+			const char *OnlyCase = ((ArgCount >= 3) && (strcmp(Args[2], "all") != 0)) ? Args[2] : 0;
+			const char *Directory = (ArgCount >= 4) ? Args[3] : "verify";
+			bool Record = (ArgCount >= 5) && (strcmp(Args[4], "record") == 0);
+			Success = RunVerification(&Jobs, Directory, Record, OnlyCase);
+		}
+		else if(QueryBenchMode)
+		{
+			uint32_t GridSize = (ArgCount >= 3) ? (uint32_t)atoi(Args[2]) : 16384;
+			uint32_t QueryCount = (ArgCount >= 4) ? (uint32_t)atoi(Args[3]) : (1 << 22);
+			Success = BenchmarkTerrainQueries(&Jobs, GridSize, QueryCount);
+		}
+		else if(FillReportMode)
+		{
+			uint32_t GridSize = (ArgCount >= 3) ? (uint32_t)atoi(Args[2]) : TERRAIN_GRID_SIZE;
+			uint32_t TileSize = (ArgCount >= 4) ? (uint32_t)atoi(Args[3]) : 128;
+			Success = (GridSize > 0) && (TileSize > 1) && ReportDepressionFill(&Jobs, GridSize, TileSize);
+		}
+		else if(StreamBenchMode)
+		{
+			uint32_t FrameCount = (ArgCount >= 3) ? (uint32_t)atoi(Args[2]) : 600;
+			double Speed = (ArgCount >= 4) ? atof(Args[3]) : 4.0;
+			double StartX = (ArgCount >= 5) ? atof(Args[4]) : 0.0;
+			double StartZ = (ArgCount >= 6) ? atof(Args[5]) : 0.0;
+			Success = (FrameCount > 0) && BenchmarkTerrainStream(&Jobs, FrameCount, Speed, StartX, StartZ);
+		}
+		else if(WorkerMode)
+		{
+			Success = RunWorldWorker(&Jobs, Args[2]);
+		}
+		else
+		{
+			world_params WorldParams = DefaultWorldParams();
+			WorldParams.TilesX = (uint32_t)atoi(Args[2]);
+			WorldParams.TilesZ = (uint32_t)atoi(Args[3]);
+			if(ArgCount >= 5)
+			{
+				WorldParams.OutputDirectory = Args[4];
+			}
+
+			if(CoordinatorMode)
+			{
+				uint32_t WorkerProcessCount = (ArgCount >= 6) ? (uint32_t)atoi(Args[5]) : std::thread::hardware_concurrency();
+				Success = RunWorldCoordinator(&WorldParams, (WorkerProcessCount > 0) ? WorkerProcessCount : 1);
+			}
+			else
+			{
+				Success = GenerateWorld(&Jobs, &WorldParams);
+			}
+		}
+
+		if(ShowJobTimings)
+		{
+			PrintJobTimings(&JobTimings);
+		}
+		PrintMemoryReport();
+		if(GlobalTrace.Enabled)
+		{
+			StopTrace();
+			WriteTrace(TraceFilename);
+		}
+		ShutdownJobSystem(&Jobs);
+
+		return(Success ? 0 : 1);
+	}
+
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -261,34 +1264,119 @@ int main(void)
 	glDisable(GL_CULL_FACE);
 	glEnable(GL_FRAMEBUFFER_SRGB);
 
+	if(StreamMode)
+	{
+		double StartX = (ArgCount >= 3) ? atof(Args[2]) : 0.0;
+		double StartZ = (ArgCount >= 4) ? atof(Args[3]) : 0.0;
+		bool Success = RunStreamViewer(&Jobs, Window, StartX, StartZ, TraceFilename);
+		if(GlobalTrace.Enabled)
+		{
+			StopTrace();
+			WriteTrace(TraceFilename);
+		}
+		PrintMemoryReport();
+		ShutdownJobSystem(&Jobs);
+
+		return(Success ? 0 : 1);
+	}
+
 	GLuint VAO, PosVBO, NormalsVBO, EBO;
-	std::vector<vec3> Vertices;
-	std::vector<vec3> Normals;
-	std::vector<uint32_t> Indices;
-	GenerateTerrain(Vertices, Normals, Indices);
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &PosVBO);
-	glGenBuffers(1, &NormalsVBO);
-	glGenBuffers(1, &EBO);
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, PosVBO);
-	glBufferData(GL_ARRAY_BUFFER, Vertices.size()*sizeof(vec3), &Vertices[0], GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
-	glBindBuffer(GL_ARRAY_BUFFER, NormalsVBO);
-	glBufferData(GL_ARRAY_BUFFER, Normals.size()*sizeof(vec3), &Normals[0], GL_STATIC_DRAW);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, Indices.size()*sizeof(uint32_t), &Indices[0], GL_STATIC_DRAW);
-	glBindVertexArray(0);
+	terrain_memory TerrainMemory = {};
+	terrain_mesh Mesh;
+	terrain_cache_entry Terrain;
+	uint32_t ErosionSeed = DefaultErosionParams().Seed;
+	if(!InitTerrainMemory(&TerrainMemory) || !GenerateTerrain(&Jobs, &TerrainMemory, ErosionSeed, &Terrain, &Mesh))
+	{
+		// NOTE(georgy): GenerateTerrain frees the terrain it fails on, the arenas and the workers are left
+		if(GlobalTrace.Enabled)
+		{
+			StopTrace();
+			WriteTrace(TraceFilename);
+		}
+		FreeTerrainMemory(&TerrainMemory);
+		ShutdownJobSystem(&Jobs);
+
+		return(1);
+	}
+	if(ShowJobTimings)
+	{
+		PrintJobTimings(&JobTimings);
+	}
+	{
+		TIMED_SCOPE("UploadBuffers");
+		MEMORY_PHASE("Upload");
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &PosVBO);
+		glGenBuffers(1, &NormalsVBO);
+		glGenBuffers(1, &EBO);
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, PosVBO);
+		glBufferData(GL_ARRAY_BUFFER, Mesh.VertexCount*sizeof(vec3), Mesh.Vertices, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+		glBindBuffer(GL_ARRAY_BUFFER, NormalsVBO);
+		glBufferData(GL_ARRAY_BUFFER, (Terrain.GridWidth + 1)*(Terrain.GridHeight + 1)*sizeof(uint32_t), Terrain.Normals, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, 0, (void *)0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, Mesh.IndexCount*sizeof(uint32_t), Mesh.Indices, GL_STATIC_DRAW);
+		glBindVertexArray(0);
+		TrackExternalMemory(MemoryCategory_GPUStaging, Mesh.VertexCount*sizeof(vec3) +
+							(Terrain.GridWidth + 1)*(Terrain.GridHeight + 1)*sizeof(uint32_t) + Mesh.IndexCount*sizeof(uint32_t));
+	}
 
 	glClearColor(0.2f, 0.4f, 0.8f, 1.0f);
 	shader Shader("shaders\\VS.glsl", "shaders\\FS.glsl");
 
+	// NOTE(georgy): Holding the left mouse button erodes the terrain under the cursor
+	const uint32_t BrushRadius = 24;
+	random_series BrushSeries = RandomSeed(DefaultErosionParams().Seed);
+	float StepX = Mesh.Vertices[1].x - Mesh.Vertices[0].x;
+	float StepZ = Mesh.Vertices[0].z - Mesh.Vertices[Terrain.GridWidth + 1].z;
+
+	bool TraceKeyWasDown = false;
+	bool RegenerateKeyWasDown = false;
 	while (!glfwWindowShouldClose(Window))
 	{
+		TIMED_SCOPE("Frame");
 		glfwPollEvents();
+
+		// NOTE(georgy): R erodes a new terrain with the next seed. It goes into the arenas of the old one and has the same
+		//				 size, so the GL buffers are overwritten in place and the indices stay as they are
+		bool RegenerateKeyDown = (glfwGetKey(Window, GLFW_KEY_R) == GLFW_PRESS);
+		if(RegenerateKeyDown && !RegenerateKeyWasDown)
+		{
+			FreeCachedTerrain(&Terrain);
+			if(!GenerateTerrain(&Jobs, &TerrainMemory, ++ErosionSeed, &Terrain, &Mesh))
+			{
+				break;
+			}
+
+			TIMED_SCOPE("UploadBuffers");
+			MEMORY_PHASE("Upload");
+			glBindBuffer(GL_ARRAY_BUFFER, PosVBO);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, Mesh.VertexCount*sizeof(vec3), Mesh.Vertices);
+			glBindBuffer(GL_ARRAY_BUFFER, NormalsVBO);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, (Terrain.GridWidth + 1)*(Terrain.GridHeight + 1)*sizeof(uint32_t), Terrain.Normals);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+		RegenerateKeyWasDown = RegenerateKeyDown;
+
+		bool TraceKeyDown = (glfwGetKey(Window, GLFW_KEY_T) == GLFW_PRESS);
+		if(TraceKeyDown && !TraceKeyWasDown)
+		{
+			if(GlobalTrace.Enabled)
+			{
+				StopTrace();
+				WriteTrace(TraceFilename);
+			}
+			else
+			{
+				StartTrace(&Jobs);
+			}
+		}
+		TraceKeyWasDown = TraceKeyDown;
+
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		mat4 Projection = Perspective(45.0f, 900.0f / 540.0f, 0.1f, 200.0f);
@@ -298,11 +1386,65 @@ int main(void)
 		Shader.SetMat4("Projection", Projection);
 		Shader.SetMat4("View", View);
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLE_STRIP, Indices.size(), GL_UNSIGNED_INT, 0);
+		glDrawElements(GL_TRIANGLE_STRIP, Mesh.IndexCount, GL_UNSIGNED_INT, 0);
 		glBindVertexArray(0);
 
+		if(glfwGetMouseButton(Window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS)
+		{
+			// NOTE(georgy): Unproject the depth under the cursor back to the world to find the terrain cell
+			double CursorX, CursorY;
+			glfwGetCursorPos(Window, &CursorX, &CursorY);
+			int32_t PixelX = (int32_t)CursorX;
+			int32_t PixelY = 540 - 1 - (int32_t)CursorY;
+			float Depth = 1.0f;
+			if((PixelX >= 0) && (PixelX < 900) && (PixelY >= 0) && (PixelY < 540))
+			{
+				glReadPixels(PixelX, PixelY, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &Depth);
+			}
+
+			if(Depth < 1.0f)
+			{
+				vec4 ClipP = vec4(2.0f*(PixelX + 0.5f)/900.0f - 1.0f, 2.0f*(PixelY + 0.5f)/540.0f - 1.0f, 2.0f*Depth - 1.0f, 1.0f);
+				vec4 WorldP = Inverse(Projection*View)*ClipP;
+				int32_t CellX = (int32_t)(WorldP.x / (WorldP.w*StepX));
+				int32_t CellZ = (int32_t)(-WorldP.z / (WorldP.w*StepZ));
+				CellX = Min(Max(CellX, 0), (int32_t)Terrain.GridWidth - 1);
+				CellZ = Min(Max(CellZ, 0), (int32_t)Terrain.GridHeight - 1);
+
+				MEMORY_PHASE("Brush");
+				brush_rect Rect = ApplyErosionBrush(&Jobs, Terrain.HeightMap, Terrain.Normals, Terrain.GridWidth, Terrain.GridHeight,
+													(uint32_t)CellX, (uint32_t)CellZ, BrushRadius, &BrushSeries, &TerrainMemory.Scratch);
+				TIMED_SCOPE("BrushUpload");
+				for(int32_t Z = Rect.ZMin; Z <= Rect.ZMax; Z++)
+				{
+					uint32_t RowStart = (uint32_t)Rect.XMin + (uint32_t)Z*(Terrain.GridWidth + 1);
+					uint32_t RowCount = (uint32_t)(Rect.XMax - Rect.XMin + 1);
+					for(uint32_t Index = RowStart; Index < RowStart + RowCount; Index++)
+					{
+						Mesh.Vertices[Index].y = Terrain.HeightMap[Index];
+					}
+
+					glBindBuffer(GL_ARRAY_BUFFER, PosVBO);
+					glBufferSubData(GL_ARRAY_BUFFER, RowStart*sizeof(vec3), RowCount*sizeof(vec3), Mesh.Vertices + RowStart);
+					glBindBuffer(GL_ARRAY_BUFFER, NormalsVBO);
+					glBufferSubData(GL_ARRAY_BUFFER, RowStart*sizeof(uint32_t), RowCount*sizeof(uint32_t), Terrain.Normals + RowStart);
+				}
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+			}
+		}
+
 		glfwSwapBuffers(Window);
 	}
 
+	if(GlobalTrace.Enabled)
+	{
+		StopTrace();
+		WriteTrace(TraceFilename);
+	}
+	PrintMemoryReport();
+	FreeCachedTerrain(&Terrain);
+	FreeTerrainMemory(&TerrainMemory);
+	ShutdownJobSystem(&Jobs);
+
 	return(0);
 }
\ No newline at end of file
@@ -244,6 +244,31 @@ FloorReal32ToInt32(float Value)
 	return(Result);
 }
 
+// NOTE(georgy): Rounds towards negative infinity, B must be positive
+inline int32_t
+FloorDivide(int32_t A, int32_t B)
+{
+	int32_t Result = A / B;
+	if ((A % B) < 0)
+	{
+		--Result;
+	}
+
+	return(Result);
+}
+
+inline int64_t
+FloorDivide(int64_t A, int64_t B)
+{
+	int64_t Result = A / B;
+	if ((A % B) < 0)
+	{
+		--Result;
+	}
+
+	return(Result);
+}
+
 inline float
 Radians(float Angle)
 {
@@ -319,6 +344,20 @@ Max(float A, float B)
 	return(Result);
 }
 
+inline int32_t
+Min(int32_t A, int32_t B)
+{
+	int32_t Result = (A < B) ? A : B;
+	return(Result);
+}
+
+inline int32_t
+Max(int32_t A, int32_t B)
+{
+	int32_t Result = (A > B) ? A : B;
+	return(Result);
+}
+
 // 
 // NOTE(georgy): vec2
 // 
@@ -1241,6 +1280,144 @@ operator*(mat4 A, vec4 B)
 	return(Result);
 }
 
+// NOTE(georgy): Cofactors from the 2x2 determinants of the top and bottom row pairs. Returns zero matrix if M is singular
+static mat4
+Inverse(const mat4& M)
+{
+	float S0 = M.a11 * M.a22 - M.a21 * M.a12;
+	float S1 = M.a11 * M.a23 - M.a21 * M.a13;
+	float S2 = M.a11 * M.a24 - M.a21 * M.a14;
+	float S3 = M.a12 * M.a23 - M.a22 * M.a13;
+	float S4 = M.a12 * M.a24 - M.a22 * M.a14;
+	float S5 = M.a13 * M.a24 - M.a23 * M.a14;
+
+	float C5 = M.a33 * M.a44 - M.a43 * M.a34;
+	float C4 = M.a32 * M.a44 - M.a42 * M.a34;
+	float C3 = M.a32 * M.a43 - M.a42 * M.a33;
+	float C2 = M.a31 * M.a44 - M.a41 * M.a34;
+	float C1 = M.a31 * M.a43 - M.a41 * M.a33;
+	float C0 = M.a31 * M.a42 - M.a41 * M.a32;
+
+	mat4 Result = {};
+
+	float Determinant = S0 * C5 - S1 * C4 + S2 * C3 + S3 * C2 - S4 * C1 + S5 * C0;
+	if (Absolute(Determinant) > Epsilon)
+	{
+		float OneOverDeterminant = 1.0f / Determinant;
+
+		Result.a11 = (M.a22 * C5 - M.a23 * C4 + M.a24 * C3) * OneOverDeterminant;
+		Result.a12 = (-M.a12 * C5 + M.a13 * C4 - M.a14 * C3) * OneOverDeterminant;
+		Result.a13 = (M.a42 * S5 - M.a43 * S4 + M.a44 * S3) * OneOverDeterminant;
+		Result.a14 = (-M.a32 * S5 + M.a33 * S4 - M.a34 * S3) * OneOverDeterminant;
+
+		Result.a21 = (-M.a21 * C5 + M.a23 * C2 - M.a24 * C1) * OneOverDeterminant;
+		Result.a22 = (M.a11 * C5 - M.a13 * C2 + M.a14 * C1) * OneOverDeterminant;
+		Result.a23 = (-M.a41 * S5 + M.a43 * S2 - M.a44 * S1) * OneOverDeterminant;
+		Result.a24 = (M.a31 * S5 - M.a33 * S2 + M.a34 * S1) * OneOverDeterminant;
+
+		Result.a31 = (M.a21 * C4 - M.a22 * C2 + M.a24 * C0) * OneOverDeterminant;
+		Result.a32 = (-M.a11 * C4 + M.a12 * C2 - M.a14 * C0) * OneOverDeterminant;
+		Result.a33 = (M.a41 * S4 - M.a42 * S2 + M.a44 * S0) * OneOverDeterminant;
+		Result.a34 = (-M.a31 * S4 + M.a32 * S2 - M.a34 * S0) * OneOverDeterminant;
+
+		Result.a41 = (-M.a21 * C3 + M.a22 * C1 - M.a23 * C0) * OneOverDeterminant;
+		Result.a42 = (M.a11 * C3 - M.a12 * C1 + M.a13 * C0) * OneOverDeterminant;
+		Result.a43 = (-M.a41 * S3 + M.a42 * S1 - M.a43 * S0) * OneOverDeterminant;
+		Result.a44 = (M.a31 * S3 - M.a32 * S1 + M.a33 * S0) * OneOverDeterminant;
+	}
+
+	return(Result);
+}
+
+// 
+// NOTE(georgy): Random
+// 
+
+struct random_series
+{
+	uint32_t State;
+};
+
+// NOTE(georgy): Integer hash with good avalanche, turns seeds and coordinates into unrelated values
+inline uint32_t
+HashU32(uint32_t Value)
+{
+	Value ^= Value >> 16;
+	Value *= 0x7FEB352D;
+	Value ^= Value >> 15;
+	Value *= 0x846CA68B;
+	Value ^= Value >> 16;
+
+	return(Value);
+}
+
+inline uint32_t
+HashCombine(uint32_t Seed, uint32_t Value)
+{
+	uint32_t Result = HashU32(Seed ^ (Value + 0x9E3779B9 + (Seed << 6) + (Seed >> 2)));
+
+	return(Result);
+}
+
+inline random_series
+RandomSeed(uint32_t Seed)
+{
+	random_series Result;
+	Result.State = HashU32(Seed);
+	if(Result.State == 0)
+	{
+		// NOTE(georgy): xorshift gets stuck at zero
+		Result.State = 0x2545F491;
+	}
+
+	return(Result);
+}
+
+inline uint32_t
+RandomNextU32(random_series *Series)
+{
+	uint32_t Result = Series->State;
+	Result ^= Result << 13;
+	Result ^= Result >> 17;
+	Result ^= Result << 5;
+	Series->State = Result;
+
+	return(Result);
+}
+
+inline uint32_t
+RandomChoice(random_series *Series, uint32_t ChoiceCount)
+{
+	uint32_t Result = RandomNextU32(Series) % ChoiceCount;
+
+	return(Result);
+}
+
+// NOTE(georgy): Returns value in [0, 1)
+inline float
+RandomUnilateral(random_series *Series)
+{
+	float Result = (RandomNextU32(Series) >> 8) * (1.0f / 16777216.0f);
+
+	return(Result);
+}
+
+// NOTE(georgy): 64-bit FNV-1a, pass the previous result as Hash to hash data in pieces
+#define HASH_BYTES_SEED 0xCBF29CE484222325ull
+
+inline uint64_t
+HashBytes(const void *Data, uint64_t Size, uint64_t Hash = HASH_BYTES_SEED)
+{
+	const uint8_t *Bytes = (const uint8_t *)Data;
+	for(uint64_t ByteIndex = 0; ByteIndex < Size; ByteIndex++)
+	{
+		Hash ^= Bytes[ByteIndex];
+		Hash *= 0x100000001B3ull;
+	}
+
+	return(Hash);
+}
+
 // 
 // NOTE(georgy): Noise
 // 
@@ -0,0 +1,421 @@
+#pragma once
+
+#include "platform.cpp"
+#include "numa.cpp"
+#include "trace.cpp"
+
+// NOTE(georgy): Tracking allocator for the terrain buffers. Every allocation has a category and a small header with its size,
+//				 so live and peak bytes are known per category and per phase. MEMORY_PHASE("Erosion") makes the phase current
+//				 until the scope ends; a phase's peaks include whatever was already live, so they are what the process needed while
+//				 it ran. Phases are set by the thread driving the pipeline, allocations of its jobs count towards them too.
+//				 GPU staging isn't allocated here: it's the bytes handed to glBufferData, which the driver keeps a copy of (TrackExternalMemory).
+//				 PrintMemoryReport prints all of it, and while tracing every change is a sample of the "Memory" counter track
+enum memory_category
+{
+	MemoryCategory_HeightMap,
+	MemoryCategory_Scratch,
+	MemoryCategory_Mesh,
+	MemoryCategory_GPUStaging,
+	MemoryCategory_Query,
+
+	MemoryCategory_Count,
+};
+
+static const char *MemoryCategoryNames[MemoryCategory_Count] = { "heightmap", "scratch", "mesh", "gpu staging", "query" };
+
+#define MAX_MEMORY_PHASES 32
+
+// NOTE(georgy): 16 bytes, so the memory after it keeps malloc's alignment
+struct memory_block_header
+{
+	uint64_t Size;
+	uint32_t Category;
+	uint32_t Magic;
+};
+#define MEMORY_BLOCK_MAGIC 0x4B4C424D // NOTE(georgy): "MBLK"
+#define MEMORY_NODE_MAGIC 0x444F4E4D // NOTE(georgy): "MNOD", a block from AllocateNodeMemory
+
+struct memory_phase
+{
+	const char *Name;
+	int64_t Peak[MemoryCategory_Count];
+	int64_t PeakTotal;
+	// NOTE(georgy): Peak RSS of the process when the phase last ended
+	uint64_t PeakRSS;
+};
+
+struct memory_state
+{
+	std::mutex Lock;
+	int64_t Live[MemoryCategory_Count];
+	int64_t Peak[MemoryCategory_Count];
+	int64_t LiveTotal;
+	int64_t PeakTotal;
+	std::atomic<uint64_t> AllocationCount;
+
+	// NOTE(georgy): Phases[0] collects everything outside of a phase, the named ones are Phases[1..PhaseCount]
+	uint32_t CurrentPhase;
+	uint32_t PhaseCount;
+	memory_phase Phases[MAX_MEMORY_PHASES + 1];
+};
+
+static memory_state GlobalMemory;
+
+inline void
+UpdateMemoryPeaks(memory_phase *Phase)
+{
+	for(uint32_t Category = 0; Category < MemoryCategory_Count; Category++)
+	{
+		if(GlobalMemory.Live[Category] > Phase->Peak[Category]) Phase->Peak[Category] = GlobalMemory.Live[Category];
+	}
+	if(GlobalMemory.LiveTotal > Phase->PeakTotal) Phase->PeakTotal = GlobalMemory.LiveTotal;
+}
+
+static void
+TrackMemory(memory_category Category, int64_t Delta)
+{
+	double Values[MemoryCategory_Count];
+	{
+		std::lock_guard<std::mutex> Guard(GlobalMemory.Lock);
+		GlobalMemory.Live[Category] += Delta;
+		GlobalMemory.LiveTotal += Delta;
+		if(GlobalMemory.Live[Category] > GlobalMemory.Peak[Category]) GlobalMemory.Peak[Category] = GlobalMemory.Live[Category];
+		if(GlobalMemory.LiveTotal > GlobalMemory.PeakTotal) GlobalMemory.PeakTotal = GlobalMemory.LiveTotal;
+		UpdateMemoryPeaks(GlobalMemory.Phases + GlobalMemory.CurrentPhase);
+
+		for(uint32_t ValueIndex = 0; ValueIndex < MemoryCategory_Count; ValueIndex++)
+		{
+			Values[ValueIndex] = (double)GlobalMemory.Live[ValueIndex];
+		}
+	}
+
+	RecordTraceCounter("Memory", MemoryCategoryNames, Values, MemoryCategory_Count);
+}
+
+// NOTE(georgy): Memory this module doesn't allocate but that should be accounted for, Delta is negative when it's released
+static void
+TrackExternalMemory(memory_category Category, int64_t Delta)
+{
+	TrackMemory(Category, Delta);
+}
+
+static void *
+AllocateMemory(memory_category Category, uint64_t Size)
+{
+	void *Result = 0;
+	memory_block_header *Header = (memory_block_header *)malloc(sizeof(memory_block_header) + Size);
+	if(Header)
+	{
+		Header->Size = Size;
+		Header->Category = Category;
+		Header->Magic = MEMORY_BLOCK_MAGIC;
+		Result = Header + 1;
+
+		TrackMemory(Category, (int64_t)Size);
+		GlobalMemory.AllocationCount++;
+	}
+
+	return(Result);
+}
+
+static void *
+AllocateZeroedMemory(memory_category Category, uint64_t Size)
+{
+	void *Result = AllocateMemory(Category, Size);
+	if(Result)
+	{
+		memset(Result, 0, Size);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Whole pages, and whole 64 KB allocation units on Windows
+inline uint64_t
+NodeMemoryMappingSize(uint64_t Size)
+{
+	uint64_t Result = (sizeof(memory_block_header) + Size + 0xFFFF) & ~(uint64_t)0xFFFF;
+	return(Result);
+}
+
+// NOTE(georgy): Like AllocateMemory, but the pages come straight from the OS and are bound to NUMANode (see numa.cpp),
+//				 so they end up on that node whichever thread touches them first. Freed with FreeMemory as well.
+//				 On a machine with one node it's just AllocateMemory
+static void *
+AllocateNodeMemory(memory_category Category, uint64_t Size, uint32_t NUMANode)
+{
+	if(GlobalNUMA.NodeCount < 2)
+	{
+		return(AllocateMemory(Category, Size));
+	}
+
+	void *Result = 0;
+	bool HugePages;
+	uint64_t MappingSize = NodeMemoryMappingSize(Size);
+	memory_block_header *Header = (memory_block_header *)ReserveVirtualMemory(MappingSize, false, &HugePages);
+	if(Header)
+	{
+		BindMemoryToNode(&GlobalNUMA, Header, MappingSize, NUMANode);
+		if(CommitVirtualMemory(Header, MappingSize))
+		{
+			Header->Size = Size;
+			Header->Category = Category;
+			Header->Magic = MEMORY_NODE_MAGIC;
+			Result = Header + 1;
+
+			TrackMemory(Category, (int64_t)Size);
+			GlobalMemory.AllocationCount++;
+		}
+		else
+		{
+			ReleaseVirtualMemory(Header, MappingSize);
+		}
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Only for memory from AllocateMemory and AllocateNodeMemory, Memory can be 0
+static void
+FreeMemory(void *Memory)
+{
+	if(Memory)
+	{
+		memory_block_header *Header = (memory_block_header *)Memory - 1;
+		Assert((Header->Magic == MEMORY_BLOCK_MAGIC) || (Header->Magic == MEMORY_NODE_MAGIC));
+		TrackMemory((memory_category)Header->Category, -(int64_t)Header->Size);
+		if(Header->Magic == MEMORY_NODE_MAGIC)
+		{
+			Header->Magic = 0;
+			ReleaseVirtualMemory(Header, NodeMemoryMappingSize(Header->Size));
+		}
+		else
+		{
+			Header->Magic = 0;
+			free(Header);
+		}
+	}
+}
+
+inline double
+Megabytes(int64_t Bytes)
+{
+	double Result = Bytes / (1024.0*1024.0);
+	return(Result);
+}
+
+// NOTE(georgy): Arenas for buffers that are built over and over, like the viewer's terrain on every regeneration.
+//				 An arena reserves its address space once and hands memory out by moving Used, ResetArena takes all of it back
+//				 without giving the pages to the OS. The next run gets memory that is already resident: no allocator calls and
+//				 no page faults. Pages an arena has touched count as live memory of its category until FreeArena.
+//				 Not thread safe, the thread driving the pipeline pushes and its jobs write into what it pushed
+#define ARENA_COMMIT_SIZE (64*1024)
+
+struct memory_arena
+{
+	memory_category Category;
+	bool HugePages;
+
+	uint8_t *Base;
+	uint64_t Reserved;
+	uint64_t Committed;
+	uint64_t Used;
+};
+
+struct temporary_memory
+{
+	memory_arena *Arena;
+	uint64_t Used;
+};
+
+// NOTE(georgy): EROSION_HUGE_PAGES=1 asks for huge pages for the arenas of the viewer's terrain and of the benchmarks
+inline bool
+HugePagesRequested(void)
+{
+	const char *HugePagesEnv = getenv("EROSION_HUGE_PAGES");
+	bool Result = HugePagesEnv && (atoi(HugePagesEnv) != 0);
+
+	return(Result);
+}
+
+// NOTE(georgy): ReserveSize is rounded up to whole huge pages, so an arena for one heightmap can use them too.
+//				 With HugePages the arena asks for 2 MB pages (see ReserveVirtualMemory), Arena->HugePages tells if it got them
+static bool
+InitArena(memory_arena *Arena, memory_category Category, uint64_t ReserveSize, bool HugePages)
+{
+	memset(Arena, 0, sizeof(*Arena));
+	Arena->Category = Category;
+	Arena->Reserved = (ReserveSize + HUGE_PAGE_SIZE - 1) & ~(uint64_t)(HUGE_PAGE_SIZE - 1);
+	Arena->Base = (uint8_t *)ReserveVirtualMemory(Arena->Reserved, HugePages, &Arena->HugePages);
+	if(!Arena->Base)
+	{
+		printf("Failed to reserve %.2f MB for an arena\n", Megabytes((int64_t)Arena->Reserved));
+		Arena->Reserved = 0;
+	}
+
+	return(Arena->Base != 0);
+}
+
+// NOTE(georgy): Returns 0 when the arena is full. The memory isn't cleared: after a reset it holds whatever the last run left there
+static void *
+PushSize(memory_arena *Arena, uint64_t Size, uint64_t Alignment = 64)
+{
+	void *Result = 0;
+	uint64_t Offset = (Arena->Used + Alignment - 1) & ~(Alignment - 1);
+	if(Offset + Size <= Arena->Reserved)
+	{
+		if(Offset + Size > Arena->Committed)
+		{
+			uint64_t Committed = (Offset + Size + ARENA_COMMIT_SIZE - 1) & ~(uint64_t)(ARENA_COMMIT_SIZE - 1);
+			Committed = (Committed < Arena->Reserved) ? Committed : Arena->Reserved;
+			// NOTE(georgy): Large pages on Windows are committed with the reservation
+			if(!Arena->HugePages && !CommitVirtualMemory(Arena->Base + Arena->Committed, Committed - Arena->Committed))
+			{
+				return(0);
+			}
+			TrackMemory(Arena->Category, (int64_t)(Committed - Arena->Committed));
+			GlobalMemory.AllocationCount++;
+			Arena->Committed = Committed;
+		}
+
+		Result = Arena->Base + Offset;
+		Arena->Used = Offset + Size;
+	}
+
+	return(Result);
+}
+
+#define PushArray(Arena, Count, type) (type *)PushSize(Arena, sizeof(type)*(uint64_t)(Count))
+
+static void
+ResetArena(memory_arena *Arena)
+{
+	Arena->Used = 0;
+}
+
+static void
+FreeArena(memory_arena *Arena)
+{
+	if(Arena->Base)
+	{
+		TrackMemory(Arena->Category, -(int64_t)Arena->Committed);
+		ReleaseVirtualMemory(Arena->Base, Arena->Reserved);
+	}
+	memset(Arena, 0, sizeof(*Arena));
+}
+
+// NOTE(georgy): Everything pushed after BeginTemporaryMemory is popped by the matching EndTemporaryMemory
+inline temporary_memory
+BeginTemporaryMemory(memory_arena *Arena)
+{
+	temporary_memory Result;
+	Result.Arena = Arena;
+	Result.Used = Arena->Used;
+
+	return(Result);
+}
+
+inline void
+EndTemporaryMemory(temporary_memory Temporary)
+{
+	Assert(Temporary.Arena->Used >= Temporary.Used);
+	Temporary.Arena->Used = Temporary.Used;
+}
+
+// NOTE(georgy): Returns the phase that was current before, for EndMemoryPhase
+static uint32_t
+BeginMemoryPhase(const char *Name)
+{
+	std::lock_guard<std::mutex> Guard(GlobalMemory.Lock);
+	uint32_t Result = GlobalMemory.CurrentPhase;
+	uint32_t PhaseIndex = 0;
+	for(uint32_t Index = 1; Index <= GlobalMemory.PhaseCount; Index++)
+	{
+		if(strcmp(GlobalMemory.Phases[Index].Name, Name) == 0)
+		{
+			PhaseIndex = Index;
+			break;
+		}
+	}
+	if((PhaseIndex == 0) && (GlobalMemory.PhaseCount < MAX_MEMORY_PHASES))
+	{
+		PhaseIndex = ++GlobalMemory.PhaseCount;
+		memset(GlobalMemory.Phases + PhaseIndex, 0, sizeof(memory_phase));
+		GlobalMemory.Phases[PhaseIndex].Name = Name;
+	}
+
+	GlobalMemory.CurrentPhase = PhaseIndex;
+	UpdateMemoryPeaks(GlobalMemory.Phases + PhaseIndex);
+
+	return(Result);
+}
+
+static void
+EndMemoryPhase(uint32_t PreviousPhase)
+{
+	uint64_t PeakRSS = GetPeakRSS();
+
+	std::lock_guard<std::mutex> Guard(GlobalMemory.Lock);
+	GlobalMemory.Phases[GlobalMemory.CurrentPhase].PeakRSS = PeakRSS;
+	GlobalMemory.CurrentPhase = PreviousPhase;
+}
+
+struct memory_phase_scope
+{
+	uint32_t PreviousPhase;
+
+	memory_phase_scope(const char *Name)
+	{
+		PreviousPhase = BeginMemoryPhase(Name);
+	}
+
+	~memory_phase_scope()
+	{
+		EndMemoryPhase(PreviousPhase);
+	}
+};
+
+#define MEMORY_PHASE(Name) memory_phase_scope TRACE_JOIN(MemoryPhase_, __LINE__)(Name)
+
+static void
+PrintMemoryReport(void)
+{
+	std::lock_guard<std::mutex> Guard(GlobalMemory.Lock);
+	if(GlobalMemory.AllocationCount == 0)
+	{
+		return;
+	}
+
+	printf("Tracked memory, MB       live       peak\n");
+	for(uint32_t Category = 0; Category < MemoryCategory_Count; Category++)
+	{
+		printf("  %-18s %10.2f %10.2f\n", MemoryCategoryNames[Category], Megabytes(GlobalMemory.Live[Category]), Megabytes(GlobalMemory.Peak[Category]));
+	}
+	printf("  %-18s %10.2f %10.2f\n", "total", Megabytes(GlobalMemory.LiveTotal), Megabytes(GlobalMemory.PeakTotal));
+	printf("  %llu allocations, process peak RSS %.2f MB\n", (unsigned long long)GlobalMemory.AllocationCount, Megabytes((int64_t)GetPeakRSS()));
+
+	printf("Peaks by phase, MB");
+	for(uint32_t Category = 0; Category < MemoryCategory_Count; Category++)
+	{
+		printf(" %11s", MemoryCategoryNames[Category]);
+	}
+	printf(" %11s %11s\n", "total", "peak RSS");
+	for(uint32_t PhaseIndex = 0; PhaseIndex <= GlobalMemory.PhaseCount; PhaseIndex++)
+	{
+		const memory_phase *Phase = GlobalMemory.Phases + PhaseIndex;
+		printf("  %-16s", (PhaseIndex == 0) ? "(no phase)" : Phase->Name);
+		for(uint32_t Category = 0; Category < MemoryCategory_Count; Category++)
+		{
+			printf(" %11.2f", Megabytes(Phase->Peak[Category]));
+		}
+		printf(" %11.2f", Megabytes(Phase->PeakTotal));
+		if(Phase->PeakRSS)
+		{
+			printf(" %11.2f\n", Megabytes((int64_t)Phase->PeakRSS));
+		}
+		else
+		{
+			printf(" %11s\n", "-");
+		}
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "job_system.cpp"
+#include "trace.cpp"
+
+static vec3
+CalculateNormal(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, uint32_t X, uint32_t Z)
+{
+	if(X == 0) X = 1;
+	if(Z == 0) Z = 1;
+	if(X == GridWidth) X = GridWidth - 1;
+	if(Z == GridHeight) Z = GridHeight - 1;
+
+	float HeightLeft = HeightMap[(X - 1) + Z*(GridWidth + 1)];
+	float HeightRight = HeightMap[(X + 1) + Z*(GridWidth + 1)];
+	float HeightDown = HeightMap[X + (Z - 1)*(GridWidth + 1)];
+	float HeightUp = HeightMap[X + (Z + 1)*(GridWidth + 1)];
+
+	vec3 Normal = Normalize(vec3(HeightLeft - HeightRight, 0.125f, HeightUp - HeightDown));
+	return(Normal);
+}
+
+// NOTE(georgy): CalculateNormal clamps border vertices to their nearest interior neighbour,
+//				 so the border is just a copy of the already computed interior
+static void
+CopyBorderNormals(uint32_t GridWidth, uint32_t GridHeight, normal_format Format, void *Normals)
+{
+	uint32_t Stride = (Format == NormalFormat_Packed) ? sizeof(uint32_t) : sizeof(vec3);
+	uint8_t *Base = (uint8_t *)Normals;
+	uint32_t RowSize = Stride*(GridWidth + 1);
+
+	for(uint32_t Z = 1; Z < GridHeight; Z++)
+	{
+		uint8_t *Row = Base + Z*RowSize;
+		memcpy(Row, Row + Stride, Stride);
+		memcpy(Row + GridWidth*Stride, Row + (GridWidth - 1)*Stride, Stride);
+	}
+
+	memcpy(Base, Base + RowSize, RowSize);
+	memcpy(Base + GridHeight*RowSize, Base + (GridHeight - 1)*RowSize, RowSize);
+}
+
+// NOTE(georgy): Same result as calling CalculateNormal for every vertex, but interior rows go through the
+//				 SIMD kernel in parallel on the job system and the result is written straight in the requested format.
+//				 Normals must have room for (GridWidth + 1)*(GridHeight + 1) elements
+static void
+CalculateNormals(job_system *Jobs, const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, normal_format Format, void *Normals)
+{
+	TIMED_FUNCTION();
+	Assert((GridWidth >= 2) && (GridHeight >= 2));
+
+	uint32_t Stride = (Format == NormalFormat_Packed) ? sizeof(uint32_t) : sizeof(vec3);
+	uint32_t RowSize = Stride*(GridWidth + 1);
+	normals_row_kernel *NormalsRow = TerrainKernels.NormalsRow;
+
+	uint32_t InteriorRowCount = GridHeight - 1;
+	ParallelFor(Jobs, "NormalRows", InteriorRowCount, GrainForCount(Jobs, InteriorRowCount), [=](uint32_t Begin, uint32_t End)
+	{
+		for(uint32_t Z = 1 + Begin; Z < 1 + End; Z++)
+		{
+			NormalsRow(HeightMap, GridWidth, Z, Format, (uint8_t *)Normals + Z*RowSize);
+		}
+	});
+
+	CopyBorderNormals(GridWidth, GridHeight, Format, Normals);
+}
+
+// NOTE(georgy): Recomputes normals only for the vertices in [XMin, XMax]x[ZMin, ZMax], e.g. after a local edit.
+//				 A changed height also changes the normals of its neighbours, so callers pass the edited rectangle grown by 1
+static void
+CalculateNormalsRect(job_system *Jobs, float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, brush_rect Rect,
+					 normal_format Format, void *Normals)
+{
+	TIMED_FUNCTION();
+	Assert((Rect.XMin >= 0) && (Rect.XMax <= (int32_t)GridWidth) && (Rect.XMin <= Rect.XMax));
+	Assert((Rect.ZMin >= 0) && (Rect.ZMax <= (int32_t)GridHeight) && (Rect.ZMin <= Rect.ZMax));
+
+	uint32_t Stride = (Format == NormalFormat_Packed) ? sizeof(uint32_t) : sizeof(vec3);
+	uint32_t RowSize = Stride*(GridWidth + 1);
+
+	uint32_t RowCount = (uint32_t)(Rect.ZMax - Rect.ZMin + 1);
+	ParallelFor(Jobs, "NormalRect", RowCount, GrainForCount(Jobs, RowCount), [=](uint32_t Begin, uint32_t End)
+	{
+		for(uint32_t Z = (uint32_t)Rect.ZMin + Begin; Z < (uint32_t)Rect.ZMin + End; Z++)
+		{
+			void *Row = (uint8_t *)Normals + Z*RowSize;
+			for(uint32_t X = (uint32_t)Rect.XMin; X <= (uint32_t)Rect.XMax; X++)
+			{
+				StoreNormal(Format, Row, X, CalculateNormal(HeightMap, GridWidth, GridHeight, X, Z));
+			}
+		}
+	});
+}
+
+// NOTE(georgy): Grows Rect by Amount samples on every side, clamped to the grid
+inline brush_rect
+GrowRect(brush_rect Rect, int32_t Amount, uint32_t GridWidth, uint32_t GridHeight)
+{
+	brush_rect Result;
+	Result.XMin = Max(Rect.XMin - Amount, 0);
+	Result.XMax = Min(Rect.XMax + Amount, (int32_t)GridWidth);
+	Result.ZMin = Max(Rect.ZMin - Amount, 0);
+	Result.ZMax = Min(Rect.ZMax + Amount, (int32_t)GridHeight);
+
+	return(Result);
+}
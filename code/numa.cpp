@@ -0,0 +1,253 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// NOTE(georgy): NUMA nodes and the CPUs that belong to them. Nodes are numbered 0..NodeCount-1 here, OSNodes has the
+//				 numbers the OS uses. Nodes without CPUs (memory-only ones) are left out. Without NUMA support, or on a machine
+//				 with one node, everything is node 0 and the functions below do nothing.
+//				 Memory placement goes through raw syscalls, so there's no dependency on libnuma: mbind to place a range,
+//				 move_pages to ask where pages ended up. Windows places pages on the node of the thread that touches them
+//				 first, so there it's up to the pinning
+#define MAX_NUMA_NODES 64
+#define MAX_NUMA_CPUS 1024
+#define NUMA_ANY_NODE 0xFFFFFFFF
+#define NUMA_ANY_CPU 0xFFFFFFFF
+
+struct numa_topology
+{
+	uint32_t NodeCount;
+	uint32_t OSNodes[MAX_NUMA_NODES];
+	uint32_t FirstCPU[MAX_NUMA_NODES];
+	uint32_t CPUCount[MAX_NUMA_NODES];
+	uint16_t CPUs[MAX_NUMA_CPUS];
+};
+
+static numa_topology GlobalNUMA;
+
+#if defined(__linux__)
+
+// NOTE(georgy): Parses "0-15,32-47" lists from sysfs, calls Callback for every number in them
+template<typename callback> static void
+ParseSysfsList(const char *Filename, callback Callback)
+{
+	FILE *File = fopen(Filename, "r");
+	if(File)
+	{
+		char Line[4096];
+		if(fgets(Line, sizeof(Line), File))
+		{
+			char *At = Line;
+			while((*At >= '0') && (*At <= '9'))
+			{
+				uint32_t First = (uint32_t)strtoul(At, &At, 10);
+				uint32_t Last = First;
+				if(*At == '-')
+				{
+					Last = (uint32_t)strtoul(At + 1, &At, 10);
+				}
+				for(uint32_t Value = First; Value <= Last; Value++)
+				{
+					Callback(Value);
+				}
+				if(*At == ',') At++;
+			}
+		}
+		fclose(File);
+	}
+}
+
+#endif
+
+static void
+DetectNUMATopology(numa_topology *Topology)
+{
+	memset(Topology, 0, sizeof(*Topology));
+	uint32_t CPUTotal = 0;
+
+#if defined(_WIN32)
+	ULONG HighestNode = 0;
+	if(GetNumaHighestNodeNumber(&HighestNode))
+	{
+		for(ULONG Node = 0; (Node <= HighestNode) && (Topology->NodeCount < MAX_NUMA_NODES); Node++)
+		{
+			// NOTE(georgy): Only the first processor group, like the rest of the affinity code
+			ULONGLONG Mask = 0;
+			if(GetNumaNodeProcessorMask((UCHAR)Node, &Mask) && Mask)
+			{
+				uint32_t NodeIndex = Topology->NodeCount++;
+				Topology->OSNodes[NodeIndex] = (uint32_t)Node;
+				Topology->FirstCPU[NodeIndex] = CPUTotal;
+				for(uint32_t CPU = 0; (CPU < 64) && (CPUTotal < MAX_NUMA_CPUS); CPU++)
+				{
+					if(Mask & ((ULONGLONG)1 << CPU))
+					{
+						Topology->CPUs[CPUTotal++] = (uint16_t)CPU;
+					}
+				}
+				Topology->CPUCount[NodeIndex] = CPUTotal - Topology->FirstCPU[NodeIndex];
+			}
+		}
+	}
+#elif defined(__linux__)
+	ParseSysfsList("/sys/devices/system/node/online", [&](uint32_t Node)
+	{
+		if(Topology->NodeCount < MAX_NUMA_NODES)
+		{
+			uint32_t NodeIndex = Topology->NodeCount;
+			Topology->OSNodes[NodeIndex] = Node;
+			Topology->FirstCPU[NodeIndex] = CPUTotal;
+
+			char Filename[128];
+			snprintf(Filename, sizeof(Filename), "/sys/devices/system/node/node%u/cpulist", Node);
+			ParseSysfsList(Filename, [&](uint32_t CPU)
+			{
+				if(CPUTotal < MAX_NUMA_CPUS)
+				{
+					Topology->CPUs[CPUTotal++] = (uint16_t)CPU;
+				}
+			});
+
+			Topology->CPUCount[NodeIndex] = CPUTotal - Topology->FirstCPU[NodeIndex];
+			if(Topology->CPUCount[NodeIndex])
+			{
+				Topology->NodeCount++;
+			}
+		}
+	});
+#endif
+
+	if(Topology->NodeCount == 0)
+	{
+		uint32_t CPUCount = std::thread::hardware_concurrency();
+		CPUCount = (CPUCount == 0) ? 1 : ((CPUCount < MAX_NUMA_CPUS) ? CPUCount : MAX_NUMA_CPUS);
+		Topology->NodeCount = 1;
+		Topology->CPUCount[0] = CPUCount;
+		for(uint32_t CPU = 0; CPU < CPUCount; CPU++)
+		{
+			Topology->CPUs[CPU] = (uint16_t)CPU;
+		}
+	}
+}
+
+// NOTE(georgy): CPUIndex is taken modulo the node's CPUs, NUMA_ANY_CPU lets the thread run on any CPU of the node
+static void
+PinCurrentThreadToNode(const numa_topology *Topology, uint32_t Node, uint32_t CPUIndex)
+{
+	const uint16_t *CPUs = Topology->CPUs + Topology->FirstCPU[Node];
+	uint32_t CPUCount = Topology->CPUCount[Node];
+	uint32_t First = (CPUIndex == NUMA_ANY_CPU) ? 0 : (CPUIndex % CPUCount);
+	uint32_t Last = (CPUIndex == NUMA_ANY_CPU) ? CPUCount : (First + 1);
+
+#if defined(_WIN32)
+	DWORD_PTR Mask = 0;
+	for(uint32_t Index = First; Index < Last; Index++)
+	{
+		Mask |= (DWORD_PTR)1 << CPUs[Index];
+	}
+	SetThreadAffinityMask(GetCurrentThread(), Mask);
+#elif defined(__linux__)
+	cpu_set_t Set;
+	CPU_ZERO(&Set);
+	for(uint32_t Index = First; Index < Last; Index++)
+	{
+		CPU_SET(CPUs[Index], &Set);
+	}
+	pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set);
+#endif
+}
+
+#if defined(__linux__) && defined(__NR_mbind)
+
+// NOTE(georgy): From <linux/mempolicy.h>
+#define NUMA_MPOL_PREFERRED 1
+
+inline void
+NUMANodeMask(const numa_topology *Topology, uint32_t Node, unsigned long *Mask, uint32_t MaskWords)
+{
+	memset(Mask, 0, sizeof(unsigned long)*MaskWords);
+	uint32_t OSNode = Topology->OSNodes[Node];
+	uint32_t WordBits = 8*sizeof(unsigned long);
+	Mask[OSNode / WordBits] |= 1UL << (OSNode % WordBits);
+}
+
+// NOTE(georgy): Pages of [Memory, Memory + Size) that aren't there yet are allocated on Node when they're first touched,
+//				 or on another node if that one is full. Memory has to be page aligned
+static bool
+BindMemoryToNode(const numa_topology *Topology, void *Memory, uint64_t Size, uint32_t Node)
+{
+	unsigned long Mask[MAX_NUMA_NODES / (8*sizeof(unsigned long)) + 1];
+	NUMANodeMask(Topology, Node, Mask, ArrayCount(Mask));
+	bool Result = (syscall(__NR_mbind, Memory, Size, NUMA_MPOL_PREFERRED, Mask, 8*sizeof(Mask), 0) == 0);
+
+	return(Result);
+}
+
+// NOTE(georgy): Checks up to SampleCount pages spread over the range and counts the ones on Node. Pages that were never
+//				 touched aren't anywhere and aren't counted
+static void
+CountPagesOnNode(const numa_topology *Topology, const void *Memory, uint64_t Size, uint32_t Node,
+				 uint64_t *LocalPages, uint64_t *TotalPages)
+{
+	const uint32_t SampleCount = 64;
+	uint64_t PageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+	uint64_t PageCount = Size / PageSize;
+	if(PageCount == 0)
+	{
+		return;
+	}
+
+	void *Pages[SampleCount];
+	int Status[SampleCount];
+	uint32_t Count = (PageCount < SampleCount) ? (uint32_t)PageCount : SampleCount;
+	uintptr_t First = ((uintptr_t)Memory + PageSize - 1) & ~(uintptr_t)(PageSize - 1);
+	for(uint32_t Index = 0; Index < Count; Index++)
+	{
+		Pages[Index] = (void *)(First + ((uint64_t)Index*(PageCount - 1) / Count)*PageSize);
+	}
+
+	if(syscall(__NR_move_pages, 0, (unsigned long)Count, Pages, 0, Status, 0) == 0)
+	{
+		for(uint32_t Index = 0; Index < Count; Index++)
+		{
+			if(Status[Index] >= 0)
+			{
+				*TotalPages += 1;
+				*LocalPages += ((uint32_t)Status[Index] == Topology->OSNodes[Node]) ? 1 : 0;
+			}
+		}
+	}
+}
+
+#else
+
+static bool
+BindMemoryToNode(const numa_topology *Topology, void *Memory, uint64_t Size, uint32_t Node)
+{
+	return(false);
+}
+
+static void
+CountPagesOnNode(const numa_topology *Topology, const void *Memory, uint64_t Size, uint32_t Node,
+				 uint64_t *LocalPages, uint64_t *TotalPages)
+{
+}
+
+#endif
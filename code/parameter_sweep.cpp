@@ -0,0 +1,385 @@
+#pragma once
+
+#include "erosion.cpp"
+#include "terrain.cpp"
+#include "platform.cpp"
+
+#include <stddef.h>
+
+// NOTE(georgy): Parameter sweep. The base heightmap is generated once and written to base.r32 in the output directory,
+//				 then every combination of the swept erosion parameters runs in its own forked process on a copy-on-write
+//				 mapping of that file. The clean pages stay shared in the page cache and only the pages a configuration
+//				 erodes get copied. Results go to a shared anonymous mapping, the parent prints them as a table and writes
+//				 sweep.csv next to the sweep_NNN.r32 heightmaps. Children never touch the job system, its threads don't survive fork
+#define MAX_SWEEP_AXES 8
+#define MAX_SWEEP_VALUES 32
+
+enum sweep_param_type
+{
+	SweepParam_U32,
+	SweepParam_S32,
+	SweepParam_Float,
+};
+
+struct sweep_param_info
+{
+	const char *Name;
+	sweep_param_type Type;
+	uint32_t Offset;
+};
+
+static const sweep_param_info SweepParams[] =
+{
+	{ "DropletCount", SweepParam_U32, offsetof(erosion_params, DropletCount) },
+	{ "MaxLifeTime", SweepParam_U32, offsetof(erosion_params, MaxLifeTime) },
+	{ "Seed", SweepParam_U32, offsetof(erosion_params, Seed) },
+	{ "Inertia", SweepParam_Float, offsetof(erosion_params, Inertia) },
+	{ "CapacityFactor", SweepParam_Float, offsetof(erosion_params, CapacityFactor) },
+	{ "MinCarryCapacity", SweepParam_Float, offsetof(erosion_params, MinCarryCapacity) },
+	{ "Deposition", SweepParam_Float, offsetof(erosion_params, Deposition) },
+	{ "Erosion", SweepParam_Float, offsetof(erosion_params, Erosion) },
+	{ "Evaporation", SweepParam_Float, offsetof(erosion_params, Evaporation) },
+	{ "Gravity", SweepParam_Float, offsetof(erosion_params, Gravity) },
+	{ "Radius", SweepParam_S32, offsetof(erosion_params, Radius) },
+};
+
+struct sweep_axis
+{
+	const sweep_param_info *Param;
+	uint32_t ValueCount;
+	float Values[MAX_SWEEP_VALUES];
+};
+
+struct sweep_result
+{
+	erosion_params Params;
+	bool Done;
+
+	uint64_t Nanoseconds;
+	// NOTE(georgy): Total height removed and added compared to the base, Eroded - Deposited is the mass lost by the run
+	double Eroded;
+	double Deposited;
+	float MaxChange;
+	float RMSChange;
+	uint64_t Hash;
+};
+
+// NOTE(georgy): Parses "Name=Value,Value,..." with Name from SweepParams
+static bool
+ParseSweepAxis(sweep_axis *Axis, const char *Text)
+{
+	const char *Equals = strchr(Text, '=');
+	if(!Equals)
+	{
+		printf("Expected Name=Value,Value,... instead of %s\n", Text);
+		return(false);
+	}
+
+	Axis->Param = 0;
+	for(uint32_t ParamIndex = 0; ParamIndex < ArrayCount(SweepParams); ParamIndex++)
+	{
+		const char *Name = SweepParams[ParamIndex].Name;
+		if((strlen(Name) == (size_t)(Equals - Text)) && (strncmp(Name, Text, Equals - Text) == 0))
+		{
+			Axis->Param = SweepParams + ParamIndex;
+		}
+	}
+	if(!Axis->Param)
+	{
+		printf("Unknown erosion parameter in %s\n", Text);
+		return(false);
+	}
+
+	Axis->ValueCount = 0;
+	const char *At = Equals + 1;
+	while(*At)
+	{
+		char *End;
+		float Value = strtof(At, &End);
+		if((End == At) || ((*End != ',') && (*End != 0)) || (Axis->ValueCount == MAX_SWEEP_VALUES))
+		{
+			printf("Bad value list in %s\n", Text);
+			return(false);
+		}
+		Axis->Values[Axis->ValueCount++] = Value;
+		At = (*End == ',') ? (End + 1) : End;
+	}
+
+	bool Result = (Axis->ValueCount > 0);
+	return(Result);
+}
+
+static void
+SetSweepParam(erosion_params *Params, const sweep_param_info *Param, float Value)
+{
+	uint8_t *Field = (uint8_t *)Params + Param->Offset;
+	switch(Param->Type)
+	{
+		case SweepParam_U32: *(uint32_t *)Field = (uint32_t)Value; break;
+		case SweepParam_S32: *(int32_t *)Field = (int32_t)Value; break;
+		case SweepParam_Float: *(float *)Field = Value; break;
+	}
+}
+
+static float
+GetSweepParam(const erosion_params *Params, const sweep_param_info *Param)
+{
+	float Result = 0.0f;
+	const uint8_t *Field = (const uint8_t *)Params + Param->Offset;
+	switch(Param->Type)
+	{
+		case SweepParam_U32: Result = (float)*(const uint32_t *)Field; break;
+		case SweepParam_S32: Result = (float)*(const int32_t *)Field; break;
+		case SweepParam_Float: Result = *(const float *)Field; break;
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Every combination of the axis values, the first axis changes slowest
+static uint32_t
+BuildSweepConfigurations(const erosion_params *BaseParams, const sweep_axis *Axes, uint32_t AxisCount, std::vector<erosion_params> &Configurations)
+{
+	uint32_t Count = 1;
+	for(uint32_t AxisIndex = 0; AxisIndex < AxisCount; AxisIndex++)
+	{
+		Count *= Axes[AxisIndex].ValueCount;
+	}
+
+	Configurations.resize(Count);
+	for(uint32_t ConfigIndex = 0; ConfigIndex < Count; ConfigIndex++)
+	{
+		erosion_params *Params = &Configurations[ConfigIndex];
+		*Params = *BaseParams;
+
+		uint32_t Remainder = ConfigIndex;
+		for(int32_t AxisIndex = (int32_t)AxisCount - 1; AxisIndex >= 0; AxisIndex--)
+		{
+			const sweep_axis *Axis = Axes + AxisIndex;
+			SetSweepParam(Params, Axis->Param, Axis->Values[Remainder % Axis->ValueCount]);
+			Remainder /= Axis->ValueCount;
+		}
+	}
+
+	return(Count);
+}
+
+static bool
+ValidSweepConfiguration(const erosion_params *Params)
+{
+	bool Result = (Params->MaxLifeTime > 0) && (Params->Radius >= 1) && (Params->Radius <= MAX_CACHED_BRUSH_RADIUS) &&
+				  (Params->Inertia >= 0.0f) && (Params->Inertia < 1.0f) && (Params->Evaporation >= 0.0f) && (Params->Evaporation <= 1.0f);
+
+	return(Result);
+}
+
+// NOTE(georgy): Erodes a copy-on-write mapping of BaseFilename, which holds the same heights as Base, and fills in Result
+static void
+RunSweepConfiguration(const char *BaseFilename, const float *Base, uint32_t GridWidth, uint32_t GridHeight, const char *OutputDirectory,
+					  uint32_t ConfigIndex, sweep_result *Result)
+{
+	uint32_t SampleCount = (GridWidth + 1)*(GridHeight + 1);
+
+	mapped_file Mapping;
+	if(!MapExistingFile(&Mapping, BaseFilename, true))
+	{
+		return;
+	}
+	if(Mapping.Size != sizeof(float)*SampleCount)
+	{
+		UnmapFile(&Mapping);
+		return;
+	}
+	float *HeightMap = (float *)Mapping.Memory;
+
+	uint64_t BeginTime = GetNanoseconds();
+	WaterErosion(HeightMap, GridWidth, GridHeight, &Result->Params);
+	Result->Nanoseconds = GetNanoseconds() - BeginTime;
+
+	double ChangeSqSum = 0.0;
+	for(uint32_t SampleIndex = 0; SampleIndex < SampleCount; SampleIndex++)
+	{
+		float Change = HeightMap[SampleIndex] - Base[SampleIndex];
+		if(Change < 0.0f)
+		{
+			Result->Eroded -= Change;
+		}
+		else
+		{
+			Result->Deposited += Change;
+		}
+		Result->MaxChange = Max(Result->MaxChange, Absolute(Change));
+		ChangeSqSum += (double)Change*Change;
+	}
+	Result->RMSChange = (float)sqrt(ChangeSqSum / SampleCount);
+	Result->Hash = HashBytes(HeightMap, sizeof(float)*SampleCount);
+
+	char Filename[512];
+	snprintf(Filename, sizeof(Filename), "%s/sweep_%03u.r32", OutputDirectory, ConfigIndex);
+	Result->Done = WriteEntireFileAtomic(Filename, HeightMap, sizeof(float)*SampleCount);
+
+	UnmapFile(&Mapping);
+}
+
+static void
+WriteSweepSummary(const char *OutputDirectory, const sweep_axis *Axes, uint32_t AxisCount, const sweep_result *Results, uint32_t ResultCount)
+{
+	char Filename[512];
+	snprintf(Filename, sizeof(Filename), "%s/sweep.csv", OutputDirectory);
+	FILE *CSV = fopen(Filename, "w");
+
+	printf("%5s", "#");
+	if(CSV) fprintf(CSV, "index");
+	for(uint32_t AxisIndex = 0; AxisIndex < AxisCount; AxisIndex++)
+	{
+		printf(" %16s", Axes[AxisIndex].Param->Name);
+		if(CSV) fprintf(CSV, ",%s", Axes[AxisIndex].Param->Name);
+	}
+	printf(" %10s %12s %12s %12s %10s %10s %16s\n", "ms", "eroded", "deposited", "mass lost", "max", "rms", "hash");
+	if(CSV) fprintf(CSV, ",ms,eroded,deposited,mass_lost,max_change,rms_change,hash\n");
+
+	for(uint32_t ResultIndex = 0; ResultIndex < ResultCount; ResultIndex++)
+	{
+		const sweep_result *Result = Results + ResultIndex;
+		printf("%5u", ResultIndex);
+		if(CSV) fprintf(CSV, "%u", ResultIndex);
+		for(uint32_t AxisIndex = 0; AxisIndex < AxisCount; AxisIndex++)
+		{
+			float Value = GetSweepParam(&Result->Params, Axes[AxisIndex].Param);
+			printf(" %16g", Value);
+			if(CSV) fprintf(CSV, ",%g", Value);
+		}
+
+		if(Result->Done)
+		{
+			double Milliseconds = Result->Nanoseconds / 1000000.0;
+			double MassLost = Result->Eroded - Result->Deposited;
+			printf(" %10.2f %12.3f %12.3f %12.3f %10.4f %10.4f %016llx\n", Milliseconds, Result->Eroded, Result->Deposited, MassLost,
+				   Result->MaxChange, Result->RMSChange, (unsigned long long)Result->Hash);
+			if(CSV) fprintf(CSV, ",%.3f,%.6f,%.6f,%.6f,%g,%g,%016llx\n", Milliseconds, Result->Eroded, Result->Deposited, MassLost,
+							Result->MaxChange, Result->RMSChange, (unsigned long long)Result->Hash);
+		}
+		else
+		{
+			printf(" FAILED\n");
+			if(CSV) fprintf(CSV, ",,,,,,,\n");
+		}
+	}
+
+	if(CSV)
+	{
+		fclose(CSV);
+	}
+}
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#endif
+
+// NOTE(georgy): Runs the configurations on up to ProcessCount processes at a time. Base stays untouched
+static bool
+RunParameterSweep(const float *Base, uint32_t GridWidth, uint32_t GridHeight, const std::vector<erosion_params> &Configurations,
+				  const sweep_axis *Axes, uint32_t AxisCount, const char *OutputDirectory, uint32_t ProcessCount)
+{
+	uint32_t ConfigCount = (uint32_t)Configurations.size();
+	uint64_t SampleCount = (uint64_t)(GridWidth + 1)*(GridHeight + 1);
+	char BaseFilename[512];
+	snprintf(BaseFilename, sizeof(BaseFilename), "%s/base.r32", OutputDirectory);
+	if(!MakeDirectory(OutputDirectory) || !WriteEntireFileAtomic(BaseFilename, Base, sizeof(float)*SampleCount))
+	{
+		printf("Failed to write %s\n", BaseFilename);
+		return(false);
+	}
+
+	uint64_t BeginTime = GetNanoseconds();
+	uint64_t ResultsSize = sizeof(sweep_result)*ConfigCount;
+#if defined(_WIN32)
+	// NOTE(georgy): No fork, configurations run one after another
+	sweep_result *Results = (sweep_result *)calloc(1, ResultsSize);
+	if(!Results)
+	{
+		return(false);
+	}
+	ProcessCount = 1;
+	for(uint32_t ConfigIndex = 0; ConfigIndex < ConfigCount; ConfigIndex++)
+	{
+		Results[ConfigIndex].Params = Configurations[ConfigIndex];
+		if(ValidSweepConfiguration(&Results[ConfigIndex].Params))
+		{
+			RunSweepConfiguration(BaseFilename, Base, GridWidth, GridHeight, OutputDirectory, ConfigIndex, Results + ConfigIndex);
+		}
+	}
+#else
+	sweep_result *Results = (sweep_result *)mmap(0, ResultsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(Results == MAP_FAILED)
+	{
+		printf("Failed to map the sweep results\n");
+		return(false);
+	}
+	memset(Results, 0, ResultsSize);
+
+	std::vector<pid_t> Running;
+	uint32_t NextConfig = 0;
+	fflush(stdout);
+	while((NextConfig < ConfigCount) || !Running.empty())
+	{
+		while((NextConfig < ConfigCount) && (Running.size() < ProcessCount))
+		{
+			uint32_t ConfigIndex = NextConfig++;
+			Results[ConfigIndex].Params = Configurations[ConfigIndex];
+			if(!ValidSweepConfiguration(&Results[ConfigIndex].Params))
+			{
+				continue;
+			}
+
+			pid_t Pid = fork();
+			if(Pid == 0)
+			{
+				RunSweepConfiguration(BaseFilename, Base, GridWidth, GridHeight, OutputDirectory, ConfigIndex, Results + ConfigIndex);
+				_exit(Results[ConfigIndex].Done ? 0 : 1);
+			}
+			else if(Pid > 0)
+			{
+				Running.push_back(Pid);
+			}
+		}
+
+		pid_t DeadPid = waitpid(-1, 0, 0);
+		for(uint32_t RunningIndex = 0; RunningIndex < Running.size(); RunningIndex++)
+		{
+			if(Running[RunningIndex] == DeadPid)
+			{
+				Running[RunningIndex] = Running.back();
+				Running.pop_back();
+				break;
+			}
+		}
+		if((DeadPid < 0) && Running.empty() && (NextConfig < ConfigCount))
+		{
+			printf("Failed to start sweep processes\n");
+			break;
+		}
+	}
+#endif
+	uint64_t EndTime = GetNanoseconds();
+
+	WriteSweepSummary(OutputDirectory, Axes, AxisCount, Results, ConfigCount);
+
+	bool Result = true;
+	uint64_t SerialNanoseconds = 0;
+	for(uint32_t ConfigIndex = 0; ConfigIndex < ConfigCount; ConfigIndex++)
+	{
+		Result = Result && Results[ConfigIndex].Done;
+		SerialNanoseconds += Results[ConfigIndex].Nanoseconds;
+	}
+	double WallMilliseconds = (EndTime - BeginTime) / 1000000.0;
+	printf("%u configurations on %u processes: %.1f ms, %.2fx the erosion time of one process\n", ConfigCount, ProcessCount,
+		   WallMilliseconds, (SerialNanoseconds / 1000000.0) / WallMilliseconds);
+
+#if defined(_WIN32)
+	free(Results);
+#else
+	munmap(Results, ResultsSize);
+#endif
+	return(Result);
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+// NOTE(georgy): Hardware counters around benchmark cases through perf_event_open. Every thread of the process gets its own
+//				 counters (the job workers already exist, so inherit wouldn't reach them) and the totals are summed.
+//				 A counter the kernel or the CPU doesn't have is just reported as unavailable, multiplexed counters are scaled
+//				 by enabled/running time. Only Linux has them, elsewhere every counter is unavailable
+
+enum perf_counter_kind
+{
+	PerfCounter_Cycles,
+	PerfCounter_Instructions,
+	PerfCounter_L1DMisses,
+	PerfCounter_LLCMisses,
+	PerfCounter_DTLBMisses,
+	PerfCounter_BranchMisses,
+	PerfCounter_PageFaults,
+
+	PerfCounter_Count,
+};
+
+static const char *PerfCounterNames[PerfCounter_Count] =
+{
+	"cycles", "instructions", "L1D misses", "LLC misses", "dTLB misses", "branch misses", "page faults",
+};
+
+#define MAX_PERF_THREADS 256
+
+struct perf_counter_set
+{
+	uint32_t ThreadCount;
+	int Files[MAX_PERF_THREADS][PerfCounter_Count];
+};
+
+struct perf_counter_values
+{
+	bool Valid[PerfCounter_Count];
+	double Values[PerfCounter_Count];
+};
+
+#if defined(__linux__)
+
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int
+OpenPerfCounter(perf_counter_kind Kind, pid_t ThreadID)
+{
+	perf_event_attr Attributes;
+	memset(&Attributes, 0, sizeof(Attributes));
+	Attributes.size = sizeof(Attributes);
+	Attributes.disabled = 1;
+	Attributes.exclude_kernel = 1;
+	Attributes.exclude_hv = 1;
+	Attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	uint64_t ReadMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	switch(Kind)
+	{
+		case PerfCounter_Cycles: Attributes.type = PERF_TYPE_HARDWARE; Attributes.config = PERF_COUNT_HW_CPU_CYCLES; break;
+		case PerfCounter_Instructions: Attributes.type = PERF_TYPE_HARDWARE; Attributes.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+		case PerfCounter_L1DMisses: Attributes.type = PERF_TYPE_HW_CACHE; Attributes.config = PERF_COUNT_HW_CACHE_L1D | ReadMiss; break;
+		case PerfCounter_LLCMisses: Attributes.type = PERF_TYPE_HARDWARE; Attributes.config = PERF_COUNT_HW_CACHE_MISSES; break;
+		case PerfCounter_DTLBMisses: Attributes.type = PERF_TYPE_HW_CACHE; Attributes.config = PERF_COUNT_HW_CACHE_DTLB | ReadMiss; break;
+		case PerfCounter_BranchMisses: Attributes.type = PERF_TYPE_HARDWARE; Attributes.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+		case PerfCounter_PageFaults: Attributes.type = PERF_TYPE_SOFTWARE; Attributes.config = PERF_COUNT_SW_PAGE_FAULTS; break;
+		default: return(-1);
+	}
+
+	int Result = (int)syscall(__NR_perf_event_open, &Attributes, ThreadID, -1, -1, 0);
+	return(Result);
+}
+
+// NOTE(georgy): Counters for every thread that exists now. Returns false if none of the counters could be opened
+static bool
+OpenPerfCounters(perf_counter_set *Set)
+{
+	bool Result = false;
+	Set->ThreadCount = 0;
+
+	DIR *Tasks = opendir("/proc/self/task");
+	if(Tasks)
+	{
+		struct dirent *Entry;
+		while((Entry = readdir(Tasks)) && (Set->ThreadCount < MAX_PERF_THREADS))
+		{
+			pid_t ThreadID = (pid_t)atoi(Entry->d_name);
+			if(ThreadID > 0)
+			{
+				int *Files = Set->Files[Set->ThreadCount++];
+				for(uint32_t Kind = 0; Kind < PerfCounter_Count; Kind++)
+				{
+					Files[Kind] = OpenPerfCounter((perf_counter_kind)Kind, ThreadID);
+					Result = Result || (Files[Kind] >= 0);
+				}
+			}
+		}
+		closedir(Tasks);
+	}
+
+	return(Result);
+}
+
+static void
+StartPerfCounters(perf_counter_set *Set)
+{
+	for(uint32_t ThreadIndex = 0; ThreadIndex < Set->ThreadCount; ThreadIndex++)
+	{
+		for(uint32_t Kind = 0; Kind < PerfCounter_Count; Kind++)
+		{
+			int File = Set->Files[ThreadIndex][Kind];
+			if(File >= 0)
+			{
+				ioctl(File, PERF_EVENT_IOC_RESET, 0);
+				ioctl(File, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+	}
+}
+
+static void
+StopPerfCounters(perf_counter_set *Set, perf_counter_values *Values)
+{
+	memset(Values, 0, sizeof(*Values));
+	for(uint32_t ThreadIndex = 0; ThreadIndex < Set->ThreadCount; ThreadIndex++)
+	{
+		for(uint32_t Kind = 0; Kind < PerfCounter_Count; Kind++)
+		{
+			int File = Set->Files[ThreadIndex][Kind];
+			if(File >= 0)
+			{
+				ioctl(File, PERF_EVENT_IOC_DISABLE, 0);
+
+				// NOTE(georgy): Value, time enabled, time running. A thread that never ran adds nothing
+				uint64_t Read[3];
+				if(read(File, Read, sizeof(Read)) == sizeof(Read))
+				{
+					if(Read[2] > 0)
+					{
+						Values->Values[Kind] += (double)Read[0]*((double)Read[1] / (double)Read[2]);
+					}
+					Values->Valid[Kind] = true;
+				}
+			}
+		}
+	}
+}
+
+static void
+ClosePerfCounters(perf_counter_set *Set)
+{
+	for(uint32_t ThreadIndex = 0; ThreadIndex < Set->ThreadCount; ThreadIndex++)
+	{
+		for(uint32_t Kind = 0; Kind < PerfCounter_Count; Kind++)
+		{
+			if(Set->Files[ThreadIndex][Kind] >= 0)
+			{
+				close(Set->Files[ThreadIndex][Kind]);
+			}
+		}
+	}
+	Set->ThreadCount = 0;
+}
+
+#else
+
+static bool
+OpenPerfCounters(perf_counter_set *Set)
+{
+	Set->ThreadCount = 0;
+	return(false);
+}
+
+static void
+StartPerfCounters(perf_counter_set *Set)
+{
+}
+
+static void
+StopPerfCounters(perf_counter_set *Set, perf_counter_values *Values)
+{
+	memset(Values, 0, sizeof(*Values));
+}
+
+static void
+ClosePerfCounters(perf_counter_set *Set)
+{
+}
+
+#endif
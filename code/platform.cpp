@@ -0,0 +1,371 @@
+#pragma once
+
+#include <errno.h>
+#include <stdio.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+// NOTE(georgy): Succeeds if the directory already exists
+static bool
+MakeDirectory(const char *Path)
+{
+#if defined(_WIN32)
+	int Error = _mkdir(Path);
+#else
+	int Error = mkdir(Path, 0755);
+#endif
+	bool Result = (Error == 0) || (errno == EEXIST);
+
+	return(Result);
+}
+
+static bool
+WriteEntireFile(const char *Filename, const void *Memory, uint64_t Size)
+{
+	bool Result = false;
+
+	FILE *File = fopen(Filename, "wb");
+	if(File)
+	{
+		Result = (fwrite(Memory, 1, Size, File) == Size);
+		Result = (fclose(File) == 0) && Result;
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Fails unless the file has at least Size bytes
+static bool
+ReadFileInto(const char *Filename, void *Memory, uint64_t Size)
+{
+	bool Result = false;
+
+	FILE *File = fopen(Filename, "rb");
+	if(File)
+	{
+		Result = (fread(Memory, 1, Size, File) == Size);
+		fclose(File);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Renames Source over Dest in one step, Dest may exist
+static bool
+ReplaceFile(const char *Source, const char *Dest)
+{
+#if defined(_WIN32)
+	bool Result = (MoveFileExA(Source, Dest, MOVEFILE_REPLACE_EXISTING) != 0);
+#else
+	bool Result = (rename(Source, Dest) == 0);
+#endif
+
+	return(Result);
+}
+
+// NOTE(georgy): Readers never see a half-written file, it is written next to Filename and renamed over it
+static bool
+WriteEntireFileAtomic(const char *Filename, const void *Memory, uint64_t Size)
+{
+	char TempFilename[1024];
+	snprintf(TempFilename, sizeof(TempFilename), "%s.tmp", Filename);
+
+	bool Result = WriteEntireFile(TempFilename, Memory, Size) && ReplaceFile(TempFilename, Filename);
+
+	return(Result);
+}
+
+static bool
+FileExists(const char *Filename)
+{
+	FILE *File = fopen(Filename, "rb");
+	bool Result = (File != 0);
+	if(File)
+	{
+		fclose(File);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Sets an environment variable of this process and the ones it starts, a null Value removes it
+static void
+SetEnv(const char *Name, const char *Value)
+{
+#if defined(_WIN32)
+	_putenv_s(Name, Value ? Value : "");
+#else
+	if(Value)
+	{
+		setenv(Name, Value, 1);
+	}
+	else
+	{
+		unsetenv(Name);
+	}
+#endif
+}
+
+// NOTE(georgy): Highest resident set size of this process so far, in bytes
+static uint64_t
+GetPeakRSS(void)
+{
+	uint64_t Result = 0;
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS Counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters)))
+	{
+		Result = Counters.PeakWorkingSetSize;
+	}
+#else
+	struct rusage Usage;
+	if(getrusage(RUSAGE_SELF, &Usage) == 0)
+	{
+#if defined(__APPLE__)
+		Result = (uint64_t)Usage.ru_maxrss;
+#else
+		Result = (uint64_t)Usage.ru_maxrss*1024;
+#endif
+	}
+#endif
+
+	return(Result);
+}
+
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+// NOTE(georgy): Address space for an arena, Size is a multiple of HUGE_PAGE_SIZE. Pages only become memory of the process when
+//				 they're first written, on Windows they have to be committed with CommitVirtualMemory before that.
+//				 With HugePages the range asks for 2 MB pages: transparent huge pages through madvise on Linux (the range is
+//				 aligned to 2 MB for them), large pages on Windows, which are committed right away and need the
+//				 "Lock pages in memory" privilege. *UsesHugePages is set when the OS took the request, otherwise it's normal pages
+static void *
+ReserveVirtualMemory(uint64_t Size, bool HugePages, bool *UsesHugePages)
+{
+	void *Result = 0;
+	*UsesHugePages = false;
+
+#if defined(_WIN32)
+	SIZE_T LargePageSize = HugePages ? GetLargePageMinimum() : 0;
+	if(LargePageSize)
+	{
+		SIZE_T LargeSize = (SIZE_T)((Size + LargePageSize - 1) & ~(uint64_t)(LargePageSize - 1));
+		Result = VirtualAlloc(0, LargeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		*UsesHugePages = (Result != 0);
+	}
+	if(!Result)
+	{
+		Result = VirtualAlloc(0, (SIZE_T)Size, MEM_RESERVE, PAGE_READWRITE);
+	}
+#else
+	uint64_t Slack = HugePages ? HUGE_PAGE_SIZE : 0;
+	uint8_t *Memory = (uint8_t *)mmap(0, Size + Slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(Memory != MAP_FAILED)
+	{
+		Result = Memory;
+		if(HugePages)
+		{
+			uint8_t *Aligned = (uint8_t *)(((uintptr_t)Memory + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+			if(Aligned > Memory)
+			{
+				munmap(Memory, (size_t)(Aligned - Memory));
+			}
+			if(Aligned + Size < Memory + Size + Slack)
+			{
+				munmap(Aligned + Size, (size_t)((Memory + Size + Slack) - (Aligned + Size)));
+			}
+			Result = Aligned;
+#if defined(MADV_HUGEPAGE)
+			*UsesHugePages = (madvise(Aligned, Size, MADV_HUGEPAGE) == 0);
+#endif
+		}
+	}
+#endif
+
+	return(Result);
+}
+
+#if defined(_WIN32)
+static bool
+CommitVirtualMemory(void *Memory, uint64_t Size)
+{
+	bool Result = (VirtualAlloc(Memory, (SIZE_T)Size, MEM_COMMIT, PAGE_READWRITE) != 0);
+
+	return(Result);
+}
+#else
+// NOTE(georgy): mmap'd pages are committed by the kernel on first touch
+static bool
+CommitVirtualMemory(void *, uint64_t)
+{
+	bool Result = true;
+
+	return(Result);
+}
+#endif
+
+static void
+ReleaseVirtualMemory(void *Memory, uint64_t Size)
+{
+#if defined(_WIN32)
+	VirtualFree(Memory, 0, MEM_RELEASE);
+#else
+	munmap(Memory, Size);
+#endif
+}
+
+struct mapped_file
+{
+	void *Memory;
+	uint64_t Size;
+#if defined(_WIN32)
+	HANDLE File;
+	HANDLE Mapping;
+#endif
+};
+
+// NOTE(georgy): Maps Size bytes of the file for reading and writing, shared with every other process that maps it.
+//				 With Create the file is created or resized to Size first
+static bool
+MapFile(mapped_file *Result, const char *Filename, uint64_t Size, bool Create)
+{
+	Result->Memory = 0;
+	Result->Size = Size;
+
+#if defined(_WIN32)
+	Result->File = CreateFileA(Filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0,
+							   Create ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if(Result->File != INVALID_HANDLE_VALUE)
+	{
+		Result->Mapping = CreateFileMappingA(Result->File, 0, PAGE_READWRITE, (DWORD)(Size >> 32), (DWORD)(Size & 0xFFFFFFFF), 0);
+		if(Result->Mapping)
+		{
+			Result->Memory = MapViewOfFile(Result->Mapping, FILE_MAP_ALL_ACCESS, 0, 0, Size);
+			if(!Result->Memory)
+			{
+				CloseHandle(Result->Mapping);
+			}
+		}
+		if(!Result->Memory)
+		{
+			CloseHandle(Result->File);
+		}
+	}
+#else
+	int File = open(Filename, Create ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+	if(File != -1)
+	{
+		struct stat FileStat;
+		bool SizeOk = (fstat(File, &FileStat) == 0) && ((uint64_t)FileStat.st_size >= Size);
+		if(Create && !SizeOk)
+		{
+			SizeOk = (ftruncate(File, (off_t)Size) == 0);
+		}
+		if(SizeOk)
+		{
+			void *Memory = mmap(0, Size, PROT_READ | PROT_WRITE, MAP_SHARED, File, 0);
+			if(Memory != MAP_FAILED)
+			{
+				Result->Memory = Memory;
+			}
+		}
+		close(File);
+	}
+#endif
+
+	return(Result->Memory != 0);
+}
+
+// NOTE(georgy): Maps the whole file, Size is the file size. With CopyOnWrite the pages are writable, but writes stay in
+//				 this process and the file doesn't change: memory is only copied for the pages that get written
+static bool
+MapExistingFile(mapped_file *Result, const char *Filename, bool CopyOnWrite)
+{
+	Result->Memory = 0;
+	Result->Size = 0;
+
+#if defined(_WIN32)
+	Result->File = CreateFileA(Filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if(Result->File != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER FileSize;
+		if(GetFileSizeEx(Result->File, &FileSize) && (FileSize.QuadPart > 0))
+		{
+			Result->Size = (uint64_t)FileSize.QuadPart;
+			Result->Mapping = CreateFileMappingA(Result->File, 0, CopyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, 0);
+			if(Result->Mapping)
+			{
+				Result->Memory = MapViewOfFile(Result->Mapping, CopyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+				if(!Result->Memory)
+				{
+					CloseHandle(Result->Mapping);
+				}
+			}
+		}
+		if(!Result->Memory)
+		{
+			CloseHandle(Result->File);
+		}
+	}
+#else
+	int File = open(Filename, O_RDONLY);
+	if(File != -1)
+	{
+		struct stat FileStat;
+		if((fstat(File, &FileStat) == 0) && (FileStat.st_size > 0))
+		{
+			Result->Size = (uint64_t)FileStat.st_size;
+			void *Memory = CopyOnWrite ? mmap(0, Result->Size, PROT_READ | PROT_WRITE, MAP_PRIVATE, File, 0) :
+										 mmap(0, Result->Size, PROT_READ, MAP_SHARED, File, 0);
+			if(Memory != MAP_FAILED)
+			{
+				Result->Memory = Memory;
+			}
+		}
+		close(File);
+	}
+#endif
+
+	return(Result->Memory != 0);
+}
+
+static bool
+MapFileReadOnly(mapped_file *File, const char *Filename)
+{
+	bool Result = MapExistingFile(File, Filename, false);
+
+	return(Result);
+}
+
+static void
+UnmapFile(mapped_file *File)
+{
+	if(File->Memory)
+	{
+#if defined(_WIN32)
+		UnmapViewOfFile(File->Memory);
+		CloseHandle(File->Mapping);
+		CloseHandle(File->File);
+#else
+		munmap(File->Memory, File->Size);
+#endif
+		File->Memory = 0;
+	}
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "erosion.cpp"
+#include "terrain.cpp"
+#include "platform.cpp"
+
+// NOTE(georgy): Eroded terrain cache. Generation is deterministic, so the result is stored under a hash of everything it depends on:
+//				 noise and erosion parameters, grid size, storage variant, kernel ISA and TERRAIN_CACHE_VERSION.
+//				 A hit maps the file copy-on-write and uses heights and normals from the mapping as they are.
+//				 Bump TERRAIN_CACHE_VERSION whenever noise, erosion or normals start producing different results
+#define TERRAIN_CACHE_MAGIC 0x43524554
+#define TERRAIN_CACHE_VERSION 2
+
+struct terrain_cache_header
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint64_t Key;
+	uint32_t GridWidth;
+	uint32_t GridHeight;
+};
+
+// NOTE(georgy): Header, (GridWidth + 1)*(GridHeight + 1) float heights, then as many packed normals
+struct terrain_cache_entry
+{
+	uint64_t Key;
+	uint32_t GridWidth;
+	uint32_t GridHeight;
+	float *HeightMap;
+	uint32_t *Normals;
+
+	void *Memory;
+	uint64_t Size;
+	bool UsesMapping;
+	mapped_file Mapping;
+};
+
+static uint64_t
+TerrainCacheKey(const noise_params *Noise, const erosion_params *Erosion, uint32_t GridWidth, uint32_t GridHeight, uint32_t Variant)
+{
+	uint32_t Header[] = { TERRAIN_CACHE_VERSION, GridWidth, GridHeight, Variant, (uint32_t)TerrainKernels.Level };
+
+	uint64_t Result = HashBytes(Header, sizeof(Header));
+	Result = HashBytes(Noise, sizeof(*Noise), Result);
+	Result = HashBytes(Erosion, sizeof(*Erosion), Result);
+	return(Result);
+}
+
+inline uint64_t
+TerrainCacheEntrySize(uint32_t GridWidth, uint32_t GridHeight)
+{
+	uint64_t SampleCount = (uint64_t)(GridWidth + 1)*(GridHeight + 1);
+	uint64_t Result = sizeof(terrain_cache_header) + SampleCount*(sizeof(float) + sizeof(uint32_t));
+
+	return(Result);
+}
+
+static void
+SetTerrainCachePointers(terrain_cache_entry *Entry)
+{
+	uint64_t SampleCount = (uint64_t)(Entry->GridWidth + 1)*(Entry->GridHeight + 1);
+	Entry->HeightMap = (float *)((uint8_t *)Entry->Memory + sizeof(terrain_cache_header));
+	Entry->Normals = (uint32_t *)(Entry->HeightMap + SampleCount);
+}
+
+static void
+GetTerrainCacheFilename(char *Dest, uint32_t DestSize, const char *Directory, uint64_t Key)
+{
+	snprintf(Dest, DestSize, "%s/%016llx.terrain", Directory, (unsigned long long)Key);
+}
+
+// NOTE(georgy): Memory for a result that will be generated and then stored with StoreCachedTerrain.
+//				 It belongs to the arena, FreeCachedTerrain leaves it there until the arena is reset
+static bool
+AllocateCachedTerrain(terrain_cache_entry *Entry, memory_arena *Arena, uint64_t Key, uint32_t GridWidth, uint32_t GridHeight)
+{
+	memset(Entry, 0, sizeof(*Entry));
+	Entry->Key = Key;
+	Entry->GridWidth = GridWidth;
+	Entry->GridHeight = GridHeight;
+	Entry->Size = TerrainCacheEntrySize(GridWidth, GridHeight);
+	Entry->Memory = PushSize(Arena, Entry->Size);
+	if(!Entry->Memory)
+	{
+		return(false);
+	}
+
+	terrain_cache_header *Header = (terrain_cache_header *)Entry->Memory;
+	Header->Magic = TERRAIN_CACHE_MAGIC;
+	Header->Version = TERRAIN_CACHE_VERSION;
+	Header->Key = Key;
+	Header->GridWidth = GridWidth;
+	Header->GridHeight = GridHeight;
+	SetTerrainCachePointers(Entry);
+
+	return(true);
+}
+
+static bool
+LoadCachedTerrain(terrain_cache_entry *Entry, const char *Filename, uint64_t Key, uint32_t GridWidth, uint32_t GridHeight)
+{
+	memset(Entry, 0, sizeof(*Entry));
+	if(!MapExistingFile(&Entry->Mapping, Filename, true))
+	{
+		return(false);
+	}
+
+	const terrain_cache_header *Header = (const terrain_cache_header *)Entry->Mapping.Memory;
+	bool Valid = (Entry->Mapping.Size == TerrainCacheEntrySize(GridWidth, GridHeight)) &&
+				 (Header->Magic == TERRAIN_CACHE_MAGIC) && (Header->Version == TERRAIN_CACHE_VERSION) && (Header->Key == Key) &&
+				 (Header->GridWidth == GridWidth) && (Header->GridHeight == GridHeight);
+	if(!Valid)
+	{
+		printf("Ignoring stale terrain cache %s\n", Filename);
+		UnmapFile(&Entry->Mapping);
+		return(false);
+	}
+
+	Entry->Key = Key;
+	Entry->GridWidth = GridWidth;
+	Entry->GridHeight = GridHeight;
+	Entry->Memory = Entry->Mapping.Memory;
+	Entry->Size = Entry->Mapping.Size;
+	Entry->UsesMapping = true;
+	SetTerrainCachePointers(Entry);
+	// NOTE(georgy): A private mapping, every page the viewer touches or edits becomes memory of this process
+	TrackExternalMemory(MemoryCategory_HeightMap, (int64_t)Entry->Size);
+
+	return(true);
+}
+
+static bool
+StoreCachedTerrain(terrain_cache_entry *Entry, const char *Directory, const char *Filename)
+{
+	bool Result = MakeDirectory(Directory) && WriteEntireFileAtomic(Filename, Entry->Memory, Entry->Size);
+	if(!Result)
+	{
+		printf("Failed to store terrain cache %s\n", Filename);
+	}
+
+	return(Result);
+}
+
+static void
+FreeCachedTerrain(terrain_cache_entry *Entry)
+{
+	if(Entry->UsesMapping)
+	{
+		TrackExternalMemory(MemoryCategory_HeightMap, -(int64_t)Entry->Size);
+		UnmapFile(&Entry->Mapping);
+		Entry->UsesMapping = false;
+	}
+	Entry->Memory = 0;
+	Entry->HeightMap = 0;
+	Entry->Normals = 0;
+}
@@ -0,0 +1,395 @@
+#pragma once
+
+#include "terrain_kernels.cpp"
+#include "platform.cpp"
+
+#include <vector>
+
+// NOTE(georgy): End-to-end scenario benchmarks. Every scenario runs in a fresh process (--scenario-run) so its wall time
+//				 includes startup and its peak RSS is its own. The child writes the checksum of its output to
+//				 Directory/<name>.result, the parent adds wall time and peak RSS and compares them with a JSON baseline:
+//				 {
+//				   "time_tolerance": 0.15, "memory_tolerance": 0.10,
+//				   "scenarios": [ { "name": "viewer512", "kernels": "avx2", "wall_ms": 250.0, "peak_rss_kb": 20000,
+//				                    "checksum": "0123456789abcdef" }, ... ]
+//				 }
+//				 Slower or bigger than the baseline by more than the tolerance is a regression. A different checksum is too,
+//				 but only against a baseline recorded with the same kernels, SIMD levels don't produce identical floats.
+//				 EROSION_SCENARIO_TIME_TOLERANCE and EROSION_SCENARIO_MEMORY_TOLERANCE override the file's tolerances
+#define SCENARIO_DEFAULT_TIME_TOLERANCE 0.15f
+#define SCENARIO_DEFAULT_MEMORY_TOLERANCE 0.10f
+
+static const char *ScenarioNames[] = { "viewer512", "erode4k", "world16k" };
+
+struct scenario_result
+{
+	char Name[32];
+	char Kernels[16];
+	double WallMilliseconds;
+	uint64_t PeakRSSKilobytes;
+	uint64_t Checksum;
+};
+
+struct scenario_baselines
+{
+	float TimeTolerance;
+	float MemoryTolerance;
+	std::vector<scenario_result> Scenarios;
+};
+
+static void
+GetScenarioResultFilename(char *Dest, uint32_t DestSize, const char *Directory, const char *Name)
+{
+	snprintf(Dest, DestSize, "%s/%s.result", Directory, Name);
+}
+
+// NOTE(georgy): Called in the scenario's process once its output is done
+static bool
+WriteScenarioChecksum(const char *Directory, const char *Name, uint64_t Checksum)
+{
+	char Filename[512];
+	GetScenarioResultFilename(Filename, sizeof(Filename), Directory, Name);
+	char Text[32];
+	int Length = snprintf(Text, sizeof(Text), "%016llx\n", (unsigned long long)Checksum);
+
+	bool Result = WriteEntireFileAtomic(Filename, Text, (uint64_t)Length);
+	return(Result);
+}
+
+// NOTE(georgy): Hashes a whole output file in chunks, chained onto Hash
+static bool
+HashFile(const char *Filename, uint64_t *Hash)
+{
+	FILE *File = fopen(Filename, "rb");
+	if(!File)
+	{
+		return(false);
+	}
+
+	uint8_t Buffer[65536];
+	size_t Size;
+	while((Size = fread(Buffer, 1, sizeof(Buffer), File)) > 0)
+	{
+		*Hash = HashBytes(Buffer, Size, *Hash);
+	}
+	bool Result = !ferror(File);
+	fclose(File);
+
+	return(Result);
+}
+
+//
+// NOTE(georgy): Baseline file. This is not a general JSON reader, it only reads back what WriteScenarioBaselines writes
+//
+
+static const char *
+FindJSONKey(const char *Text, const char *End, const char *Key)
+{
+	const char *Result = 0;
+
+	size_t KeyLength = strlen(Key);
+	for(const char *At = Text; At + KeyLength + 2 <= End; At++)
+	{
+		if((At[0] == '"') && (strncmp(At + 1, Key, KeyLength) == 0) && (At[KeyLength + 1] == '"'))
+		{
+			At += KeyLength + 2;
+			while((At < End) && ((*At == ' ') || (*At == ':')))
+			{
+				At++;
+			}
+			Result = At;
+			break;
+		}
+	}
+
+	return(Result);
+}
+
+static bool
+ReadJSONNumber(const char *Text, const char *End, const char *Key, double *Value)
+{
+	const char *At = FindJSONKey(Text, End, Key);
+	bool Result = (At != 0) && (sscanf(At, "%lf", Value) == 1);
+
+	return(Result);
+}
+
+static bool
+ReadJSONString(const char *Text, const char *End, const char *Key, char *Dest, uint32_t DestSize)
+{
+	const char *At = FindJSONKey(Text, End, Key);
+	if(!At || (*At != '"'))
+	{
+		return(false);
+	}
+
+	At++;
+	uint32_t Length = 0;
+	while((At < End) && (*At != '"') && (Length + 1 < DestSize))
+	{
+		Dest[Length++] = *At++;
+	}
+	Dest[Length] = 0;
+
+	bool Result = (At < End) && (*At == '"');
+	return(Result);
+}
+
+// NOTE(georgy): A missing file is an empty baseline with the default tolerances
+static bool
+LoadScenarioBaselines(const char *Filename, scenario_baselines *Baselines)
+{
+	Baselines->TimeTolerance = SCENARIO_DEFAULT_TIME_TOLERANCE;
+	Baselines->MemoryTolerance = SCENARIO_DEFAULT_MEMORY_TOLERANCE;
+	Baselines->Scenarios.clear();
+	if(!FileExists(Filename))
+	{
+		return(true);
+	}
+
+	mapped_file File;
+	if(!MapFileReadOnly(&File, Filename))
+	{
+		printf("Failed to read %s\n", Filename);
+		return(false);
+	}
+	const char *Text = (const char *)File.Memory;
+	const char *End = Text + File.Size;
+
+	double Tolerance;
+	if(ReadJSONNumber(Text, End, "time_tolerance", &Tolerance)) Baselines->TimeTolerance = (float)Tolerance;
+	if(ReadJSONNumber(Text, End, "memory_tolerance", &Tolerance)) Baselines->MemoryTolerance = (float)Tolerance;
+
+	// NOTE(georgy): Every scenario is one flat object, so its fields are between its braces
+	const char *At = Text;
+	while((At = FindJSONKey(At, End, "name")) != 0)
+	{
+		const char *ObjectBegin = At;
+		while((ObjectBegin > Text) && (*ObjectBegin != '{')) ObjectBegin--;
+		const char *ObjectEnd = At;
+		while((ObjectEnd < End) && (*ObjectEnd != '}')) ObjectEnd++;
+
+		scenario_result Scenario = {};
+		double WallMilliseconds, PeakRSS;
+		char Checksum[32];
+		if(ReadJSONString(ObjectBegin, ObjectEnd, "name", Scenario.Name, sizeof(Scenario.Name)) &&
+		   ReadJSONString(ObjectBegin, ObjectEnd, "kernels", Scenario.Kernels, sizeof(Scenario.Kernels)) &&
+		   ReadJSONNumber(ObjectBegin, ObjectEnd, "wall_ms", &WallMilliseconds) &&
+		   ReadJSONNumber(ObjectBegin, ObjectEnd, "peak_rss_kb", &PeakRSS) &&
+		   ReadJSONString(ObjectBegin, ObjectEnd, "checksum", Checksum, sizeof(Checksum)))
+		{
+			Scenario.WallMilliseconds = WallMilliseconds;
+			Scenario.PeakRSSKilobytes = (uint64_t)PeakRSS;
+			Scenario.Checksum = strtoull(Checksum, 0, 16);
+			Baselines->Scenarios.push_back(Scenario);
+		}
+		At = ObjectEnd;
+	}
+
+	UnmapFile(&File);
+	return(true);
+}
+
+static bool
+WriteScenarioBaselines(const char *Filename, const scenario_baselines *Baselines)
+{
+	std::vector<char> Text(256 + 256*Baselines->Scenarios.size());
+	size_t Length = (size_t)snprintf(&Text[0], Text.size(), "{\n  \"time_tolerance\": %.3f,\n  \"memory_tolerance\": %.3f,\n  \"scenarios\": [\n",
+									 Baselines->TimeTolerance, Baselines->MemoryTolerance);
+	for(uint32_t ScenarioIndex = 0; ScenarioIndex < Baselines->Scenarios.size(); ScenarioIndex++)
+	{
+		const scenario_result *Scenario = &Baselines->Scenarios[ScenarioIndex];
+		Length += (size_t)snprintf(&Text[Length], Text.size() - Length,
+								   "    { \"name\": \"%s\", \"kernels\": \"%s\", \"wall_ms\": %.3f, \"peak_rss_kb\": %llu, \"checksum\": \"%016llx\" }%s\n",
+								   Scenario->Name, Scenario->Kernels, Scenario->WallMilliseconds, (unsigned long long)Scenario->PeakRSSKilobytes,
+								   (unsigned long long)Scenario->Checksum, (ScenarioIndex + 1 < Baselines->Scenarios.size()) ? "," : "");
+	}
+	Length += (size_t)snprintf(&Text[Length], Text.size() - Length, "  ]\n}\n");
+
+	bool Result = WriteEntireFileAtomic(Filename, &Text[0], Length);
+	if(!Result)
+	{
+		printf("Failed to write %s\n", Filename);
+	}
+	return(Result);
+}
+
+//
+// NOTE(georgy): Running and comparing
+//
+
+#if defined(_WIN32)
+
+static bool
+RunScenarioProcess(const char *Directory, const char *Name, scenario_result *Result)
+{
+	printf("Scenario benchmarks are only supported on Linux\n");
+	return(false);
+}
+
+#else
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static bool
+RunScenarioProcess(const char *Directory, const char *Name, scenario_result *Result)
+{
+	char ResultFilename[512];
+	GetScenarioResultFilename(ResultFilename, sizeof(ResultFilename), Directory, Name);
+	remove(ResultFilename);
+
+	fflush(stdout);
+	uint64_t BeginTime = GetNanoseconds();
+	pid_t Pid = fork();
+	if(Pid == 0)
+	{
+		execl("/proc/self/exe", "erosion", "--scenario-run", Name, Directory, (char *)0);
+		_exit(127);
+	}
+	else if(Pid < 0)
+	{
+		return(false);
+	}
+
+	int Status = 0;
+	struct rusage Usage = {};
+	bool Exited = (wait4(Pid, &Status, 0, &Usage) == Pid) && WIFEXITED(Status) && (WEXITSTATUS(Status) == 0);
+	uint64_t EndTime = GetNanoseconds();
+
+	memset(Result, 0, sizeof(*Result));
+	snprintf(Result->Name, sizeof(Result->Name), "%s", Name);
+	snprintf(Result->Kernels, sizeof(Result->Kernels), "%s", ISALevelNames[TerrainKernels.Level]);
+	Result->WallMilliseconds = (EndTime - BeginTime) / 1000000.0;
+	// NOTE(georgy): ru_maxrss is in kilobytes on Linux
+	Result->PeakRSSKilobytes = (uint64_t)Usage.ru_maxrss;
+
+	char Text[32] = {};
+	bool Success = Exited && ReadFileInto(ResultFilename, Text, 16);
+	if(Success)
+	{
+		Result->Checksum = strtoull(Text, 0, 16);
+	}
+	else
+	{
+		printf("Scenario %s failed\n", Name);
+	}
+	remove(ResultFilename);
+
+	return(Success);
+}
+
+#endif
+
+static scenario_result *
+FindScenarioBaseline(scenario_baselines *Baselines, const char *Name)
+{
+	scenario_result *Result = 0;
+	for(uint32_t ScenarioIndex = 0; ScenarioIndex < Baselines->Scenarios.size(); ScenarioIndex++)
+	{
+		if(strcmp(Baselines->Scenarios[ScenarioIndex].Name, Name) == 0)
+		{
+			Result = &Baselines->Scenarios[ScenarioIndex];
+			break;
+		}
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Prints the comparison and returns false on a regression
+static bool
+CompareScenario(const scenario_result *Scenario, const scenario_result *Baseline, const scenario_baselines *Baselines)
+{
+	double TimeChange = Scenario->WallMilliseconds / Baseline->WallMilliseconds - 1.0;
+	double MemoryChange = (double)Scenario->PeakRSSKilobytes / (double)Baseline->PeakRSSKilobytes - 1.0;
+	bool TimeRegressed = (TimeChange > Baselines->TimeTolerance);
+	bool MemoryRegressed = (MemoryChange > Baselines->MemoryTolerance);
+	bool SameKernels = (strcmp(Scenario->Kernels, Baseline->Kernels) == 0);
+	bool OutputChanged = SameKernels && (Scenario->Checksum != Baseline->Checksum);
+
+	printf("  vs baseline: time %+.1f%%%s, peak RSS %+.1f%%%s, output %s\n",
+		   100.0*TimeChange, TimeRegressed ? " REGRESSION" : "", 100.0*MemoryChange, MemoryRegressed ? " REGRESSION" : "",
+		   !SameKernels ? "not compared (other kernels)" : (OutputChanged ? "CHANGED" : "identical"));
+
+	bool Result = !TimeRegressed && !MemoryRegressed && !OutputChanged;
+	return(Result);
+}
+
+// NOTE(georgy): Runs the scenario named Which (or all of them) and compares with BaselineFilename. Scenarios without a baseline
+//				 are added to it, Record replaces the baselines of the scenarios that ran. Returns false on failure or regression
+static bool
+RunScenarios(const char *Which, const char *BaselineFilename, bool Record, const char *Directory)
+{
+	scenario_baselines Baselines;
+	if(!LoadScenarioBaselines(BaselineFilename, &Baselines))
+	{
+		return(false);
+	}
+	const char *TimeToleranceEnv = getenv("EROSION_SCENARIO_TIME_TOLERANCE");
+	const char *MemoryToleranceEnv = getenv("EROSION_SCENARIO_MEMORY_TOLERANCE");
+	float TimeTolerance = (TimeToleranceEnv && TimeToleranceEnv[0]) ? (float)atof(TimeToleranceEnv) : Baselines.TimeTolerance;
+	float MemoryTolerance = (MemoryToleranceEnv && MemoryToleranceEnv[0]) ? (float)atof(MemoryToleranceEnv) : Baselines.MemoryTolerance;
+	scenario_baselines Tolerances;
+	Tolerances.TimeTolerance = TimeTolerance;
+	Tolerances.MemoryTolerance = MemoryTolerance;
+
+	if(!MakeDirectory(Directory))
+	{
+		printf("Failed to create %s\n", Directory);
+		return(false);
+	}
+
+	bool Result = true;
+	bool BaselinesChanged = false;
+	bool FoundScenario = false;
+	for(uint32_t ScenarioIndex = 0; ScenarioIndex < ArrayCount(ScenarioNames); ScenarioIndex++)
+	{
+		const char *Name = ScenarioNames[ScenarioIndex];
+		if((strcmp(Which, "all") != 0) && (strcmp(Which, Name) != 0))
+		{
+			continue;
+		}
+		FoundScenario = true;
+
+		scenario_result Scenario;
+		if(!RunScenarioProcess(Directory, Name, &Scenario))
+		{
+			Result = false;
+			continue;
+		}
+		printf("%-10s %10.1f ms %10llu KB peak RSS  checksum %016llx (%s)\n", Name, Scenario.WallMilliseconds,
+			   (unsigned long long)Scenario.PeakRSSKilobytes, (unsigned long long)Scenario.Checksum, Scenario.Kernels);
+
+		scenario_result *Baseline = FindScenarioBaseline(&Baselines, Name);
+		if(Baseline && !Record)
+		{
+			Result = CompareScenario(&Scenario, Baseline, &Tolerances) && Result;
+		}
+		else
+		{
+			printf("  recorded as the baseline\n");
+			if(Baseline)
+			{
+				*Baseline = Scenario;
+			}
+			else
+			{
+				Baselines.Scenarios.push_back(Scenario);
+			}
+			BaselinesChanged = true;
+		}
+	}
+
+	if(!FoundScenario)
+	{
+		printf("Unknown scenario %s\n", Which);
+		Result = false;
+	}
+	if(BaselinesChanged)
+	{
+		Result = WriteScenarioBaselines(BaselineFilename, &Baselines) && Result;
+	}
+
+	return(Result);
+}
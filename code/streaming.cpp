@@ -0,0 +1,612 @@
+#pragma once
+
+#include "erosion.cpp"
+#include "normals.cpp"
+#include "terrain.cpp"
+
+// NOTE(georgy): Endless terrain around a moving camera. The world is split into square tiles that are generated the first time
+//				 they come within ViewRadius of the camera, on the job system's background workers: noise and erosion on the
+//				 tile extended by a halo, like in world.cpp, then the core is cropped out with its normals and mesh vertices.
+//				 Tiles aren't blended with their neighbours here, that would need the neighbours' eroded halos around. Droplets
+//				 are tied to world positions, so neighbours erode their shared edge nearly the same way, see --stream-bench
+//				 for how much they differ.
+//
+//				 Tiles live in a fixed pool of slots allocated once, as many as fit in MemoryCap. When the pool is full a
+//				 new tile takes the slot of the least recently needed tile that is not in view and not being generated.
+//				 UpdateTerrainStream only looks at the slots and queues jobs, it never waits for one, so moving the camera
+//				 can't stall the frame. A tile that isn't ready yet is just missing for a few frames.
+//				 Tile coordinates are 64-bit and the noise is precise anywhere (see NoiseRunBase), the viewer draws tiles
+//				 relative to the camera so the floats it renders with stay small
+
+struct stream_params
+{
+	// NOTE(georgy): Cells per tile edge, a tile has TileSize + 1 samples per edge and shares its last row/column with the next tile
+	uint32_t TileSize;
+	// NOTE(georgy): Extra cells generated and eroded on every side of a tile, must be more than ErosionReach
+	uint32_t Halo;
+	// NOTE(georgy): Distance between samples in the mesh
+	float CellSize;
+	// NOTE(georgy): Tiles that have a sample within ViewRadius samples of the camera are kept
+	uint32_t ViewRadius;
+	uint64_t MemoryCap;
+	uint32_t MaxTilesInFlight;
+	// NOTE(georgy): How far the skirt around every tile hangs down. It hides the cracks where neighbours differ
+	float SkirtDepth;
+
+	noise_params Noise;
+	uint32_t Seed;
+	// NOTE(georgy): DropletCount is per TileSize x TileSize area
+	erosion_params Erosion;
+};
+
+inline stream_params
+DefaultStreamParams(void)
+{
+	stream_params Result;
+	Result.TileSize = 128;
+	Result.CellSize = 32.0f / 512.0f;
+	Result.ViewRadius = 640;
+	Result.MemoryCap = 64*1024*1024;
+	Result.MaxTilesInFlight = 8;
+	Result.SkirtDepth = 0.5f;
+	Result.Noise = DefaultNoiseParams(10.0f);
+	Result.Seed = 1337;
+	Result.Erosion = DefaultErosionParams();
+	// NOTE(georgy): Same droplet density as the viewer's 512x512 terrain
+	Result.Erosion.DropletCount /= (512 / Result.TileSize)*(512 / Result.TileSize);
+	Result.Halo = 2*ErosionReach(&Result.Erosion);
+
+	return(Result);
+}
+
+enum stream_tile_state
+{
+	StreamTile_Free,
+	StreamTile_Generating,
+	StreamTile_Ready,
+};
+
+struct terrain_stream;
+
+struct stream_slot
+{
+	terrain_stream *Stream;
+	int64_t TileX, TileZ;
+	// NOTE(georgy): Written by the tile's job when it's done, everything else is only touched by the main thread
+	std::atomic<uint32_t> State;
+	uint64_t LastUsedFrame;
+	// NOTE(georgy): Set when the slot gets a new tile, the viewer clears it once it has uploaded the tile
+	bool Changed;
+
+	// NOTE(georgy): (TileSize + 1)^2 samples, and StreamTileVertexCount normals and vertices relative to the tile's first sample
+	float *HeightMap;
+	uint32_t *Normals;
+	vec3 *Vertices;
+};
+
+struct stream_stats
+{
+	uint64_t FrameCount;
+	uint64_t TilesRequested;
+	uint64_t TilesEvicted;
+	// NOTE(georgy): Tiles in view that weren't ready at the end of the last update
+	uint32_t TilesMissing;
+	uint64_t MaxUpdateNanoseconds;
+	uint64_t TotalUpdateNanoseconds;
+};
+
+struct stream_request
+{
+	int64_t TileX, TileZ;
+	int64_t DistanceSquared;
+};
+
+struct terrain_stream
+{
+	job_system *Jobs;
+	stream_params Params;
+
+	uint32_t SlotCount;
+	stream_slot *Slots;
+	float *HeightMaps;
+	uint8_t *MeshData;
+
+	// NOTE(georgy): Strip indices for one tile, the same for every tile
+	uint32_t VertexCount;
+	uint32_t IndexCount;
+	uint32_t *Indices;
+
+	// NOTE(georgy): Square window of tiles around the camera tile that can be in view, WindowTiles on a side
+	int32_t WindowRadius;
+	uint32_t WindowTiles;
+	uint8_t *WindowPresent;
+	stream_request *Requests;
+
+	uint64_t Frame;
+	job_counter Pending;
+	std::atomic<uint64_t> TilesGenerated;
+	stream_stats Stats;
+};
+
+inline uint32_t
+StreamTileSamples(const stream_params *Params)
+{
+	uint32_t Result = (Params->TileSize + 1)*(Params->TileSize + 1);
+	return(Result);
+}
+
+// NOTE(georgy): The grid, then the skirt: a copy of the border loop (StreamBorderSample) SkirtDepth lower
+inline uint32_t
+StreamTileVertexCount(const stream_params *Params)
+{
+	uint32_t Result = StreamTileSamples(Params) + 4*Params->TileSize;
+	return(Result);
+}
+
+inline uint32_t
+StreamTileIndexCount(const stream_params *Params)
+{
+	terrain_mesh Mesh;
+	SetTerrainMeshSize(&Mesh, Params->TileSize, Params->TileSize);
+	uint32_t Result = Mesh.IndexCount + 2 + 2*(4*Params->TileSize + 1);
+
+	return(Result);
+}
+
+inline uint64_t
+StreamSlotSize(const stream_params *Params)
+{
+	uint64_t Result = sizeof(float)*(uint64_t)StreamTileSamples(Params) + (sizeof(uint32_t) + sizeof(vec3))*(uint64_t)StreamTileVertexCount(Params);
+	return(Result);
+}
+
+// NOTE(georgy): Index-th sample of the loop around the tile's border, Index is in [0, 4*TileSize)
+inline uint32_t
+StreamBorderSample(uint32_t TileSize, uint32_t Index)
+{
+	uint32_t Side = Index / TileSize;
+	uint32_t Step = Index % TileSize;
+	uint32_t Result = 0;
+	switch(Side)
+	{
+		case 0: Result = Step; break;
+		case 1: Result = TileSize + Step*(TileSize + 1); break;
+		case 2: Result = (TileSize - Step) + TileSize*(TileSize + 1); break;
+		case 3: Result = (TileSize - Step)*(TileSize + 1); break;
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Scratch a tile's job allocates while it runs: the extended grid, and the core plus one sample on every side with its normals
+inline uint64_t
+StreamTileScratchSize(const stream_params *Params)
+{
+	uint64_t GridSamples = Params->TileSize + 2*Params->Halo + 1;
+	uint64_t BorderSamples = Params->TileSize + 3;
+	uint64_t Result = sizeof(float)*GridSamples*GridSamples + (sizeof(float) + sizeof(uint32_t))*BorderSamples*BorderSamples;
+
+	return(Result);
+}
+
+// NOTE(georgy): Squared distance in samples from the camera to the nearest sample of the tile
+inline int64_t
+StreamTileDistanceSquared(const stream_params *Params, int64_t TileX, int64_t TileZ, double CameraX, double CameraZ)
+{
+	double MinX = (double)TileX*Params->TileSize;
+	double MinZ = (double)TileZ*Params->TileSize;
+	double DistanceX = (CameraX < MinX) ? (MinX - CameraX) : ((CameraX > MinX + Params->TileSize) ? (CameraX - MinX - Params->TileSize) : 0.0);
+	double DistanceZ = (CameraZ < MinZ) ? (MinZ - CameraZ) : ((CameraZ > MinZ + Params->TileSize) ? (CameraZ - MinZ - Params->TileSize) : 0.0);
+	int64_t Result = (int64_t)(DistanceX*DistanceX + DistanceZ*DistanceZ);
+
+	return(Result);
+}
+
+inline bool
+StreamTileInView(const stream_params *Params, int64_t TileX, int64_t TileZ, double CameraX, double CameraZ)
+{
+	bool Result = (StreamTileDistanceSquared(Params, TileX, TileZ, CameraX, CameraZ) <= (int64_t)Params->ViewRadius*Params->ViewRadius);
+	return(Result);
+}
+
+static bool
+GenerateStreamTile(const stream_params *Params, int64_t TileX, int64_t TileZ, float *HeightMap, uint32_t *Normals, vec3 *Vertices)
+{
+	TIMED_FUNCTION();
+
+	uint32_t GridSize = Params->TileSize + 2*Params->Halo;
+	uint32_t GridSamples = GridSize + 1;
+	uint32_t BorderGridSize = Params->TileSize + 2;
+	uint32_t BorderSamples = BorderGridSize + 1;
+	uint32_t CoreSamples = Params->TileSize + 1;
+
+	float *Grid = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*GridSamples*GridSamples);
+	float *Border = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*BorderSamples*BorderSamples);
+	uint32_t *BorderNormals = (uint32_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(uint32_t)*BorderSamples*BorderSamples);
+	bool Result = Grid && Border && BorderNormals;
+	if(Result)
+	{
+		int64_t OriginX = TileX*Params->TileSize - Params->Halo;
+		int64_t OriginZ = TileZ*Params->TileSize - Params->Halo;
+		uint32_t DropletsPerBlock = DropletsPerSpawnBlock(Params->Erosion.DropletCount, Params->TileSize*Params->TileSize);
+		FillHeightMapNoiseRows(Grid, GridSize, OriginX, OriginZ, &Params->Noise, 0, GridSamples);
+		Result = WaterErosionRegion(Grid, GridSize, GridSize, OriginX, OriginZ, &Params->Erosion, DropletsPerBlock, Params->Seed);
+	}
+	else
+	{
+		printf("Out of memory for stream tile %lld %lld\n", (long long)TileX, (long long)TileZ);
+	}
+
+	if(Result)
+	{
+		for(uint32_t Z = 0; Z < BorderSamples; Z++)
+		{
+			memcpy(Border + Z*BorderSamples, Grid + (Params->Halo - 1) + (Params->Halo - 1 + Z)*GridSamples, sizeof(float)*BorderSamples);
+		}
+		CalculateNormals(0, Border, BorderGridSize, BorderGridSize, NormalFormat_Packed, BorderNormals);
+
+		for(uint32_t Z = 0; Z < CoreSamples; Z++)
+		{
+			uint32_t BorderOffset = 1 + (Z + 1)*BorderSamples;
+			memcpy(HeightMap + Z*CoreSamples, Border + BorderOffset, sizeof(float)*CoreSamples);
+			memcpy(Normals + Z*CoreSamples, BorderNormals + BorderOffset, sizeof(uint32_t)*CoreSamples);
+			for(uint32_t X = 0; X < CoreSamples; X++)
+			{
+				Vertices[X + Z*CoreSamples] = vec3(Params->CellSize*X, HeightMap[X + Z*CoreSamples], -Params->CellSize*Z);
+			}
+		}
+
+		for(uint32_t Index = 0; Index < 4*Params->TileSize; Index++)
+		{
+			uint32_t Sample = StreamBorderSample(Params->TileSize, Index);
+			Vertices[CoreSamples*CoreSamples + Index] = Vertices[Sample] - vec3(0.0f, Params->SkirtDepth, 0.0f);
+			Normals[CoreSamples*CoreSamples + Index] = Normals[Sample];
+		}
+	}
+
+	FreeMemory(BorderNormals);
+	FreeMemory(Border);
+	FreeMemory(Grid);
+
+	return(Result);
+}
+
+static void
+StreamTileProc(void *Data, uint32_t, uint32_t)
+{
+	stream_slot *Slot = (stream_slot *)Data;
+	terrain_stream *Stream = Slot->Stream;
+
+	// NOTE(georgy): A tile that failed is left empty instead of retrying every frame, all its triangles are degenerate
+	if(!GenerateStreamTile(&Stream->Params, Slot->TileX, Slot->TileZ, Slot->HeightMap, Slot->Normals, Slot->Vertices))
+	{
+		memset(Slot->HeightMap, 0, sizeof(float)*StreamTileSamples(&Stream->Params));
+		for(uint32_t Index = 0; Index < Stream->VertexCount; Index++)
+		{
+			Slot->Vertices[Index] = vec3(0.0f, 0.0f, 0.0f);
+		}
+	}
+
+	Stream->TilesGenerated.fetch_add(1);
+	Slot->State.store(StreamTile_Ready, std::memory_order_release);
+}
+
+static bool
+InitTerrainStream(job_system *Jobs, terrain_stream *Stream, const stream_params *Params)
+{
+	Stream->Jobs = Jobs;
+	Stream->Params = *Params;
+	Stream->Slots = 0;
+	Stream->HeightMaps = 0;
+	Stream->MeshData = 0;
+	Stream->Indices = 0;
+	Stream->WindowPresent = 0;
+	Stream->Requests = 0;
+	Stream->Frame = 0;
+	Stream->TilesGenerated = 0;
+	Stream->Stats = {};
+
+	// NOTE(georgy): The main thread never runs jobs here, without another worker no tile would ever be generated
+	if(Jobs->WorkerCount < 2)
+	{
+		printf("Streaming needs at least 2 workers, there is %u\n", Jobs->WorkerCount);
+		return(false);
+	}
+	if((Params->TileSize < 2) || (Params->Halo <= ErosionReach(&Params->Erosion)) || (Params->MaxTilesInFlight == 0))
+	{
+		printf("Stream halo %u must be more than the droplet reach %u\n", Params->Halo, ErosionReach(&Params->Erosion));
+		return(false);
+	}
+
+	Stream->WindowRadius = (int32_t)(Params->ViewRadius / Params->TileSize) + 1;
+	Stream->WindowTiles = 2*(uint32_t)Stream->WindowRadius + 1;
+	uint32_t WindowTileCount = Stream->WindowTiles*Stream->WindowTiles;
+
+	uint64_t ScratchSize = Params->MaxTilesInFlight*StreamTileScratchSize(Params);
+	uint64_t SlotSize = StreamSlotSize(Params);
+	uint64_t SlotCount = (Params->MemoryCap > ScratchSize) ? ((Params->MemoryCap - ScratchSize) / SlotSize) : 0;
+	Stream->SlotCount = (SlotCount < 65536) ? (uint32_t)SlotCount : 65536;
+	uint32_t MaxTilesInView = 0;
+	for(int32_t TileZ = -Stream->WindowRadius; TileZ <= Stream->WindowRadius; TileZ++)
+	{
+		for(int32_t TileX = -Stream->WindowRadius; TileX <= Stream->WindowRadius; TileX++)
+		{
+			// NOTE(georgy): The camera can be anywhere in its tile, the worst case is a corner
+			bool InView = StreamTileInView(Params, TileX, TileZ, 0.0, 0.0) || StreamTileInView(Params, TileX, TileZ, Params->TileSize, 0.0) ||
+						  StreamTileInView(Params, TileX, TileZ, 0.0, Params->TileSize) || StreamTileInView(Params, TileX, TileZ, Params->TileSize, Params->TileSize);
+			MaxTilesInView += InView ? 1 : 0;
+		}
+	}
+	if(Stream->SlotCount < MaxTilesInView)
+	{
+		printf("Stream memory cap of %.1f MB holds %u tiles, %u can be in view\n", Params->MemoryCap / (1024.0*1024.0), Stream->SlotCount, MaxTilesInView);
+		return(false);
+	}
+
+	uint32_t SampleCount = StreamTileSamples(Params);
+	Stream->VertexCount = StreamTileVertexCount(Params);
+	Stream->IndexCount = StreamTileIndexCount(Params);
+	Stream->Slots = new stream_slot[Stream->SlotCount];
+	Stream->HeightMaps = (float *)AllocateZeroedMemory(MemoryCategory_HeightMap, sizeof(float)*SampleCount*Stream->SlotCount);
+	Stream->MeshData = (uint8_t *)AllocateMemory(MemoryCategory_Mesh, (sizeof(uint32_t) + sizeof(vec3))*(uint64_t)Stream->VertexCount*Stream->SlotCount);
+	Stream->Indices = (uint32_t *)AllocateMemory(MemoryCategory_Mesh, sizeof(uint32_t)*Stream->IndexCount);
+	Stream->WindowPresent = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, WindowTileCount);
+	Stream->Requests = (stream_request *)AllocateMemory(MemoryCategory_Scratch, sizeof(stream_request)*WindowTileCount);
+	if(!Stream->HeightMaps || !Stream->MeshData || !Stream->Indices || !Stream->WindowPresent || !Stream->Requests)
+	{
+		printf("Out of memory for %u stream tiles\n", Stream->SlotCount);
+		return(false);
+	}
+
+	uint32_t *SlotNormals = (uint32_t *)Stream->MeshData;
+	vec3 *SlotVertices = (vec3 *)(SlotNormals + Stream->VertexCount*Stream->SlotCount);
+	for(uint32_t SlotIndex = 0; SlotIndex < Stream->SlotCount; SlotIndex++)
+	{
+		stream_slot *Slot = Stream->Slots + SlotIndex;
+		Slot->Stream = Stream;
+		Slot->TileX = 0;
+		Slot->TileZ = 0;
+		Slot->State = StreamTile_Free;
+		Slot->LastUsedFrame = 0;
+		Slot->Changed = false;
+		Slot->HeightMap = Stream->HeightMaps + SlotIndex*SampleCount;
+		Slot->Normals = SlotNormals + SlotIndex*Stream->VertexCount;
+		Slot->Vertices = SlotVertices + SlotIndex*Stream->VertexCount;
+	}
+
+	// NOTE(georgy): The indices only depend on the tile size. The grid's are built with the first slot's buffers, its first tile
+	//				 overwrites the vertices. The skirt continues the strip after two repeated indices, pairing every border
+	//				 sample with the one below it
+	terrain_mesh Mesh;
+	SetTerrainMeshSize(&Mesh, Params->TileSize, Params->TileSize);
+	Mesh.Vertices = Stream->Slots[0].Vertices;
+	Mesh.Indices = Stream->Indices;
+	BuildTerrainMesh(0, Stream->Slots[0].HeightMap, Params->TileSize, Params->TileSize, 1.0f, 1.0f, &Mesh);
+
+	uint32_t *SkirtIndices = Stream->Indices + Mesh.IndexCount;
+	*SkirtIndices++ = Stream->Indices[Mesh.IndexCount - 1];
+	*SkirtIndices++ = StreamBorderSample(Params->TileSize, 0);
+	for(uint32_t Index = 0; Index <= 4*Params->TileSize; Index++)
+	{
+		uint32_t LoopIndex = Index % (4*Params->TileSize);
+		*SkirtIndices++ = StreamBorderSample(Params->TileSize, LoopIndex);
+		*SkirtIndices++ = SampleCount + LoopIndex;
+	}
+
+	return(true);
+}
+
+// NOTE(georgy): Waits for the tiles still being generated, so it can stall
+static void
+FreeTerrainStream(terrain_stream *Stream)
+{
+	if(Stream->Slots)
+	{
+		WaitForCounter(Stream->Jobs, &Stream->Pending);
+	}
+
+	delete[] Stream->Slots;
+	FreeMemory(Stream->HeightMaps);
+	FreeMemory(Stream->MeshData);
+	FreeMemory(Stream->Indices);
+	FreeMemory(Stream->WindowPresent);
+	FreeMemory(Stream->Requests);
+	Stream->Slots = 0;
+}
+
+static int
+CompareStreamRequests(const void *A, const void *B)
+{
+	int64_t DistanceA = ((const stream_request *)A)->DistanceSquared;
+	int64_t DistanceB = ((const stream_request *)B)->DistanceSquared;
+	int Result = (DistanceA < DistanceB) ? -1 : ((DistanceA > DistanceB) ? 1 : 0);
+
+	return(Result);
+}
+
+// NOTE(georgy): Free slot, or the least recently needed ready one that isn't in view now. -1 if every slot is in use
+static int32_t
+FindStreamSlot(terrain_stream *Stream)
+{
+	int32_t Result = -1;
+	uint64_t OldestFrame = Stream->Frame;
+	for(uint32_t SlotIndex = 0; SlotIndex < Stream->SlotCount; SlotIndex++)
+	{
+		stream_slot *Slot = Stream->Slots + SlotIndex;
+		uint32_t State = Slot->State.load(std::memory_order_acquire);
+		if(State == StreamTile_Free)
+		{
+			Result = (int32_t)SlotIndex;
+			break;
+		}
+		if((State == StreamTile_Ready) && (Slot->LastUsedFrame < OldestFrame))
+		{
+			OldestFrame = Slot->LastUsedFrame;
+			Result = (int32_t)SlotIndex;
+		}
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Called every frame with the camera position in samples. Marks the tiles in view as used and queues the missing
+//				 ones nearest first, at most MaxTilesInFlight at a time. Never waits for a job
+static void
+UpdateTerrainStream(terrain_stream *Stream, double CameraX, double CameraZ)
+{
+	TIMED_FUNCTION();
+	uint64_t BeginTime = GetNanoseconds();
+
+	const stream_params *Params = &Stream->Params;
+	Stream->Frame++;
+	int64_t CameraTileX = (int64_t)floor(CameraX / Params->TileSize);
+	int64_t CameraTileZ = (int64_t)floor(CameraZ / Params->TileSize);
+	memset(Stream->WindowPresent, 0, Stream->WindowTiles*Stream->WindowTiles);
+
+	uint32_t InFlight = 0;
+	uint32_t Missing = 0;
+	for(uint32_t SlotIndex = 0; SlotIndex < Stream->SlotCount; SlotIndex++)
+	{
+		stream_slot *Slot = Stream->Slots + SlotIndex;
+		uint32_t State = Slot->State.load(std::memory_order_acquire);
+		if(State == StreamTile_Free)
+		{
+			continue;
+		}
+
+		InFlight += (State == StreamTile_Generating) ? 1 : 0;
+		int64_t WindowX = Slot->TileX - CameraTileX + Stream->WindowRadius;
+		int64_t WindowZ = Slot->TileZ - CameraTileZ + Stream->WindowRadius;
+		if((WindowX >= 0) && (WindowX < (int64_t)Stream->WindowTiles) && (WindowZ >= 0) && (WindowZ < (int64_t)Stream->WindowTiles) &&
+		   StreamTileInView(Params, Slot->TileX, Slot->TileZ, CameraX, CameraZ))
+		{
+			Stream->WindowPresent[WindowX + WindowZ*Stream->WindowTiles] = 1;
+			Slot->LastUsedFrame = Stream->Frame;
+			Missing += (State == StreamTile_Generating) ? 1 : 0;
+		}
+	}
+
+	uint32_t RequestCount = 0;
+	for(int32_t WindowZ = 0; WindowZ < (int32_t)Stream->WindowTiles; WindowZ++)
+	{
+		for(int32_t WindowX = 0; WindowX < (int32_t)Stream->WindowTiles; WindowX++)
+		{
+			int64_t TileX = CameraTileX + WindowX - Stream->WindowRadius;
+			int64_t TileZ = CameraTileZ + WindowZ - Stream->WindowRadius;
+			if(!Stream->WindowPresent[WindowX + WindowZ*Stream->WindowTiles] && StreamTileInView(Params, TileX, TileZ, CameraX, CameraZ))
+			{
+				stream_request *Request = Stream->Requests + RequestCount++;
+				Request->TileX = TileX;
+				Request->TileZ = TileZ;
+				Request->DistanceSquared = StreamTileDistanceSquared(Params, TileX, TileZ, CameraX, CameraZ);
+			}
+		}
+	}
+	Missing += RequestCount;
+
+	if((RequestCount > 0) && (InFlight < Params->MaxTilesInFlight))
+	{
+		qsort(Stream->Requests, RequestCount, sizeof(stream_request), CompareStreamRequests);
+		for(uint32_t RequestIndex = 0; (RequestIndex < RequestCount) && (InFlight < Params->MaxTilesInFlight); RequestIndex++)
+		{
+			int32_t SlotIndex = FindStreamSlot(Stream);
+			if(SlotIndex < 0)
+			{
+				break;
+			}
+
+			stream_slot *Slot = Stream->Slots + SlotIndex;
+			if(Slot->State.load(std::memory_order_relaxed) == StreamTile_Ready)
+			{
+				Stream->Stats.TilesEvicted++;
+			}
+			Slot->TileX = Stream->Requests[RequestIndex].TileX;
+			Slot->TileZ = Stream->Requests[RequestIndex].TileZ;
+			Slot->LastUsedFrame = Stream->Frame;
+			Slot->Changed = true;
+			Slot->State.store(StreamTile_Generating, std::memory_order_relaxed);
+			AddJob(Stream->Jobs, "StreamTile", StreamTileProc, Slot, 0, 0, &Stream->Pending);
+
+			InFlight++;
+			Stream->Stats.TilesRequested++;
+		}
+	}
+
+	uint64_t UpdateTime = GetNanoseconds() - BeginTime;
+	Stream->Stats.FrameCount++;
+	Stream->Stats.TilesMissing = Missing;
+	Stream->Stats.TotalUpdateNanoseconds += UpdateTime;
+	Stream->Stats.MaxUpdateNanoseconds = (UpdateTime > Stream->Stats.MaxUpdateNanoseconds) ? UpdateTime : Stream->Stats.MaxUpdateNanoseconds;
+}
+
+// NOTE(georgy): A slot's tile can be drawn once it's ready and was in view at the last update
+inline bool
+StreamSlotVisible(const terrain_stream *Stream, const stream_slot *Slot)
+{
+	bool Result = (Slot->State.load(std::memory_order_acquire) == StreamTile_Ready) && (Slot->LastUsedFrame == Stream->Frame);
+	return(Result);
+}
+
+// NOTE(georgy): Height at (X, Z) in samples if the tile under it is ready, false otherwise
+static bool
+SampleTerrainStream(const terrain_stream *Stream, double X, double Z, float *Height)
+{
+	const stream_params *Params = &Stream->Params;
+	int64_t TileX = (int64_t)floor(X / Params->TileSize);
+	int64_t TileZ = (int64_t)floor(Z / Params->TileSize);
+	bool Result = false;
+	for(uint32_t SlotIndex = 0; SlotIndex < Stream->SlotCount; SlotIndex++)
+	{
+		const stream_slot *Slot = Stream->Slots + SlotIndex;
+		if((Slot->TileX == TileX) && (Slot->TileZ == TileZ) && (Slot->State.load(std::memory_order_acquire) == StreamTile_Ready))
+		{
+			float LocalX = (float)(X - (double)TileX*Params->TileSize);
+			float LocalZ = (float)(Z - (double)TileZ*Params->TileSize);
+			uint32_t CellX = (uint32_t)Min((int32_t)LocalX, (int32_t)Params->TileSize - 1);
+			uint32_t CellZ = (uint32_t)Min((int32_t)LocalZ, (int32_t)Params->TileSize - 1);
+			float U = LocalX - CellX;
+			float V = LocalZ - CellZ;
+
+			uint32_t Stride = Params->TileSize + 1;
+			const float *Cell = Slot->HeightMap + CellX + CellZ*Stride;
+			*Height = (1.0f - V)*((1.0f - U)*Cell[0] + U*Cell[1]) + V*((1.0f - U)*Cell[Stride] + U*Cell[Stride + 1]);
+			Result = true;
+			break;
+		}
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Largest height difference on the shared edges of ready neighbouring tiles, and how many edges were compared
+static float
+MeasureStreamSeams(const terrain_stream *Stream, uint32_t *EdgeCount)
+{
+	uint32_t TileSize = Stream->Params.TileSize;
+	uint32_t Stride = TileSize + 1;
+	float Result = 0.0f;
+	*EdgeCount = 0;
+	for(uint32_t SlotIndex = 0; SlotIndex < Stream->SlotCount; SlotIndex++)
+	{
+		const stream_slot *Slot = Stream->Slots + SlotIndex;
+		if(Slot->State.load(std::memory_order_acquire) != StreamTile_Ready) continue;
+
+		for(uint32_t OtherIndex = 0; OtherIndex < Stream->SlotCount; OtherIndex++)
+		{
+			const stream_slot *Other = Stream->Slots + OtherIndex;
+			bool Right = (Other->TileX == Slot->TileX + 1) && (Other->TileZ == Slot->TileZ);
+			bool Below = (Other->TileX == Slot->TileX) && (Other->TileZ == Slot->TileZ + 1);
+			if((!Right && !Below) || (Other->State.load(std::memory_order_acquire) != StreamTile_Ready)) continue;
+
+			for(uint32_t I = 0; I <= TileSize; I++)
+			{
+				float A = Right ? Slot->HeightMap[TileSize + I*Stride] : Slot->HeightMap[I + TileSize*Stride];
+				float B = Right ? Other->HeightMap[I*Stride] : Other->HeightMap[I];
+				Result = Max(Result, Absolute(A - B));
+			}
+			*EdgeCount += 1;
+		}
+	}
+
+	return(Result);
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "job_system.cpp"
+#include "memory.cpp"
+#include "trace.cpp"
+
+#define MAX_NOISE_OCTAVES 8
+
+struct noise_params
+{
+	float Frequency;
+	uint32_t OctaveCount;
+	float OctaveAmplitudes[MAX_NOISE_OCTAVES];
+	float MaxHeight;
+};
+
+inline noise_params
+DefaultNoiseParams(float MaxHeight)
+{
+	noise_params Result = {};
+	Result.Frequency = 0.5f*0.01345f;
+	Result.OctaveCount = 4;
+	Result.OctaveAmplitudes[0] = 1.5f;
+	Result.OctaveAmplitudes[1] = 0.5f;
+	Result.OctaveAmplitudes[2] = 0.25f;
+	Result.OctaveAmplitudes[3] = 0.125f;
+	Result.MaxHeight = MaxHeight;
+
+	return(Result);
+}
+
+// NOTE(georgy): Noise positions are float, and Frequency*X loses precision as X grows. The noise repeats every
+//				 NOISE_PERIOD lattice cells (the permutation table is indexed mod its size), so far from the origin a position
+//				 is split into a run base that's a multiple of NOISE_RUN_SIZE samples, whose position is wrapped into
+//				 [0, NOISE_PERIOD) in double, and the float offset from it. That keeps the error the same anywhere in the
+//				 64-bit range. A sample's position only depends on its own coordinate, so grids that overlap still agree.
+//				 Within NOISE_EXACT_RANGE samples of the origin the base is 0, so positions there are computed as before
+#define NOISE_PERIOD 512.0
+#define NOISE_RUN_SIZE 4096
+#define NOISE_EXACT_RANGE 65536
+
+inline int64_t
+NoiseRunBase(int64_t Coordinate)
+{
+	int64_t Result = FloorDivide(Coordinate, (int64_t)NOISE_RUN_SIZE)*NOISE_RUN_SIZE;
+	if((Result >= -NOISE_EXACT_RANGE) && (Result < NOISE_EXACT_RANGE))
+	{
+		Result = 0;
+	}
+
+	return(Result);
+}
+
+inline float
+WrappedNoisePosition(float Frequency, int64_t Base)
+{
+	double Position = (double)Frequency*(double)Base;
+	float Result = (float)(Position - NOISE_PERIOD*floor(Position / NOISE_PERIOD));
+
+	return(Result);
+}
+
+// NOTE(georgy): Fills rows [FirstRow, OnePastLastRow) of a heightmap whose first sample is the world sample (OriginX, OriginZ)
+static void
+FillHeightMapNoiseRows(float *HeightMap, uint32_t GridWidth, int64_t OriginX, int64_t OriginZ, const noise_params *Noise,
+					   uint32_t FirstRow, uint32_t OnePastLastRow)
+{
+	for(uint32_t Z = FirstRow; Z < OnePastLastRow; Z++)
+	{
+		float *Row = HeightMap + Z*(GridWidth + 1);
+		memset(Row, 0, sizeof(float) * (GridWidth + 1));
+
+		int64_t WorldZ = OriginZ + (int64_t)Z;
+		int64_t BaseZ = NoiseRunBase(WorldZ);
+		float LocalZ = (float)(WorldZ - BaseZ);
+		float OctaveFrequency = Noise->Frequency;
+		for(uint32_t Octave = 0; Octave < Noise->OctaveCount; Octave++)
+		{
+			float Y = -(OctaveFrequency*LocalZ + WrappedNoisePosition(OctaveFrequency, BaseZ));
+
+			// NOTE(georgy): One kernel call per run of samples with the same base, that's the whole row near the origin
+			uint32_t X = 0;
+			while(X <= GridWidth)
+			{
+				int64_t WorldX = OriginX + (int64_t)X;
+				int64_t BaseX = NoiseRunBase(WorldX);
+				int64_t RunEndX = (BaseX == 0) ? NOISE_EXACT_RANGE : (BaseX + NOISE_RUN_SIZE);
+				uint32_t RunEnd = (uint32_t)((RunEndX - OriginX < (int64_t)GridWidth + 1) ? (RunEndX - OriginX) : ((int64_t)GridWidth + 1));
+				TerrainKernels.NoiseRow(Row + X, RunEnd - X, (int32_t)(WorldX - BaseX), OctaveFrequency, WrappedNoisePosition(OctaveFrequency, BaseX),
+										Y, Noise->OctaveAmplitudes[Octave]);
+				X = RunEnd;
+			}
+			OctaveFrequency *= 2.0f;
+		}
+
+		for(uint32_t X = 0; X <= GridWidth; X++)
+		{
+			Row[X] *= Noise->MaxHeight;
+		}
+	}
+}
+
+static void
+FillHeightMapNoise(job_system *Jobs, float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, int64_t OriginX, int64_t OriginZ, const noise_params *Noise)
+{
+	TIMED_FUNCTION();
+
+	noise_params NoiseCopy = *Noise;
+	ParallelFor(Jobs, "NoiseRows", GridHeight + 1, GrainForCount(Jobs, GridHeight + 1), [=](uint32_t Begin, uint32_t End)
+	{
+		FillHeightMapNoiseRows(HeightMap, GridWidth, OriginX, OriginZ, &NoiseCopy, Begin, End);
+	});
+}
+
+// NOTE(georgy): One triangle strip for the whole grid, every row ends with two extra indices that make degenerate triangles
+struct terrain_mesh
+{
+	uint32_t VertexCount;
+	uint32_t IndexCount;
+	vec3 *Vertices;
+	uint32_t *Indices;
+};
+
+inline void
+SetTerrainMeshSize(terrain_mesh *Mesh, uint32_t GridWidth, uint32_t GridHeight)
+{
+	Mesh->VertexCount = (GridWidth + 1)*(GridHeight + 1);
+	Mesh->IndexCount = (2*(GridWidth + 1) + 2)*GridHeight;
+}
+
+inline uint64_t
+TerrainMeshSize(uint32_t GridWidth, uint32_t GridHeight)
+{
+	terrain_mesh Mesh;
+	SetTerrainMeshSize(&Mesh, GridWidth, GridHeight);
+	uint64_t Result = sizeof(vec3)*(uint64_t)Mesh.VertexCount + sizeof(uint32_t)*(uint64_t)Mesh.IndexCount;
+
+	return(Result);
+}
+
+static bool
+PushTerrainMesh(memory_arena *Arena, terrain_mesh *Mesh, uint32_t GridWidth, uint32_t GridHeight)
+{
+	SetTerrainMeshSize(Mesh, GridWidth, GridHeight);
+	Mesh->Vertices = PushArray(Arena, Mesh->VertexCount, vec3);
+	Mesh->Indices = PushArray(Arena, Mesh->IndexCount, uint32_t);
+	bool Result = Mesh->Vertices && Mesh->Indices;
+
+	return(Result);
+}
+
+// NOTE(georgy): Fills a mesh that already has room for the grid (PushTerrainMesh)
+static void
+BuildTerrainMesh(job_system *Jobs, const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, float TerrainWidth, float TerrainHeight,
+				 terrain_mesh *Mesh)
+{
+	TIMED_FUNCTION();
+
+	float StepX = TerrainWidth / GridWidth;
+	float StepZ = TerrainHeight / GridHeight;
+	uint32_t IndicesPerRow = 2*(GridWidth + 1) + 2;
+
+	vec3 *VertexData = Mesh->Vertices;
+	uint32_t *IndexData = Mesh->Indices;
+
+	ParallelFor(Jobs, "MeshRows", GridHeight + 1, GrainForCount(Jobs, GridHeight + 1), [=](uint32_t Begin, uint32_t End)
+	{
+		for(uint32_t Z = Begin; Z < End; Z++)
+		{
+			for(uint32_t X = 0; X <= GridWidth; X++)
+			{
+				float Height = HeightMap[X + Z*(GridWidth + 1)];
+				VertexData[X + Z*(GridWidth + 1)] = vec3(StepX*X, Height, -StepZ*Z);
+			}
+
+			if(Z < GridHeight)
+			{
+				uint32_t *RowIndices = IndexData + Z*IndicesPerRow;
+				for(uint32_t X = 0; X <= GridWidth; X++)
+				{
+					uint32_t Index0 = X + Z*(GridWidth + 1);
+					uint32_t Index1 = X + (Z + 1)*(GridWidth + 1);
+
+					*RowIndices++ = Index0;
+					*RowIndices++ = Index1;
+
+					if(X == GridWidth)
+					{
+						*RowIndices++ = Index1;
+						*RowIndices++ = (Z + 1)*(GridWidth + 1);
+					}
+				}
+			}
+		}
+	});
+}
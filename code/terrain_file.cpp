@@ -0,0 +1,648 @@
+#pragma once
+
+#include "job_system.cpp"
+#include "memory.cpp"
+#include "platform.cpp"
+
+// NOTE(georgy): Terrain container. Every layer (heights, normals, ...) of a (GridWidth + 1) x (GridHeight + 1) sample grid
+//				 is cut into TileSize x TileSize sample tiles that are compressed on their own, so a reader that maps the
+//				 file decompresses only the tiles it needs, on any thread. Layout, all little-endian:
+//				 terrain_file_header
+//				 terrain_file_layer[LayerCount]
+//				 terrain_file_tile[LayerCount*TilesX*TilesZ], layer by layer, tiles in row order
+//				 tile data
+
+#define TERRAIN_FILE_MAGIC 0x4E524554 // NOTE(georgy): "TERN"
+#define TERRAIN_FILE_VERSION 1
+#define TERRAIN_FILE_DEFAULT_TILE_SIZE 128
+
+enum terrain_layer_kind
+{
+	TerrainLayer_Height,
+	// NOTE(georgy): Packed GL_INT_2_10_10_10_REV normals
+	TerrainLayer_Normals,
+	// NOTE(georgy): Float erosion layers (see erosion_layers): water that passed over a sample, sediment deposited on it,
+	//				 material eroded from it
+	TerrainLayer_Flow,
+	TerrainLayer_Deposit,
+	TerrainLayer_Erosion,
+};
+
+enum terrain_tile_codec
+{
+	TerrainCodec_Raw,
+	// NOTE(georgy): Samples minus a prediction from their neighbours, split into byte planes, then LZ
+	TerrainCodec_DeltaLZ,
+};
+
+struct terrain_file_header
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t GridWidth;
+	uint32_t GridHeight;
+	uint32_t TileSize;
+	uint32_t LayerCount;
+};
+
+struct terrain_file_layer
+{
+	uint32_t Kind;
+	uint32_t BytesPerSample;
+};
+
+struct terrain_file_tile
+{
+	uint64_t Offset;
+	// NOTE(georgy): HashBytes of the decompressed tile, rows in order
+	uint64_t Hash;
+	uint32_t Size;
+	uint32_t Codec;
+};
+
+struct terrain_layer_source
+{
+	terrain_layer_kind Kind;
+	uint32_t BytesPerSample;
+	const void *Samples;
+};
+
+//
+// NOTE(georgy): LZ
+//
+
+// NOTE(georgy): LZ77 in the LZ4 block layout: a token (literal count << 4 | match length - 4), literal count extension bytes,
+//				 literals, 16-bit match offset, match length extension bytes. The last sequence has literals only
+#define TERRAIN_LZ_MIN_MATCH 4
+#define TERRAIN_LZ_HASH_BITS 12
+
+inline uint64_t
+LZCompressBound(uint64_t Size)
+{
+	uint64_t Result = Size + Size/255 + 16;
+
+	return(Result);
+}
+
+inline uint8_t *
+LZWriteLength(uint8_t *Out, uint64_t Length)
+{
+	while(Length >= 255)
+	{
+		*Out++ = 255;
+		Length -= 255;
+	}
+	*Out++ = (uint8_t)Length;
+
+	return(Out);
+}
+
+static uint8_t *
+LZWriteSequence(uint8_t *Out, const uint8_t *Literals, uint64_t LiteralCount, uint32_t Offset, uint64_t MatchLength)
+{
+	uint64_t MatchCode = (MatchLength >= TERRAIN_LZ_MIN_MATCH) ? (MatchLength - TERRAIN_LZ_MIN_MATCH) : 0;
+	*Out++ = (uint8_t)(((LiteralCount < 15) ? LiteralCount : 15) << 4 | ((MatchCode < 15) ? MatchCode : 15));
+	if(LiteralCount >= 15)
+	{
+		Out = LZWriteLength(Out, LiteralCount - 15);
+	}
+	memcpy(Out, Literals, LiteralCount);
+	Out += LiteralCount;
+
+	if(MatchLength)
+	{
+		*Out++ = (uint8_t)(Offset & 0xFF);
+		*Out++ = (uint8_t)(Offset >> 8);
+		if(MatchCode >= 15)
+		{
+			Out = LZWriteLength(Out, MatchCode - 15);
+		}
+	}
+
+	return(Out);
+}
+
+// NOTE(georgy): Dest must have room for LZCompressBound(SourceSize) bytes
+static uint64_t
+LZCompress(const uint8_t *Source, uint64_t SourceSize, uint8_t *Dest)
+{
+	uint32_t HashTable[1 << TERRAIN_LZ_HASH_BITS];
+	memset(HashTable, 0, sizeof(HashTable));
+
+	uint8_t *Out = Dest;
+	uint64_t LiteralStart = 0;
+	uint64_t P = 0;
+	while(P + TERRAIN_LZ_MIN_MATCH <= SourceSize)
+	{
+		uint32_t Sequence;
+		memcpy(&Sequence, Source + P, sizeof(Sequence));
+		uint32_t Hash = (Sequence*2654435761u) >> (32 - TERRAIN_LZ_HASH_BITS);
+		// NOTE(georgy): Positions are stored + 1, so zero is an empty slot
+		uint64_t Candidate = HashTable[Hash];
+		HashTable[Hash] = (uint32_t)(P + 1);
+
+		if(Candidate && ((P - (Candidate - 1)) <= 0xFFFF) && (memcmp(Source + Candidate - 1, &Sequence, sizeof(Sequence)) == 0))
+		{
+			uint64_t MatchP = Candidate - 1;
+			uint64_t MatchLength = TERRAIN_LZ_MIN_MATCH;
+			while(((P + MatchLength) < SourceSize) && (Source[MatchP + MatchLength] == Source[P + MatchLength]))
+			{
+				MatchLength++;
+			}
+
+			Out = LZWriteSequence(Out, Source + LiteralStart, P - LiteralStart, (uint32_t)(P - MatchP), MatchLength);
+			P += MatchLength;
+			LiteralStart = P;
+		}
+		else
+		{
+			P++;
+		}
+	}
+	Out = LZWriteSequence(Out, Source + LiteralStart, SourceSize - LiteralStart, 0, 0);
+
+	uint64_t Result = (uint64_t)(Out - Dest);
+	return(Result);
+}
+
+inline bool
+LZReadLength(const uint8_t **In, const uint8_t *InEnd, uint64_t *Length)
+{
+	uint8_t Byte;
+	do
+	{
+		if(*In >= InEnd)
+		{
+			return(false);
+		}
+		Byte = *(*In)++;
+		*Length += Byte;
+	} while(Byte == 255);
+
+	return(true);
+}
+
+// NOTE(georgy): Checks every length and offset, so a corrupt tile fails instead of writing out of bounds
+static bool
+LZDecompress(const uint8_t *Source, uint64_t SourceSize, uint8_t *Dest, uint64_t DestSize)
+{
+	const uint8_t *In = Source;
+	const uint8_t *InEnd = Source + SourceSize;
+	uint8_t *Out = Dest;
+	uint8_t *OutEnd = Dest + DestSize;
+
+	for(;;)
+	{
+		if(In >= InEnd)
+		{
+			return(false);
+		}
+
+		uint8_t Token = *In++;
+		uint64_t LiteralCount = Token >> 4;
+		if((LiteralCount == 15) && !LZReadLength(&In, InEnd, &LiteralCount))
+		{
+			return(false);
+		}
+		if((LiteralCount > (uint64_t)(InEnd - In)) || (LiteralCount > (uint64_t)(OutEnd - Out)))
+		{
+			return(false);
+		}
+		memcpy(Out, In, LiteralCount);
+		In += LiteralCount;
+		Out += LiteralCount;
+
+		if(In == InEnd)
+		{
+			break;
+		}
+
+		if((InEnd - In) < 2)
+		{
+			return(false);
+		}
+		uint32_t Offset = In[0] | (In[1] << 8);
+		In += 2;
+		uint64_t MatchLength = Token & 15;
+		if((MatchLength == 15) && !LZReadLength(&In, InEnd, &MatchLength))
+		{
+			return(false);
+		}
+		MatchLength += TERRAIN_LZ_MIN_MATCH;
+		if((Offset == 0) || (Offset > (uint64_t)(Out - Dest)) || (MatchLength > (uint64_t)(OutEnd - Out)))
+		{
+			return(false);
+		}
+
+		// NOTE(georgy): Matches may overlap what they produce, so byte by byte
+		const uint8_t *Match = Out - Offset;
+		for(uint64_t ByteIndex = 0; ByteIndex < MatchLength; ByteIndex++)
+		{
+			Out[ByteIndex] = Match[ByteIndex];
+		}
+		Out += MatchLength;
+	}
+
+	return(Out == OutEnd);
+}
+
+//
+// NOTE(georgy): Tiles
+//
+
+inline uint32_t
+LoadSample(const uint8_t *Sample, uint32_t BytesPerSample)
+{
+	uint32_t Result = 0;
+	memcpy(&Result, Sample, BytesPerSample);
+
+	return(Result);
+}
+
+inline void
+StoreSample(uint8_t *Sample, uint32_t BytesPerSample, uint32_t Value)
+{
+	memcpy(Sample, &Value, BytesPerSample);
+}
+
+// NOTE(georgy): The left neighbour, or the upper one in the first column. Works on the raw bits: a plane through three
+//				 neighbours predicts worse for floats, whose bits aren't linear in the value across exponents
+inline uint32_t
+PredictSample(uint32_t X, uint32_t Z, uint32_t Left, uint32_t Up)
+{
+	uint32_t Result = 0;
+	if(X > 0) Result = Left;
+	else if(Z > 0) Result = Up;
+
+	return(Result);
+}
+
+// NOTE(georgy): Smooth layers have small differences from the prediction, mostly zero high bytes, which LZ handles well
+//				 once the bytes of the same significance are next to each other
+static void
+DeltaFilterTile(const uint8_t *Samples, uint32_t Width, uint32_t Height, uint32_t BytesPerSample, uint8_t *Dest)
+{
+	uint32_t SampleCount = Width*Height;
+	for(uint32_t Z = 0; Z < Height; Z++)
+	{
+		for(uint32_t X = 0; X < Width; X++)
+		{
+			uint32_t Index = X + Z*Width;
+			uint32_t Left = (X > 0) ? LoadSample(Samples + (Index - 1)*BytesPerSample, BytesPerSample) : 0;
+			uint32_t Up = (Z > 0) ? LoadSample(Samples + (Index - Width)*BytesPerSample, BytesPerSample) : 0;
+			uint32_t Prediction = PredictSample(X, Z, Left, Up);
+
+			uint32_t Delta = LoadSample(Samples + Index*BytesPerSample, BytesPerSample) - Prediction;
+			for(uint32_t Byte = 0; Byte < BytesPerSample; Byte++)
+			{
+				Dest[Byte*SampleCount + Index] = (uint8_t)(Delta >> (8*Byte));
+			}
+		}
+	}
+}
+
+// NOTE(georgy): Rows go to Dest with DestStride bytes between them
+static void
+UndoDeltaFilterTile(const uint8_t *Filtered, uint32_t Width, uint32_t Height, uint32_t BytesPerSample, uint8_t *Dest, uint64_t DestStride)
+{
+	uint32_t SampleCount = Width*Height;
+	for(uint32_t Z = 0; Z < Height; Z++)
+	{
+		uint8_t *Row = Dest + Z*DestStride;
+		for(uint32_t X = 0; X < Width; X++)
+		{
+			uint32_t Index = X + Z*Width;
+			uint32_t Delta = 0;
+			for(uint32_t Byte = 0; Byte < BytesPerSample; Byte++)
+			{
+				Delta |= (uint32_t)Filtered[Byte*SampleCount + Index] << (8*Byte);
+			}
+
+			uint32_t Left = (X > 0) ? LoadSample(Row + (X - 1)*BytesPerSample, BytesPerSample) : 0;
+			uint32_t Up = (Z > 0) ? LoadSample(Row - DestStride + X*BytesPerSample, BytesPerSample) : 0;
+			uint32_t Prediction = PredictSample(X, Z, Left, Up);
+			StoreSample(Row + X*BytesPerSample, BytesPerSample, Prediction + Delta);
+		}
+	}
+}
+
+inline uint32_t
+TerrainTileCount(uint32_t SampleCount, uint32_t TileSize)
+{
+	uint32_t Result = (SampleCount + TileSize - 1) / TileSize;
+
+	return(Result);
+}
+
+struct terrain_tile_rect
+{
+	uint32_t X, Z;
+	uint32_t Width, Height;
+};
+
+inline terrain_tile_rect
+GetTerrainTileRect(uint32_t GridWidth, uint32_t GridHeight, uint32_t TileSize, uint32_t TileX, uint32_t TileZ)
+{
+	terrain_tile_rect Result;
+	Result.X = TileX*TileSize;
+	Result.Z = TileZ*TileSize;
+	Result.Width = ((GridWidth + 1 - Result.X) < TileSize) ? (GridWidth + 1 - Result.X) : TileSize;
+	Result.Height = ((GridHeight + 1 - Result.Z) < TileSize) ? (GridHeight + 1 - Result.Z) : TileSize;
+
+	return(Result);
+}
+
+//
+// NOTE(georgy): Writing
+//
+
+struct terrain_compressed_tile
+{
+	uint8_t *Data;
+	uint64_t Size;
+	uint64_t Hash;
+	uint32_t Codec;
+};
+
+// NOTE(georgy): Tiles are compressed in parallel, then written in order. Layers are full (GridWidth + 1) x (GridHeight + 1) grids
+static bool
+WriteTerrainFile(job_system *Jobs, const char *Filename, uint32_t GridWidth, uint32_t GridHeight, uint32_t TileSize,
+				 const terrain_layer_source *Layers, uint32_t LayerCount)
+{
+	uint32_t TilesX = TerrainTileCount(GridWidth + 1, TileSize);
+	uint32_t TilesZ = TerrainTileCount(GridHeight + 1, TileSize);
+	uint32_t TileCount = TilesX*TilesZ;
+	uint32_t EntryCount = LayerCount*TileCount;
+
+	terrain_compressed_tile *CompressedTiles = (terrain_compressed_tile *)AllocateZeroedMemory(MemoryCategory_Scratch, EntryCount*sizeof(terrain_compressed_tile));
+	if(!CompressedTiles)
+	{
+		return(false);
+	}
+
+	std::atomic<uint32_t> FailedTileCount(0);
+	ParallelFor(Jobs, "CompressTiles", EntryCount, 1, [&](uint32_t Begin, uint32_t End)
+	{
+		for(uint32_t EntryIndex = Begin; EntryIndex < End; EntryIndex++)
+		{
+			const terrain_layer_source *Layer = Layers + EntryIndex / TileCount;
+			uint32_t TileIndex = EntryIndex % TileCount;
+			terrain_tile_rect Rect = GetTerrainTileRect(GridWidth, GridHeight, TileSize, TileIndex % TilesX, TileIndex / TilesX);
+
+			uint64_t RowSize = (uint64_t)Rect.Width*Layer->BytesPerSample;
+			uint64_t TileBytes = RowSize*Rect.Height;
+			uint8_t *Samples = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, TileBytes);
+			uint8_t *Filtered = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, TileBytes);
+			uint8_t *Compressed = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, LZCompressBound(TileBytes));
+			if(Samples && Filtered && Compressed)
+			{
+				const uint8_t *Source = (const uint8_t *)Layer->Samples;
+				for(uint32_t Z = 0; Z < Rect.Height; Z++)
+				{
+					uint64_t SourceOffset = ((uint64_t)(Rect.Z + Z)*(GridWidth + 1) + Rect.X)*Layer->BytesPerSample;
+					memcpy(Samples + Z*RowSize, Source + SourceOffset, RowSize);
+				}
+
+				terrain_compressed_tile *Tile = CompressedTiles + EntryIndex;
+				Tile->Hash = HashBytes(Samples, TileBytes);
+				DeltaFilterTile(Samples, Rect.Width, Rect.Height, Layer->BytesPerSample, Filtered);
+				uint64_t CompressedSize = LZCompress(Filtered, TileBytes, Compressed);
+				if(CompressedSize < TileBytes)
+				{
+					Tile->Data = Compressed;
+					Tile->Size = CompressedSize;
+					Tile->Codec = TerrainCodec_DeltaLZ;
+					FreeMemory(Samples);
+				}
+				else
+				{
+					Tile->Data = Samples;
+					Tile->Size = TileBytes;
+					Tile->Codec = TerrainCodec_Raw;
+					FreeMemory(Compressed);
+				}
+				FreeMemory(Filtered);
+			}
+			else
+			{
+				FreeMemory(Compressed);
+				FreeMemory(Filtered);
+				FreeMemory(Samples);
+				FailedTileCount.fetch_add(1);
+			}
+		}
+	});
+
+	bool Result = (FailedTileCount == 0);
+	if(Result)
+	{
+		terrain_file_header Header;
+		Header.Magic = TERRAIN_FILE_MAGIC;
+		Header.Version = TERRAIN_FILE_VERSION;
+		Header.GridWidth = GridWidth;
+		Header.GridHeight = GridHeight;
+		Header.TileSize = TileSize;
+		Header.LayerCount = LayerCount;
+
+		terrain_file_layer *FileLayers = (terrain_file_layer *)AllocateMemory(MemoryCategory_Scratch, sizeof(terrain_file_layer)*LayerCount);
+		terrain_file_tile *FileTiles = (terrain_file_tile *)AllocateMemory(MemoryCategory_Scratch, sizeof(terrain_file_tile)*EntryCount);
+		Result = FileLayers && FileTiles;
+		if(!Result)
+		{
+			printf("Out of memory for the index of %s\n", Filename);
+		}
+		else
+		{
+			uint64_t Offset = sizeof(Header) + sizeof(terrain_file_layer)*LayerCount + sizeof(terrain_file_tile)*EntryCount;
+			for(uint32_t LayerIndex = 0; LayerIndex < LayerCount; LayerIndex++)
+			{
+				FileLayers[LayerIndex].Kind = Layers[LayerIndex].Kind;
+				FileLayers[LayerIndex].BytesPerSample = Layers[LayerIndex].BytesPerSample;
+			}
+			for(uint32_t EntryIndex = 0; EntryIndex < EntryCount; EntryIndex++)
+			{
+				FileTiles[EntryIndex].Offset = Offset;
+				FileTiles[EntryIndex].Hash = CompressedTiles[EntryIndex].Hash;
+				FileTiles[EntryIndex].Size = (uint32_t)CompressedTiles[EntryIndex].Size;
+				FileTiles[EntryIndex].Codec = CompressedTiles[EntryIndex].Codec;
+				Offset += CompressedTiles[EntryIndex].Size;
+			}
+
+			char TempFilename[1024];
+			snprintf(TempFilename, sizeof(TempFilename), "%s.tmp", Filename);
+			FILE *File = fopen(TempFilename, "wb");
+			Result = (File != 0);
+			if(File)
+			{
+				Result = (fwrite(&Header, sizeof(Header), 1, File) == 1);
+				Result = Result && (fwrite(FileLayers, sizeof(terrain_file_layer), LayerCount, File) == LayerCount);
+				Result = Result && (fwrite(FileTiles, sizeof(terrain_file_tile), EntryCount, File) == EntryCount);
+				for(uint32_t EntryIndex = 0; Result && (EntryIndex < EntryCount); EntryIndex++)
+				{
+					Result = (fwrite(CompressedTiles[EntryIndex].Data, 1, CompressedTiles[EntryIndex].Size, File) == CompressedTiles[EntryIndex].Size);
+				}
+				Result = (fclose(File) == 0) && Result;
+			}
+			Result = Result && ReplaceFile(TempFilename, Filename);
+		}
+
+		FreeMemory(FileTiles);
+		FreeMemory(FileLayers);
+	}
+
+	for(uint32_t EntryIndex = 0; EntryIndex < EntryCount; EntryIndex++)
+	{
+		FreeMemory(CompressedTiles[EntryIndex].Data);
+	}
+	FreeMemory(CompressedTiles);
+
+	return(Result);
+}
+
+//
+// NOTE(georgy): Reading
+//
+
+struct terrain_file
+{
+	mapped_file File;
+
+	const terrain_file_header *Header;
+	const terrain_file_layer *Layers;
+	const terrain_file_tile *Tiles;
+	uint32_t TilesX, TilesZ;
+};
+
+static void
+CloseTerrainFile(terrain_file *File)
+{
+	UnmapFile(&File->File);
+}
+
+// NOTE(georgy): Maps the file and checks that the header and the tile index fit in it, tile data is checked when it's read
+static bool
+OpenTerrainFile(terrain_file *Result, const char *Filename)
+{
+	if(!MapFileReadOnly(&Result->File, Filename))
+	{
+		printf("Can't open %s\n", Filename);
+		return(false);
+	}
+
+	const uint8_t *Memory = (const uint8_t *)Result->File.Memory;
+	uint64_t Size = Result->File.Size;
+	bool Valid = (Size >= sizeof(terrain_file_header));
+	if(Valid)
+	{
+		Result->Header = (const terrain_file_header *)Memory;
+		Valid = (Result->Header->Magic == TERRAIN_FILE_MAGIC) && (Result->Header->Version == TERRAIN_FILE_VERSION) &&
+				(Result->Header->TileSize > 0) && (Result->Header->LayerCount > 0);
+	}
+	if(Valid)
+	{
+		Result->TilesX = TerrainTileCount(Result->Header->GridWidth + 1, Result->Header->TileSize);
+		Result->TilesZ = TerrainTileCount(Result->Header->GridHeight + 1, Result->Header->TileSize);
+		uint64_t EntryCount = (uint64_t)Result->Header->LayerCount*Result->TilesX*Result->TilesZ;
+		uint64_t IndexEnd = sizeof(terrain_file_header) + sizeof(terrain_file_layer)*Result->Header->LayerCount + sizeof(terrain_file_tile)*EntryCount;
+		Valid = (IndexEnd <= Size);
+		if(Valid)
+		{
+			Result->Layers = (const terrain_file_layer *)(Memory + sizeof(terrain_file_header));
+			Result->Tiles = (const terrain_file_tile *)(Result->Layers + Result->Header->LayerCount);
+			for(uint64_t EntryIndex = 0; Valid && (EntryIndex < EntryCount); EntryIndex++)
+			{
+				Valid = (Result->Tiles[EntryIndex].Offset <= Size) && (Result->Tiles[EntryIndex].Size <= Size - Result->Tiles[EntryIndex].Offset);
+			}
+			for(uint32_t LayerIndex = 0; Valid && (LayerIndex < Result->Header->LayerCount); LayerIndex++)
+			{
+				uint32_t BytesPerSample = Result->Layers[LayerIndex].BytesPerSample;
+				Valid = (BytesPerSample >= 1) && (BytesPerSample <= 4);
+			}
+		}
+	}
+
+	if(!Valid)
+	{
+		printf("%s is not a valid terrain file\n", Filename);
+		CloseTerrainFile(Result);
+	}
+
+	return(Valid);
+}
+
+// NOTE(georgy): Decompresses one tile, rows go to Dest with DestStride bytes between them. Safe to call from any thread
+static bool
+ReadTerrainTile(terrain_file *File, uint32_t LayerIndex, uint32_t TileX, uint32_t TileZ, void *Dest, uint64_t DestStride)
+{
+	const terrain_file_header *Header = File->Header;
+	uint32_t BytesPerSample = File->Layers[LayerIndex].BytesPerSample;
+	const terrain_file_tile *Tile = File->Tiles + ((uint64_t)LayerIndex*File->TilesZ + TileZ)*File->TilesX + TileX;
+	const uint8_t *Data = (const uint8_t *)File->File.Memory + Tile->Offset;
+	terrain_tile_rect Rect = GetTerrainTileRect(Header->GridWidth, Header->GridHeight, Header->TileSize, TileX, TileZ);
+	uint64_t RowSize = (uint64_t)Rect.Width*BytesPerSample;
+	uint64_t TileBytes = RowSize*Rect.Height;
+
+	bool Result = false;
+	if(Tile->Codec == TerrainCodec_Raw)
+	{
+		if(Tile->Size == TileBytes)
+		{
+			for(uint32_t Z = 0; Z < Rect.Height; Z++)
+			{
+				memcpy((uint8_t *)Dest + Z*DestStride, Data + Z*RowSize, RowSize);
+			}
+			Result = true;
+		}
+	}
+	else if(Tile->Codec == TerrainCodec_DeltaLZ)
+	{
+		uint8_t *Filtered = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, TileBytes);
+		if(Filtered && LZDecompress(Data, Tile->Size, Filtered, TileBytes))
+		{
+			UndoDeltaFilterTile(Filtered, Rect.Width, Rect.Height, BytesPerSample, (uint8_t *)Dest, DestStride);
+			Result = true;
+		}
+		FreeMemory(Filtered);
+	}
+
+	if(Result)
+	{
+		uint64_t Hash = HASH_BYTES_SEED;
+		for(uint32_t Z = 0; Z < Rect.Height; Z++)
+		{
+			Hash = HashBytes((uint8_t *)Dest + Z*DestStride, RowSize, Hash);
+		}
+		Result = (Hash == Tile->Hash);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Decompresses every tile of the layer in parallel into a full (GridWidth + 1) x (GridHeight + 1) grid
+static bool
+ReadTerrainLayer(job_system *Jobs, terrain_file *File, uint32_t LayerIndex, void *Dest)
+{
+	uint32_t BytesPerSample = File->Layers[LayerIndex].BytesPerSample;
+	uint64_t DestStride = (uint64_t)(File->Header->GridWidth + 1)*BytesPerSample;
+	uint32_t TileCount = File->TilesX*File->TilesZ;
+
+	std::atomic<uint32_t> FailedTileCount(0);
+	ParallelFor(Jobs, "DecompressTiles", TileCount, 1, [&](uint32_t Begin, uint32_t End)
+	{
+		for(uint32_t TileIndex = Begin; TileIndex < End; TileIndex++)
+		{
+			uint32_t TileX = TileIndex % File->TilesX;
+			uint32_t TileZ = TileIndex / File->TilesX;
+			terrain_tile_rect Rect = GetTerrainTileRect(File->Header->GridWidth, File->Header->GridHeight, File->Header->TileSize, TileX, TileZ);
+			uint8_t *TileDest = (uint8_t *)Dest + Rect.Z*DestStride + (uint64_t)Rect.X*BytesPerSample;
+			if(!ReadTerrainTile(File, LayerIndex, TileX, TileZ, TileDest, DestStride))
+			{
+				printf("Terrain tile %u %u of layer %u is corrupt\n", TileX, TileZ, LayerIndex);
+				FailedTileCount.fetch_add(1);
+			}
+		}
+	});
+
+	bool Result = (FailedTileCount == 0);
+	return(Result);
+}
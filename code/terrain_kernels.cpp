@@ -0,0 +1,960 @@
+#pragma once
+
+#include "cpu_dispatch.cpp"
+
+// NOTE(georgy): Adds Amplitude*(0.5f*PerlinNoise2D(vec2(Frequency*(StartX + I) + OffsetX, Y)) + 0.5f) to Dest[I] for I in [0, Count).
+//				 OffsetX is 0 near the origin, far from it it's the wrapped part of the position (see FillHeightMapNoiseRows)
+typedef void noise_row_kernel(float *Dest, uint32_t Count, int32_t StartX, float Frequency, float OffsetX, float Y, float Amplitude);
+
+// NOTE(georgy): Takes up to TakeAmount from the cells within Radius of the droplet's position P (which is inside
+//				 the cell XIndex, ZIndex), weighted by the distance to P. Returns how much was actually taken
+typedef float erode_brush_kernel(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight,
+								 uint32_t XIndex, uint32_t ZIndex, vec2 P, int32_t Radius, float TakeAmount);
+
+enum normal_format
+{
+	NormalFormat_Float3,
+	// NOTE(georgy): GL_INT_2_10_10_10_REV, x in the low bits, w is unused
+	NormalFormat_Packed,
+};
+
+// NOTE(georgy): Writes normals of the interior vertices [1, GridWidth - 1] of the row Z (0 < Z < GridHeight)
+//				 to element X of Dest, which is either vec3 or uint32_t depending on Format
+typedef void normals_row_kernel(const float *HeightMap, uint32_t GridWidth, uint32_t Z, normal_format Format, void *Dest);
+
+// NOTE(georgy): Bilinear heights of the Count points (X[I], Z[I]), in grid units, and the normals of the bilinear surface
+//				 there when Normals isn't null. Points outside [0, GridWidth]x[0, GridHeight] are clamped to it.
+//				 The normal is built like CalculateNormal's, from the slopes of the cell instead of central differences
+typedef void sample_terrain_kernel(const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const float *X, const float *Z,
+								   uint32_t Count, float *Heights, vec3 *Normals);
+
+struct terrain_kernels
+{
+	cpu_isa_level Level;
+
+	noise_row_kernel *NoiseRow;
+	erode_brush_kernel *ErodeBrush;
+	normals_row_kernel *NormalsRow;
+	sample_terrain_kernel *SampleTerrain;
+};
+
+static terrain_kernels TerrainKernels;
+
+//
+// NOTE(georgy): Scalar
+//
+
+static void
+NoiseRowScalar(float *Dest, uint32_t Count, int32_t StartX, float Frequency, float OffsetX, float Y, float Amplitude)
+{
+	for(uint32_t I = 0; I < Count; I++)
+	{
+		float X = Frequency*(float)(StartX + (int32_t)I) + OffsetX;
+		Dest[I] += Amplitude*(0.5f*PerlinNoise2D(vec2(X, Y)) + 0.5f);
+	}
+}
+
+static float
+ErodeBrushScalar(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight,
+				 uint32_t XIndex, uint32_t ZIndex, vec2 P, int32_t Radius, float TakeAmount)
+{
+	float Taken = 0.0f;
+
+	float WeightSum = 0.0f;
+	for(int32_t ZOffset = -Radius; ZOffset <= Radius; ZOffset++)
+	{
+		for(int32_t XOffset = -Radius; XOffset <= Radius; XOffset++)
+		{
+			int32_t XInd = XIndex + XOffset;
+			int32_t ZInd = ZIndex + ZOffset;
+			if((XInd >= 0) && (XInd <= (int32_t)GridWidth) && (ZInd >= 0) && (ZInd <= (int32_t)GridHeight))
+			{
+				WeightSum += Max(0.0f, Radius - Length(vec2i(XInd, ZInd) - P));
+			}
+		}
+	}
+
+	for(int32_t ZOffset = -Radius; ZOffset <= Radius; ZOffset++)
+	{
+		for(int32_t XOffset = -Radius; XOffset <= Radius; XOffset++)
+		{
+			int32_t XInd = XIndex + XOffset;
+			int32_t ZInd = ZIndex + ZOffset;
+			if((XInd >= 0) && (XInd <= (int32_t)GridWidth) && (ZInd >= 0) && (ZInd <= (int32_t)GridHeight))
+			{
+				float Weight = Max(0.0f, Radius - Length(vec2i(XInd, ZInd) - P)) / WeightSum;
+				float AmountToErode = Weight*TakeAmount;
+				float DeltaSediment = (HeightMap[XInd + ZInd*(GridWidth+1)] < AmountToErode) ? HeightMap[XInd + ZInd*(GridWidth+1)] : AmountToErode;
+				HeightMap[XInd + ZInd*(GridWidth+1)] -= DeltaSediment;
+				Taken += DeltaSediment;
+			}
+		}
+	}
+
+	return(Taken);
+}
+
+inline uint32_t
+PackNormal(vec3 Normal)
+{
+	uint32_t X = (uint32_t)lrintf(Clamp(Normal.x, -1.0f, 1.0f)*511.0f) & 0x3FF;
+	uint32_t Y = (uint32_t)lrintf(Clamp(Normal.y, -1.0f, 1.0f)*511.0f) & 0x3FF;
+	uint32_t Z = (uint32_t)lrintf(Clamp(Normal.z, -1.0f, 1.0f)*511.0f) & 0x3FF;
+	uint32_t Result = X | (Y << 10) | (Z << 20);
+	return(Result);
+}
+
+inline vec3
+UnpackNormal(uint32_t Packed)
+{
+	// NOTE(georgy): Sign-extend each 10-bit component
+	int32_t X = (int32_t)(Packed << 22) >> 22;
+	int32_t Y = (int32_t)(Packed << 12) >> 22;
+	int32_t Z = (int32_t)(Packed << 2) >> 22;
+	vec3 Result = vec3(Max(X / 511.0f, -1.0f), Max(Y / 511.0f, -1.0f), Max(Z / 511.0f, -1.0f));
+	return(Result);
+}
+
+inline void
+StoreNormal(normal_format Format, void *Dest, uint32_t X, vec3 Normal)
+{
+	if(Format == NormalFormat_Packed)
+	{
+		((uint32_t *)Dest)[X] = PackNormal(Normal);
+	}
+	else
+	{
+		((vec3 *)Dest)[X] = Normal;
+	}
+}
+
+static void
+NormalsRowScalar(const float *HeightMap, uint32_t GridWidth, uint32_t Z, normal_format Format, void *Dest)
+{
+	const float *Row = HeightMap + Z*(GridWidth + 1);
+	const float *RowDown = Row - (GridWidth + 1);
+	const float *RowUp = Row + (GridWidth + 1);
+	for(uint32_t X = 1; X < GridWidth; X++)
+	{
+		StoreNormal(Format, Dest, X, Normalize(vec3(Row[X - 1] - Row[X + 1], 0.125f, RowUp[X] - RowDown[X])));
+	}
+}
+
+static void
+SampleTerrainScalar(const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const float *X, const float *Z,
+					uint32_t Count, float *Heights, vec3 *Normals)
+{
+	for(uint32_t I = 0; I < Count; I++)
+	{
+		float PX = Min(Max(X[I], 0.0f), (float)GridWidth);
+		float PZ = Min(Max(Z[I], 0.0f), (float)GridHeight);
+		uint32_t XIndex = ((uint32_t)PX < GridWidth) ? (uint32_t)PX : (GridWidth - 1);
+		uint32_t ZIndex = ((uint32_t)PZ < GridHeight) ? (uint32_t)PZ : (GridHeight - 1);
+		float U = PX - (float)XIndex;
+		float V = PZ - (float)ZIndex;
+
+		const float *Cell = HeightMap + XIndex + ZIndex*(GridWidth + 1);
+		float Height00 = Cell[0];
+		float Height01 = Cell[1];
+		float Height10 = Cell[GridWidth + 1];
+		float Height11 = Cell[GridWidth + 2];
+		float Height0 = Lerp(Height00, Height01, U);
+		float Height1 = Lerp(Height10, Height11, U);
+		Heights[I] = Lerp(Height0, Height1, V);
+
+		if(Normals)
+		{
+			float SlopeX = Lerp(Height01 - Height00, Height11 - Height10, V);
+			float SlopeZ = Height1 - Height0;
+			Normals[I] = Normalize(vec3(-2.0f*SlopeX, 0.125f, 2.0f*SlopeZ));
+		}
+	}
+}
+
+// NOTE(georgy): The brush only touches cells in [XMin, XMax]x[ZMin, ZMax], SIMD variants iterate this rectangle
+//				 directly instead of testing every offset
+struct brush_rect
+{
+	int32_t XMin, XMax;
+	int32_t ZMin, ZMax;
+};
+
+inline brush_rect
+ClampBrush(uint32_t GridWidth, uint32_t GridHeight, uint32_t XIndex, uint32_t ZIndex, int32_t Radius)
+{
+	brush_rect Result;
+	Result.XMin = (int32_t)XIndex - Radius;
+	Result.XMax = (int32_t)XIndex + Radius;
+	Result.ZMin = (int32_t)ZIndex - Radius;
+	Result.ZMax = (int32_t)ZIndex + Radius;
+	if(Result.XMin < 0) Result.XMin = 0;
+	if(Result.ZMin < 0) Result.ZMin = 0;
+	if(Result.XMax > (int32_t)GridWidth) Result.XMax = GridWidth;
+	if(Result.ZMax > (int32_t)GridHeight) Result.ZMax = GridHeight;
+
+	return(Result);
+}
+
+inline float
+BrushWeight(int32_t X, float DZSq, vec2 P, int32_t Radius)
+{
+	float DX = (float)X - P.x;
+	float Result = Max(0.0f, Radius - SquareRoot(DX*DX + DZSq));
+	return(Result);
+}
+
+#if SIMD_X86
+
+//
+// NOTE(georgy): SSE4.2
+//
+
+TARGET_SSE42 static void
+NoiseRowSSE42(float *Dest, uint32_t Count, int32_t StartX, float Frequency, float OffsetX, float Y, float Amplitude)
+{
+	int32_t J = FloorReal32ToInt32(Y);
+	float V = Y - J;
+	float QuinticFactorForV = V * V * V * (V * (6.0f * V - 15.0f) + 10.0f);
+	const uint32_t PermutationMask = ArrayCount(PermutationTable) - 1;
+	const uint32_t GradientMask = ArrayCount(Gradients2D) - 1;
+
+	__m128 FrequencyWide = _mm_set1_ps(Frequency);
+	__m128 OffsetXWide = _mm_set1_ps(OffsetX);
+	__m128 AmplitudeWide = _mm_set1_ps(Amplitude);
+	__m128 VWide = _mm_set1_ps(V);
+	__m128 V1Wide = _mm_set1_ps(V - 1.0f);
+	__m128 QuinticVWide = _mm_set1_ps(QuinticFactorForV);
+	__m128 One = _mm_set1_ps(1.0f);
+	__m128i LaneOffsets = _mm_setr_epi32(0, 1, 2, 3);
+
+	uint32_t I = 0;
+	for(; I + 4 <= Count; I += 4)
+	{
+		__m128 X = _mm_add_ps(_mm_mul_ps(FrequencyWide, _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(StartX + (int32_t)I), LaneOffsets))), OffsetXWide);
+		__m128 XFloor = _mm_floor_ps(X);
+		__m128 U = _mm_sub_ps(X, XFloor);
+
+		// NOTE(georgy): No gathers before AVX2, so hash lanes one by one
+		alignas(16) int32_t XCells[4];
+		alignas(16) float G00x[4], G00y[4], G10x[4], G10y[4], G01x[4], G01y[4], G11x[4], G11y[4];
+		_mm_store_si128((__m128i *)XCells, _mm_cvttps_epi32(XFloor));
+		for(uint32_t Lane = 0; Lane < 4; Lane++)
+		{
+			uint32_t PermutationForI = PermutationTable[XCells[Lane] & PermutationMask];
+			uint32_t PermutationForI1 = PermutationTable[(XCells[Lane] + 1) & PermutationMask];
+			vec2 Gradient00 = Gradients2D[PermutationTable[(PermutationForI + J) & PermutationMask] & GradientMask];
+			vec2 Gradient10 = Gradients2D[PermutationTable[(PermutationForI1 + J) & PermutationMask] & GradientMask];
+			vec2 Gradient01 = Gradients2D[PermutationTable[(PermutationForI + J + 1) & PermutationMask] & GradientMask];
+			vec2 Gradient11 = Gradients2D[PermutationTable[(PermutationForI1 + J + 1) & PermutationMask] & GradientMask];
+			G00x[Lane] = Gradient00.x; G00y[Lane] = Gradient00.y;
+			G10x[Lane] = Gradient10.x; G10y[Lane] = Gradient10.y;
+			G01x[Lane] = Gradient01.x; G01y[Lane] = Gradient01.y;
+			G11x[Lane] = Gradient11.x; G11y[Lane] = Gradient11.y;
+		}
+
+		__m128 U1 = _mm_sub_ps(U, One);
+		__m128 Ramp00 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(G00x), U), _mm_mul_ps(_mm_load_ps(G00y), VWide));
+		__m128 Ramp10 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(G10x), U1), _mm_mul_ps(_mm_load_ps(G10y), VWide));
+		__m128 Ramp01 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(G01x), U), _mm_mul_ps(_mm_load_ps(G01y), V1Wide));
+		__m128 Ramp11 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(G11x), U1), _mm_mul_ps(_mm_load_ps(G11y), V1Wide));
+
+		__m128 QuinticU = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(U, U), U),
+									 _mm_add_ps(_mm_mul_ps(U, _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(6.0f), U), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f)));
+		__m128 InvQuinticU = _mm_sub_ps(One, QuinticU);
+		__m128 X0 = _mm_add_ps(_mm_mul_ps(Ramp00, InvQuinticU), _mm_mul_ps(Ramp10, QuinticU));
+		__m128 X1 = _mm_add_ps(_mm_mul_ps(Ramp01, InvQuinticU), _mm_mul_ps(Ramp11, QuinticU));
+		__m128 Noise = _mm_add_ps(_mm_mul_ps(X0, _mm_sub_ps(One, QuinticVWide)), _mm_mul_ps(X1, QuinticVWide));
+		Noise = _mm_mul_ps(_mm_add_ps(Noise, _mm_set1_ps(0.7071f)), _mm_set1_ps(0.70711356243812756328666383821242f));
+
+		__m128 Value = _mm_mul_ps(AmplitudeWide, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.5f), Noise), _mm_set1_ps(0.5f)));
+		_mm_storeu_ps(Dest + I, _mm_add_ps(_mm_loadu_ps(Dest + I), Value));
+	}
+
+	NoiseRowScalar(Dest + I, Count - I, StartX + (int32_t)I, Frequency, OffsetX, Y, Amplitude);
+}
+
+TARGET_SSE42 static float
+ErodeBrushSSE42(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight,
+				uint32_t XIndex, uint32_t ZIndex, vec2 P, int32_t Radius, float TakeAmount)
+{
+	brush_rect Rect = ClampBrush(GridWidth, GridHeight, XIndex, ZIndex, Radius);
+	__m128 PX = _mm_set1_ps(P.x);
+	__m128 RadiusWide = _mm_set1_ps((float)Radius);
+	__m128 Zero = _mm_setzero_ps();
+	__m128i LaneOffsets = _mm_setr_epi32(0, 1, 2, 3);
+
+	__m128 WeightSumWide = Zero;
+	float WeightSum = 0.0f;
+	for(int32_t Z = Rect.ZMin; Z <= Rect.ZMax; Z++)
+	{
+		float DZ = (float)Z - P.y;
+		float DZSq = DZ*DZ;
+		__m128 DZSqWide = _mm_set1_ps(DZSq);
+		int32_t X = Rect.XMin;
+		for(; X + 3 <= Rect.XMax; X += 4)
+		{
+			__m128 DX = _mm_sub_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(X), LaneOffsets)), PX);
+			__m128 Distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(DX, DX), DZSqWide));
+			WeightSumWide = _mm_add_ps(WeightSumWide, _mm_max_ps(Zero, _mm_sub_ps(RadiusWide, Distance)));
+		}
+		for(; X <= Rect.XMax; X++)
+		{
+			WeightSum += BrushWeight(X, DZSq, P, Radius);
+		}
+	}
+	WeightSumWide = _mm_hadd_ps(WeightSumWide, WeightSumWide);
+	WeightSumWide = _mm_hadd_ps(WeightSumWide, WeightSumWide);
+	WeightSum += _mm_cvtss_f32(WeightSumWide);
+
+	__m128 WeightSumInput = _mm_set1_ps(WeightSum);
+	__m128 TakeAmountWide = _mm_set1_ps(TakeAmount);
+	__m128 TakenWide = Zero;
+	float Taken = 0.0f;
+	for(int32_t Z = Rect.ZMin; Z <= Rect.ZMax; Z++)
+	{
+		float DZ = (float)Z - P.y;
+		float DZSq = DZ*DZ;
+		__m128 DZSqWide = _mm_set1_ps(DZSq);
+		float *Row = HeightMap + Z*(GridWidth + 1);
+		int32_t X = Rect.XMin;
+		for(; X + 3 <= Rect.XMax; X += 4)
+		{
+			__m128 DX = _mm_sub_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(X), LaneOffsets)), PX);
+			__m128 Distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(DX, DX), DZSqWide));
+			__m128 Weight = _mm_div_ps(_mm_max_ps(Zero, _mm_sub_ps(RadiusWide, Distance)), WeightSumInput);
+			__m128 AmountToErode = _mm_mul_ps(Weight, TakeAmountWide);
+			__m128 Height = _mm_loadu_ps(Row + X);
+			__m128 DeltaSediment = _mm_min_ps(Height, AmountToErode);
+			_mm_storeu_ps(Row + X, _mm_sub_ps(Height, DeltaSediment));
+			TakenWide = _mm_add_ps(TakenWide, DeltaSediment);
+		}
+		for(; X <= Rect.XMax; X++)
+		{
+			float AmountToErode = (BrushWeight(X, DZSq, P, Radius) / WeightSum)*TakeAmount;
+			float DeltaSediment = Min(Row[X], AmountToErode);
+			Row[X] -= DeltaSediment;
+			Taken += DeltaSediment;
+		}
+	}
+	TakenWide = _mm_hadd_ps(TakenWide, TakenWide);
+	TakenWide = _mm_hadd_ps(TakenWide, TakenWide);
+	Taken += _mm_cvtss_f32(TakenWide);
+
+	return(Taken);
+}
+
+// NOTE(georgy): rsqrt is only good for ~12 bits, one Newton-Raphson step brings it close to full float precision
+TARGET_SSE42 inline __m128
+ReciprocalSquareRoot(__m128 Value)
+{
+	__m128 Estimate = _mm_rsqrt_ps(Value);
+	__m128 HalfValue = _mm_mul_ps(_mm_set1_ps(0.5f), Value);
+	__m128 Result = _mm_mul_ps(Estimate, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(HalfValue, _mm_mul_ps(Estimate, Estimate))));
+	return(Result);
+}
+
+TARGET_SSE42 static void
+NormalsRowSSE42(const float *HeightMap, uint32_t GridWidth, uint32_t Z, normal_format Format, void *Dest)
+{
+	const float *Row = HeightMap + Z*(GridWidth + 1);
+	const float *RowDown = Row - (GridWidth + 1);
+	const float *RowUp = Row + (GridWidth + 1);
+	__m128 NormalY = _mm_set1_ps(0.125f);
+	__m128 NormalYSq = _mm_mul_ps(NormalY, NormalY);
+	__m128 PackScale = _mm_set1_ps(511.0f);
+	__m128 MinusOne = _mm_set1_ps(-1.0f);
+	__m128 One = _mm_set1_ps(1.0f);
+	__m128i PackMask = _mm_set1_epi32(0x3FF);
+
+	uint32_t X = 1;
+	for(; X + 4 <= GridWidth; X += 4)
+	{
+		__m128 NormalX = _mm_sub_ps(_mm_loadu_ps(Row + X - 1), _mm_loadu_ps(Row + X + 1));
+		__m128 NormalZ = _mm_sub_ps(_mm_loadu_ps(RowUp + X), _mm_loadu_ps(RowDown + X));
+		__m128 LengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(NormalX, NormalX), NormalYSq), _mm_mul_ps(NormalZ, NormalZ));
+		__m128 InvLength = ReciprocalSquareRoot(LengthSq);
+		NormalX = _mm_mul_ps(NormalX, InvLength);
+		__m128 OutY = _mm_mul_ps(NormalY, InvLength);
+		NormalZ = _mm_mul_ps(NormalZ, InvLength);
+
+		if(Format == NormalFormat_Packed)
+		{
+			__m128i PackedX = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(NormalX, MinusOne), One), PackScale)), PackMask);
+			__m128i PackedY = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(OutY, One), PackScale)), PackMask);
+			__m128i PackedZ = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(NormalZ, MinusOne), One), PackScale)), PackMask);
+			__m128i Packed = _mm_or_si128(PackedX, _mm_or_si128(_mm_slli_epi32(PackedY, 10), _mm_slli_epi32(PackedZ, 20)));
+			_mm_storeu_si128((__m128i *)((uint32_t *)Dest + X), Packed);
+		}
+		else
+		{
+			alignas(16) float OutX[4], OutYs[4], OutZ[4];
+			_mm_store_ps(OutX, NormalX);
+			_mm_store_ps(OutYs, OutY);
+			_mm_store_ps(OutZ, NormalZ);
+			for(uint32_t Lane = 0; Lane < 4; Lane++)
+			{
+				((vec3 *)Dest)[X + Lane] = vec3(OutX[Lane], OutYs[Lane], OutZ[Lane]);
+			}
+		}
+	}
+	for(; X < GridWidth; X++)
+	{
+		StoreNormal(Format, Dest, X, Normalize(vec3(Row[X - 1] - Row[X + 1], 0.125f, RowUp[X] - RowDown[X])));
+	}
+}
+
+//
+// NOTE(georgy): AVX2
+//
+
+TARGET_AVX2 inline float
+HorizontalAdd(__m256 A)
+{
+	__m128 Sum = _mm_add_ps(_mm256_castps256_ps128(A), _mm256_extractf128_ps(A, 1));
+	Sum = _mm_hadd_ps(Sum, Sum);
+	Sum = _mm_hadd_ps(Sum, Sum);
+	float Result = _mm_cvtss_f32(Sum);
+	return(Result);
+}
+
+TARGET_AVX2 static void
+NoiseRowAVX2(float *Dest, uint32_t Count, int32_t StartX, float Frequency, float OffsetX, float Y, float Amplitude)
+{
+	int32_t J = FloorReal32ToInt32(Y);
+	float V = Y - J;
+	float QuinticFactorForV = V * V * V * (V * (6.0f * V - 15.0f) + 10.0f);
+
+	const int *Permutation = (const int *)PermutationTable;
+	const float *Gradients = (const float *)Gradients2D;
+	__m256i PermutationMask = _mm256_set1_epi32(ArrayCount(PermutationTable) - 1);
+	__m256i GradientMask = _mm256_set1_epi32(ArrayCount(Gradients2D) - 1);
+	__m256i JWide = _mm256_set1_epi32(J);
+	__m256i J1Wide = _mm256_set1_epi32(J + 1);
+	__m256i OneInt = _mm256_set1_epi32(1);
+	__m256i LaneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	__m256 FrequencyWide = _mm256_set1_ps(Frequency);
+	__m256 OffsetXWide = _mm256_set1_ps(OffsetX);
+	__m256 AmplitudeWide = _mm256_set1_ps(Amplitude);
+	__m256 VWide = _mm256_set1_ps(V);
+	__m256 V1Wide = _mm256_set1_ps(V - 1.0f);
+	__m256 QuinticVWide = _mm256_set1_ps(QuinticFactorForV);
+	__m256 One = _mm256_set1_ps(1.0f);
+
+	uint32_t I = 0;
+	for(; I + 8 <= Count; I += 8)
+	{
+		__m256 X = _mm256_add_ps(_mm256_mul_ps(FrequencyWide, _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(StartX + (int32_t)I), LaneOffsets))), OffsetXWide);
+		__m256 XFloor = _mm256_floor_ps(X);
+		__m256i XCell = _mm256_cvttps_epi32(XFloor);
+		__m256 U = _mm256_sub_ps(X, XFloor);
+
+		__m256i PermutationForI = _mm256_i32gather_epi32(Permutation, _mm256_and_si256(XCell, PermutationMask), 4);
+		__m256i PermutationForI1 = _mm256_i32gather_epi32(Permutation, _mm256_and_si256(_mm256_add_epi32(XCell, OneInt), PermutationMask), 4);
+		__m256i Hash00 = _mm256_i32gather_epi32(Permutation, _mm256_and_si256(_mm256_add_epi32(PermutationForI, JWide), PermutationMask), 4);
+		__m256i Hash10 = _mm256_i32gather_epi32(Permutation, _mm256_and_si256(_mm256_add_epi32(PermutationForI1, JWide), PermutationMask), 4);
+		__m256i Hash01 = _mm256_i32gather_epi32(Permutation, _mm256_and_si256(_mm256_add_epi32(PermutationForI, J1Wide), PermutationMask), 4);
+		__m256i Hash11 = _mm256_i32gather_epi32(Permutation, _mm256_and_si256(_mm256_add_epi32(PermutationForI1, J1Wide), PermutationMask), 4);
+
+		// NOTE(georgy): Gradients2D is an array of vec2, so the x of gradient N is float 2*N and y is 2*N + 1
+		Hash00 = _mm256_slli_epi32(_mm256_and_si256(Hash00, GradientMask), 1);
+		Hash10 = _mm256_slli_epi32(_mm256_and_si256(Hash10, GradientMask), 1);
+		Hash01 = _mm256_slli_epi32(_mm256_and_si256(Hash01, GradientMask), 1);
+		Hash11 = _mm256_slli_epi32(_mm256_and_si256(Hash11, GradientMask), 1);
+
+		__m256 U1 = _mm256_sub_ps(U, One);
+		__m256 Ramp00 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(Gradients, Hash00, 4), U),
+									  _mm256_mul_ps(_mm256_i32gather_ps(Gradients + 1, Hash00, 4), VWide));
+		__m256 Ramp10 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(Gradients, Hash10, 4), U1),
+									  _mm256_mul_ps(_mm256_i32gather_ps(Gradients + 1, Hash10, 4), VWide));
+		__m256 Ramp01 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(Gradients, Hash01, 4), U),
+									  _mm256_mul_ps(_mm256_i32gather_ps(Gradients + 1, Hash01, 4), V1Wide));
+		__m256 Ramp11 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(Gradients, Hash11, 4), U1),
+									  _mm256_mul_ps(_mm256_i32gather_ps(Gradients + 1, Hash11, 4), V1Wide));
+
+		__m256 QuinticU = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(U, U), U),
+										_mm256_add_ps(_mm256_mul_ps(U, _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(6.0f), U), _mm256_set1_ps(15.0f))), _mm256_set1_ps(10.0f)));
+		__m256 InvQuinticU = _mm256_sub_ps(One, QuinticU);
+		__m256 X0 = _mm256_add_ps(_mm256_mul_ps(Ramp00, InvQuinticU), _mm256_mul_ps(Ramp10, QuinticU));
+		__m256 X1 = _mm256_add_ps(_mm256_mul_ps(Ramp01, InvQuinticU), _mm256_mul_ps(Ramp11, QuinticU));
+		__m256 Noise = _mm256_add_ps(_mm256_mul_ps(X0, _mm256_sub_ps(One, QuinticVWide)), _mm256_mul_ps(X1, QuinticVWide));
+		Noise = _mm256_mul_ps(_mm256_add_ps(Noise, _mm256_set1_ps(0.7071f)), _mm256_set1_ps(0.70711356243812756328666383821242f));
+
+		__m256 Value = _mm256_mul_ps(AmplitudeWide, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), Noise), _mm256_set1_ps(0.5f)));
+		_mm256_storeu_ps(Dest + I, _mm256_add_ps(_mm256_loadu_ps(Dest + I), Value));
+	}
+
+	NoiseRowScalar(Dest + I, Count - I, StartX + (int32_t)I, Frequency, OffsetX, Y, Amplitude);
+}
+
+TARGET_AVX2 static float
+ErodeBrushAVX2(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight,
+			   uint32_t XIndex, uint32_t ZIndex, vec2 P, int32_t Radius, float TakeAmount)
+{
+	brush_rect Rect = ClampBrush(GridWidth, GridHeight, XIndex, ZIndex, Radius);
+	__m256 PX = _mm256_set1_ps(P.x);
+	__m256 RadiusWide = _mm256_set1_ps((float)Radius);
+	__m256 Zero = _mm256_setzero_ps();
+	__m256i LaneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i XEnd = _mm256_set1_epi32(Rect.XMax + 1);
+
+	__m256 WeightSumWide = Zero;
+	for(int32_t Z = Rect.ZMin; Z <= Rect.ZMax; Z++)
+	{
+		float DZ = (float)Z - P.y;
+		__m256 DZSq = _mm256_set1_ps(DZ*DZ);
+		for(int32_t X = Rect.XMin; X <= Rect.XMax; X += 8)
+		{
+			__m256i XLanes = _mm256_add_epi32(_mm256_set1_epi32(X), LaneOffsets);
+			__m256 Mask = _mm256_castsi256_ps(_mm256_cmpgt_epi32(XEnd, XLanes));
+			__m256 DX = _mm256_sub_ps(_mm256_cvtepi32_ps(XLanes), PX);
+			__m256 Distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(DX, DX), DZSq));
+			__m256 Weight = _mm256_and_ps(Mask, _mm256_max_ps(Zero, _mm256_sub_ps(RadiusWide, Distance)));
+			WeightSumWide = _mm256_add_ps(WeightSumWide, Weight);
+		}
+	}
+	__m256 WeightSum = _mm256_set1_ps(HorizontalAdd(WeightSumWide));
+
+	__m256 TakeAmountWide = _mm256_set1_ps(TakeAmount);
+	__m256 TakenWide = Zero;
+	for(int32_t Z = Rect.ZMin; Z <= Rect.ZMax; Z++)
+	{
+		float DZ = (float)Z - P.y;
+		__m256 DZSq = _mm256_set1_ps(DZ*DZ);
+		float *Row = HeightMap + Z*(GridWidth + 1);
+		for(int32_t X = Rect.XMin; X <= Rect.XMax; X += 8)
+		{
+			__m256i XLanes = _mm256_add_epi32(_mm256_set1_epi32(X), LaneOffsets);
+			__m256i MaskInt = _mm256_cmpgt_epi32(XEnd, XLanes);
+			__m256 Mask = _mm256_castsi256_ps(MaskInt);
+			__m256 DX = _mm256_sub_ps(_mm256_cvtepi32_ps(XLanes), PX);
+			__m256 Distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(DX, DX), DZSq));
+			__m256 Weight = _mm256_div_ps(_mm256_max_ps(Zero, _mm256_sub_ps(RadiusWide, Distance)), WeightSum);
+			__m256 AmountToErode = _mm256_mul_ps(Weight, TakeAmountWide);
+			__m256 Height = _mm256_maskload_ps(Row + X, MaskInt);
+			__m256 DeltaSediment = _mm256_and_ps(Mask, _mm256_min_ps(Height, AmountToErode));
+			_mm256_maskstore_ps(Row + X, MaskInt, _mm256_sub_ps(Height, DeltaSediment));
+			TakenWide = _mm256_add_ps(TakenWide, DeltaSediment);
+		}
+	}
+
+	float Taken = HorizontalAdd(TakenWide);
+	return(Taken);
+}
+
+TARGET_AVX2 inline __m256
+ReciprocalSquareRoot(__m256 Value)
+{
+	__m256 Estimate = _mm256_rsqrt_ps(Value);
+	__m256 HalfValue = _mm256_mul_ps(_mm256_set1_ps(0.5f), Value);
+	__m256 Result = _mm256_mul_ps(Estimate, _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(HalfValue, _mm256_mul_ps(Estimate, Estimate))));
+	return(Result);
+}
+
+TARGET_AVX2 static void
+NormalsRowAVX2(const float *HeightMap, uint32_t GridWidth, uint32_t Z, normal_format Format, void *Dest)
+{
+	const float *Row = HeightMap + Z*(GridWidth + 1);
+	const float *RowDown = Row - (GridWidth + 1);
+	const float *RowUp = Row + (GridWidth + 1);
+	__m256 NormalY = _mm256_set1_ps(0.125f);
+	__m256 NormalYSq = _mm256_mul_ps(NormalY, NormalY);
+	__m256 PackScale = _mm256_set1_ps(511.0f);
+	__m256 MinusOne = _mm256_set1_ps(-1.0f);
+	__m256 One = _mm256_set1_ps(1.0f);
+	__m256i PackMask = _mm256_set1_epi32(0x3FF);
+
+	uint32_t X = 1;
+	for(; X + 8 <= GridWidth; X += 8)
+	{
+		__m256 NormalX = _mm256_sub_ps(_mm256_loadu_ps(Row + X - 1), _mm256_loadu_ps(Row + X + 1));
+		__m256 NormalZ = _mm256_sub_ps(_mm256_loadu_ps(RowUp + X), _mm256_loadu_ps(RowDown + X));
+		__m256 LengthSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(NormalX, NormalX), NormalYSq), _mm256_mul_ps(NormalZ, NormalZ));
+		__m256 InvLength = ReciprocalSquareRoot(LengthSq);
+		NormalX = _mm256_mul_ps(NormalX, InvLength);
+		__m256 OutY = _mm256_mul_ps(NormalY, InvLength);
+		NormalZ = _mm256_mul_ps(NormalZ, InvLength);
+
+		if(Format == NormalFormat_Packed)
+		{
+			__m256i PackedX = _mm256_and_si256(_mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(NormalX, MinusOne), One), PackScale)), PackMask);
+			__m256i PackedY = _mm256_and_si256(_mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(OutY, One), PackScale)), PackMask);
+			__m256i PackedZ = _mm256_and_si256(_mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(NormalZ, MinusOne), One), PackScale)), PackMask);
+			__m256i Packed = _mm256_or_si256(PackedX, _mm256_or_si256(_mm256_slli_epi32(PackedY, 10), _mm256_slli_epi32(PackedZ, 20)));
+			_mm256_storeu_si256((__m256i *)((uint32_t *)Dest + X), Packed);
+		}
+		else
+		{
+			alignas(32) float OutX[8], OutYs[8], OutZ[8];
+			_mm256_store_ps(OutX, NormalX);
+			_mm256_store_ps(OutYs, OutY);
+			_mm256_store_ps(OutZ, NormalZ);
+			for(uint32_t Lane = 0; Lane < 8; Lane++)
+			{
+				((vec3 *)Dest)[X + Lane] = vec3(OutX[Lane], OutYs[Lane], OutZ[Lane]);
+			}
+		}
+	}
+	for(; X < GridWidth; X++)
+	{
+		StoreNormal(Format, Dest, X, Normalize(vec3(Row[X - 1] - Row[X + 1], 0.125f, RowUp[X] - RowDown[X])));
+	}
+}
+
+// NOTE(georgy): NaN positions end up at 0, max returns its second operand when either one is NaN
+TARGET_AVX2 static void
+SampleTerrainAVX2(const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const float *X, const float *Z,
+				  uint32_t Count, float *Heights, vec3 *Normals)
+{
+	const float *NextRow = HeightMap + (GridWidth + 1);
+	__m256 Zero = _mm256_setzero_ps();
+	__m256 MaxX = _mm256_set1_ps((float)GridWidth);
+	__m256 MaxZ = _mm256_set1_ps((float)GridHeight);
+	__m256i LastX = _mm256_set1_epi32((int32_t)GridWidth - 1);
+	__m256i LastZ = _mm256_set1_epi32((int32_t)GridHeight - 1);
+	__m256i Pitch = _mm256_set1_epi32((int32_t)GridWidth + 1);
+	__m256 NormalY = _mm256_set1_ps(0.125f);
+	__m256 NormalYSq = _mm256_mul_ps(NormalY, NormalY);
+	__m256 MinusTwo = _mm256_set1_ps(-2.0f);
+	__m256 Two = _mm256_set1_ps(2.0f);
+
+	uint32_t I = 0;
+	for(; I + 8 <= Count; I += 8)
+	{
+		__m256 PX = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(X + I), Zero), MaxX);
+		__m256 PZ = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(Z + I), Zero), MaxZ);
+		__m256i XIndex = _mm256_min_epi32(_mm256_cvttps_epi32(PX), LastX);
+		__m256i ZIndex = _mm256_min_epi32(_mm256_cvttps_epi32(PZ), LastZ);
+		__m256 U = _mm256_sub_ps(PX, _mm256_cvtepi32_ps(XIndex));
+		__m256 V = _mm256_sub_ps(PZ, _mm256_cvtepi32_ps(ZIndex));
+
+		__m256i Index = _mm256_add_epi32(XIndex, _mm256_mullo_epi32(ZIndex, Pitch));
+		__m256 Height00 = _mm256_i32gather_ps(HeightMap, Index, 4);
+		__m256 Height01 = _mm256_i32gather_ps(HeightMap + 1, Index, 4);
+		__m256 Height10 = _mm256_i32gather_ps(NextRow, Index, 4);
+		__m256 Height11 = _mm256_i32gather_ps(NextRow + 1, Index, 4);
+		__m256 Height0 = _mm256_add_ps(Height00, _mm256_mul_ps(_mm256_sub_ps(Height01, Height00), U));
+		__m256 Height1 = _mm256_add_ps(Height10, _mm256_mul_ps(_mm256_sub_ps(Height11, Height10), U));
+		__m256 SlopeZ = _mm256_sub_ps(Height1, Height0);
+		_mm256_storeu_ps(Heights + I, _mm256_add_ps(Height0, _mm256_mul_ps(SlopeZ, V)));
+
+		if(Normals)
+		{
+			__m256 Slope0 = _mm256_sub_ps(Height01, Height00);
+			__m256 Slope1 = _mm256_sub_ps(Height11, Height10);
+			__m256 NormalX = _mm256_mul_ps(MinusTwo, _mm256_add_ps(Slope0, _mm256_mul_ps(_mm256_sub_ps(Slope1, Slope0), V)));
+			__m256 NormalZ = _mm256_mul_ps(Two, SlopeZ);
+			__m256 LengthSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(NormalX, NormalX), NormalYSq), _mm256_mul_ps(NormalZ, NormalZ));
+			__m256 InvLength = ReciprocalSquareRoot(LengthSq);
+
+			alignas(32) float OutX[8], OutY[8], OutZ[8];
+			_mm256_store_ps(OutX, _mm256_mul_ps(NormalX, InvLength));
+			_mm256_store_ps(OutY, _mm256_mul_ps(NormalY, InvLength));
+			_mm256_store_ps(OutZ, _mm256_mul_ps(NormalZ, InvLength));
+			for(uint32_t Lane = 0; Lane < 8; Lane++)
+			{
+				Normals[I + Lane] = vec3(OutX[Lane], OutY[Lane], OutZ[Lane]);
+			}
+		}
+	}
+
+	SampleTerrainScalar(HeightMap, GridWidth, GridHeight, X + I, Z + I, Count - I, Heights + I, Normals ? (Normals + I) : 0);
+}
+
+//
+// NOTE(georgy): AVX-512
+//
+
+TARGET_AVX512 static void
+NoiseRowAVX512(float *Dest, uint32_t Count, int32_t StartX, float Frequency, float OffsetX, float Y, float Amplitude)
+{
+	int32_t J = FloorReal32ToInt32(Y);
+	float V = Y - J;
+	float QuinticFactorForV = V * V * V * (V * (6.0f * V - 15.0f) + 10.0f);
+
+	const int *Permutation = (const int *)PermutationTable;
+	const float *Gradients = (const float *)Gradients2D;
+	__m512i PermutationMask = _mm512_set1_epi32(ArrayCount(PermutationTable) - 1);
+	__m512i GradientMask = _mm512_set1_epi32(ArrayCount(Gradients2D) - 1);
+	__m512i JWide = _mm512_set1_epi32(J);
+	__m512i J1Wide = _mm512_set1_epi32(J + 1);
+	__m512i OneInt = _mm512_set1_epi32(1);
+	__m512i LaneOffsets = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+	__m512 FrequencyWide = _mm512_set1_ps(Frequency);
+	__m512 OffsetXWide = _mm512_set1_ps(OffsetX);
+	__m512 AmplitudeWide = _mm512_set1_ps(Amplitude);
+	__m512 VWide = _mm512_set1_ps(V);
+	__m512 V1Wide = _mm512_set1_ps(V - 1.0f);
+	__m512 QuinticVWide = _mm512_set1_ps(QuinticFactorForV);
+	__m512 One = _mm512_set1_ps(1.0f);
+
+	for(uint32_t I = 0; I < Count; I += 16)
+	{
+		uint32_t Remaining = Count - I;
+		__mmask16 Mask = (Remaining >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << Remaining) - 1);
+
+		__m512 X = _mm512_add_ps(_mm512_mul_ps(FrequencyWide, _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_set1_epi32(StartX + (int32_t)I), LaneOffsets))), OffsetXWide);
+		__m512 XFloor = _mm512_roundscale_ps(X, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+		__m512i XCell = _mm512_cvttps_epi32(XFloor);
+		__m512 U = _mm512_sub_ps(X, XFloor);
+
+		__m512i PermutationForI = _mm512_i32gather_epi32(_mm512_and_si512(XCell, PermutationMask), Permutation, 4);
+		__m512i PermutationForI1 = _mm512_i32gather_epi32(_mm512_and_si512(_mm512_add_epi32(XCell, OneInt), PermutationMask), Permutation, 4);
+		__m512i Hash00 = _mm512_i32gather_epi32(_mm512_and_si512(_mm512_add_epi32(PermutationForI, JWide), PermutationMask), Permutation, 4);
+		__m512i Hash10 = _mm512_i32gather_epi32(_mm512_and_si512(_mm512_add_epi32(PermutationForI1, JWide), PermutationMask), Permutation, 4);
+		__m512i Hash01 = _mm512_i32gather_epi32(_mm512_and_si512(_mm512_add_epi32(PermutationForI, J1Wide), PermutationMask), Permutation, 4);
+		__m512i Hash11 = _mm512_i32gather_epi32(_mm512_and_si512(_mm512_add_epi32(PermutationForI1, J1Wide), PermutationMask), Permutation, 4);
+
+		Hash00 = _mm512_slli_epi32(_mm512_and_si512(Hash00, GradientMask), 1);
+		Hash10 = _mm512_slli_epi32(_mm512_and_si512(Hash10, GradientMask), 1);
+		Hash01 = _mm512_slli_epi32(_mm512_and_si512(Hash01, GradientMask), 1);
+		Hash11 = _mm512_slli_epi32(_mm512_and_si512(Hash11, GradientMask), 1);
+
+		__m512 U1 = _mm512_sub_ps(U, One);
+		__m512 Ramp00 = _mm512_add_ps(_mm512_mul_ps(_mm512_i32gather_ps(Hash00, Gradients, 4), U),
+									  _mm512_mul_ps(_mm512_i32gather_ps(Hash00, Gradients + 1, 4), VWide));
+		__m512 Ramp10 = _mm512_add_ps(_mm512_mul_ps(_mm512_i32gather_ps(Hash10, Gradients, 4), U1),
+									  _mm512_mul_ps(_mm512_i32gather_ps(Hash10, Gradients + 1, 4), VWide));
+		__m512 Ramp01 = _mm512_add_ps(_mm512_mul_ps(_mm512_i32gather_ps(Hash01, Gradients, 4), U),
+									  _mm512_mul_ps(_mm512_i32gather_ps(Hash01, Gradients + 1, 4), V1Wide));
+		__m512 Ramp11 = _mm512_add_ps(_mm512_mul_ps(_mm512_i32gather_ps(Hash11, Gradients, 4), U1),
+									  _mm512_mul_ps(_mm512_i32gather_ps(Hash11, Gradients + 1, 4), V1Wide));
+
+		__m512 QuinticU = _mm512_mul_ps(_mm512_mul_ps(_mm512_mul_ps(U, U), U),
+										_mm512_add_ps(_mm512_mul_ps(U, _mm512_sub_ps(_mm512_mul_ps(_mm512_set1_ps(6.0f), U), _mm512_set1_ps(15.0f))), _mm512_set1_ps(10.0f)));
+		__m512 InvQuinticU = _mm512_sub_ps(One, QuinticU);
+		__m512 X0 = _mm512_add_ps(_mm512_mul_ps(Ramp00, InvQuinticU), _mm512_mul_ps(Ramp10, QuinticU));
+		__m512 X1 = _mm512_add_ps(_mm512_mul_ps(Ramp01, InvQuinticU), _mm512_mul_ps(Ramp11, QuinticU));
+		__m512 Noise = _mm512_add_ps(_mm512_mul_ps(X0, _mm512_sub_ps(One, QuinticVWide)), _mm512_mul_ps(X1, QuinticVWide));
+		Noise = _mm512_mul_ps(_mm512_add_ps(Noise, _mm512_set1_ps(0.7071f)), _mm512_set1_ps(0.70711356243812756328666383821242f));
+
+		__m512 Value = _mm512_mul_ps(AmplitudeWide, _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), Noise), _mm512_set1_ps(0.5f)));
+		_mm512_mask_storeu_ps(Dest + I, Mask, _mm512_add_ps(_mm512_maskz_loadu_ps(Mask, Dest + I), Value));
+	}
+}
+
+TARGET_AVX512 static float
+ErodeBrushAVX512(float *HeightMap, uint32_t GridWidth, uint32_t GridHeight,
+				 uint32_t XIndex, uint32_t ZIndex, vec2 P, int32_t Radius, float TakeAmount)
+{
+	brush_rect Rect = ClampBrush(GridWidth, GridHeight, XIndex, ZIndex, Radius);
+	__m512 PX = _mm512_set1_ps(P.x);
+	__m512 RadiusWide = _mm512_set1_ps((float)Radius);
+	__m512 Zero = _mm512_setzero_ps();
+	__m512i LaneOffsets = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m512i XLast = _mm512_set1_epi32(Rect.XMax);
+
+	__m512 WeightSumWide = Zero;
+	for(int32_t Z = Rect.ZMin; Z <= Rect.ZMax; Z++)
+	{
+		float DZ = (float)Z - P.y;
+		__m512 DZSq = _mm512_set1_ps(DZ*DZ);
+		for(int32_t X = Rect.XMin; X <= Rect.XMax; X += 16)
+		{
+			__m512i XLanes = _mm512_add_epi32(_mm512_set1_epi32(X), LaneOffsets);
+			__mmask16 Mask = _mm512_cmple_epi32_mask(XLanes, XLast);
+			__m512 DX = _mm512_sub_ps(_mm512_cvtepi32_ps(XLanes), PX);
+			__m512 Distance = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(DX, DX), DZSq));
+			__m512 Weight = _mm512_maskz_max_ps(Mask, Zero, _mm512_sub_ps(RadiusWide, Distance));
+			WeightSumWide = _mm512_add_ps(WeightSumWide, Weight);
+		}
+	}
+	__m512 WeightSum = _mm512_set1_ps(_mm512_reduce_add_ps(WeightSumWide));
+
+	__m512 TakeAmountWide = _mm512_set1_ps(TakeAmount);
+	__m512 TakenWide = Zero;
+	for(int32_t Z = Rect.ZMin; Z <= Rect.ZMax; Z++)
+	{
+		float DZ = (float)Z - P.y;
+		__m512 DZSq = _mm512_set1_ps(DZ*DZ);
+		float *Row = HeightMap + Z*(GridWidth + 1);
+		for(int32_t X = Rect.XMin; X <= Rect.XMax; X += 16)
+		{
+			__m512i XLanes = _mm512_add_epi32(_mm512_set1_epi32(X), LaneOffsets);
+			__mmask16 Mask = _mm512_cmple_epi32_mask(XLanes, XLast);
+			__m512 DX = _mm512_sub_ps(_mm512_cvtepi32_ps(XLanes), PX);
+			__m512 Distance = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(DX, DX), DZSq));
+			__m512 Weight = _mm512_div_ps(_mm512_max_ps(Zero, _mm512_sub_ps(RadiusWide, Distance)), WeightSum);
+			__m512 AmountToErode = _mm512_mul_ps(Weight, TakeAmountWide);
+			__m512 Height = _mm512_maskz_loadu_ps(Mask, Row + X);
+			__m512 DeltaSediment = _mm512_maskz_min_ps(Mask, Height, AmountToErode);
+			_mm512_mask_storeu_ps(Row + X, Mask, _mm512_sub_ps(Height, DeltaSediment));
+			TakenWide = _mm512_add_ps(TakenWide, DeltaSediment);
+		}
+	}
+
+	float Taken = _mm512_reduce_add_ps(TakenWide);
+	return(Taken);
+}
+
+TARGET_AVX512 static void
+NormalsRowAVX512(const float *HeightMap, uint32_t GridWidth, uint32_t Z, normal_format Format, void *Dest)
+{
+	const float *Row = HeightMap + Z*(GridWidth + 1);
+	const float *RowDown = Row - (GridWidth + 1);
+	const float *RowUp = Row + (GridWidth + 1);
+	__m512 NormalY = _mm512_set1_ps(0.125f);
+	__m512 NormalYSq = _mm512_mul_ps(NormalY, NormalY);
+	__m512 PackScale = _mm512_set1_ps(511.0f);
+	__m512 MinusOne = _mm512_set1_ps(-1.0f);
+	__m512 One = _mm512_set1_ps(1.0f);
+	__m512i PackMask = _mm512_set1_epi32(0x3FF);
+
+	for(uint32_t X = 1; X < GridWidth; X += 16)
+	{
+		uint32_t Remaining = GridWidth - X;
+		uint32_t LaneCount = (Remaining >= 16) ? 16 : Remaining;
+		__mmask16 Mask = (__mmask16)((LaneCount == 16) ? 0xFFFF : ((1u << LaneCount) - 1));
+
+		__m512 NormalX = _mm512_sub_ps(_mm512_maskz_loadu_ps(Mask, Row + X - 1), _mm512_maskz_loadu_ps(Mask, Row + X + 1));
+		__m512 NormalZ = _mm512_sub_ps(_mm512_maskz_loadu_ps(Mask, RowUp + X), _mm512_maskz_loadu_ps(Mask, RowDown + X));
+		__m512 LengthSq = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(NormalX, NormalX), NormalYSq), _mm512_mul_ps(NormalZ, NormalZ));
+
+		// NOTE(georgy): rsqrt14 plus one Newton-Raphson step
+		__m512 Estimate = _mm512_rsqrt14_ps(LengthSq);
+		__m512 HalfLengthSq = _mm512_mul_ps(_mm512_set1_ps(0.5f), LengthSq);
+		__m512 InvLength = _mm512_mul_ps(Estimate, _mm512_sub_ps(_mm512_set1_ps(1.5f), _mm512_mul_ps(HalfLengthSq, _mm512_mul_ps(Estimate, Estimate))));
+		NormalX = _mm512_mul_ps(NormalX, InvLength);
+		__m512 OutY = _mm512_mul_ps(NormalY, InvLength);
+		NormalZ = _mm512_mul_ps(NormalZ, InvLength);
+
+		if(Format == NormalFormat_Packed)
+		{
+			__m512i PackedX = _mm512_and_si512(_mm512_cvtps_epi32(_mm512_mul_ps(_mm512_min_ps(_mm512_max_ps(NormalX, MinusOne), One), PackScale)), PackMask);
+			__m512i PackedY = _mm512_and_si512(_mm512_cvtps_epi32(_mm512_mul_ps(_mm512_min_ps(OutY, One), PackScale)), PackMask);
+			__m512i PackedZ = _mm512_and_si512(_mm512_cvtps_epi32(_mm512_mul_ps(_mm512_min_ps(_mm512_max_ps(NormalZ, MinusOne), One), PackScale)), PackMask);
+			__m512i Packed = _mm512_or_si512(PackedX, _mm512_or_si512(_mm512_slli_epi32(PackedY, 10), _mm512_slli_epi32(PackedZ, 20)));
+			_mm512_mask_storeu_epi32((uint32_t *)Dest + X, Mask, Packed);
+		}
+		else
+		{
+			alignas(64) float OutX[16], OutYs[16], OutZ[16];
+			_mm512_store_ps(OutX, NormalX);
+			_mm512_store_ps(OutYs, OutY);
+			_mm512_store_ps(OutZ, NormalZ);
+			for(uint32_t Lane = 0; Lane < LaneCount; Lane++)
+			{
+				((vec3 *)Dest)[X + Lane] = vec3(OutX[Lane], OutYs[Lane], OutZ[Lane]);
+			}
+		}
+	}
+}
+
+// NOTE(georgy): Masked off lanes load 0 and gather the first sample, so the tail doesn't need a scalar loop
+TARGET_AVX512 static void
+SampleTerrainAVX512(const float *HeightMap, uint32_t GridWidth, uint32_t GridHeight, const float *X, const float *Z,
+					uint32_t Count, float *Heights, vec3 *Normals)
+{
+	const float *NextRow = HeightMap + (GridWidth + 1);
+	__m512 Zero = _mm512_setzero_ps();
+	__m512 MaxX = _mm512_set1_ps((float)GridWidth);
+	__m512 MaxZ = _mm512_set1_ps((float)GridHeight);
+	__m512i LastX = _mm512_set1_epi32((int32_t)GridWidth - 1);
+	__m512i LastZ = _mm512_set1_epi32((int32_t)GridHeight - 1);
+	__m512i Pitch = _mm512_set1_epi32((int32_t)GridWidth + 1);
+	__m512 NormalY = _mm512_set1_ps(0.125f);
+	__m512 NormalYSq = _mm512_mul_ps(NormalY, NormalY);
+	__m512 MinusTwo = _mm512_set1_ps(-2.0f);
+	__m512 Two = _mm512_set1_ps(2.0f);
+
+	for(uint32_t I = 0; I < Count; I += 16)
+	{
+		uint32_t Remaining = Count - I;
+		uint32_t LaneCount = (Remaining >= 16) ? 16 : Remaining;
+		__mmask16 Mask = (__mmask16)((LaneCount == 16) ? 0xFFFF : ((1u << LaneCount) - 1));
+
+		__m512 PX = _mm512_min_ps(_mm512_max_ps(_mm512_maskz_loadu_ps(Mask, X + I), Zero), MaxX);
+		__m512 PZ = _mm512_min_ps(_mm512_max_ps(_mm512_maskz_loadu_ps(Mask, Z + I), Zero), MaxZ);
+		__m512i XIndex = _mm512_min_epi32(_mm512_cvttps_epi32(PX), LastX);
+		__m512i ZIndex = _mm512_min_epi32(_mm512_cvttps_epi32(PZ), LastZ);
+		__m512 U = _mm512_sub_ps(PX, _mm512_cvtepi32_ps(XIndex));
+		__m512 V = _mm512_sub_ps(PZ, _mm512_cvtepi32_ps(ZIndex));
+
+		__m512i Index = _mm512_add_epi32(XIndex, _mm512_mullo_epi32(ZIndex, Pitch));
+		__m512 Height00 = _mm512_i32gather_ps(Index, HeightMap, 4);
+		__m512 Height01 = _mm512_i32gather_ps(Index, HeightMap + 1, 4);
+		__m512 Height10 = _mm512_i32gather_ps(Index, NextRow, 4);
+		__m512 Height11 = _mm512_i32gather_ps(Index, NextRow + 1, 4);
+		__m512 Height0 = _mm512_add_ps(Height00, _mm512_mul_ps(_mm512_sub_ps(Height01, Height00), U));
+		__m512 Height1 = _mm512_add_ps(Height10, _mm512_mul_ps(_mm512_sub_ps(Height11, Height10), U));
+		__m512 SlopeZ = _mm512_sub_ps(Height1, Height0);
+		_mm512_mask_storeu_ps(Heights + I, Mask, _mm512_add_ps(Height0, _mm512_mul_ps(SlopeZ, V)));
+
+		if(Normals)
+		{
+			__m512 Slope0 = _mm512_sub_ps(Height01, Height00);
+			__m512 Slope1 = _mm512_sub_ps(Height11, Height10);
+			__m512 NormalX = _mm512_mul_ps(MinusTwo, _mm512_add_ps(Slope0, _mm512_mul_ps(_mm512_sub_ps(Slope1, Slope0), V)));
+			__m512 NormalZ = _mm512_mul_ps(Two, SlopeZ);
+			__m512 LengthSq = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(NormalX, NormalX), NormalYSq), _mm512_mul_ps(NormalZ, NormalZ));
+
+			__m512 Estimate = _mm512_rsqrt14_ps(LengthSq);
+			__m512 HalfLengthSq = _mm512_mul_ps(_mm512_set1_ps(0.5f), LengthSq);
+			__m512 InvLength = _mm512_mul_ps(Estimate, _mm512_sub_ps(_mm512_set1_ps(1.5f), _mm512_mul_ps(HalfLengthSq, _mm512_mul_ps(Estimate, Estimate))));
+
+			alignas(64) float OutX[16], OutY[16], OutZ[16];
+			_mm512_store_ps(OutX, _mm512_mul_ps(NormalX, InvLength));
+			_mm512_store_ps(OutY, _mm512_mul_ps(NormalY, InvLength));
+			_mm512_store_ps(OutZ, _mm512_mul_ps(NormalZ, InvLength));
+			for(uint32_t Lane = 0; Lane < LaneCount; Lane++)
+			{
+				Normals[I + Lane] = vec3(OutX[Lane], OutY[Lane], OutZ[Lane]);
+			}
+		}
+	}
+}
+
+#endif
+
+static void
+SetTerrainKernels(cpu_isa_level Level)
+{
+	TerrainKernels.Level = ISALevel_Scalar;
+	TerrainKernels.NoiseRow = NoiseRowScalar;
+	TerrainKernels.ErodeBrush = ErodeBrushScalar;
+	TerrainKernels.NormalsRow = NormalsRowScalar;
+	TerrainKernels.SampleTerrain = SampleTerrainScalar;
+
+#if SIMD_X86
+	switch(Level)
+	{
+		case ISALevel_SSE42:
+		{
+			TerrainKernels.Level = ISALevel_SSE42;
+			TerrainKernels.NoiseRow = NoiseRowSSE42;
+			TerrainKernels.ErodeBrush = ErodeBrushSSE42;
+			TerrainKernels.NormalsRow = NormalsRowSSE42;
+			// NOTE(georgy): SSE4.2 has no gathers, 4 corners of 4 scattered cells are 16 scalar loads either way
+			TerrainKernels.SampleTerrain = SampleTerrainScalar;
+		} break;
+
+		case ISALevel_AVX2:
+		{
+			TerrainKernels.Level = ISALevel_AVX2;
+			TerrainKernels.NoiseRow = NoiseRowAVX2;
+			TerrainKernels.ErodeBrush = ErodeBrushAVX2;
+			TerrainKernels.NormalsRow = NormalsRowAVX2;
+			TerrainKernels.SampleTerrain = SampleTerrainAVX2;
+		} break;
+
+		case ISALevel_AVX512:
+		{
+			TerrainKernels.Level = ISALevel_AVX512;
+			TerrainKernels.NoiseRow = NoiseRowAVX512;
+			TerrainKernels.ErodeBrush = ErodeBrushAVX512;
+			TerrainKernels.NormalsRow = NormalsRowAVX512;
+			TerrainKernels.SampleTerrain = SampleTerrainAVX512;
+		} break;
+
+		default: break;
+	}
+#endif
+}
+
+static void
+InitTerrainKernels(void)
+{
+	SetTerrainKernels(ChooseCPUISALevel());
+	printf("Terrain kernels: %s\n", ISALevelNames[TerrainKernels.Level]);
+}
@@ -0,0 +1,283 @@
+#pragma once
+
+#include "job_system.cpp"
+
+// NOTE(georgy): Trace events in the Chrome trace-event JSON format (chrome://tracing, ui.perfetto.dev).
+//				 Every thread that records gets its own ring of complete events, so recording is a couple of stores
+//				 and the oldest events are overwritten once the ring is full. Jobs are recorded through the job timing hook,
+//				 everything else with TIMED_SCOPE, counter tracks with RecordTraceCounter. While tracing is off a scope costs one relaxed load.
+//				 EROSION_TRACE=File traces the whole run, the viewer also toggles it with T
+#define TRACE_RING_SIZE (1 << 16)
+
+struct trace_event
+{
+	const char *Name;
+	uint64_t BeginNanoseconds;
+	uint64_t EndNanoseconds;
+};
+
+struct trace_thread
+{
+	uint32_t ThreadIndex;
+	uint32_t JobWorkerIndex;
+	std::atomic<uint64_t> WriteIndex;
+	trace_event Events[TRACE_RING_SIZE];
+};
+
+// NOTE(georgy): A sample of a counter track, like memory use. These are rare, so they go into one list under the lock
+#define TRACE_MAX_COUNTER_VALUES 8
+
+struct trace_counter
+{
+	const char *Name;
+	const char * const *ValueNames;
+	uint32_t ValueCount;
+	uint64_t Nanoseconds;
+	double Values[TRACE_MAX_COUNTER_VALUES];
+};
+
+struct trace_state
+{
+	std::atomic<bool> Enabled;
+	uint64_t StartNanoseconds;
+
+	std::mutex Lock;
+	std::vector<trace_thread *> Threads;
+	std::vector<trace_counter> Counters;
+
+	job_system *Jobs;
+	job_timing_hook *ChainedHook;
+	void *ChainedHookUser;
+};
+
+static trace_state GlobalTrace;
+static thread_local trace_thread *ThreadTrace = 0;
+
+static trace_thread *
+GetThreadTrace(void)
+{
+	if(!ThreadTrace)
+	{
+		trace_thread *Thread = new trace_thread;
+		Thread->JobWorkerIndex = JobWorkerIndex;
+		Thread->WriteIndex = 0;
+
+		std::lock_guard<std::mutex> Guard(GlobalTrace.Lock);
+		Thread->ThreadIndex = (uint32_t)GlobalTrace.Threads.size();
+		GlobalTrace.Threads.push_back(Thread);
+		ThreadTrace = Thread;
+	}
+
+	return(ThreadTrace);
+}
+
+inline void
+RecordTraceEvent(const char *Name, uint64_t BeginNanoseconds, uint64_t EndNanoseconds)
+{
+	trace_thread *Thread = GetThreadTrace();
+	uint64_t WriteIndex = Thread->WriteIndex.load(std::memory_order_relaxed);
+	trace_event *Event = Thread->Events + (WriteIndex & (TRACE_RING_SIZE - 1));
+	Event->Name = Name;
+	Event->BeginNanoseconds = BeginNanoseconds;
+	Event->EndNanoseconds = EndNanoseconds;
+	Thread->WriteIndex.store(WriteIndex + 1, std::memory_order_release);
+}
+
+// NOTE(georgy): Name and ValueNames must stay valid until the trace is written
+static void
+RecordTraceCounter(const char *Name, const char * const *ValueNames, const double *Values, uint32_t ValueCount)
+{
+	if(GlobalTrace.Enabled.load(std::memory_order_relaxed))
+	{
+		trace_counter Counter;
+		Counter.Name = Name;
+		Counter.ValueNames = ValueNames;
+		Counter.ValueCount = (ValueCount < TRACE_MAX_COUNTER_VALUES) ? ValueCount : TRACE_MAX_COUNTER_VALUES;
+		Counter.Nanoseconds = GetNanoseconds();
+		memcpy(Counter.Values, Values, sizeof(double)*Counter.ValueCount);
+
+		std::lock_guard<std::mutex> Guard(GlobalTrace.Lock);
+		GlobalTrace.Counters.push_back(Counter);
+	}
+}
+
+struct trace_scope
+{
+	const char *Name;
+	uint64_t BeginNanoseconds;
+
+	trace_scope(const char *ScopeName)
+	{
+		Name = ScopeName;
+		BeginNanoseconds = GlobalTrace.Enabled.load(std::memory_order_relaxed) ? GetNanoseconds() : 0;
+	}
+
+	~trace_scope()
+	{
+		if(BeginNanoseconds)
+		{
+			RecordTraceEvent(Name, BeginNanoseconds, GetNanoseconds());
+		}
+	}
+};
+
+#define TRACE_JOIN2(A, B) A##B
+#define TRACE_JOIN(A, B) TRACE_JOIN2(A, B)
+#define TIMED_SCOPE(Name) trace_scope TRACE_JOIN(TraceScope_, __LINE__)(Name)
+#define TIMED_FUNCTION() TIMED_SCOPE(__FUNCTION__)
+
+static void
+TraceJobTiming(void *, const char *Name, uint32_t WorkerIndex, uint64_t BeginNanoseconds, uint64_t EndNanoseconds)
+{
+	if(GlobalTrace.Enabled.load(std::memory_order_relaxed))
+	{
+		RecordTraceEvent(Name, BeginNanoseconds, EndNanoseconds);
+	}
+	if(GlobalTrace.ChainedHook)
+	{
+		GlobalTrace.ChainedHook(GlobalTrace.ChainedHookUser, Name, WorkerIndex, BeginNanoseconds, EndNanoseconds);
+	}
+}
+
+// NOTE(georgy): Drops the events of a previous trace. Jobs can be 0 when there is no job system to hook into
+static void
+StartTrace(job_system *Jobs)
+{
+	if(GlobalTrace.Enabled)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> Guard(GlobalTrace.Lock);
+		for(uint32_t ThreadIndex = 0; ThreadIndex < GlobalTrace.Threads.size(); ThreadIndex++)
+		{
+			GlobalTrace.Threads[ThreadIndex]->WriteIndex = 0;
+		}
+		GlobalTrace.Counters.clear();
+	}
+
+	if(Jobs && (Jobs->TimingHook != TraceJobTiming))
+	{
+		GlobalTrace.Jobs = Jobs;
+		GlobalTrace.ChainedHook = Jobs->TimingHook;
+		GlobalTrace.ChainedHookUser = Jobs->TimingHookUser;
+		SetJobTimingHook(Jobs, TraceJobTiming, 0);
+	}
+
+	GlobalTrace.StartNanoseconds = GetNanoseconds();
+	GlobalTrace.Enabled = true;
+}
+
+static void
+StopTrace(void)
+{
+	GlobalTrace.Enabled = false;
+	if(GlobalTrace.Jobs)
+	{
+		SetJobTimingHook(GlobalTrace.Jobs, GlobalTrace.ChainedHook, GlobalTrace.ChainedHookUser);
+		GlobalTrace.Jobs = 0;
+		GlobalTrace.ChainedHook = 0;
+		GlobalTrace.ChainedHookUser = 0;
+	}
+}
+
+static void
+WriteTraceString(FILE *File, const char *String)
+{
+	fputc('"', File);
+	for(const char *At = String; *At; At++)
+	{
+		if((*At == '"') || (*At == '\\'))
+		{
+			fputc('\\', File);
+		}
+		fputc(*At, File);
+	}
+	fputc('"', File);
+}
+
+// NOTE(georgy): Call after StopTrace once no jobs are running, events that are still being recorded could be torn
+static bool
+WriteTrace(const char *Filename)
+{
+	FILE *File = fopen(Filename, "w");
+	if(!File)
+	{
+		printf("Failed to write trace %s\n", Filename);
+		return(false);
+	}
+
+	uint64_t EventCount = 0;
+	fprintf(File, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(File, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"erosion\"}}");
+
+	std::lock_guard<std::mutex> Guard(GlobalTrace.Lock);
+	for(uint32_t ThreadIndex = 0; ThreadIndex < GlobalTrace.Threads.size(); ThreadIndex++)
+	{
+		trace_thread *Thread = GlobalTrace.Threads[ThreadIndex];
+		uint64_t WriteIndex = Thread->WriteIndex.load(std::memory_order_acquire);
+		if(WriteIndex == 0)
+		{
+			continue;
+		}
+
+		char ThreadName[64];
+		if(Thread->JobWorkerIndex == 0)
+		{
+			snprintf(ThreadName, sizeof(ThreadName), "Main %u", Thread->ThreadIndex);
+		}
+		else
+		{
+			snprintf(ThreadName, sizeof(ThreadName), "Worker %u", Thread->JobWorkerIndex);
+		}
+		fprintf(File, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				Thread->ThreadIndex, ThreadName);
+
+		uint64_t FirstIndex = (WriteIndex > TRACE_RING_SIZE) ? (WriteIndex - TRACE_RING_SIZE) : 0;
+		for(uint64_t EventIndex = FirstIndex; EventIndex < WriteIndex; EventIndex++)
+		{
+			const trace_event *Event = Thread->Events + (EventIndex & (TRACE_RING_SIZE - 1));
+			if(Event->BeginNanoseconds < GlobalTrace.StartNanoseconds)
+			{
+				continue;
+			}
+
+			fprintf(File, ",\n{\"name\":");
+			WriteTraceString(File, Event->Name);
+			fprintf(File, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", Thread->ThreadIndex,
+					(Event->BeginNanoseconds - GlobalTrace.StartNanoseconds) / 1000.0,
+					(Event->EndNanoseconds - Event->BeginNanoseconds) / 1000.0);
+			EventCount++;
+		}
+	}
+
+	for(uint32_t CounterIndex = 0; CounterIndex < GlobalTrace.Counters.size(); CounterIndex++)
+	{
+		const trace_counter *Counter = &GlobalTrace.Counters[CounterIndex];
+		if(Counter->Nanoseconds < GlobalTrace.StartNanoseconds)
+		{
+			continue;
+		}
+
+		fprintf(File, ",\n{\"name\":");
+		WriteTraceString(File, Counter->Name);
+		fprintf(File, ",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{", (Counter->Nanoseconds - GlobalTrace.StartNanoseconds) / 1000.0);
+		for(uint32_t ValueIndex = 0; ValueIndex < Counter->ValueCount; ValueIndex++)
+		{
+			if(ValueIndex > 0)
+			{
+				fputc(',', File);
+			}
+			WriteTraceString(File, Counter->ValueNames[ValueIndex]);
+			fprintf(File, ":%.17g", Counter->Values[ValueIndex]);
+		}
+		fprintf(File, "}}");
+		EventCount++;
+	}
+	fprintf(File, "\n]}\n");
+
+	bool Result = (fclose(File) == 0);
+	printf("Wrote %llu trace events to %s\n", (unsigned long long)EventCount, Filename);
+	return(Result);
+}
@@ -0,0 +1,643 @@
+#pragma once
+
+#include "erosion_checkpoint.cpp"
+#include "normals.cpp"
+#include "terrain.cpp"
+
+// NOTE(georgy): Golden-output verification of the kernel variants. A golden is the output of the scalar reference (scalar kernels,
+//				 float heights, CalculateNormal for every vertex) for one of the fixed cases below. Its hash and metrics are
+//				 committed in VerifyGoldens, so a change to the reference itself fails instead of becoming the new truth.
+//				 Every variant runs on the same input and is compared with the reference output: bit-exact through the hash, and
+//				 otherwise by max and RMS error and, for erosion, by how much more or less volume it eroded. A variant with all
+//				 tolerances zero has to be bit-exact. "record" prints the VerifyGoldens entries of the reference as it is now
+#define VERIFY_GOLDEN_VERSION 1
+#define VERIFY_MAX_HEIGHT 10.0f
+#define VERIFY_MAX_VARIANTS 16
+
+enum verify_stage
+{
+	VerifyStage_Noise,
+	VerifyStage_Erosion,
+	VerifyStage_Normals,
+
+	VerifyStage_Count,
+};
+
+struct verify_case
+{
+	const char *Name;
+	verify_stage Stage;
+	uint32_t GridSize;
+	// NOTE(georgy): World sample of the first noise sample
+	int32_t OriginX;
+	int32_t OriginZ;
+	uint32_t Seed;
+	uint32_t DropletCount;
+};
+
+// NOTE(georgy): Odd sizes leave a remainder after every SIMD width, negative origins put noise at negative coordinates
+static const verify_case VerifyCases[] =
+{
+	{ "noise129", VerifyStage_Noise, 129, -4099, 517, 0, 0 },
+	{ "noise512", VerifyStage_Noise, 512, 0, 0, 0, 0 },
+	{ "erosion128", VerifyStage_Erosion, 128, 0, 0, 1337, 20000 },
+	{ "erosion257", VerifyStage_Erosion, 257, 3000, -2000, 7, 40000 },
+	{ "normals129", VerifyStage_Normals, 129, -4099, 517, 0, 0 },
+	{ "normals512", VerifyStage_Normals, 512, 0, 0, 0, 0 },
+};
+
+enum verify_variant_kind
+{
+	VerifyVariant_Kernels,
+	VerifyVariant_Quantized,
+	VerifyVariant_DirtyTracked,
+	VerifyVariant_Checkpointed,
+	VerifyVariant_Resumed,
+	VerifyVariant_NormalsRect,
+	VerifyVariant_NormalsPacked,
+};
+
+struct verify_variant
+{
+	const char *Name;
+	verify_variant_kind Kind;
+	cpu_isa_level Level;
+
+	// NOTE(georgy): All zero means the variant has to be bit-exact
+	float MaxError;
+	float RMSError;
+	float MassError;
+};
+
+struct verify_golden
+{
+	const char *Name;
+	// NOTE(georgy): Hash of the case and the parameters, a golden of other settings has to be recorded again
+	uint64_t CaseKey;
+	// NOTE(georgy): HashBytes of the reference output, and its mean and RMS for when it isn't bit-exact
+	uint64_t Hash;
+	double Mean;
+	double RMS;
+};
+
+// NOTE(georgy): Recorded with "--verify all Directory record" from the scalar reference of a release build
+static const verify_golden VerifyGoldens[] =
+{
+	{ "noise129", 0x22C41044DF7D4E09ull, 0xDA2E0622E3080B34ull, 17.828006405689308, 17.839276877475513 },
+	{ "noise512", 0x117F94B872822867ull, 0x1B1E2026742E4D0Dull, 17.613260250429946, 17.648405738642541 },
+	{ "erosion128", 0x49B68E61D6F351EDull, 0xACC32DF1A2AF9FD5ull, 15.428823009390333, 15.45427456601014 },
+	{ "erosion257", 0x4F44DFA6B78BFA27ull, 0xBAF96C37FD166891ull, 17.156774394322056, 17.213688076855973 },
+	{ "normals129", 0x5437F31567180D37ull, 0xA4548A60031A4841ull, 0.28669293751157965, 0.57735026721862026 },
+	{ "normals512", 0xB451326EB1E097F9ull, 0x1C2E02A8DFEBEA9Dull, 0.27375466827467926, 0.57735026959476132 },
+};
+
+struct verify_buffers
+{
+	uint32_t SampleCount;
+	uint32_t FloatCount;
+
+	float *Input;
+	float *Golden;
+	float *Output;
+	uint16_t *Samples;
+	uint32_t *PackedNormals;
+	uint8_t *DirtyTiles;
+};
+
+struct height_error
+{
+	float MaxError;
+	float RMSError;
+	float MeanError;
+};
+
+struct verify_result
+{
+	bool Exact;
+	bool Passed;
+	height_error Error;
+	float MassError;
+};
+
+static height_error
+CompareHeightMaps(const float *HeightMap, const float *Reference, uint32_t SampleCount)
+{
+	height_error Result = {};
+	double ErrorSum = 0.0;
+	double ErrorSqSum = 0.0;
+	for(uint32_t SampleIndex = 0; SampleIndex < SampleCount; SampleIndex++)
+	{
+		float Error = HeightMap[SampleIndex] - Reference[SampleIndex];
+		Result.MaxError = Max(Result.MaxError, Absolute(Error));
+		ErrorSum += Error;
+		ErrorSqSum += (double)Error*Error;
+	}
+	Result.MeanError = (float)(ErrorSum / SampleCount);
+	Result.RMSError = (float)sqrt(ErrorSqSum / SampleCount);
+
+	return(Result);
+}
+
+static double
+HeightMapVolume(const float *HeightMap, uint32_t SampleCount)
+{
+	double Result = 0.0;
+	for(uint32_t SampleIndex = 0; SampleIndex < SampleCount; SampleIndex++)
+	{
+		Result += HeightMap[SampleIndex];
+	}
+
+	return(Result);
+}
+
+static void
+GetVerifyCaseParams(const verify_case *Case, noise_params *Noise, erosion_params *Erosion)
+{
+	*Noise = DefaultNoiseParams(VERIFY_MAX_HEIGHT);
+	*Erosion = DefaultErosionParams();
+	Erosion->Seed = Case->Seed;
+	Erosion->DropletCount = Case->DropletCount;
+}
+
+static uint64_t
+VerifyCaseKey(const verify_case *Case)
+{
+	noise_params Noise;
+	erosion_params Erosion;
+	GetVerifyCaseParams(Case, &Noise, &Erosion);
+
+	uint32_t Header[] = { VERIFY_GOLDEN_VERSION, (uint32_t)Case->Stage, Case->GridSize, (uint32_t)Case->OriginX, (uint32_t)Case->OriginZ };
+	uint64_t Result = HashBytes(Header, sizeof(Header));
+	Result = HashBytes(&Noise, sizeof(Noise), Result);
+	if(Case->Stage == VerifyStage_Erosion)
+	{
+		Result = HashBytes(&Erosion, sizeof(Erosion), Result);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Only the stages that tolerate differences have entries, SIMD erosion takes the same droplets but their
+//				 paths drift apart as soon as a brush weight rounds differently
+static void
+GetVerifyKernelTolerance(verify_stage Stage, verify_variant *Variant)
+{
+	switch(Stage)
+	{
+		case VerifyStage_Noise: { Variant->MaxError = 4e-5f; Variant->RMSError = 4e-6f; } break;
+		case VerifyStage_Erosion: { Variant->MaxError = 0.1f; Variant->RMSError = 0.005f; Variant->MassError = 0.01f; } break;
+		case VerifyStage_Normals: { Variant->MaxError = 1e-5f; Variant->RMSError = 1e-6f; } break;
+		default: break;
+	}
+}
+
+// NOTE(georgy): How far the mean and RMS of a reference output that isn't bit-exact with its golden may be, relative to the
+//				 golden's. Another compiler can round the reference differently, and erosion paths drift apart from there
+static double
+GetVerifyGoldenTolerance(verify_stage Stage)
+{
+	double Result = (Stage == VerifyStage_Erosion) ? 1e-3 : 1e-5;
+
+	return(Result);
+}
+
+// NOTE(georgy): The kernels of every level up to Highest, plus the storages and passes built on top of the reference kernels.
+//				 Those run with scalar kernels, so the ones that claim to give the same result have to be bit-exact
+static uint32_t
+BuildVerifyVariants(verify_stage Stage, cpu_isa_level Highest, verify_variant *Variants)
+{
+	uint32_t Count = 0;
+	for(uint32_t Level = ISALevel_Scalar; Level <= (uint32_t)Highest; Level++)
+	{
+		verify_variant *Variant = Variants + Count++;
+		*Variant = {};
+		Variant->Name = ISALevelNames[Level];
+		Variant->Kind = VerifyVariant_Kernels;
+		Variant->Level = (cpu_isa_level)Level;
+		if(Level != ISALevel_Scalar)
+		{
+			GetVerifyKernelTolerance(Stage, Variant);
+		}
+	}
+
+	if(Stage == VerifyStage_Erosion)
+	{
+		Variants[Count++] = { "u16", VerifyVariant_Quantized, ISALevel_Scalar, 0.1f, 0.02f, 0.01f };
+		Variants[Count++] = { "dirty-tracked", VerifyVariant_DirtyTracked, ISALevel_Scalar, 0.0f, 0.0f, 0.0f };
+		Variants[Count++] = { "checkpointed", VerifyVariant_Checkpointed, ISALevel_Scalar, 0.0f, 0.0f, 0.0f };
+		Variants[Count++] = { "resumed", VerifyVariant_Resumed, ISALevel_Scalar, 0.0f, 0.0f, 0.0f };
+	}
+	else if(Stage == VerifyStage_Normals)
+	{
+		Variants[Count++] = { "rect", VerifyVariant_NormalsRect, ISALevel_Scalar, 0.0f, 0.0f, 0.0f };
+		// NOTE(georgy): 10 bits per component round to within half a step, 1/1022
+		Variants[Count++] = { "packed", VerifyVariant_NormalsPacked, Highest, 1.0f / 511.0f, 1.0f / 1022.0f, 0.0f };
+	}
+	Assert(Count <= VERIFY_MAX_VARIANTS);
+
+	return(Count);
+}
+
+static const verify_golden *
+FindVerifyGolden(const verify_case *Case)
+{
+	const verify_golden *Result = 0;
+	for(uint32_t GoldenIndex = 0; GoldenIndex < ArrayCount(VerifyGoldens); GoldenIndex++)
+	{
+		if(strcmp(VerifyGoldens[GoldenIndex].Name, Case->Name) == 0)
+		{
+			Result = VerifyGoldens + GoldenIndex;
+			break;
+		}
+	}
+
+	return(Result);
+}
+
+static void
+GetVerifyMetrics(const float *Values, uint32_t Count, double *Mean, double *RMS)
+{
+	double Sum = 0.0;
+	double SqSum = 0.0;
+	for(uint32_t Index = 0; Index < Count; Index++)
+	{
+		Sum += Values[Index];
+		SqSum += (double)Values[Index]*Values[Index];
+	}
+	*Mean = Sum / Count;
+	*RMS = sqrt(SqSum / Count);
+}
+
+// NOTE(georgy): Checks the reference output in Buffers->Golden against the committed golden of the case
+static bool
+CheckVerifyGolden(const verify_case *Case, const verify_buffers *Buffers)
+{
+	const verify_golden *Golden = FindVerifyGolden(Case);
+	if(!Golden)
+	{
+		printf("%s: no committed golden, record one with \"--verify %s Directory record\" and add it to VerifyGoldens\n", Case->Name, Case->Name);
+		return(false);
+	}
+	if(Golden->CaseKey != VerifyCaseKey(Case))
+	{
+		printf("%s: the committed golden was recorded for other settings, record it again\n", Case->Name);
+		return(false);
+	}
+
+	bool Result = true;
+	uint64_t Hash = HashBytes(Buffers->Golden, sizeof(float)*(uint64_t)Buffers->FloatCount);
+	if(Hash != Golden->Hash)
+	{
+		double Mean, RMS;
+		GetVerifyMetrics(Buffers->Golden, Buffers->FloatCount, &Mean, &RMS);
+		double Tolerance = GetVerifyGoldenTolerance(Case->Stage);
+		Result = (Absolute((float)(Mean - Golden->Mean)) <= Tolerance*Absolute((float)Golden->Mean)) &&
+				 (Absolute((float)(RMS - Golden->RMS)) <= Tolerance*Golden->RMS);
+		printf("%s: the scalar reference isn't bit-exact with its golden, mean %.9g (golden %.9g) rms %.9g (golden %.9g)%s\n",
+			   Case->Name, Mean, Golden->Mean, RMS, Golden->RMS, Result ? ", within tolerance" : "");
+	}
+
+	return(Result);
+}
+
+static verify_golden
+RecordVerifyGolden(const verify_case *Case, const verify_buffers *Buffers)
+{
+	verify_golden Result = {};
+	Result.Name = Case->Name;
+	Result.CaseKey = VerifyCaseKey(Case);
+	Result.Hash = HashBytes(Buffers->Golden, sizeof(float)*(uint64_t)Buffers->FloatCount);
+	GetVerifyMetrics(Buffers->Golden, Buffers->FloatCount, &Result.Mean, &Result.RMS);
+
+	return(Result);
+}
+
+static void
+RemoveVerifyCheckpoints(const char *Directory, uint32_t JournalCount)
+{
+	char Filename[1024];
+	GetCheckpointFilename(Filename, sizeof(Filename), Directory, 0, true);
+	remove(Filename);
+	for(uint32_t Sequence = 1; Sequence <= JournalCount; Sequence++)
+	{
+		GetCheckpointFilename(Filename, sizeof(Filename), Directory, Sequence, false);
+		remove(Filename);
+	}
+}
+
+// NOTE(georgy): The input of erosion and normals is the reference noise, the golden is the output of the reference
+static void
+RunVerifyReference(job_system *Jobs, const verify_case *Case, verify_buffers *Buffers)
+{
+	noise_params Noise;
+	erosion_params Erosion;
+	GetVerifyCaseParams(Case, &Noise, &Erosion);
+	uint32_t GridSize = Case->GridSize;
+
+	SetTerrainKernels(ISALevel_Scalar);
+	FillHeightMapNoise(Jobs, Buffers->Input, GridSize, GridSize, Case->OriginX, Case->OriginZ, &Noise);
+	switch(Case->Stage)
+	{
+		case VerifyStage_Noise:
+		{
+			memcpy(Buffers->Golden, Buffers->Input, sizeof(float)*Buffers->SampleCount);
+		} break;
+
+		case VerifyStage_Erosion:
+		{
+			memcpy(Buffers->Golden, Buffers->Input, sizeof(float)*Buffers->SampleCount);
+			WaterErosion(Buffers->Golden, GridSize, GridSize, &Erosion);
+		} break;
+
+		case VerifyStage_Normals:
+		{
+			vec3 *Normals = (vec3 *)Buffers->Golden;
+			for(uint32_t Z = 0; Z <= GridSize; Z++)
+			{
+				for(uint32_t X = 0; X <= GridSize; X++)
+				{
+					Normals[X + Z*(GridSize + 1)] = CalculateNormal(Buffers->Input, GridSize, GridSize, X, Z);
+				}
+			}
+		} break;
+
+		default: break;
+	}
+}
+
+// NOTE(georgy): Writes the variant's output to Buffers->Output. Fails only if the variant itself couldn't run
+static bool
+RunVerifyVariant(job_system *Jobs, const verify_case *Case, const verify_variant *Variant, verify_buffers *Buffers,
+				 const char *CheckpointDirectory)
+{
+	noise_params Noise;
+	erosion_params Erosion;
+	GetVerifyCaseParams(Case, &Noise, &Erosion);
+	uint32_t GridSize = Case->GridSize;
+	uint64_t HeightMapSize = sizeof(float)*Buffers->SampleCount;
+
+	bool Result = true;
+	SetTerrainKernels(Variant->Level);
+	switch(Variant->Kind)
+	{
+		case VerifyVariant_Kernels:
+		{
+			if(Case->Stage == VerifyStage_Noise)
+			{
+				FillHeightMapNoise(Jobs, Buffers->Output, GridSize, GridSize, Case->OriginX, Case->OriginZ, &Noise);
+			}
+			else if(Case->Stage == VerifyStage_Erosion)
+			{
+				memcpy(Buffers->Output, Buffers->Input, HeightMapSize);
+				WaterErosion(Buffers->Output, GridSize, GridSize, &Erosion);
+			}
+			else
+			{
+				CalculateNormals(Jobs, Buffers->Input, GridSize, GridSize, NormalFormat_Float3, Buffers->Output);
+			}
+		} break;
+
+		case VerifyVariant_Quantized:
+		{
+			quantized_heights Heights;
+			QuantizeHeightMap(&Heights, Buffers->Samples, Buffers->Input, GridSize, GridSize, Erosion.Seed);
+			random_series Series = RandomSeed(Erosion.Seed);
+			WaterErosion(&Heights, GridSize, GridSize, &Erosion, &Series);
+			DequantizeHeightMap(Buffers->Output, &Heights, GridSize, GridSize);
+		} break;
+
+		case VerifyVariant_DirtyTracked:
+		{
+			uint32_t TilesX = TerrainTileCount(GridSize + 1, DIRTY_TILE_SIZE);
+			memset(Buffers->DirtyTiles, 0, TilesX*TerrainTileCount(GridSize + 1, DIRTY_TILE_SIZE));
+			memcpy(Buffers->Output, Buffers->Input, HeightMapSize);
+
+			dirty_tracked_heights Heights = { Buffers->Output, GridSize, TilesX, Buffers->DirtyTiles };
+			random_series Series = RandomSeed(Erosion.Seed);
+			WaterErosion(&Heights, GridSize, GridSize, &Erosion, &Series);
+		} break;
+
+		case VerifyVariant_Checkpointed:
+		{
+			// NOTE(georgy): Without a base the run starts over, and a checkpoint after every batch of droplets
+			//				 exercises both journals and folding them into a new base
+			RemoveVerifyCheckpoints(CheckpointDirectory, 0);
+			memcpy(Buffers->Output, Buffers->Input, HeightMapSize);
+
+			erosion_checkpoint_stats Stats;
+			Result = WaterErosionCheckpointed(Buffers->Output, GridSize, GridSize, &Erosion, CheckpointDirectory, 0.0f, &Stats);
+			RemoveVerifyCheckpoints(CheckpointDirectory, Stats.CheckpointCount);
+		} break;
+
+		case VerifyVariant_Resumed:
+		{
+			// NOTE(georgy): The first run is interrupted halfway and its heightmap thrown away, so the second one has to
+			//				 continue from the checkpoints and still end with the heightmap of the uninterrupted reference
+			RemoveVerifyCheckpoints(CheckpointDirectory, 0);
+			memcpy(Buffers->Output, Buffers->Input, HeightMapSize);
+
+			erosion_checkpoint_stats Interrupted;
+			Result = WaterErosionCheckpointed(Buffers->Output, GridSize, GridSize, &Erosion, CheckpointDirectory, 0.0f, &Interrupted,
+											  Erosion.DropletCount / 2);
+			memcpy(Buffers->Output, Buffers->Input, HeightMapSize);
+
+			erosion_checkpoint_stats Resumed;
+			Result = Result && WaterErosionCheckpointed(Buffers->Output, GridSize, GridSize, &Erosion, CheckpointDirectory, 0.0f, &Resumed) &&
+					 (Resumed.ResumedCursor > 0) && (Resumed.ResumedCursor < Erosion.DropletCount);
+			RemoveVerifyCheckpoints(CheckpointDirectory, Interrupted.CheckpointCount + Resumed.CheckpointCount);
+		} break;
+
+		case VerifyVariant_NormalsRect:
+		{
+			brush_rect Rect = { 0, (int32_t)GridSize, 0, (int32_t)GridSize };
+			CalculateNormalsRect(Jobs, Buffers->Input, GridSize, GridSize, Rect, NormalFormat_Float3, Buffers->Output);
+		} break;
+
+		case VerifyVariant_NormalsPacked:
+		{
+			CalculateNormals(Jobs, Buffers->Input, GridSize, GridSize, NormalFormat_Packed, Buffers->PackedNormals);
+			vec3 *Normals = (vec3 *)Buffers->Output;
+			for(uint32_t SampleIndex = 0; SampleIndex < Buffers->SampleCount; SampleIndex++)
+			{
+				Normals[SampleIndex] = UnpackNormal(Buffers->PackedNormals[SampleIndex]);
+			}
+		} break;
+
+		default: break;
+	}
+
+	return(Result);
+}
+
+static verify_result
+CompareWithGolden(const verify_case *Case, const verify_variant *Variant, const verify_buffers *Buffers)
+{
+	verify_result Result = {};
+	uint64_t DataSize = sizeof(float)*(uint64_t)Buffers->FloatCount;
+	Result.Exact = (HashBytes(Buffers->Output, DataSize) == HashBytes(Buffers->Golden, DataSize));
+	Result.Error = CompareHeightMaps(Buffers->Output, Buffers->Golden, Buffers->FloatCount);
+
+	// NOTE(georgy): Erosion only moves material around, except for the sediment droplets carry off the grid or still hold
+	//				 when they die. So the volume it removed has to match the reference's
+	bool MassPassed = true;
+	if(Case->Stage == VerifyStage_Erosion)
+	{
+		double InputVolume = HeightMapVolume(Buffers->Input, Buffers->SampleCount);
+		double GoldenEroded = InputVolume - HeightMapVolume(Buffers->Golden, Buffers->SampleCount);
+		double OutputEroded = InputVolume - HeightMapVolume(Buffers->Output, Buffers->SampleCount);
+		Result.MassError = (GoldenEroded != 0.0) ? (float)((OutputEroded - GoldenEroded) / GoldenEroded) : 0.0f;
+		MassPassed = (Absolute(Result.MassError) <= Variant->MassError);
+	}
+
+	bool HasTolerance = (Variant->MaxError > 0.0f) || (Variant->RMSError > 0.0f) || (Variant->MassError > 0.0f);
+	Result.Passed = Result.Exact ||
+					(HasTolerance && (Result.Error.MaxError <= Variant->MaxError) && (Result.Error.RMSError <= Variant->RMSError) && MassPassed);
+
+	return(Result);
+}
+
+static void
+FreeVerifyBuffers(verify_buffers *Buffers)
+{
+	FreeMemory(Buffers->Input);
+	FreeMemory(Buffers->Golden);
+	FreeMemory(Buffers->Output);
+	FreeMemory(Buffers->Samples);
+	FreeMemory(Buffers->PackedNormals);
+	FreeMemory(Buffers->DirtyTiles);
+}
+
+static bool
+AllocateVerifyBuffers(verify_buffers *Buffers, const verify_case *Case)
+{
+	memset(Buffers, 0, sizeof(*Buffers));
+	uint32_t GridSize = Case->GridSize;
+	uint32_t TileCount = TerrainTileCount(GridSize + 1, DIRTY_TILE_SIZE)*TerrainTileCount(GridSize + 1, DIRTY_TILE_SIZE);
+
+	Buffers->SampleCount = (GridSize + 1)*(GridSize + 1);
+	Buffers->FloatCount = (Case->Stage == VerifyStage_Normals) ? 3*Buffers->SampleCount : Buffers->SampleCount;
+	Buffers->Input = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*Buffers->SampleCount);
+	Buffers->Golden = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*Buffers->FloatCount);
+	Buffers->Output = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*Buffers->FloatCount);
+	Buffers->Samples = (uint16_t *)AllocateMemory(MemoryCategory_HeightMap, sizeof(uint16_t)*Buffers->SampleCount);
+	Buffers->PackedNormals = (uint32_t *)AllocateMemory(MemoryCategory_Scratch, sizeof(uint32_t)*Buffers->SampleCount);
+	Buffers->DirtyTiles = (uint8_t *)AllocateMemory(MemoryCategory_Scratch, TileCount);
+
+	bool Result = Buffers->Input && Buffers->Golden && Buffers->Output && Buffers->Samples && Buffers->PackedNormals && Buffers->DirtyTiles;
+	return(Result);
+}
+
+// NOTE(georgy): Runs every variant of every case (or only the case named OnlyCase) against the committed goldens, checkpointing
+//				 into Directory. Returns false if a reference doesn't match its golden or any variant failed
+static bool
+RunVerification(job_system *Jobs, const char *Directory, bool Record, const char *OnlyCase)
+{
+	if(!MakeDirectory(Directory))
+	{
+		printf("Can't verify in %s\n", Directory);
+		return(false);
+	}
+	char CheckpointDirectory[512];
+	snprintf(CheckpointDirectory, sizeof(CheckpointDirectory), "%s/checkpoints", Directory);
+
+	cpu_isa_level PreviousLevel = TerrainKernels.Level;
+	cpu_isa_level Highest = DetectCPUISALevel();
+	printf("Verifying kernels up to %s against the scalar reference in %s\n", ISALevelNames[Highest], Directory);
+	printf("%-12s %-14s %-6s %12s %12s %10s %10s\n", "case", "variant", "result", "max error", "rms error", "mass", "ms");
+
+	bool Result = true;
+	verify_golden Recorded[ArrayCount(VerifyCases)];
+	uint32_t RecordedCount = 0;
+	uint32_t CaseCount = 0;
+	uint32_t VariantCount = 0;
+	uint32_t FailedCount = 0;
+	for(uint32_t CaseIndex = 0; CaseIndex < ArrayCount(VerifyCases); CaseIndex++)
+	{
+		const verify_case *Case = VerifyCases + CaseIndex;
+		if(OnlyCase && (strcmp(OnlyCase, Case->Name) != 0))
+		{
+			continue;
+		}
+		CaseCount++;
+
+		verify_buffers Buffers;
+		if(!AllocateVerifyBuffers(&Buffers, Case))
+		{
+			printf("Out of memory for %s\n", Case->Name);
+			FreeVerifyBuffers(&Buffers);
+			Result = false;
+			continue;
+		}
+
+		// NOTE(georgy): The reference also produces the input, and its output is what the variants are compared with
+		//				 once it matches the committed golden
+		RunVerifyReference(Jobs, Case, &Buffers);
+		if(Record)
+		{
+			Recorded[RecordedCount++] = RecordVerifyGolden(Case, &Buffers);
+		}
+		else if(!CheckVerifyGolden(Case, &Buffers))
+		{
+			Result = false;
+		}
+
+		verify_variant Variants[VERIFY_MAX_VARIANTS];
+		uint32_t CaseVariantCount = BuildVerifyVariants(Case->Stage, Highest, Variants);
+		for(uint32_t VariantIndex = 0; VariantIndex < CaseVariantCount; VariantIndex++)
+		{
+			const verify_variant *Variant = Variants + VariantIndex;
+			VariantCount++;
+
+			uint64_t BeginTime = GetNanoseconds();
+			bool Ran = RunVerifyVariant(Jobs, Case, Variant, &Buffers, CheckpointDirectory);
+			uint64_t Nanoseconds = GetNanoseconds() - BeginTime;
+
+			verify_result Compared = {};
+			if(Ran)
+			{
+				Compared = CompareWithGolden(Case, Variant, &Buffers);
+			}
+
+			const char *Status = !Ran ? "ERROR" : (Compared.Exact ? "exact" : (Compared.Passed ? "ok" : "FAIL"));
+			printf("%-12s %-14s %-6s %12.4g %12.4g", Case->Name, Variant->Name, Status, Compared.Error.MaxError, Compared.Error.RMSError);
+			if(Case->Stage == VerifyStage_Erosion)
+			{
+				printf(" %+9.4f%%", 100.0f*Compared.MassError);
+			}
+			else
+			{
+				printf(" %10s", "-");
+			}
+			printf(" %10.2f\n", Nanoseconds / 1000000.0);
+
+			if(!Ran || !Compared.Passed)
+			{
+				FailedCount++;
+				Result = false;
+			}
+		}
+
+		FreeVerifyBuffers(&Buffers);
+	}
+	SetTerrainKernels(PreviousLevel);
+
+	if(CaseCount == 0)
+	{
+		printf("Unknown verification case %s\n", OnlyCase);
+		return(false);
+	}
+
+	if(Record)
+	{
+		printf("Goldens for VerifyGoldens:\n");
+		for(uint32_t GoldenIndex = 0; GoldenIndex < RecordedCount; GoldenIndex++)
+		{
+			const verify_golden *Golden = Recorded + GoldenIndex;
+			printf("\t{ \"%s\", 0x%016llXull, 0x%016llXull, %.17g, %.17g },\n", Golden->Name, (unsigned long long)Golden->CaseKey,
+				   (unsigned long long)Golden->Hash, Golden->Mean, Golden->RMS);
+		}
+	}
+
+	printf("%u of %u variants passed\n", VariantCount - FailedCount, VariantCount);
+	return(Result);
+}
@@ -0,0 +1,491 @@
+#pragma once
+
+#include "erosion.cpp"
+#include "normals.cpp"
+#include "terrain.cpp"
+#include "platform.cpp"
+
+// NOTE(georgy): Multi-tile world generation. Tiles are eroded independently on a grid extended by a halo on every side,
+//				 so tiles can be spread over threads or processes. Every tile goes noise -> erosion -> blend/export as a chain
+//				 of dependent jobs, so different tiles overlap in different stages. At most MaxTilesInFlight extended
+//				 heightmaps are alive at once, which caps the memory.
+//
+//				 Seams: droplets are tied to world positions (see WaterErosionRegion), so overlapping tiles run the same
+//				 droplets over their overlap, but not on the same heights: near a grid's outer edge the droplets from
+//				 beyond it are missing, and every droplet that crosses the difference carries it further in. So two tiles
+//				 end up with slightly different heights everywhere in their overlap, the most near their edges.
+//				 The halo is twice the droplet reach, and after all neighbours are eroded every output sample is a
+//				 weighted sum of the tiles covering it (HaloBlendWeight), which fades each tile out before its edge.
+//				 Both tiles sharing an edge compute that sum from the same inputs in the same order, so it's the blend
+//				 that makes shared samples match exactly.
+//
+//				 NUMA: tiles are dealt out to the nodes of the job system round robin. A tile's extended heightmap is bound to
+//				 its node and all of its jobs are queued there, so its erosion and blend run next to its memory
+
+struct world_params
+{
+	uint32_t TilesX, TilesZ;
+	// NOTE(georgy): Cells per tile edge, a tile has TileSize + 1 samples per edge and shares its last row/column with the next tile
+	uint32_t TileSize;
+	// NOTE(georgy): Extra cells generated and eroded on every side of a tile, must be more than ErosionReach
+	uint32_t Halo;
+	uint32_t MaxTilesInFlight;
+
+	noise_params Noise;
+	uint32_t Seed;
+	// NOTE(georgy): DropletCount is per TileSize x TileSize area
+	erosion_params Erosion;
+
+	const char *OutputDirectory;
+};
+
+inline world_params
+DefaultWorldParams(void)
+{
+	world_params Result;
+	Result.TilesX = 4;
+	Result.TilesZ = 4;
+	Result.TileSize = 512;
+	Result.MaxTilesInFlight = 3;
+	Result.Noise = DefaultNoiseParams(10.0f);
+	Result.Seed = 1337;
+	Result.Erosion = DefaultErosionParams();
+	Result.Halo = 2*ErosionReach(&Result.Erosion);
+	Result.OutputDirectory = "world";
+
+	return(Result);
+}
+
+// NOTE(georgy): Weight of a tile's eroded height at sample Index of its extended grid. It is zero in the outer
+//				 Reach samples, then ramps so that the weights of two overlapping tiles sum to one
+static float
+HaloBlendWeight(int32_t Index, uint32_t GridSize, uint32_t Reach, uint32_t Halo)
+{
+	float Result = 0.0f;
+	if((Index >= 0) && (Index <= (int32_t)GridSize))
+	{
+		int32_t EdgeDistance = (Index < ((int32_t)GridSize - Index)) ? Index : ((int32_t)GridSize - Index);
+		Result = Clamp((float)(EdgeDistance - (int32_t)Reach) / (float)(2*(Halo - Reach)), 0.0f, 1.0f);
+	}
+
+	return(Result);
+}
+
+static bool
+CheckWorldParams(const world_params *Params)
+{
+	bool Result = true;
+	if((Params->TilesX == 0) || (Params->TilesZ == 0))
+	{
+		printf("World needs at least one tile\n");
+		Result = false;
+	}
+	else if((Params->Halo <= ErosionReach(&Params->Erosion)) || (Params->TileSize < 2*Params->Halo))
+	{
+		printf("World halo %u must be more than the droplet reach %u and at most half the tile size\n", Params->Halo, ErosionReach(&Params->Erosion));
+		Result = false;
+	}
+	else if(!MakeDirectory(Params->OutputDirectory))
+	{
+		printf("Can't create %s\n", Params->OutputDirectory);
+		Result = false;
+	}
+
+	return(Result);
+}
+
+struct world_pipeline;
+
+struct world_tile
+{
+	world_pipeline *Pipeline;
+	uint32_t TileX, TileZ;
+	// NOTE(georgy): Node of the job system the tile's jobs run on
+	uint32_t Node;
+
+	// NOTE(georgy): Extended grid, only alive between noise and erosion
+	float *HeightMap;
+
+	job_counter NoiseDone;
+	job_counter Eroded;
+	job_counter NeighboursEroded;
+	job_counter Exported;
+};
+
+struct world_pipeline
+{
+	job_system *Jobs;
+	const world_params *Params;
+	world_tile *Tiles;
+
+	std::atomic<uint32_t> FailedTileCount;
+	// NOTE(georgy): Sampled pages of the extended heightmaps and how many were on the tile's node
+	std::atomic<uint64_t> LocalPages;
+	std::atomic<uint64_t> SampledPages;
+};
+
+static void
+GetWorldTileFilename(char *Dest, uint32_t DestSize, const world_params *Params, uint32_t TileX, uint32_t TileZ, const char *Extension)
+{
+	snprintf(Dest, DestSize, "%s/tile_%u_%u.%s", Params->OutputDirectory, TileX, TileZ, Extension);
+}
+
+inline uint32_t
+WorldTileGridSize(const world_params *Params)
+{
+	uint32_t Result = Params->TileSize + 2*Params->Halo;
+
+	return(Result);
+}
+
+static void
+WorldTileNoiseProc(void *Data, uint32_t Begin, uint32_t End)
+{
+	world_tile *Tile = (world_tile *)Data;
+	world_pipeline *Pipeline = Tile->Pipeline;
+	const world_params *Params = Pipeline->Params;
+
+	int32_t OriginX = (int32_t)(Tile->TileX*Params->TileSize) - (int32_t)Params->Halo;
+	int32_t OriginZ = (int32_t)(Tile->TileZ*Params->TileSize) - (int32_t)Params->Halo;
+	FillHeightMapNoiseRows(Tile->HeightMap, WorldTileGridSize(Params), OriginX, OriginZ, &Params->Noise, Begin, End);
+}
+
+// NOTE(georgy): Erodes an extended grid filled with FillHeightMapNoise and leaves it on disk
+//				 for the blend of this tile and its neighbours
+static bool
+ErodeWorldTile(const world_params *Params, uint32_t TileX, uint32_t TileZ, float *HeightMap)
+{
+	uint32_t GridSize = WorldTileGridSize(Params);
+	int32_t OriginX = (int32_t)(TileX*Params->TileSize) - (int32_t)Params->Halo;
+	int32_t OriginZ = (int32_t)(TileZ*Params->TileSize) - (int32_t)Params->Halo;
+	uint32_t DropletsPerBlock = DropletsPerSpawnBlock(Params->Erosion.DropletCount, Params->TileSize*Params->TileSize);
+	if(!WaterErosionRegion(HeightMap, GridSize, GridSize, OriginX, OriginZ, &Params->Erosion, DropletsPerBlock, Params->Seed))
+	{
+		return(false);
+	}
+
+	char Filename[1024];
+	GetWorldTileFilename(Filename, sizeof(Filename), Params, TileX, TileZ, "halo");
+	bool Result = WriteEntireFileAtomic(Filename, HeightMap, sizeof(float)*(GridSize + 1)*(GridSize + 1));
+	if(!Result)
+	{
+		printf("Failed to write %s\n", Filename);
+	}
+
+	return(Result);
+}
+
+// NOTE(georgy): Blends the core of the tile, plus one sample on every side for the normals, from the eroded grids
+//				 of the tile and its neighbours, then computes normals and writes the tile out.
+//				 If WorldHeightMap is not null the tile also goes there, each tile writes only the samples it owns:
+//				 its core without the last row and column, unless they are on the world edge
+static bool
+BlendWorldTile(job_system *Jobs, const world_params *Params, uint32_t TileX, uint32_t TileZ, float *WorldHeightMap)
+{
+	uint32_t Reach = ErosionReach(&Params->Erosion);
+	uint32_t GridSize = WorldTileGridSize(Params);
+	uint32_t GridSamples = GridSize + 1;
+	uint32_t BlendGridSize = Params->TileSize + 2;
+	uint32_t BlendSamples = BlendGridSize + 1;
+	uint32_t CoreSamples = Params->TileSize + 1;
+
+	float *Neighbour = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*GridSamples*GridSamples);
+	float *Blended = (float *)AllocateZeroedMemory(MemoryCategory_Scratch, BlendSamples*BlendSamples*sizeof(float));
+	float *WeightSums = (float *)AllocateZeroedMemory(MemoryCategory_Scratch, BlendSamples*BlendSamples*sizeof(float));
+	float *WeightsX = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*BlendSamples);
+	float *WeightsZ = (float *)AllocateMemory(MemoryCategory_Scratch, sizeof(float)*BlendSamples);
+	uint32_t *BlendedNormals = (uint32_t *)AllocateMemory(MemoryCategory_Mesh, sizeof(uint32_t)*BlendSamples*BlendSamples);
+	float *Heights = (float *)AllocateMemory(MemoryCategory_HeightMap, sizeof(float)*CoreSamples*CoreSamples);
+	uint32_t *Normals = (uint32_t *)AllocateMemory(MemoryCategory_Mesh, sizeof(uint32_t)*CoreSamples*CoreSamples);
+
+	bool Result = Neighbour && Blended && WeightSums && WeightsX && WeightsZ && BlendedNormals && Heights && Normals;
+	char Filename[1024];
+
+	// NOTE(georgy): Neighbours go in world order, so every tile sums a shared sample in the same order
+	int32_t BlendOriginX = (int32_t)(TileX*Params->TileSize) - 1;
+	int32_t BlendOriginZ = (int32_t)(TileZ*Params->TileSize) - 1;
+	for(int32_t NeighbourZ = (int32_t)TileZ - 1; Result && (NeighbourZ <= (int32_t)TileZ + 1); NeighbourZ++)
+	{
+		for(int32_t NeighbourX = (int32_t)TileX - 1; Result && (NeighbourX <= (int32_t)TileX + 1); NeighbourX++)
+		{
+			if((NeighbourX < 0) || (NeighbourX >= (int32_t)Params->TilesX) ||
+			   (NeighbourZ < 0) || (NeighbourZ >= (int32_t)Params->TilesZ))
+			{
+				continue;
+			}
+
+			GetWorldTileFilename(Filename, sizeof(Filename), Params, (uint32_t)NeighbourX, (uint32_t)NeighbourZ, "halo");
+			if(!ReadFileInto(Filename, Neighbour, sizeof(float)*GridSamples*GridSamples))
+			{
+				printf("Failed to read %s\n", Filename);
+				Result = false;
+				break;
+			}
+
+			int32_t OffsetX = BlendOriginX - (NeighbourX*(int32_t)Params->TileSize - (int32_t)Params->Halo);
+			int32_t OffsetZ = BlendOriginZ - (NeighbourZ*(int32_t)Params->TileSize - (int32_t)Params->Halo);
+			for(uint32_t I = 0; I < BlendSamples; I++)
+			{
+				WeightsX[I] = HaloBlendWeight(OffsetX + (int32_t)I, GridSize, Reach, Params->Halo);
+				WeightsZ[I] = HaloBlendWeight(OffsetZ + (int32_t)I, GridSize, Reach, Params->Halo);
+			}
+
+			for(uint32_t Z = 0; Z < BlendSamples; Z++)
+			{
+				if(WeightsZ[Z] == 0.0f) continue;
+
+				const float *SourceRow = Neighbour + (OffsetZ + (int32_t)Z)*(int32_t)GridSamples + OffsetX;
+				for(uint32_t X = 0; X < BlendSamples; X++)
+				{
+					float Weight = WeightsX[X]*WeightsZ[Z];
+					if(Weight == 0.0f) continue;
+
+					Blended[X + Z*BlendSamples] += Weight*SourceRow[X];
+					WeightSums[X + Z*BlendSamples] += Weight;
+				}
+			}
+		}
+	}
+
+	if(Result)
+	{
+		for(uint32_t SampleIndex = 0; SampleIndex < BlendSamples*BlendSamples; SampleIndex++)
+		{
+			Blended[SampleIndex] /= WeightSums[SampleIndex];
+		}
+
+		CalculateNormals(Jobs, Blended, BlendGridSize, BlendGridSize, NormalFormat_Packed, BlendedNormals);
+		for(uint32_t Z = 0; Z < CoreSamples; Z++)
+		{
+			uint32_t BlendOffset = 1 + (Z + 1)*BlendSamples;
+			memcpy(Heights + Z*CoreSamples, Blended + BlendOffset, sizeof(float)*CoreSamples);
+			memcpy(Normals + Z*CoreSamples, BlendedNormals + BlendOffset, sizeof(uint32_t)*CoreSamples);
+		}
+
+		GetWorldTileFilename(Filename, sizeof(Filename), Params, TileX, TileZ, "r32");
+		Result = WriteEntireFileAtomic(Filename, Heights, sizeof(float)*CoreSamples*CoreSamples);
+		GetWorldTileFilename(Filename, sizeof(Filename), Params, TileX, TileZ, "n32");
+		Result = WriteEntireFileAtomic(Filename, Normals, sizeof(uint32_t)*CoreSamples*CoreSamples) && Result;
+
+		if(WorldHeightMap)
+		{
+			uint32_t WorldSamplesX = Params->TilesX*Params->TileSize + 1;
+			uint32_t OwnedX = (TileX == Params->TilesX - 1) ? CoreSamples : Params->TileSize;
+			uint32_t OwnedZ = (TileZ == Params->TilesZ - 1) ? CoreSamples : Params->TileSize;
+			for(uint32_t Z = 0; Z < OwnedZ; Z++)
+			{
+				uint64_t WorldOffset = (uint64_t)(TileZ*Params->TileSize + Z)*WorldSamplesX + TileX*Params->TileSize;
+				memcpy(WorldHeightMap + WorldOffset, Heights + Z*CoreSamples, sizeof(float)*OwnedX);
+			}
+		}
+	}
+
+	FreeMemory(Normals);
+	FreeMemory(Heights);
+	FreeMemory(BlendedNormals);
+	FreeMemory(WeightsZ);
+	FreeMemory(WeightsX);
+	FreeMemory(WeightSums);
+	FreeMemory(Blended);
+	FreeMemory(Neighbour);
+
+	return(Result);
+}
+
+static void
+WorldTileErosionProc(void *Data, uint32_t, uint32_t)
+{
+	world_tile *Tile = (world_tile *)Data;
+	world_pipeline *Pipeline = Tile->Pipeline;
+
+	if(!ErodeWorldTile(Pipeline->Params, Tile->TileX, Tile->TileZ, Tile->HeightMap))
+	{
+		Pipeline->FailedTileCount.fetch_add(1);
+	}
+
+	if(Pipeline->Jobs->NodeCount > 1)
+	{
+		uint32_t GridSamples = WorldTileGridSize(Pipeline->Params) + 1;
+		uint64_t LocalPages = 0;
+		uint64_t SampledPages = 0;
+		CountPagesOnNode(&GlobalNUMA, Tile->HeightMap, sizeof(float)*GridSamples*GridSamples, Pipeline->Jobs->NUMANodes[Tile->Node],
+						 &LocalPages, &SampledPages);
+		Pipeline->LocalPages.fetch_add(LocalPages);
+		Pipeline->SampledPages.fetch_add(SampledPages);
+	}
+
+	FreeMemory(Tile->HeightMap);
+	Tile->HeightMap = 0;
+}
+
+static void
+WorldTileBlendProc(void *Data, uint32_t, uint32_t)
+{
+	world_tile *Tile = (world_tile *)Data;
+	world_pipeline *Pipeline = Tile->Pipeline;
+
+	if(!BlendWorldTile(Pipeline->Jobs, Pipeline->Params, Tile->TileX, Tile->TileZ, 0))
+	{
+		printf("Failed to export tile %u %u\n", Tile->TileX, Tile->TileZ);
+		Pipeline->FailedTileCount.fetch_add(1);
+	}
+}
+
+// NOTE(georgy): Eroded extended grids are only needed until every neighbour is blended
+static void
+RemoveWorldHalos(const world_params *Params)
+{
+	for(uint32_t TileZ = 0; TileZ < Params->TilesZ; TileZ++)
+	{
+		for(uint32_t TileX = 0; TileX < Params->TilesX; TileX++)
+		{
+			char Filename[1024];
+			GetWorldTileFilename(Filename, sizeof(Filename), Params, TileX, TileZ, "halo");
+			remove(Filename);
+		}
+	}
+}
+
+// NOTE(georgy): Index of the last neighbour in submission order, a tile can be blended once that one is submitted
+inline uint32_t
+LastNeighbourTileIndex(const world_params *Params, uint32_t TileIndex)
+{
+	uint32_t TileX = TileIndex % Params->TilesX;
+	uint32_t TileZ = TileIndex / Params->TilesX;
+	uint32_t LastX = (TileX + 1 < Params->TilesX) ? (TileX + 1) : TileX;
+	uint32_t LastZ = (TileZ + 1 < Params->TilesZ) ? (TileZ + 1) : TileZ;
+	uint32_t Result = LastX + LastZ*Params->TilesX;
+
+	return(Result);
+}
+
+static void
+AddWorldTileBlend(world_pipeline *Pipeline, uint32_t TileIndex)
+{
+	const world_params *Params = Pipeline->Params;
+	world_tile *Tile = Pipeline->Tiles + TileIndex;
+
+	job_counter *Dependencies[9];
+	uint32_t DependencyCount = 0;
+	for(int32_t NeighbourZ = (int32_t)Tile->TileZ - 1; NeighbourZ <= (int32_t)Tile->TileZ + 1; NeighbourZ++)
+	{
+		for(int32_t NeighbourX = (int32_t)Tile->TileX - 1; NeighbourX <= (int32_t)Tile->TileX + 1; NeighbourX++)
+		{
+			if((NeighbourX >= 0) && (NeighbourX < (int32_t)Params->TilesX) &&
+			   (NeighbourZ >= 0) && (NeighbourZ < (int32_t)Params->TilesZ))
+			{
+				Dependencies[DependencyCount++] = &Pipeline->Tiles[NeighbourX + NeighbourZ*Params->TilesX].Eroded;
+			}
+		}
+	}
+
+	AddJoin(Pipeline->Jobs, &Tile->NeighboursEroded, Dependencies, DependencyCount);
+	AddNodeJob(Pipeline->Jobs, Tile->Node, "TileBlend", WorldTileBlendProc, Tile, 0, 0, &Tile->Exported, &Tile->NeighboursEroded);
+}
+
+static bool
+GenerateWorld(job_system *Jobs, const world_params *Params)
+{
+	Assert(Params->MaxTilesInFlight > 0);
+	if(!CheckWorldParams(Params))
+	{
+		return(false);
+	}
+	MEMORY_PHASE("World");
+
+	job_timing_stats StageTimings;
+	bool OwnTimingHook = (Jobs->TimingHook == 0);
+	if(OwnTimingHook)
+	{
+		SetJobTimingHook(Jobs, AccumulateJobTiming, &StageTimings);
+	}
+
+	uint32_t TileCount = Params->TilesX*Params->TilesZ;
+
+	world_pipeline Pipeline;
+	Pipeline.Jobs = Jobs;
+	Pipeline.Params = Params;
+	Pipeline.Tiles = new world_tile[TileCount];
+	Pipeline.FailedTileCount = 0;
+	Pipeline.LocalPages = 0;
+	Pipeline.SampledPages = 0;
+
+	node_job_stats NodeStatsBefore;
+	GetNodeJobStats(Jobs, &NodeStatsBefore);
+	uint64_t BeginTime = GetNanoseconds();
+
+	// NOTE(georgy): Halo files left by an earlier run would be blended in place of a tile whose erosion failed
+	RemoveWorldHalos(Params);
+
+	uint32_t GridSamples = WorldTileGridSize(Params) + 1;
+	uint32_t NextBlendIndex = 0;
+	for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
+	{
+		// NOTE(georgy): Bound the extended heightmaps alive at once
+		if(TileIndex >= Params->MaxTilesInFlight)
+		{
+			WaitForCounter(Jobs, &Pipeline.Tiles[TileIndex - Params->MaxTilesInFlight].Eroded);
+		}
+
+		world_tile *Tile = Pipeline.Tiles + TileIndex;
+		Tile->Pipeline = &Pipeline;
+		Tile->TileX = TileIndex % Params->TilesX;
+		Tile->TileZ = TileIndex / Params->TilesX;
+		Tile->Node = NodeForIndex(Jobs, TileIndex);
+		Tile->HeightMap = (float *)AllocateNodeMemory(MemoryCategory_HeightMap, sizeof(float)*GridSamples*GridSamples, Jobs->NUMANodes[Tile->Node]);
+		if(Tile->HeightMap)
+		{
+			uint32_t Grain = GrainForCount(Jobs, GridSamples);
+			for(uint32_t Begin = 0; Begin < GridSamples; Begin += Grain)
+			{
+				uint32_t End = ((GridSamples - Begin) > Grain) ? (Begin + Grain) : GridSamples;
+				AddNodeJob(Jobs, Tile->Node, "TileNoise", WorldTileNoiseProc, Tile, Begin, End, &Tile->NoiseDone);
+			}
+			AddNodeJob(Jobs, Tile->Node, "TileErosion", WorldTileErosionProc, Tile, 0, 0, &Tile->Eroded, &Tile->NoiseDone);
+		}
+		else
+		{
+			// NOTE(georgy): Neighbours' blends report the missing tile, its halo file was removed before the tiles started
+			printf("Out of memory for tile %u %u\n", Tile->TileX, Tile->TileZ);
+			Pipeline.FailedTileCount.fetch_add(1);
+		}
+
+		while((NextBlendIndex < TileCount) && (LastNeighbourTileIndex(Params, NextBlendIndex) <= TileIndex))
+		{
+			AddWorldTileBlend(&Pipeline, NextBlendIndex++);
+		}
+	}
+
+	for(uint32_t TileIndex = 0; TileIndex < TileCount; TileIndex++)
+	{
+		WaitForCounter(Jobs, &Pipeline.Tiles[TileIndex].Exported);
+	}
+
+	uint64_t EndTime = GetNanoseconds();
+	printf("World %ux%u tiles of %u, halo %u: %.3f ms\n", Params->TilesX, Params->TilesZ, Params->TileSize, Params->Halo, (EndTime - BeginTime) / 1000000.0);
+	if(Jobs->NodeCount > 1)
+	{
+		node_job_stats NodeStats;
+		GetNodeJobStats(Jobs, &NodeStats);
+		uint64_t LocalJobs = NodeStats.JobCount[0] - NodeStatsBefore.JobCount[0];
+		uint64_t RemoteJobs = NodeStats.JobCount[1] - NodeStatsBefore.JobCount[1];
+		double LocalTime = (double)(NodeStats.Nanoseconds[0] - NodeStatsBefore.Nanoseconds[0]);
+		double RemoteTime = (double)(NodeStats.Nanoseconds[1] - NodeStatsBefore.Nanoseconds[1]);
+		printf("NUMA: %u nodes, tile jobs %llu local / %llu remote (%.1f%% of their time local), %.1f%% of sampled heightmap pages on the tile's node\n",
+			   Jobs->NodeCount, (unsigned long long)LocalJobs, (unsigned long long)RemoteJobs,
+			   100.0*LocalTime / ((LocalTime + RemoteTime > 0.0) ? (LocalTime + RemoteTime) : 1.0),
+			   100.0*Pipeline.LocalPages / ((Pipeline.SampledPages > 0) ? (double)Pipeline.SampledPages : 1.0));
+	}
+	if(OwnTimingHook)
+	{
+		SetJobTimingHook(Jobs, 0, 0);
+		PrintJobTimings(&StageTimings);
+	}
+
+	RemoveWorldHalos(Params);
+
+	bool Result = (Pipeline.FailedTileCount == 0);
+	delete[] Pipeline.Tiles;
+
+	return(Result);
+}